@@ -22,14 +22,21 @@ static void s_usage(const char* exe)
   mi_error_fmt(
       "minima v%d.%d.%d\n"
       "Usage:\n"
-      "  %s [--cache-dir <dir>] -c <file.min> [out.mx]   Compile only (default out = file.min.mx)\n"
+      "  %s [--cache-dir <dir>] -c [-O] <file.min> [out.mx]  Compile only (default out = file.min.mx; -O optimizes)\n"
       "  %s [--cache-dir <dir>] -d <file.mi|file.mx>      Disassemble (compile if needed)\n"
-      "  %s [--cache-dir <dir>] <file.min>               Compile and run\n"
-      "  %s [--cache-dir <dir>] <file.mx>                Run MIX file\n",
+      "  %s [--cache-dir <dir>] [--jit|--jit-dump] <file.min>  Compile and run\n"
+      "  %s [--cache-dir <dir>] [--jit|--jit-dump] <file.mx>   Run MIX file\n"
+      "  %s [--cache-dir <dir>] --aot <file.mi|file.mx> <out.so>  Compile to a native shared object ($CC, default cc)\n"
+      "  %s [--cache-dir <dir>] <file.so>                      Run a shared object made with --aot\n"
+      "Options:\n"
+      "  --jit       Compile hot code to native x86-64 (--no-jit: interpret only, the default)\n"
+      "  --jit-dump  As --jit, and print the native code of each chunk it compiles\n"
+      "Environment:\n"
+      "  MINIMA_JIT_THRESHOLD  Entries plus loop back-edges before --jit compiles a chunk\n",
       MINIMA_VERSION_MAJOR,
       MINIMA_VERSION_PATCH,
       MINIMA_VERSION_MINOR,
-      exe, exe, exe, exe);
+      exe, exe, exe, exe, exe, exe);
 }
 
 //----------------------------------------------------------
@@ -45,13 +52,44 @@ int main(int argc, char** argv)
   }
 
   const char* cache_dir = NULL;
+  MiVmJitMode jit = MI_VM_JIT_OFF;
   int argi = 1;
-  if (argi + 2 <= argc && strcmp(argv[argi], "--cache-dir") == 0)
+  while (argi < argc)
   {
-    cache_dir = argv[argi + 1];
-    argi += 2;
+    if (argi + 2 <= argc && strcmp(argv[argi], "--cache-dir") == 0)
+    {
+      cache_dir = argv[argi + 1];
+      argi += 2;
+    }
+    else if (strcmp(argv[argi], "--jit") == 0)
+    {
+      jit = MI_VM_JIT_ON;
+      argi += 1;
+    }
+    else if (strcmp(argv[argi], "--jit-dump") == 0)
+    {
+      jit = MI_VM_JIT_DUMP;
+      argi += 1;
+    }
+    else if (strcmp(argv[argi], "--no-jit") == 0)
+    {
+      jit = MI_VM_JIT_OFF;
+      argi += 1;
+    }
+    else
+    {
+      break;
+    }
   }
 
+#if !MI_VM_JIT
+  if (jit != MI_VM_JIT_OFF)
+  {
+    mi_error("jit: this build has no native code support (MI_VM_JIT=0)\n");
+    return 1;
+  }
+#endif
+
   int rem = argc - argi;
   char** args = &argv[argi];
   if (rem < 1)
@@ -63,6 +101,14 @@ int main(int argc, char** argv)
   // Compile only
   if (strcmp(args[0], "-c") == 0)
   {
+    bool optimize = false;
+    if (rem >= 2 && strcmp(args[1], "-O") == 0)
+    {
+      optimize = true;
+      args += 1;
+      rem -= 1;
+    }
+
     if (rem != 2 && rem != 3)
     {
       s_usage(argv[0]);
@@ -82,7 +128,7 @@ int main(int argc, char** argv)
       x_fs_path_change_extension(&out_file, ".mx");
     }
 
-    int r = mi_compile_only(in_file, out_file.buf, cache_dir);
+    int r = mi_compile_only_ex(in_file, out_file.buf, cache_dir, optimize);
     return r;
   }
 
@@ -103,15 +149,30 @@ int main(int argc, char** argv)
     return mi_disasm(in_file, cache_dir);
   }
 
-  // Single arg: compile+run or run MIX
+  // Ahead-of-time compile to a shared object
+  if (strcmp(args[0], "--aot") == 0)
+  {
+    if (rem != 3)
+    {
+      s_usage(argv[0]);
+      return 1;
+    }
+    return mi_aot_compile(args[1], args[2], cache_dir);
+  }
+
+  // Single arg: compile+run, run MIX or run an AOT object
   if (rem == 1)
   {
     const char* path = args[0];
+    if (x_cstr_ends_with(path, ".so") || x_cstr_ends_with(path, ".dylib") || x_cstr_ends_with(path, ".dll"))
+    {
+      return mi_run_aot(path, cache_dir);
+    }
     if (x_cstr_ends_with(path, ".mx"))
     {
-      return mi_run_mx(path, cache_dir);
+      return mi_run_mx_ex(path, cache_dir, jit);
     }
-    return mi_run_source(path, cache_dir);
+    return mi_run_source_ex(path, cache_dir, jit);
   }
 
   s_usage(argv[0]);
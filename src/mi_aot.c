@@ -0,0 +1,589 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mi_aot.h"
+#include "mi_log.h"
+
+//----------------------------------------------------------
+// Chunk fingerprint
+//----------------------------------------------------------
+
+uint64_t mi_aot_chunk_hash(const MiVmChunk* chunk)
+{
+  // FNV-1a over the instruction fields (not their in-memory layout).
+  uint64_t h = 1469598103934665603ull;
+  uint8_t bytes[8];
+  for (size_t pc = 0; pc <= chunk->code_count; ++pc)
+  {
+    if (pc == chunk->code_count)
+    {
+      memcpy(bytes, &chunk->code_count, sizeof(uint32_t));
+      memset(bytes + 4, 0, 4);
+    }
+    else
+    {
+      const MiVmIns* ins = &chunk->code[pc];
+      uint32_t imm = (uint32_t)ins->imm;
+      bytes[0] = ins->op;
+      bytes[1] = ins->a;
+      bytes[2] = ins->b;
+      bytes[3] = ins->c;
+      for (int i = 0; i < 4; ++i)
+      {
+        bytes[4 + i] = (uint8_t)(imm >> (8 * i));
+      }
+    }
+    for (int i = 0; i < 8; ++i)
+    {
+      h ^= bytes[i];
+      h *= 1099511628211ull;
+    }
+  }
+  return h;
+}
+
+//----------------------------------------------------------
+// C templates
+//----------------------------------------------------------
+
+// Declarations repeated from mi_aot.h / mi_jit.h / mi_runtime.h, so the
+// generated file compiles on its own (see MI_AOT_ABI).
+static const char* s_prelude =
+  "#include <stddef.h>\n"
+  "#include <stdint.h>\n"
+  "#include <string.h>\n"
+  "\n"
+  "#if defined(_WIN32)\n"
+  "#define AOT_EXPORT __declspec(dllexport)\n"
+  "#else\n"
+  "#define AOT_EXPORT __attribute__((visibility(\"default\")))\n"
+  "#endif\n"
+  "\n"
+  "typedef struct Frame { void* vm; const void* chunk; unsigned char* regs; unsigned char* locals; } Frame;\n"
+  "typedef struct Helpers\n"
+  "{\n"
+  "  void (*release)(void* vm, void* v);\n"
+  "  void (*assign)(void* vm, void* dst, const void* src);\n"
+  "  void (*step)(Frame* f, uint32_t pc);\n"
+  "  _Bool (*truthy)(const void* v);\n"
+  "  _Bool (*holds)(Frame* f, uint32_t pc);\n"
+  "} Helpers;\n"
+  "typedef struct Chunk { size_t (*fn)(Frame* f, size_t pc); uint64_t code_hash; const unsigned char* native; } Chunk;\n"
+  "typedef struct Image\n"
+  "{\n"
+  "  uint32_t abi;\n"
+  "  uint32_t value_size;\n"
+  "  const unsigned char* mx;\n"
+  "  size_t mx_size;\n"
+  "  const Chunk* chunks;\n"
+  "  size_t chunk_count;\n"
+  "  void (*bind)(const Helpers* helpers);\n"
+  "} Image;\n"
+  "\n"
+  "static Helpers H;\n"
+  "\n"
+  "#define R(n) (f->regs + (size_t)(n) * VSIZE)\n"
+  "#define L(n) (f->locals + (size_t)(n) * VSIZE)\n"
+  "#define KIND(p) (*(const uint32_t*)(p))\n"
+  "#define I64(p) (*(int64_t*)((p) + 8))\n"
+  "#define U64(p) (*(uint64_t*)((p) + 8))\n"
+  "#define F64(p) (*(double*)((p) + 8))\n"
+  "#define BOOL(p) (*(const unsigned char*)((p) + 8))\n"
+  "#define HEAP(p) (KIND(p) > K_STRING)\n"
+  "\n"
+  "static inline void drop(Frame* f, unsigned char* p) { if (HEAP(p)) H.release(f->vm, p); }\n"
+  "static inline void copy(Frame* f, unsigned char* d, unsigned char* s) { if (HEAP(d) || HEAP(s)) H.assign(f->vm, d, s); else memcpy(d, s, VSIZE); }\n"
+  "static inline void clear(Frame* f, unsigned char* p) { drop(f, p); memset(p, 0, VSIZE); }\n"
+  "static inline void set_int(Frame* f, unsigned char* p, int64_t v) { drop(f, p); *(uint64_t*)p = K_INT; I64(p) = v; }\n"
+  "static inline void set_float(Frame* f, unsigned char* p, double v) { drop(f, p); *(uint64_t*)p = K_FLOAT; F64(p) = v; }\n"
+  "static inline void set_bool(Frame* f, unsigned char* p, int v) { drop(f, p); *(uint64_t*)p = K_BOOL; U64(p) = v ? 1u : 0u; }\n"
+  "\n";
+
+static const char* s_int_cmp(MiVmOp op)
+{
+  switch (op)
+  {
+    case MI_VM_OP_EQ:   case MI_VM_OP_EQ_INT:   case MI_VM_OP_JUMP_IF_NOT_EQ:   case MI_VM_OP_JUMP_IF_NOT_EQ_INT:   return "==";
+    case MI_VM_OP_NEQ:  case MI_VM_OP_NEQ_INT:  case MI_VM_OP_JUMP_IF_NOT_NEQ:  case MI_VM_OP_JUMP_IF_NOT_NEQ_INT:  return "!=";
+    case MI_VM_OP_LT:   case MI_VM_OP_LT_INT:   case MI_VM_OP_JUMP_IF_NOT_LT:   case MI_VM_OP_JUMP_IF_NOT_LT_INT:   return "<";
+    case MI_VM_OP_LTEQ: case MI_VM_OP_LTEQ_INT: case MI_VM_OP_JUMP_IF_NOT_LTEQ: case MI_VM_OP_JUMP_IF_NOT_LTEQ_INT: return "<=";
+    case MI_VM_OP_GT:   case MI_VM_OP_GT_INT:   case MI_VM_OP_JUMP_IF_NOT_GT:   case MI_VM_OP_JUMP_IF_NOT_GT_INT:   return ">";
+    default:                                                                                                      return ">=";
+  }
+}
+
+static const char* s_arith(MiVmOp op)
+{
+  switch (op)
+  {
+    case MI_VM_OP_ADD: case MI_VM_OP_ADD_INT: case MI_VM_OP_ADD_FLOAT: return "+";
+    case MI_VM_OP_SUB: case MI_VM_OP_SUB_INT: case MI_VM_OP_SUB_FLOAT: return "-";
+    case MI_VM_OP_MUL: case MI_VM_OP_MUL_INT: case MI_VM_OP_MUL_FLOAT: return "*";
+    default:                                                           return "/";
+  }
+}
+
+static void s_label(FILE* out, size_t target, size_t count)
+{
+  if (target >= count)
+  {
+    fprintf(out, "Lend");
+  }
+  else
+  {
+    fprintf(out, "L%zu", target);
+  }
+}
+
+// Emit the C for the instruction at pc, mirroring the JIT's templates
+// (mi_jit.c). Returns false when it is left to the interpreter.
+static bool s_emit_ins(FILE* out, const MiVmChunk* chunk, size_t pc)
+{
+  MiVmIns ins = chunk->code[pc];
+  MiVmOp op = (MiVmOp)ins.op;
+  size_t target = (size_t)((int64_t)pc + 1 + ins.imm);
+  unsigned a = ins.a;
+  unsigned b = ins.b;
+  unsigned c = ins.c;
+
+  switch (op)
+  {
+    case MI_VM_OP_NOOP:
+      fprintf(out, "  ;\n");
+      return true;
+
+    case MI_VM_OP_LOAD_CONST:
+      {
+        const MiRtValue* k = &chunk->consts[ins.imm];
+        if (k->kind == MI_RT_VAL_INT)
+        {
+          fprintf(out, "  set_int(f, R(%u), (int64_t)UINT64_C(%llu));\n", a, (unsigned long long)k->as.i);
+        }
+        else if (k->kind == MI_RT_VAL_FLOAT && isfinite(k->as.f))
+        {
+          fprintf(out, "  set_float(f, R(%u), %a);\n", a, k->as.f);
+        }
+        else if (k->kind == MI_RT_VAL_BOOL)
+        {
+          fprintf(out, "  set_bool(f, R(%u), %d);\n", a, k->as.b ? 1 : 0);
+        }
+        else if (k->kind == MI_RT_VAL_VOID)
+        {
+          fprintf(out, "  clear(f, R(%u));\n", a);
+        }
+        else
+        {
+          // Strings and heap constants live in the loaded program.
+          fprintf(out, "  H.step(f, %zu);\n", pc);
+        }
+      }
+      return true;
+
+    case MI_VM_OP_MOV:
+      fprintf(out, "  copy(f, R(%u), R(%u));\n", a, b);
+      return true;
+
+    case MI_VM_OP_LOAD_LOCAL:
+      fprintf(out, "  copy(f, R(%u), L(%d));\n", a, (int)ins.imm);
+      return true;
+
+    case MI_VM_OP_STORE_LOCAL:
+      fprintf(out, "  copy(f, L(%d), R(%u));\n", (int)ins.imm, a);
+      return true;
+
+    case MI_VM_OP_ADD_INT:
+    case MI_VM_OP_SUB_INT:
+    case MI_VM_OP_MUL_INT:
+      fprintf(out, "  set_int(f, R(%u), (int64_t)(U64(R(%u)) %s U64(R(%u))));\n", a, b, s_arith(op), c);
+      return true;
+
+    case MI_VM_OP_ADD_FLOAT:
+    case MI_VM_OP_SUB_FLOAT:
+    case MI_VM_OP_MUL_FLOAT:
+    case MI_VM_OP_DIV_FLOAT:
+      fprintf(out, "  set_float(f, R(%u), F64(R(%u)) %s F64(R(%u)));\n", a, b, s_arith(op), c);
+      return true;
+
+    case MI_VM_OP_EQ_INT:
+    case MI_VM_OP_NEQ_INT:
+    case MI_VM_OP_LT_INT:
+    case MI_VM_OP_LTEQ_INT:
+    case MI_VM_OP_GT_INT:
+    case MI_VM_OP_GTEQ_INT:
+      fprintf(out, "  set_bool(f, R(%u), I64(R(%u)) %s I64(R(%u)));\n", a, b, s_int_cmp(op), c);
+      return true;
+
+    case MI_VM_OP_LT_FLOAT:
+    case MI_VM_OP_LTEQ_FLOAT:
+    case MI_VM_OP_GT_FLOAT:
+    case MI_VM_OP_GTEQ_FLOAT:
+      {
+        MiVmOp cmp = (MiVmOp)(MI_VM_OP_LT + (op - MI_VM_OP_LT_FLOAT));
+        fprintf(out, "  set_bool(f, R(%u), F64(R(%u)) %s F64(R(%u)));\n", a, b, s_int_cmp(cmp), c);
+      }
+      return true;
+
+    case MI_VM_OP_JUMP_IF_NOT_EQ_INT:
+    case MI_VM_OP_JUMP_IF_NOT_NEQ_INT:
+    case MI_VM_OP_JUMP_IF_NOT_LT_INT:
+    case MI_VM_OP_JUMP_IF_NOT_LTEQ_INT:
+    case MI_VM_OP_JUMP_IF_NOT_GT_INT:
+    case MI_VM_OP_JUMP_IF_NOT_GTEQ_INT:
+      fprintf(out, "  if (!(I64(R(%u)) %s I64(R(%u)))) goto ", b, s_int_cmp(op), c);
+      s_label(out, target, chunk->code_count);
+      fprintf(out, ";\n");
+      return true;
+
+    case MI_VM_OP_ADD:
+    case MI_VM_OP_SUB:
+    case MI_VM_OP_MUL:
+      fprintf(out, "  if (KIND(R(%u)) == K_INT && KIND(R(%u)) == K_INT) set_int(f, R(%u), (int64_t)(U64(R(%u)) %s U64(R(%u))));\n",
+          b, c, a, b, s_arith(op), c);
+      fprintf(out, "  else if (KIND(R(%u)) == K_FLOAT && KIND(R(%u)) == K_FLOAT) set_float(f, R(%u), F64(R(%u)) %s F64(R(%u)));\n",
+          b, c, a, b, s_arith(op), c);
+      fprintf(out, "  else H.step(f, %zu);\n", pc);
+      return true;
+
+    case MI_VM_OP_DIV:
+      // int / int is a float; only float / float is inline.
+      fprintf(out, "  if (KIND(R(%u)) == K_FLOAT && KIND(R(%u)) == K_FLOAT) set_float(f, R(%u), F64(R(%u)) / F64(R(%u)));\n",
+          b, c, a, b, c);
+      fprintf(out, "  else H.step(f, %zu);\n", pc);
+      return true;
+
+    case MI_VM_OP_EQ:
+    case MI_VM_OP_NEQ:
+    case MI_VM_OP_LT:
+    case MI_VM_OP_LTEQ:
+    case MI_VM_OP_GT:
+    case MI_VM_OP_GTEQ:
+      fprintf(out, "  if (KIND(R(%u)) == K_INT && KIND(R(%u)) == K_INT) set_bool(f, R(%u), I64(R(%u)) %s I64(R(%u)));\n",
+          b, c, a, b, s_int_cmp(op), c);
+      fprintf(out, "  else H.step(f, %zu);\n", pc);
+      return true;
+
+    case MI_VM_OP_JUMP_IF_NOT_EQ:
+    case MI_VM_OP_JUMP_IF_NOT_NEQ:
+    case MI_VM_OP_JUMP_IF_NOT_LT:
+    case MI_VM_OP_JUMP_IF_NOT_LTEQ:
+    case MI_VM_OP_JUMP_IF_NOT_GT:
+    case MI_VM_OP_JUMP_IF_NOT_GTEQ:
+      fprintf(out, "  if (KIND(R(%u)) == K_INT && KIND(R(%u)) == K_INT ? !(I64(R(%u)) %s I64(R(%u))) : !H.holds(f, %zu)) goto ",
+          b, c, b, s_int_cmp(op), c, pc);
+      s_label(out, target, chunk->code_count);
+      fprintf(out, ";\n");
+      return true;
+
+    case MI_VM_OP_JUMP:
+      fprintf(out, "  goto ");
+      s_label(out, target, chunk->code_count);
+      fprintf(out, ";\n");
+      return true;
+
+    case MI_VM_OP_JUMP_IF_TRUE:
+    case MI_VM_OP_JUMP_IF_FALSE:
+      // mi_rt_make_bool() only writes the first payload byte.
+      fprintf(out, "  if (%s(KIND(R(%u)) == K_BOOL ? BOOL(R(%u)) != 0 : H.truthy(R(%u)))) goto ",
+          op == MI_VM_OP_JUMP_IF_TRUE ? "" : "!", a, a, a);
+      s_label(out, target, chunk->code_count);
+      fprintf(out, ";\n");
+      return true;
+
+    case MI_VM_OP_ADD_LOCAL_CONST:
+    case MI_VM_OP_SUB_LOCAL_CONST:
+      {
+        const MiRtValue* k = &chunk->consts[ins.b];
+        if (k->kind != MI_RT_VAL_INT)
+        {
+          fprintf(out, "  H.step(f, %zu);\n", pc);
+          return true;
+        }
+        const char* sign = op == MI_VM_OP_ADD_LOCAL_CONST ? "+" : "-";
+        fprintf(out, "  if (KIND(L(%d)) == K_INT) { set_int(f, R(%u), (int64_t)(U64(L(%d)) %s UINT64_C(%llu))); I64(L(%d)) = I64(R(%u)); }\n",
+            (int)ins.imm, a, (int)ins.imm, sign, (unsigned long long)k->as.i, (int)ins.imm, a);
+        fprintf(out, "  else H.step(f, %zu);\n", pc);
+      }
+      return true;
+
+    case MI_VM_OP_CLEAR_REGS:
+      for (unsigned i = 0; i < b; ++i)
+      {
+        fprintf(out, "  clear(f, R(%u));\n", a + i);
+      }
+      return true;
+
+    case MI_VM_OP_FOR_PREP:
+      // Ranges that are not ints or have a zero step are reported by the interpreter.
+      fprintf(out, "  if (KIND(R(%u)) != K_INT || KIND(R(%u)) != K_INT || KIND(R(%u)) != K_INT || I64(R(%u)) == 0) return %zu;\n",
+          a, a + 1, a + 2, a + 2, pc);
+      fprintf(out, "  if (I64(R(%u)) > 0 ? I64(R(%u)) >= I64(R(%u)) : I64(R(%u)) <= I64(R(%u))) goto ",
+          a + 2, a, a + 1, a, a + 1);
+      s_label(out, target, chunk->code_count);
+      fprintf(out, ";\n");
+      return true;
+
+    case MI_VM_OP_FOR_LOOP:
+      fprintf(out, "  if (KIND(R(%u)) != K_INT) return %zu;\n", a, pc);
+      fprintf(out, "  if (I64(R(%u)) > 0 ? U64(R(%u)) - U64(R(%u)) > U64(R(%u)) : U64(R(%u)) - U64(R(%u)) > 0u - U64(R(%u))) { U64(R(%u)) += U64(R(%u)); goto ",
+          a + 2, a + 1, a, a + 2, a, a + 1, a + 2, a, a + 2);
+      s_label(out, target, chunk->code_count);
+      fprintf(out, "; }\n");
+      return true;
+
+    case MI_VM_OP_MOD:
+    case MI_VM_OP_ITER_NEXT:
+    case MI_VM_OP_INDEX:
+    case MI_VM_OP_STORE_INDEX:
+    case MI_VM_OP_LEN:
+    case MI_VM_OP_LOAD_VAR:
+    case MI_VM_OP_STORE_VAR:
+    case MI_VM_OP_LOAD_UPVAL:
+    case MI_VM_OP_STORE_UPVAL:
+    case MI_VM_OP_ADD_VAR_CONST:
+    case MI_VM_OP_SUB_VAR_CONST:
+    case MI_VM_OP_SCOPE_PUSH:
+    case MI_VM_OP_SCOPE_POP:
+    case MI_VM_OP_SCOPE_RESET:
+    case MI_VM_OP_ARG_CLEAR:
+      fprintf(out, "  H.step(f, %zu);\n", pc);
+      return true;
+
+    default:
+      // Calls, returns and the rarer opcodes run in the interpreter.
+      fprintf(out, "  return %zu;\n", pc);
+      return false;
+  }
+}
+
+static void s_emit_chunk(FILE* out, const MiVmChunk* chunk, size_t index)
+{
+  size_t n = chunk->code_count;
+  uint8_t* native = (uint8_t*)calloc(n + 1u, 1u);
+  if (!native)
+  {
+    mi_error("mi_aot: out of memory\n");
+    exit(1);
+  }
+
+  fprintf(out, "// %.*s\n", (int)chunk->dbg_name.length, chunk->dbg_name.ptr ? chunk->dbg_name.ptr : "");
+  fprintf(out, "static size_t s_chunk_%zu(Frame* f, size_t pc)\n{\n", index);
+
+  // Bodies first (into a scratch file) so the entry switch only lists the
+  // instructions that run natively.
+  FILE* body = tmpfile();
+  if (!body)
+  {
+    mi_error("mi_aot: cannot create a temporary file\n");
+    exit(1);
+  }
+  for (size_t pc = 0; pc < n; ++pc)
+  {
+    const MiVmIns* ins = &chunk->code[pc];
+    fprintf(body, "L%zu: // %s a=%u b=%u c=%u imm=%d\n", pc, mi_vm_op_name((MiVmOp)ins->op), ins->a, ins->b, ins->c, (int)ins->imm);
+    native[pc] = s_emit_ins(body, chunk, pc) ? 1u : 0u;
+  }
+  fprintf(body, "Lend:\n  return %zu;\n}\n\n", n);
+
+  fprintf(out, "  switch (pc)\n  {\n");
+  for (size_t pc = 0; pc < n; ++pc)
+  {
+    if (native[pc])
+    {
+      fprintf(out, "    case %zu: goto L%zu;\n", pc, pc);
+    }
+  }
+  fprintf(out, "    default: return pc;\n  }\n");
+
+  rewind(body);
+  char buf[4096];
+  size_t got;
+  while ((got = fread(buf, 1, sizeof(buf), body)) > 0)
+  {
+    fwrite(buf, 1, got, out);
+  }
+  fclose(body);
+
+  fprintf(out, "static const unsigned char s_native_%zu[] = {", index);
+  for (size_t pc = 0; pc < n; ++pc)
+  {
+    fprintf(out, "%s%u", pc ? "," : " ", native[pc]);
+  }
+  fprintf(out, n ? " };\n\n" : " 0 };\n\n");
+  free(native);
+}
+
+static bool s_write_source(FILE* out, const char* mx_file, const MiMixProgram* p)
+{
+  FILE* mx = fopen(mx_file, "rb");
+  if (!mx)
+  {
+    mi_error_fmt("aot: cannot read %s\n", mx_file);
+    return false;
+  }
+
+  fprintf(out, "// Generated by minima --aot from %s. Do not edit.\n", mx_file);
+  fprintf(out, "#define VSIZE %u\n", (unsigned)sizeof(MiRtValue));
+  fprintf(out, "#define K_INT %d\n#define K_FLOAT %d\n#define K_BOOL %d\n#define K_STRING %d\n",
+      (int)MI_RT_VAL_INT, (int)MI_RT_VAL_FLOAT, (int)MI_RT_VAL_BOOL, (int)MI_RT_VAL_STRING);
+  fputs(s_prelude, out);
+
+  fprintf(out, "static const unsigned char s_mx[] =\n{");
+  size_t size = 0;
+  int ch;
+  while ((ch = fgetc(mx)) != EOF)
+  {
+    fprintf(out, "%s0x%02x,", (size % 16u) ? " " : "\n  ", (unsigned)ch);
+    size += 1;
+  }
+  fclose(mx);
+  fprintf(out, "\n};\n\n");
+
+  for (size_t i = 0; i < p->chunk_count; ++i)
+  {
+    s_emit_chunk(out, p->chunks[i], i);
+  }
+
+  fprintf(out, "static const Chunk s_chunks[] =\n{\n");
+  for (size_t i = 0; i < p->chunk_count; ++i)
+  {
+    fprintf(out, "  { s_chunk_%zu, UINT64_C(0x%016llx), s_native_%zu },\n",
+        i, (unsigned long long)mi_aot_chunk_hash(p->chunks[i]), i);
+  }
+  fprintf(out, "};\n\n");
+
+  fprintf(out,
+      "static void s_bind(const Helpers* helpers)\n{\n  H = *helpers;\n}\n\n"
+      "static const Image s_image = { %d, VSIZE, s_mx, %zu, s_chunks, %zu, s_bind };\n\n"
+      "AOT_EXPORT const Image* mi_aot_image(void)\n{\n  return &s_image;\n}\n",
+      MI_AOT_ABI, size, p->chunk_count);
+  return !ferror(out);
+}
+
+//----------------------------------------------------------
+// Public API
+//----------------------------------------------------------
+
+bool mi_aot_build(MiVm* vm, const char* mx_file, const char* out_file)
+{
+#if !MI_VM_JIT
+  // The object would build, but this VM could never attach its code.
+  (void)vm;
+  (void)mx_file;
+  (void)out_file;
+  mi_error("aot: this build has no native code support (MI_VM_JIT=0)\n");
+  return false;
+#endif
+  if (offsetof(MiRtValue, kind) != 0 || offsetof(MiRtValue, as) != 8 || sizeof(MiRtValueKind) != 4)
+  {
+    mi_error("aot: unsupported value layout in this build\n");
+    return false;
+  }
+
+  char c_file[1024];
+  if (snprintf(c_file, sizeof(c_file), "%s.c", out_file) >= (int)sizeof(c_file))
+  {
+    mi_error_fmt("aot: path too long: %s\n", out_file);
+    return false;
+  }
+
+  // Translate the code as the VM will see it once loaded (linked and verified).
+  MiMixProgram p;
+  if (!mi_mx_load_file(vm, mx_file, &p))
+  {
+    mi_error_fmt("aot: failed to load MIX file: %s\n", mx_file);
+    return false;
+  }
+
+  bool ok = false;
+  FILE* out = fopen(c_file, "wb");
+  if (!out)
+  {
+    mi_error_fmt("aot: cannot write %s\n", c_file);
+  }
+  else
+  {
+    ok = s_write_source(out, mx_file, &p);
+    ok = (fclose(out) == 0) && ok;
+  }
+  mi_mx_program_destroy(&p);
+  if (!ok)
+  {
+    return false;
+  }
+
+  // Build with the system compiler ($CC, or cc).
+  const char* cc = getenv("CC");
+  if (!cc || !cc[0])
+  {
+    cc = "cc";
+  }
+  char cmd[4096];
+  if (snprintf(cmd, sizeof(cmd), "%s -O2 -shared -fPIC -fno-strict-aliasing -w -o \"%s\" \"%s\"", cc, out_file, c_file) >= (int)sizeof(cmd))
+  {
+    mi_error_fmt("aot: path too long: %s\n", out_file);
+    return false;
+  }
+  if (system(cmd) != 0)
+  {
+    mi_error_fmt("aot: C compiler failed (source kept in %s):\n  %s\n", c_file, cmd);
+    return false;
+  }
+
+  (void)remove(c_file);
+  return true;
+}
+
+#if MI_VM_JIT
+static const MiAotHelpers s_helpers =
+{
+  mi_vm_jit_release,
+  mi_vm_jit_assign,
+  mi_vm_jit_step,
+  mi_vm_jit_truthy,
+  mi_vm_jit_holds,
+};
+#endif
+
+bool mi_aot_attach(MiVm* vm, const MiAotImage* image, MiMixProgram* out_program)
+{
+#if MI_VM_JIT
+  if (!mi_mx_load_memory(vm, image->mx, image->mx_size, out_program))
+  {
+    mi_error("aot: the embedded program failed to load\n");
+    return false;
+  }
+
+  bool ok = out_program->chunk_count == image->chunk_count;
+  image->bind(&s_helpers);
+  for (size_t i = 0; ok && i < out_program->chunk_count; ++i)
+  {
+    MiVmChunk* chunk = out_program->chunks[i];
+    const MiAotChunk* native = &image->chunks[i];
+    if (mi_aot_chunk_hash(chunk) != native->code_hash)
+    {
+      ok = false;
+      break;
+    }
+    chunk->jit = mi_jit_adopt(native->fn, native->native, chunk->code_count);
+    ok = chunk->jit != NULL;
+  }
+
+  if (!ok)
+  {
+    // Loading links and verifies against this VM; code that came out
+    // different from what was translated cannot use the native functions.
+    mi_error("aot: native code does not match the embedded program; rebuild it with --aot\n");
+    mi_mx_program_destroy(out_program);
+    return false;
+  }
+  return true;
+#else
+  (void)vm;
+  (void)image;
+  (void)out_program;
+  mi_error("aot: this build has no native code support (MI_VM_JIT=0)\n");
+  return false;
+#endif
+}
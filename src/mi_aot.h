@@ -0,0 +1,90 @@
+#ifndef MI_AOT_H
+#define MI_AOT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mi_vm.h"
+#include "mi_mx.h"
+#include "mi_jit.h"
+
+/**
+ * Ahead-of-time compilation of MX programs to shared objects.
+ *
+ * mi_aot_build() translates every chunk of a program to a C function with
+ * the same per-instruction templates the JIT uses (mi_jit.c), embeds the MX
+ * image, and builds the result with the system C compiler. Running the
+ * shared object loads the embedded program and attaches each function to
+ * its chunk as native code, so hot paths run compiled from the first
+ * instruction; calls, returns and the rarer opcodes still go through the
+ * interpreter, exactly as with the JIT.
+ *
+ * The generated code has no link-time dependency on the VM: the slow paths
+ * it needs (mi_vm_jit_*) are handed over through MiAotHelpers when the
+ * object is loaded. Objects are tied to the value layout and helper ABI of
+ * the build that made them and are rejected by any other.
+ */
+
+// Bump when MiAotImage, MiAotChunk, MiAotHelpers or the generated code's
+// view of MiRtValue / MiJitFrame change. The declarations are repeated in the
+// prelude written by mi_aot_build(), which must be kept in sync.
+#define MI_AOT_ABI 1
+
+// Exported by every AOT object (a MiAotImageFn): returns its MiAotImage.
+#define MI_AOT_IMAGE_SYMBOL "mi_aot_image"
+
+typedef size_t (*MiAotChunkFn)(MiJitFrame* frame, size_t pc);
+
+typedef struct MiAotHelpers
+{
+  void (*release)(MiVm* vm, MiRtValue* v);
+  void (*assign)(MiVm* vm, MiRtValue* dst, const MiRtValue* src);
+  void (*step)(MiJitFrame* frame, uint32_t pc);
+  bool (*truthy)(const MiRtValue* v);
+  bool (*holds)(MiJitFrame* frame, uint32_t pc);
+} MiAotHelpers;
+
+typedef struct MiAotChunk
+{
+  MiAotChunkFn   fn;
+  uint64_t       code_hash;  // mi_aot_chunk_hash() of the chunk it was made from
+  const uint8_t* native;     // 1 for each instruction fn runs, 0 where it returns at once
+} MiAotChunk;
+
+struct MiAotImage
+{
+  uint32_t          abi;         // MI_AOT_ABI
+  uint32_t          value_size;  // sizeof(MiRtValue)
+  const uint8_t*    mx;          // Embedded MX file
+  size_t            mx_size;
+  const MiAotChunk* chunks;      // In MiMixProgram::chunks order
+  size_t            chunk_count;
+  void            (*bind)(const MiAotHelpers* helpers);
+};
+typedef struct MiAotImage MiAotImage;
+
+/**
+ * Translate an MX file to C and build it as a shared object.
+ * @param vm        VM to load the program with (set up like the one that will run it).
+ * @param mx_file   Program to translate.
+ * @param out_file  Shared object to write. Its C source is written next to
+ *                  it (out_file + ".c") and kept only when the build fails.
+ * @return true on success. Failures are reported with mi_error_fmt.
+ */
+bool mi_aot_build(MiVm* vm, const char* mx_file, const char* out_file);
+
+/**
+ * Load the program embedded in an AOT image and attach its native code.
+ * The image's helpers are bound on the first call.
+ * @return true on success; out_program is then owned by the caller
+ *         (mi_mx_program_destroy).
+ */
+bool mi_aot_attach(MiVm* vm, const MiAotImage* image, MiMixProgram* out_program);
+
+/**
+ * Fingerprint of a chunk's code, used to match AOT functions to chunks.
+ */
+uint64_t mi_aot_chunk_hash(const MiVmChunk* chunk);
+
+#endif // MI_AOT_H
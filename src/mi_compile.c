@@ -1,5 +1,6 @@
 #include "mi_compile.h"
 #include "mi_fold.h"
+#include "mi_peephole.h"
 #include "mi_runtime.h"
 
 #include "mi_log.h"
@@ -18,7 +19,9 @@ static bool      s_chunk_const_eq(MiRtValue a, MiRtValue b);
 static void      s_chunk_emit_loc(MiVmChunk* c, uint32_t line, uint32_t col, MiVmOp op, uint8_t a, uint8_t b, uint8_t c0, int32_t imm);
 
 static MiVmChunk* s_chunk_create(void);
-static MiVmChunk* s_vm_compile_script_ast(MiVm* vm, const MiScript* script, XArena* arena, XSlice dbg_name, XSlice dbg_file, bool skip_typecheck);
+typedef struct MiVmNestCtx MiVmNestCtx;
+typedef struct MiVmLazyUnit MiVmLazyUnit;
+static MiVmChunk* s_vm_compile_script_ast(MiVm* vm, const MiScript* script, MiVmLazyUnit* unit, XSlice dbg_name, XSlice dbg_file, bool skip_typecheck, const MiVmNestCtx* nest);
 
 static void* s_realloc(void* ptr, size_t size)
 {
@@ -100,7 +103,7 @@ static bool s_chunk_const_eq(MiRtValue a, MiRtValue b)
     case MI_RT_VAL_FLOAT:return a.as.f == b.as.f;
     case MI_RT_VAL_STRING:
                          {
-                           return s_slice_eq(a.as.s, b.as.s);
+                           return s_slice_eq(mi_rt_value_slice(a), mi_rt_value_slice(b));
                          }
     case MI_RT_VAL_BLOCK: return a.as.block == b.as.block; // blocks compared by pointer identity
     case MI_RT_VAL_CMD:   return a.as.cmd == b.as.cmd;
@@ -109,7 +112,9 @@ static bool s_chunk_const_eq(MiRtValue a, MiRtValue b)
     case MI_RT_VAL_PAIR:  return a.as.pair == b.as.pair;
     case MI_RT_VAL_KVREF:
                           {
-                            return (a.as.kvref.dict == b.as.kvref.dict) && (a.as.kvref.entry_index == b.as.kvref.entry_index);
+                            MiRtKvRef ra = mi_rt_value_kvref(a);
+                            MiRtKvRef rb = mi_rt_value_kvref(b);
+                            return (ra.dict == rb.dict) && (ra.entry_index == rb.entry_index);
                           }
     default: return false;
   }
@@ -225,7 +230,7 @@ static int32_t s_chunk_add_const(MiVmChunk* c, MiRtValue v)
 
   if (v.kind == MI_RT_VAL_STRING)
   {
-    v.as.s = s_slice_dup_heap(v.as.s);
+    v = mi_rt_make_string_slice(s_slice_dup_heap(mi_rt_value_slice(v)));
   }
   c->consts[c->const_count] = v;
   return (int32_t) c->const_count++;
@@ -329,17 +334,138 @@ static int32_t s_chunk_add_subchunk(MiVmChunk* c, MiVmChunk* sub)
 // Compiler (AST -> bytecode)
 //----------------------------------------------------------
 
+// Names a chunk's scope frame can bind (set targets, cmd names, include
+// aliases, foreach variables, parameters), chained to the chunks enclosing it.
+// Blocks run with their defining frame as parent, so these are the only names
+// a function body can reach by lookup besides the root ones.
+typedef struct MiVmScopeNames
+{
+  XSlice*                      names;
+  size_t                       count;
+  size_t                       capacity;
+  bool                         dynamic;  // Also binds names computed at runtime
+  bool                         cmds;     // Binds commands (cmd, func, include)
+  const struct MiVmScopeNames* parent;
+} MiVmScopeNames;
+
+// Locals of a user command body resolved to frame slots; slot i is names[i].
+typedef struct MiVmLocals
+{
+  XSlice*   names;
+  int32_t   count;
+  int32_t*  param_slots;  // Per parameter: slot, or -1 when bound by name
+  XSlice*   param_names;
+  uint32_t  param_count;
+  bool      dynamic_params;  // Parameter names are computed at runtime
+  bool      dynamic;         // The body may bind names computed at runtime
+} MiVmLocals;
+
+// Bindings of the enclosing bodies a nested body reaches by upvalue index
+// (see MiVmChunk.upval_count). outer[i] is the enclosing body's upvalue
+// index for names[i], or -1 when the enclosing body's own frames bind it.
+typedef struct MiVmUpvals
+{
+  XSlice*   names;
+  int32_t*  outer;
+  uint32_t  count;
+} MiVmUpvals;
+
+// A typed `func` declared at the top level of the script whose calls can be
+// replaced by its body: a single `return` of a small expression over its
+// parameters (see s_inline_collect).
+typedef struct MiVmInlineFunc
+{
+  const MiFuncSig* sig;
+  const MiExpr*    value;  // The returned expression
+  int              size;   // Expression nodes in value
+  int              binds;  // Bindings of sig->name anywhere in the script
+} MiVmInlineFunc;
+
+typedef struct MiVmInlineFuncs
+{
+  MiVmInlineFunc* funcs;
+  size_t          count;
+  bool            dynamic;  // Some name is bound through a computed name
+} MiVmInlineFuncs;
+
+// What a nested chunk inherits from the chunk compiling it.
+struct MiVmNestCtx
+{
+  const MiTypecheckVarTypes* var_types;
+  const MiVmScopeNames*      outer;
+  const MiVmLocals*          locals;     // User command bodies only
+  const MiVmInlineFuncs*     inline_funcs;
+  const MiVmUpvals*          upvals;
+};
+
+// State shared by the chunks of a script compiled with
+// mi_compile_vm_script_lazy(): the AST their bodies are compiled from and the
+// whole-script analyses they inherit. Freed with the last body still pending.
+struct MiVmLazyUnit
+{
+  MiVm*               vm;
+  XArena*             arena;    // Owns the AST
+  char*               source;   // Text the AST points into
+  MiTypecheckVarTypes var_types;
+  MiVmInlineFuncs     inline_funcs;
+  MiVmScopeNames**    names;    // Scope names of every chunk compiled so far
+  size_t              name_count;
+  uint32_t            refs;     // Pending bodies + compiles in progress
+};
+
+// A block or command body whose compilation waits for its first call: the
+// nesting context its s_vm_compile_script_ast() call would have been given.
+struct MiVmLazy
+{
+  MiVmLazyUnit*              unit;
+  const MiScript*            script;
+  const MiTypecheckVarTypes* var_types;
+  const MiVmScopeNames*      outer;
+  const MiVmInlineFuncs*     inline_funcs;
+  MiVmLocals                 locals;
+  bool                       has_locals;
+  MiVmUpvals                 upvals;
+};
+
 typedef struct MiVmBuild
 {
   MiVm*       vm;
   MiVmChunk*  chunk;
   uint8_t     next_reg;
   uint8_t     reg_base;
+  uint8_t     reg_high;   // Highest next_reg since the innermost loop began
+
+  // Frame slots holding spilled registers, above the named locals.
+  uint32_t    spill_base;
+  uint32_t    spill_top;
+  uint32_t    spill_high;
 
   // Names of typed `func` declarations in the current script
   XSlice*     func_names;
   size_t      func_name_count;
 
+  // Whole-script variable types; selects typed arithmetic opcodes. 
+  const MiTypecheckVarTypes* var_types;
+
+  // Names bindable in this chunk's frame and the frames enclosing it.
+  const MiVmScopeNames* scope_names;
+
+  // Slot-resolved locals when compiling a user command body, else NULL.
+  const MiVmLocals* locals;
+
+  // Enclosing bindings captured by the blocks of this body, else NULL.
+  const MiVmUpvals* upvals;
+
+  // Functions of the top-level script whose calls can be inlined.
+  const MiVmInlineFuncs* inline_funcs;
+
+  // Set when nested bodies are left for mi_compile_force().
+  MiVmLazyUnit* unit;
+
+  // While compiling an inlined body: its parameters live in these registers.
+  const MiFuncSig* inline_sig;
+  const uint8_t*   inline_regs;
+
   // Current source location for emitted instructions (1-based; 0 = unknown). 
   uint32_t    dbg_line;
   uint32_t    dbg_col;
@@ -352,6 +478,10 @@ typedef struct MiVmBuild
     size_t  break_jumps[64];
     size_t  break_jump_count;
     int     scope_base_depth; // inline_scope_depth value outside this loop
+    int     continue_depth;   // inline_scope_depth value continue unwinds to
+    bool    step_after_body;  // continue jumps forward to a step emitted after the body
+    size_t  continue_jumps[64];
+    size_t  continue_jump_count;
   } loops[16];
 
   // Tracks active inlined scope depth for proper cleanup on `return`.
@@ -362,6 +492,10 @@ typedef struct MiVmBuild
   // When >0, we are compiling an expression that is itself an argument of
   // another command call. Command expressions must preserve the arg stack.
   int         arg_expr_depth;
+
+  // Set while compiling the value of a `return`: a call compiled right
+  // under it is in tail position and may replace the running frame.
+  bool        tail_call;
 } MiVmBuild;
 
 static bool s_build_is_func_name(const MiVmBuild* b, XSlice name)
@@ -413,75 +547,1730 @@ static uint8_t s_compile_expr(MiVmBuild* b, const MiExpr* e);
 
 static uint8_t s_alloc_reg(MiVmBuild* b)
 {
-  if (b->next_reg >= 250u)
+  if (b->next_reg >= MI_VM_REG_COUNT)
+  {
+    mi_error("mi_vm: ran out of registers\n");
+    return 0;
+  }
+  uint8_t r = b->next_reg++;
+  if (b->next_reg > b->reg_high)
+  {
+    b->reg_high = b->next_reg;
+  }
+  return r;
+}
+
+// An expression that started allocating at 'mark' and produced 'r': every
+// other register it took is dead now and can be handed out again.
+static void s_settle_regs(MiVmBuild* b, uint8_t mark, uint8_t r)
+{
+  b->next_reg = (r >= mark && r < MI_VM_REG_COUNT) ? (uint8_t)(r + 1u) : mark;
+}
+
+// Frame slot for a register that has to outlive a subexpression compiled
+// under register pressure. Slots are released in reverse order.
+static int32_t s_spill_slot(MiVmBuild* b)
+{
+  int32_t slot = (int32_t)(b->spill_base + b->spill_top);
+  b->spill_top += 1;
+  if (b->spill_top > b->spill_high)
+  {
+    b->spill_high = b->spill_top;
+  }
+  return slot;
+}
+
+static void s_spill_release(MiVmBuild* b)
+{
+  b->spill_top -= 1;
+}
+
+// Literals and direct variable reads compile to one load into one register.
+static bool s_expr_is_leaf(const MiExpr* e)
+{
+  if (!e)
+  {
+    return true;
+  }
+  switch (e->kind)
+  {
+    case MI_EXPR_INT_LITERAL:
+    case MI_EXPR_FLOAT_LITERAL:
+    case MI_EXPR_STRING_LITERAL:
+    case MI_EXPR_BOOL_LITERAL:
+    case MI_EXPR_VOID_LITERAL:
+      return true;
+    case MI_EXPR_VAR:
+      return !e->as.var.is_indirect;
+    default:
+      return false;
+  }
+}
+
+// Registers [from, reg_high) were used by a loop that just ended: clear them
+// so the objects its last iteration left there are released now rather than
+// whenever the registers get reused.
+static void s_emit_clear_loop_regs(MiVmBuild* b, uint8_t from)
+{
+  if (b->reg_high > from)
+  {
+    s_emit(b, MI_VM_OP_CLEAR_REGS, from, (uint8_t)(b->reg_high - from), 0, 0);
+  }
+}
+
+// True when the typechecker proved that 'args' pass the signature check the
+// VM would otherwise repeat on every call of 'cmd'.
+static bool s_call_args_proven(const MiVmBuild* b, const MiRtCmd* cmd, const MiExprList* args, int argc)
+{
+  const MiFuncTypeSig* sig = cmd->sig;
+  if (!sig)
+  {
+    // Natives without a signature are never checked; user commands only
+    // have their arity checked.
+    return !cmd->is_native && (uint32_t)argc == cmd->param_count;
+  }
+  if (sig->is_variadic ? argc < sig->param_count : argc != sig->param_count)
+  {
+    return false;
+  }
+
+  int i = 0;
+  for (const MiExprList* it = args; it; it = it->next, ++i)
+  {
+    MiTypeKind expected = sig->variadic_type;
+    if (i < sig->param_count)
+    {
+      expected = sig->param_types ? sig->param_types[i] : MI_TYPE_ANY;
+    }
+    if (expected != MI_TYPE_ANY && mi_typecheck_expr_type(b->var_types, it->expr) != expected)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+static MiVmOp s_map_unary(MiTokenKind op)
+{
+  switch (op)
+  {
+    case MI_TOK_MINUS: return MI_VM_OP_NEG;
+    case MI_TOK_NOT:   return MI_VM_OP_NOT;
+    default:           return MI_VM_OP_NOOP;
+  }
+}
+
+static MiVmOp s_map_binary(MiTokenKind op)
+{
+  switch (op)
+  {
+    case MI_TOK_PLUS:  return MI_VM_OP_ADD;
+    case MI_TOK_MINUS: return MI_VM_OP_SUB;
+    case MI_TOK_STAR:  return MI_VM_OP_MUL;
+    case MI_TOK_SLASH: return MI_VM_OP_DIV;
+    case MI_TOK_EQEQ:  return MI_VM_OP_EQ;
+    case MI_TOK_BANGEQ:return MI_VM_OP_NEQ;
+    case MI_TOK_LT:    return MI_VM_OP_LT;
+    case MI_TOK_LTEQ:  return MI_VM_OP_LTEQ;
+    case MI_TOK_GT:    return MI_VM_OP_GT;
+    case MI_TOK_GTEQ:  return MI_VM_OP_GTEQ;
+    case MI_TOK_AND:   return MI_VM_OP_AND;
+    case MI_TOK_OR:    return MI_VM_OP_OR;
+    default:           return MI_VM_OP_NOOP;
+  }
+}
+
+// Typed form of an arithmetic/compare opcode when both operand types are
+// known, else the generic opcode.
+static MiVmOp s_typed_binary(MiVmOp op, MiTypeKind lt, MiTypeKind rt)
+{
+  if (lt == MI_TYPE_INT && rt == MI_TYPE_INT)
+  {
+    switch (op)
+    {
+      case MI_VM_OP_ADD:  return MI_VM_OP_ADD_INT;
+      case MI_VM_OP_SUB:  return MI_VM_OP_SUB_INT;
+      case MI_VM_OP_MUL:  return MI_VM_OP_MUL_INT;
+      case MI_VM_OP_EQ:   return MI_VM_OP_EQ_INT;
+      case MI_VM_OP_NEQ:  return MI_VM_OP_NEQ_INT;
+      case MI_VM_OP_LT:   return MI_VM_OP_LT_INT;
+      case MI_VM_OP_LTEQ: return MI_VM_OP_LTEQ_INT;
+      case MI_VM_OP_GT:   return MI_VM_OP_GT_INT;
+      case MI_VM_OP_GTEQ: return MI_VM_OP_GTEQ_INT;
+      default:            return op;
+    }
+  }
+
+  if (lt == MI_TYPE_FLOAT && rt == MI_TYPE_FLOAT)
+  {
+    switch (op)
+    {
+      case MI_VM_OP_ADD:  return MI_VM_OP_ADD_FLOAT;
+      case MI_VM_OP_SUB:  return MI_VM_OP_SUB_FLOAT;
+      case MI_VM_OP_MUL:  return MI_VM_OP_MUL_FLOAT;
+      case MI_VM_OP_DIV:  return MI_VM_OP_DIV_FLOAT;
+      case MI_VM_OP_LT:   return MI_VM_OP_LT_FLOAT;
+      case MI_VM_OP_LTEQ: return MI_VM_OP_LTEQ_FLOAT;
+      case MI_VM_OP_GT:   return MI_VM_OP_GT_FLOAT;
+      case MI_VM_OP_GTEQ: return MI_VM_OP_GTEQ_FLOAT;
+      default:            return op;
+    }
+  }
+
+  return op;
+}
+
+static void s_chunk_patch_imm(MiVmChunk* c, size_t ins_index, int32_t imm)
+{
+  if (!c || ins_index >= c->code_count)
+  {
+    return;
+  }
+  c->code[ins_index].imm = imm;
+
+  // Suppress JMP/JT/JF 0: fallthrough is implicit. 
+  if (imm == 0)
+  {
+    MiVmOp op = (MiVmOp)c->code[ins_index].op;
+    if (op == MI_VM_OP_JUMP || op == MI_VM_OP_JUMP_IF_TRUE || op == MI_VM_OP_JUMP_IF_FALSE)
+    {
+      c->code[ins_index].op = (uint8_t)MI_VM_OP_NOOP;
+      c->code[ins_index].a = 0;
+      c->code[ins_index].b = 0;
+      c->code[ins_index].c = 0;
+      c->code[ins_index].imm = 0;
+    }
+  }
+}
+
+static bool s_expr_is_lit_string(const MiExpr* e, const char* cstr)
+{
+  if (!e || e->kind != MI_EXPR_STRING_LITERAL)
+  {
+    return false;
+  }
+
+  return s_slice_eq(e->as.string_lit.value, x_slice_from_cstr(cstr));
+}
+
+//----------------------------------------------------------
+// Local slot resolution
+//----------------------------------------------------------
+
+static void s_names_add(MiVmScopeNames* n, XSlice name)
+{
+  for (size_t i = 0; i < n->count; ++i)
+  {
+    if (s_slice_eq(n->names[i], name))
+    {
+      return;
+    }
+  }
+
+  if (n->count == n->capacity)
+  {
+    n->capacity = n->capacity ? n->capacity * 2u : 16u;
+    n->names = (XSlice*)s_realloc(n->names, n->capacity * sizeof(XSlice));
+  }
+  n->names[n->count++] = name;
+}
+
+static bool s_names_chain_has(const MiVmScopeNames* n, XSlice name)
+{
+  for (; n; n = n->parent)
+  {
+    for (size_t i = 0; i < n->count; ++i)
+    {
+      if (s_slice_eq(n->names[i], name))
+      {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+static bool s_names_chain_dynamic(const MiVmScopeNames* n)
+{
+  for (; n; n = n->parent)
+  {
+    if (n->dynamic)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+// `set` used as a value: whatever calls it later binds a name the scans
+// can't see, in the frame it runs in.
+static bool s_expr_is_set_value(const MiExpr* e)
+{
+  return (e->kind == MI_EXPR_VAR && !e->as.var.is_indirect && s_slice_eq(e->as.var.name, x_slice_from_cstr("set"))) ||
+    s_expr_is_lit_string(e, "set");
+}
+
+// Heads other than a name or a module member are values computed at runtime,
+// and may evaluate to `set`; so may the value `call` calls.
+static bool s_head_is_computed(const MiExpr* head)
+{
+  return !head || (head->kind != MI_EXPR_STRING_LITERAL && head->kind != MI_EXPR_QUAL) ||
+    s_expr_is_lit_string(head, "call");
+}
+
+static void s_names_collect_script(MiVmScopeNames* n, const MiScript* script);
+static void s_names_collect_command(MiVmScopeNames* n, const MiExpr* e);
+
+// Block literals are skipped: they compile to chunks with frames of their own.
+static void s_names_collect_expr(MiVmScopeNames* n, const MiExpr* e)
+{
+  if (!e)
+  {
+    return;
+  }
+
+  if (s_expr_is_set_value(e))
+  {
+    n->dynamic = true;
+    return;
+  }
+
+  switch (e->kind)
+  {
+    case MI_EXPR_VAR:
+      if (e->as.var.is_indirect)
+      {
+        s_names_collect_expr(n, e->as.var.name_expr);
+      }
+      break;
+    case MI_EXPR_INDEX:
+      s_names_collect_expr(n, e->as.index.target);
+      s_names_collect_expr(n, e->as.index.index);
+      break;
+    case MI_EXPR_UNARY:
+      s_names_collect_expr(n, e->as.unary.expr);
+      break;
+    case MI_EXPR_BINARY:
+      s_names_collect_expr(n, e->as.binary.left);
+      s_names_collect_expr(n, e->as.binary.right);
+      break;
+    case MI_EXPR_LIST:
+    case MI_EXPR_DICT:
+      for (const MiExprList* it = (e->kind == MI_EXPR_LIST) ? e->as.list.items : e->as.dict.items; it; it = it->next)
+      {
+        s_names_collect_expr(n, it->expr);
+      }
+      break;
+    case MI_EXPR_PAIR:
+      s_names_collect_expr(n, e->as.pair.key);
+      s_names_collect_expr(n, e->as.pair.value);
+      break;
+    case MI_EXPR_QUAL:
+      s_names_collect_expr(n, e->as.qual.target);
+      break;
+    case MI_EXPR_COMMAND:
+      s_names_collect_command(n, e);
+      break;
+    default:
+      break;
+  }
+}
+
+static void s_names_collect_command(MiVmScopeNames* n, const MiExpr* e)
+{
+  const MiExpr* head = e->as.command.head;
+  const MiExprList* args = e->as.command.args;
+  const MiExpr* first = args ? args->expr : NULL;
+  bool is_set = s_expr_is_lit_string(head, "set") && e->as.command.argc == 2u && first;
+
+  if (is_set && first->kind == MI_EXPR_STRING_LITERAL)
+  {
+    s_names_add(n, first->as.string_lit.value);
+  }
+  else if (is_set && first->kind == MI_EXPR_VAR && !first->as.var.is_indirect)
+  {
+    s_names_add(n, first->as.var.name);
+  }
+  else if (is_set && first->kind == MI_EXPR_QUAL)
+  {
+    // May land in any frame the target block was defined in.
+    s_names_add(n, first->as.qual.member);
+  }
+  else if (s_expr_is_lit_string(head, "set") && !(is_set && first->kind == MI_EXPR_INDEX))
+  {
+    n->dynamic = true;
+  }
+  else if (s_expr_is_lit_string(head, "cmd") || s_expr_is_lit_string(head, "foreach"))
+  {
+    if (first && first->kind == MI_EXPR_STRING_LITERAL)
+    {
+      s_names_add(n, first->as.string_lit.value);
+    }
+    else
+    {
+      n->dynamic = true;
+    }
+    n->cmds = n->cmds || s_expr_is_lit_string(head, "cmd");
+  }
+
+  if (s_head_is_computed(head))
+  {
+    n->dynamic = true;
+  }
+
+  // if/while/foreach bodies are compiled inline, in scopes of this chunk.
+  bool inline_bodies = s_expr_is_lit_string(head, "if") ||
+    s_expr_is_lit_string(head, "while") ||
+    s_expr_is_lit_string(head, "foreach");
+
+  if (head && head->kind != MI_EXPR_STRING_LITERAL)
+  {
+    s_names_collect_expr(n, head);
+  }
+  for (const MiExprList* it = args; it; it = it->next)
+  {
+    if (inline_bodies && it->expr && it->expr->kind == MI_EXPR_BLOCK)
+    {
+      s_names_collect_script(n, it->expr->as.block.script);
+    }
+    else
+    {
+      s_names_collect_expr(n, it->expr);
+    }
+  }
+}
+
+static void s_names_collect_script(MiVmScopeNames* n, const MiScript* script)
+{
+  for (const MiCommandList* it = script ? script->first : NULL; it; it = it->next)
+  {
+    const MiCommand* cmd = it->command;
+    if (!cmd)
+    {
+      continue;
+    }
+    if (cmd->is_include_stmt)
+    {
+      s_names_add(n, cmd->include_alias_tok.lexeme);
+      n->cmds = true;
+    }
+
+    MiExpr fake;
+    memset(&fake, 0, sizeof(fake));
+    fake.kind = MI_EXPR_COMMAND;
+    fake.as.command.head = cmd->head;
+    fake.as.command.args = cmd->args;
+    fake.as.command.argc = (unsigned int)cmd->argc;
+    s_names_collect_command(n, &fake);
+  }
+}
+
+// A name in a user command body can live in a slot when every run binds it in
+// the function frame before touching it and nothing can reach it by name:
+//  - its first occurrence binds it, in the innermost inline scope (if/while/
+//    foreach body) that holds all of its occurrences, so no run can observe
+//    it unbound or see a binding from a previous loop iteration;
+//  - no nested block, qualified command head or computed name refers to it;
+//  - no enclosing frame (or the root) can already hold the name, since `set`
+//    assigns the nearest existing binding.
+typedef struct MiLocalVar
+{
+  XSlice name;
+  int    first_scope;
+  int    home_scope;
+  bool   first_is_def;
+  bool   captured;
+} MiLocalVar;
+
+typedef struct MiLocalScan
+{
+  MiLocalVar* vars;
+  int         var_count;
+  int         var_capacity;
+  int*        scope_parent;
+  int*        scope_depth;
+  int         scope_count;
+  int         scope_capacity;
+  int         scope;         // Current inline scope
+  int         nested_depth;  // >0 inside a block literal (own chunk)
+  bool        dynamic;       // A name is bound or read through a computed name
+} MiLocalScan;
+
+static void s_scan_enter_scope(MiLocalScan* s)
+{
+  if (s->scope_count == s->scope_capacity)
+  {
+    s->scope_capacity = s->scope_capacity ? s->scope_capacity * 2 : 16;
+    s->scope_parent = (int*)s_realloc(s->scope_parent, (size_t)s->scope_capacity * sizeof(int));
+    s->scope_depth = (int*)s_realloc(s->scope_depth, (size_t)s->scope_capacity * sizeof(int));
+  }
+  int id = s->scope_count++;
+  s->scope_parent[id] = s->scope;
+  s->scope_depth[id] = (s->scope >= 0) ? s->scope_depth[s->scope] + 1 : 0;
+  s->scope = id;
+}
+
+static void s_scan_leave_scope(MiLocalScan* s)
+{
+  s->scope = s->scope_parent[s->scope];
+}
+
+static int s_scan_common_scope(const MiLocalScan* s, int a, int b)
+{
+  while (a != b)
+  {
+    if (s->scope_depth[a] >= s->scope_depth[b])
+    {
+      a = s->scope_parent[a];
+    }
+    else
+    {
+      b = s->scope_parent[b];
+    }
+  }
+  return a;
+}
+
+static void s_scan_name(MiLocalScan* s, XSlice name, bool is_def)
+{
+  for (int i = 0; i < s->var_count; ++i)
+  {
+    MiLocalVar* v = &s->vars[i];
+    if (s_slice_eq(v->name, name))
+    {
+      if (s->nested_depth > 0)
+      {
+        v->captured = true;
+      }
+      else
+      {
+        v->home_scope = s_scan_common_scope(s, v->home_scope, s->scope);
+      }
+      return;
+    }
+  }
+
+  if (s->var_count == s->var_capacity)
+  {
+    s->var_capacity = s->var_capacity ? s->var_capacity * 2 : 16;
+    s->vars = (MiLocalVar*)s_realloc(s->vars, (size_t)s->var_capacity * sizeof(MiLocalVar));
+  }
+  MiLocalVar* v = &s->vars[s->var_count++];
+  v->name = name;
+  v->first_scope = s->scope;
+  v->home_scope = s->scope;
+  v->first_is_def = is_def;
+  v->captured = s->nested_depth > 0;
+}
+
+static void s_scan_script(MiLocalScan* s, const MiScript* script);
+static void s_scan_command(MiLocalScan* s, const MiExpr* e);
+
+static void s_scan_expr(MiLocalScan* s, const MiExpr* e)
+{
+  if (!e)
+  {
+    return;
+  }
+
+  if (s_expr_is_set_value(e))
+  {
+    s->dynamic = true;
+    return;
+  }
+
+  switch (e->kind)
+  {
+    case MI_EXPR_VAR:
+      if (e->as.var.is_indirect)
+      {
+        s->dynamic = true;
+        s_scan_expr(s, e->as.var.name_expr);
+      }
+      else
+      {
+        s_scan_name(s, e->as.var.name, false);
+      }
+      break;
+    case MI_EXPR_INDEX:
+      s_scan_expr(s, e->as.index.target);
+      s_scan_expr(s, e->as.index.index);
+      break;
+    case MI_EXPR_UNARY:
+      s_scan_expr(s, e->as.unary.expr);
+      break;
+    case MI_EXPR_BINARY:
+      s_scan_expr(s, e->as.binary.left);
+      s_scan_expr(s, e->as.binary.right);
+      break;
+    case MI_EXPR_LIST:
+    case MI_EXPR_DICT:
+      for (const MiExprList* it = (e->kind == MI_EXPR_LIST) ? e->as.list.items : e->as.dict.items; it; it = it->next)
+      {
+        s_scan_expr(s, it->expr);
+      }
+      break;
+    case MI_EXPR_PAIR:
+      s_scan_expr(s, e->as.pair.key);
+      s_scan_expr(s, e->as.pair.value);
+      break;
+    case MI_EXPR_QUAL:
+      s_scan_expr(s, e->as.qual.target);
+      break;
+    case MI_EXPR_BLOCK:
+      s->nested_depth += 1;
+      s_scan_script(s, e->as.block.script);
+      s->nested_depth -= 1;
+      break;
+    case MI_EXPR_COMMAND:
+      s_scan_command(s, e);
+      break;
+    default:
+      break;
+  }
+}
+
+// Body of if/while/foreach: inlined into the chunk under a scope of its own.
+static void s_scan_inline_body(MiLocalScan* s, const MiExpr* body, const XSlice* bound)
+{
+  if (!body || body->kind != MI_EXPR_BLOCK || !body->as.block.script)
+  {
+    s_scan_expr(s, body);
+    return;
+  }
+
+  s_scan_enter_scope(s);
+  if (bound)
+  {
+    // The loop variable is defined in the body scope and shadows any binding
+    // of the same name around the loop; one slot cannot hold both.
+    for (int i = 0; i < s->var_count; ++i)
+    {
+      if (s_slice_eq(s->vars[i].name, *bound))
+      {
+        s->vars[i].captured = true;
+      }
+    }
+    s_scan_name(s, *bound, true);
+  }
+  s_scan_script(s, body->as.block.script);
+  s_scan_leave_scope(s);
+}
+
+// Mirrors the evaluation order s_compile_command_expr emits.
+static void s_scan_command(MiLocalScan* s, const MiExpr* e)
+{
+  const MiExpr* head = e->as.command.head;
+  const MiExprList* args = e->as.command.args;
+  unsigned int argc = e->as.command.argc;
+  const MiExpr* first = args ? args->expr : NULL;
+
+  if (s->nested_depth == 0 && s_expr_is_lit_string(head, "set"))
+  {
+    const MiExpr* rhs = (argc == 2u && args->next) ? args->next->expr : NULL;
+    if (!first || !rhs)
+    {
+      s->dynamic = true;
+    }
+    else if (first->kind == MI_EXPR_STRING_LITERAL)
+    {
+      s_scan_expr(s, rhs);
+      s_scan_name(s, first->as.string_lit.value, true);
+    }
+    else if (first->kind == MI_EXPR_VAR && !first->as.var.is_indirect)
+    {
+      s_scan_expr(s, rhs);
+      s_scan_name(s, first->as.var.name, true);
+    }
+    else if (first->kind == MI_EXPR_QUAL || first->kind == MI_EXPR_INDEX)
+    {
+      s_scan_expr(s, first);
+      s_scan_expr(s, rhs);
+    }
+    else
+    {
+      s->dynamic = true;
+    }
+    return;
+  }
+
+  if (s->nested_depth == 0 && s_expr_is_lit_string(head, "if"))
+  {
+    // if <cond> <block> ("elseif" <cond> <block>)* ("else" <block>)?
+    const MiExprList* it = args;
+    while (it)
+    {
+      if (s_expr_is_lit_string(it->expr, "else"))
+      {
+        s_scan_inline_body(s, it->next ? it->next->expr : NULL, NULL);
+        break;
+      }
+      if (s_expr_is_lit_string(it->expr, "elseif"))
+      {
+        it = it->next;
+        continue;
+      }
+      s_scan_expr(s, it->expr);
+      it = it->next;
+      if (it)
+      {
+        s_scan_inline_body(s, it->expr, NULL);
+        it = it->next;
+      }
+    }
+    return;
+  }
+
+  if (s->nested_depth == 0 && s_expr_is_lit_string(head, "while") && argc == 2u)
+  {
+    s_scan_expr(s, first);
+    s_scan_inline_body(s, args->next->expr, NULL);
+    return;
+  }
+
+  if (s->nested_depth == 0 && s_expr_is_lit_string(head, "foreach") && argc == 3u &&
+      first && first->kind == MI_EXPR_STRING_LITERAL)
+  {
+    const MiExpr* list_expr = args->next->expr;
+    if (list_expr && list_expr->kind == MI_EXPR_STRING_LITERAL)
+    {
+      s_scan_name(s, list_expr->as.string_lit.value, false);
+    }
+    else
+    {
+      s_scan_expr(s, list_expr);
+    }
+    s_scan_inline_body(s, args->next->next->expr, &first->as.string_lit.value);
+    return;
+  }
+
+  if (s->nested_depth == 0 && s_expr_is_lit_string(head, "foreach") && (argc == 4u || argc == 5u) &&
+      first && first->kind == MI_EXPR_STRING_LITERAL)
+  {
+    // Int range: the bounds, then the body.
+    const MiExprList* it = args->next;
+    for (unsigned int k = 2u; k < argc; ++k, it = it->next)
+    {
+      s_scan_expr(s, it->expr);
+    }
+    s_scan_inline_body(s, it->expr, &first->as.string_lit.value);
+    return;
+  }
+
+  if (s_expr_is_lit_string(head, "cmd") || s_expr_is_lit_string(head, "foreach"))
+  {
+    // Bound by name at runtime (cmd) or inside a nested chunk.
+    if (first && first->kind == MI_EXPR_STRING_LITERAL)
+    {
+      s->nested_depth += 1;
+      s_scan_name(s, first->as.string_lit.value, true);
+      s->nested_depth -= 1;
+    }
+    else
+    {
+      s->dynamic = true;
+    }
+  }
+  else if (s_expr_is_lit_string(head, "set"))
+  {
+    // Assignment inside a nested chunk: it reaches this frame by name.
+    if (first && first->kind == MI_EXPR_STRING_LITERAL)
+    {
+      s_scan_name(s, first->as.string_lit.value, true);
+    }
+    else if (first && first->kind == MI_EXPR_VAR && !first->as.var.is_indirect)
+    {
+      s_scan_name(s, first->as.var.name, true);
+    }
+    else if (!first || (first->kind != MI_EXPR_QUAL && first->kind != MI_EXPR_INDEX))
+    {
+      s->dynamic = true;
+    }
+  }
+
+  for (const MiExprList* it = args; it; it = it->next)
+  {
+    s_scan_expr(s, it->expr);
+  }
+
+  if (head && head->kind == MI_EXPR_STRING_LITERAL)
+  {
+    XSlice name = head->as.string_lit.value;
+    if (s_slice_has_double_colon(name))
+    {
+      // The first segment of a qualified head is looked up by name.
+      size_t len = 0;
+      while (len + 1 < name.length && !(name.ptr[len] == ':' && name.ptr[len + 1] == ':'))
+      {
+        len += 1;
+      }
+      s->nested_depth += 1;
+      s_scan_name(s, x_slice_init(name.ptr, len), false);
+      s->nested_depth -= 1;
+    }
+    else
+    {
+      // Heads that are not registered commands load a variable.
+      s_scan_name(s, name, false);
+    }
+  }
+  else
+  {
+    s_scan_expr(s, head);
+  }
+  s->dynamic = s->dynamic || s_head_is_computed(head);
+}
+
+static void s_scan_script(MiLocalScan* s, const MiScript* script)
+{
+  for (const MiCommandList* it = script ? script->first : NULL; it; it = it->next)
+  {
+    const MiCommand* cmd = it->command;
+    if (!cmd)
+    {
+      continue;
+    }
+
+    MiExpr fake;
+    memset(&fake, 0, sizeof(fake));
+    fake.kind = MI_EXPR_COMMAND;
+    fake.as.command.head = cmd->head;
+    fake.as.command.args = cmd->args;
+    fake.as.command.argc = (unsigned int)cmd->argc;
+    s_scan_command(s, &fake);
+
+    if (cmd->is_include_stmt)
+    {
+      s_scan_name(s, cmd->include_alias_tok.lexeme, true);
+    }
+  }
+}
+
+static void s_locals_free(MiVmLocals* locals)
+{
+  free(locals->names);
+  free(locals->param_slots);
+  free(locals->param_names);
+  memset(locals, 0, sizeof(*locals));
+}
+
+// Resolve the slot locals of a user command body compiled by 'b'.
+static void s_locals_resolve(const MiVmBuild* b, const XSlice* params, uint32_t param_count, const MiScript* body, MiVmLocals* out)
+{
+  memset(out, 0, sizeof(*out));
+
+  MiLocalScan s;
+  memset(&s, 0, sizeof(s));
+  s.scope = -1;
+  s_scan_enter_scope(&s);
+  for (uint32_t i = 0; i < param_count; ++i)
+  {
+    s_scan_name(&s, params[i], true);
+  }
+  s_scan_script(&s, body);
+
+  out->dynamic = s.dynamic;
+
+  if (!s.dynamic && !s_names_chain_dynamic(b->scope_names))
+  {
+    for (int i = 0; i < s.var_count; ++i)
+    {
+      const MiLocalVar* v = &s.vars[i];
+      if (v->captured || !v->first_is_def || v->first_scope != v->home_scope)
+      {
+        continue;
+      }
+      if (s_names_chain_has(b->scope_names, v->name) ||
+          mi_vm_find_command(b->vm, v->name, NULL) ||
+          mi_rt_var_get(b->vm->rt, v->name, NULL) ||
+          mi_rt_var_get_from(&b->vm->rt->root, v->name, NULL))
+      {
+        continue;
+      }
+
+      out->names = (XSlice*)s_realloc(out->names, (size_t)(out->count + 1) * sizeof(XSlice));
+      out->names[out->count++] = v->name;
+    }
+  }
+
+  if (param_count > 0)
+  {
+    out->param_count = param_count;
+    out->param_names = (XSlice*)s_realloc(NULL, (size_t)param_count * sizeof(XSlice));
+    memcpy(out->param_names, params, (size_t)param_count * sizeof(XSlice));
+    out->param_slots = (int32_t*)s_realloc(NULL, (size_t)param_count * sizeof(int32_t));
+    for (uint32_t i = 0; i < param_count; ++i)
+    {
+      out->param_slots[i] = -1;
+      for (int32_t k = 0; k < out->count; ++k)
+      {
+        if (s_slice_eq(out->names[k], params[i]))
+        {
+          out->param_slots[i] = k;
+          break;
+        }
+      }
+    }
+  }
+
+  free(s.vars);
+  free(s.scope_parent);
+  free(s.scope_depth);
+}
+
+static int32_t s_local_slot(const MiVmBuild* b, XSlice name)
+{
+  if (!b->locals)
+  {
+    return -1;
+  }
+  for (int32_t i = 0; i < b->locals->count; ++i)
+  {
+    if (s_slice_eq(b->locals->names[i], name))
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+//----------------------------------------------------------
+// Upvalues
+//----------------------------------------------------------
+
+// A nested body runs without the frames of the body creating it when it
+// reaches every name those frames may bind (the candidates) through an
+// upvalue. That holds when the nested body and every block nested in it:
+//  - bind and read no computed names, and know their parameter names;
+//  - bind no candidate themselves (cmd, func, foreach variable, include);
+//  - look up no candidate by name: calls of registered commands check for a
+//    binding that shadows them, qualified heads look up their first segment;
+//  - call no values when the frames left out bind commands, as a command
+//    passed by name is found by lookup.
+typedef struct MiUpvalScan
+{
+  MiVm*          vm;
+  MiVmScopeNames names;      // Bound by the scanned body's frames
+  XSlice*        cand;
+  size_t         cand_count;
+  bool           cand_cmds;  // The frames left out bind commands
+  XSlice*        used;       // Candidates referenced, in first-use order
+  uint32_t       used_count;
+  bool           ok;
+} MiUpvalScan;
+
+static bool s_upscan_is_cand(const MiUpvalScan* s, XSlice name)
+{
+  for (size_t i = 0; i < s->cand_count; ++i)
+  {
+    if (s_slice_eq(s->cand[i], name))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void s_upscan_use(MiUpvalScan* s, XSlice name)
+{
+  if (!s_upscan_is_cand(s, name))
+  {
+    return;
+  }
+  for (uint32_t i = 0; i < s->used_count; ++i)
+  {
+    if (s_slice_eq(s->used[i], name))
+    {
+      return;
+    }
+  }
+  s->used = (XSlice*)s_realloc(s->used, (size_t)(s->used_count + 1u) * sizeof(XSlice));
+  s->used[s->used_count++] = name;
+}
+
+static void s_upscan_free(MiUpvalScan* s)
+{
+  free(s->names.names);
+  free(s->cand);
+  free(s->used);
+}
+
+static void s_upscan_body(MiUpvalScan* s, MiVm* vm, const XSlice* cand, size_t cand_count, bool cand_cmds,
+    const MiScript* script, const XSlice* params, uint32_t param_count);
+static void s_upscan_script(MiUpvalScan* s, const MiScript* script);
+static void s_upscan_command(MiUpvalScan* s, const MiExpr* e);
+
+// A block nested in the scanned body: its candidates are the body's own
+// names and candidates, and the ones it references are the body's too.
+static void s_upscan_nested(MiUpvalScan* s, const MiScript* script, const XSlice* params, uint32_t param_count, bool params_known)
+{
+  if (!s->ok || !params_known)
+  {
+    s->ok = false;
+    return;
+  }
+
+  size_t n = s->names.count + s->cand_count;
+  XSlice* cand = (XSlice*)s_realloc(NULL, (n ? n : 1u) * sizeof(XSlice));
+  if (s->names.count > 0)
+  {
+    memcpy(cand, s->names.names, s->names.count * sizeof(XSlice));
+  }
+  if (s->cand_count > 0)
+  {
+    memcpy(cand + s->names.count, s->cand, s->cand_count * sizeof(XSlice));
+  }
+
+  MiUpvalScan sub;
+  s_upscan_body(&sub, s->vm, cand, n, s->cand_cmds || s->names.cmds, script, params, param_count);
+  s->ok = sub.ok;
+  for (uint32_t i = 0; i < sub.used_count; ++i)
+  {
+    s_upscan_use(s, sub.used[i]);
+  }
+  s_upscan_free(&sub);
+  free(cand);
+}
+
+static void s_upscan_expr(MiUpvalScan* s, const MiExpr* e)
+{
+  if (!e || !s->ok)
+  {
+    return;
+  }
+
+  switch (e->kind)
+  {
+    case MI_EXPR_VAR:
+      if (e->as.var.is_indirect)
+      {
+        s->ok = false;
+      }
+      else
+      {
+        s_upscan_use(s, e->as.var.name);
+      }
+      break;
+    case MI_EXPR_INDEX:
+      s_upscan_expr(s, e->as.index.target);
+      s_upscan_expr(s, e->as.index.index);
+      break;
+    case MI_EXPR_UNARY:
+      s_upscan_expr(s, e->as.unary.expr);
+      break;
+    case MI_EXPR_BINARY:
+      s_upscan_expr(s, e->as.binary.left);
+      s_upscan_expr(s, e->as.binary.right);
+      break;
+    case MI_EXPR_LIST:
+    case MI_EXPR_DICT:
+      for (const MiExprList* it = (e->kind == MI_EXPR_LIST) ? e->as.list.items : e->as.dict.items; it; it = it->next)
+      {
+        s_upscan_expr(s, it->expr);
+      }
+      break;
+    case MI_EXPR_PAIR:
+      s_upscan_expr(s, e->as.pair.key);
+      s_upscan_expr(s, e->as.pair.value);
+      break;
+    case MI_EXPR_QUAL:
+      s_upscan_expr(s, e->as.qual.target);
+      break;
+    case MI_EXPR_BLOCK:
+      s_upscan_nested(s, e->as.block.script, NULL, 0u, true);
+      break;
+    case MI_EXPR_COMMAND:
+      s_upscan_command(s, e);
+      break;
+    default:
+      break;
+  }
+}
+
+// Mirrors the special forms of s_compile_command_expr.
+static void s_upscan_command(MiUpvalScan* s, const MiExpr* e)
+{
+  const MiExpr* head = e->as.command.head;
+  const MiExprList* args = e->as.command.args;
+  unsigned int argc = e->as.command.argc;
+  const MiExpr* first = args ? args->expr : NULL;
+
+  if (s_expr_is_lit_string(head, "set") && argc == 2u && first)
+  {
+    if (first->kind == MI_EXPR_STRING_LITERAL)
+    {
+      s_upscan_use(s, first->as.string_lit.value);
+    }
+    else
+    {
+      s_upscan_expr(s, first);
+    }
+    s_upscan_expr(s, args->next->expr);
+    return;
+  }
+
+  if (s_expr_is_lit_string(head, "cmd") || s_expr_is_lit_string(head, "foreach"))
+  {
+    // The name was checked to be a literal with the body's names.
+    if (first && first->kind == MI_EXPR_STRING_LITERAL && s_upscan_is_cand(s, first->as.string_lit.value))
+    {
+      s->ok = false;
+      return;
+    }
+  }
+
+  const MiExprList* last = args;
+  while (last && last->next)
+  {
+    last = last->next;
+  }
+  if (s_expr_is_lit_string(head, "cmd") && argc >= 2u && last->expr && last->expr->kind == MI_EXPR_BLOCK)
+  {
+    XSlice params[MI_VM_ARG_STACK_COUNT];
+    uint32_t param_count = 0;
+    bool literal_params = true;
+    for (const MiExprList* cur = args->next; cur && cur->next; cur = cur->next)
+    {
+      const MiExpr* pe = cur->expr;
+      if (pe && pe->kind == MI_EXPR_LIST && cur->next->next == NULL)
+      {
+        continue;
+      }
+      if (!pe || pe->kind != MI_EXPR_STRING_LITERAL || param_count >= MI_VM_ARG_STACK_COUNT)
+      {
+        literal_params = false;
+        break;
+      }
+      params[param_count++] = pe->as.string_lit.value;
+    }
+    s_upscan_nested(s, last->expr->as.block.script, params, param_count, literal_params);
+    return;
+  }
+
+  bool inline_bodies = s_expr_is_lit_string(head, "if") ||
+    s_expr_is_lit_string(head, "while") ||
+    s_expr_is_lit_string(head, "foreach");
+
+  for (const MiExprList* it = args; it; it = it->next)
+  {
+    if (inline_bodies && it->expr && it->expr->kind == MI_EXPR_BLOCK)
+    {
+      s_upscan_script(s, it->expr->as.block.script);
+    }
+    else if (it == args->next && s_expr_is_lit_string(head, "foreach") && it->expr &&
+        it->expr->kind == MI_EXPR_STRING_LITERAL)
+    {
+      // foreach over a variable given by name.
+      s_upscan_use(s, it->expr->as.string_lit.value);
+    }
+    else if (!(it == args && s_expr_is_lit_string(head, "foreach")))
+    {
+      s_upscan_expr(s, it->expr);
+    }
+  }
+
+  bool calls_value = false;
+  if (head && head->kind == MI_EXPR_STRING_LITERAL)
+  {
+    XSlice name = head->as.string_lit.value;
+    if (inline_bodies || s_expr_is_lit_string(head, "return") ||
+        s_expr_is_lit_string(head, "break") || s_expr_is_lit_string(head, "continue"))
+    {
+      return;
+    }
+    if (s_slice_has_double_colon(name))
+    {
+      size_t len = 0;
+      while (len + 1 < name.length && !(name.ptr[len] == ':' && name.ptr[len + 1] == ':'))
+      {
+        len += 1;
+      }
+      s->ok = s->ok && !s_upscan_is_cand(s, x_slice_init(name.ptr, len));
+    }
+    else if (mi_vm_find_command(s->vm, name, NULL))
+    {
+      s->ok = s->ok && !s_upscan_is_cand(s, name);
+      calls_value = s_expr_is_lit_string(head, "call");
+    }
+    else
+    {
+      s_upscan_use(s, name);
+      calls_value = true;
+    }
+  }
+  else
+  {
+    s_upscan_expr(s, head);
+    calls_value = true;
+  }
+
+  if (calls_value && s->cand_cmds)
+  {
+    s->ok = false;
+  }
+}
+
+static void s_upscan_script(MiUpvalScan* s, const MiScript* script)
+{
+  for (const MiCommandList* it = script ? script->first : NULL; it && s->ok; it = it->next)
+  {
+    const MiCommand* cmd = it->command;
+    if (!cmd)
+    {
+      continue;
+    }
+    if (cmd->is_include_stmt && s_upscan_is_cand(s, cmd->include_alias_tok.lexeme))
+    {
+      s->ok = false;
+      return;
+    }
+
+    MiExpr fake;
+    memset(&fake, 0, sizeof(fake));
+    fake.kind = MI_EXPR_COMMAND;
+    fake.as.command.head = cmd->head;
+    fake.as.command.args = cmd->args;
+    fake.as.command.argc = (unsigned int)cmd->argc;
+    s_upscan_command(s, &fake);
+  }
+}
+
+// Scan a body whose parameters shadow the candidates of the same name.
+static void s_upscan_body(MiUpvalScan* s, MiVm* vm, const XSlice* cand, size_t cand_count, bool cand_cmds,
+    const MiScript* script, const XSlice* params, uint32_t param_count)
+{
+  memset(s, 0, sizeof(*s));
+  s->vm = vm;
+  s->cand_cmds = cand_cmds;
+  s_names_collect_script(&s->names, script);
+  for (uint32_t i = 0; i < param_count; ++i)
+  {
+    s_names_add(&s->names, params[i]);
+  }
+  s->ok = !s->names.dynamic;
+  if (!s->ok)
+  {
+    return;
+  }
+
+  s->cand = (XSlice*)s_realloc(NULL, (cand_count ? cand_count : 1u) * sizeof(XSlice));
+  for (size_t i = 0; i < cand_count; ++i)
+  {
+    bool is_param = false;
+    for (uint32_t k = 0; k < param_count && !is_param; ++k)
+    {
+      is_param = s_slice_eq(cand[i], params[k]);
+    }
+    if (!is_param)
+    {
+      s->cand[s->cand_count++] = cand[i];
+    }
+  }
+
+  s_upscan_script(s, script);
+}
+
+// Upvalues of a body nested in the one 'b' compiles: the bindings of b's
+// frames (or b's own upvalues) it references, provided it references them
+// all that way. Nothing is captured from top-level frames, which outlive
+// the blocks created in them.
+static void s_upvals_resolve(const MiVmBuild* b, const MiScript* script, const MiVmLocals* locals, MiVmUpvals* out)
+{
+  memset(out, 0, sizeof(*out));
+
+  const MiVmScopeNames* n = b->scope_names;
+  if (!n || !n->parent || n->dynamic || (locals && locals->dynamic_params))
+  {
+    return;
+  }
+
+  uint32_t outer_count = b->upvals ? b->upvals->count : 0u;
+  size_t cand_count = n->count + outer_count;
+  XSlice* cand = (XSlice*)s_realloc(NULL, (cand_count ? cand_count : 1u) * sizeof(XSlice));
+  if (n->count > 0)
+  {
+    memcpy(cand, n->names, n->count * sizeof(XSlice));
+  }
+  if (outer_count > 0)
+  {
+    memcpy(cand + n->count, b->upvals->names, outer_count * sizeof(XSlice));
+  }
+
+  bool cmds = false;
+  for (const MiVmScopeNames* it = n; it && it->parent; it = it->parent)
+  {
+    cmds = cmds || it->cmds;
+  }
+
+  MiUpvalScan s;
+  s_upscan_body(&s, b->vm, cand, cand_count, cmds, script,
+      locals ? locals->param_names : NULL, locals ? locals->param_count : 0u);
+  if (s.ok && s.used_count > 0)
+  {
+    out->names = s.used;
+    out->count = s.used_count;
+    out->outer = (int32_t*)s_realloc(NULL, s.used_count * sizeof(int32_t));
+    for (uint32_t i = 0; i < s.used_count; ++i)
+    {
+      out->outer[i] = -1;
+      for (uint32_t k = 0; k < outer_count; ++k)
+      {
+        if (s_slice_eq(b->upvals->names[k], s.used[i]))
+        {
+          out->outer[i] = (int32_t)k;
+          break;
+        }
+      }
+    }
+    s.used = NULL;
+  }
+  s_upscan_free(&s);
+  free(cand);
+}
+
+static void s_upvals_free(MiVmUpvals* upvals)
+{
+  free(upvals->names);
+  free(upvals->outer);
+  memset(upvals, 0, sizeof(*upvals));
+}
+
+// Upvalue i of a chunk is named by its symbol i.
+static void s_chunk_set_upvals(MiVmChunk* c, const MiVmUpvals* upvals)
+{
+  if (!upvals || upvals->count == 0)
+  {
+    return;
+  }
+  for (uint32_t i = 0; i < upvals->count; ++i)
+  {
+    (void)s_chunk_add_symbol(c, upvals->names[i]);
+  }
+  c->upval_outer = (int32_t*)s_realloc(NULL, upvals->count * sizeof(int32_t));
+  memcpy(c->upval_outer, upvals->outer, upvals->count * sizeof(int32_t));
+  c->upval_count = upvals->count;
+}
+
+static int32_t s_upval_index(const MiVmBuild* b, XSlice name)
+{
+  if (!b->upvals)
+  {
+    return -1;
+  }
+  for (uint32_t i = 0; i < b->upvals->count; ++i)
+  {
+    if (s_slice_eq(b->upvals->names[i], name))
+    {
+      return (int32_t)i;
+    }
+  }
+  return -1;
+}
+
+// Read or assign a variable through the nearest binding the compiler can
+// place: a frame slot, an upvalue, else a lookup by name.
+static void s_emit_load_name(MiVmBuild* b, uint8_t r, XSlice name)
+{
+  int32_t slot = s_local_slot(b, name);
+  int32_t up = (slot < 0) ? s_upval_index(b, name) : -1;
+  if (slot >= 0)
+  {
+    s_emit(b, MI_VM_OP_LOAD_LOCAL, r, 0, 0, slot);
+  }
+  else if (up >= 0)
+  {
+    s_emit(b, MI_VM_OP_LOAD_UPVAL, r, 0, 0, up);
+  }
+  else
+  {
+    s_emit(b, MI_VM_OP_LOAD_VAR, r, 0, 0, s_chunk_add_symbol(b->chunk, name));
+  }
+}
+
+static void s_emit_store_name(MiVmBuild* b, uint8_t r, XSlice name)
+{
+  int32_t slot = s_local_slot(b, name);
+  int32_t up = (slot < 0) ? s_upval_index(b, name) : -1;
+  if (slot >= 0)
+  {
+    s_emit(b, MI_VM_OP_STORE_LOCAL, r, 0, 0, slot);
+  }
+  else if (up >= 0)
+  {
+    s_emit(b, MI_VM_OP_STORE_UPVAL, r, 0, 0, up);
+  }
+  else
+  {
+    s_emit(b, MI_VM_OP_STORE_VAR, r, 0, 0, s_chunk_add_symbol(b->chunk, name));
+  }
+}
+
+//----------------------------------------------------------
+// Inlining of small functions
+//----------------------------------------------------------
+
+static int s_inline_param_index(const MiFuncSig* sig, XSlice name)
+{
+  for (int i = 0; i < sig->param_count; ++i)
+  {
+    if (s_slice_eq(sig->params[i].name, name))
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Nodes of an inlinable expression: literals, parameters and the operators
+// over them. -1 when anything else appears (calls, blocks, other names...).
+static int s_inline_expr_size(const MiExpr* e, const MiFuncSig* sig)
+{
+  if (!e)
+  {
+    return -1;
+  }
+
+  switch (e->kind)
+  {
+    case MI_EXPR_INT_LITERAL:
+    case MI_EXPR_FLOAT_LITERAL:
+    case MI_EXPR_STRING_LITERAL:
+    case MI_EXPR_BOOL_LITERAL:
+      return 1;
+    case MI_EXPR_VAR:
+      return (!e->as.var.is_indirect && s_inline_param_index(sig, e->as.var.name) >= 0) ? 1 : -1;
+    case MI_EXPR_UNARY:
+      {
+        int n = s_inline_expr_size(e->as.unary.expr, sig);
+        return n < 0 ? -1 : n + 1;
+      }
+    case MI_EXPR_BINARY:
+      {
+        int l = s_inline_expr_size(e->as.binary.left, sig);
+        int r = s_inline_expr_size(e->as.binary.right, sig);
+        return (l < 0 || r < 0) ? -1 : l + r + 1;
+      }
+    default:
+      return -1;
+  }
+}
+
+static void s_inline_bind(MiVmInlineFuncs* f, XSlice name)
+{
+  for (size_t i = 0; i < f->count; ++i)
+  {
+    if (s_slice_eq(f->funcs[i].sig->name, name))
+    {
+      f->funcs[i].binds += 1;
+    }
+  }
+}
+
+static void s_inline_scan_script(MiVmInlineFuncs* f, const MiScript* script);
+static void s_inline_scan_command(MiVmInlineFuncs* f, const MiExpr* head, const MiExprList* args, unsigned int argc);
+
+// Unlike s_names_collect_*, this walks block literals too: a function name
+// bound in any frame may shadow the function at some call site.
+static void s_inline_scan_expr(MiVmInlineFuncs* f, const MiExpr* e)
+{
+  if (!e)
+  {
+    return;
+  }
+
+  switch (e->kind)
+  {
+    case MI_EXPR_VAR:
+      s_inline_scan_expr(f, e->as.var.name_expr);
+      break;
+    case MI_EXPR_INDEX:
+      s_inline_scan_expr(f, e->as.index.target);
+      s_inline_scan_expr(f, e->as.index.index);
+      break;
+    case MI_EXPR_UNARY:
+      s_inline_scan_expr(f, e->as.unary.expr);
+      break;
+    case MI_EXPR_BINARY:
+      s_inline_scan_expr(f, e->as.binary.left);
+      s_inline_scan_expr(f, e->as.binary.right);
+      break;
+    case MI_EXPR_LIST:
+    case MI_EXPR_DICT:
+      for (const MiExprList* it = (e->kind == MI_EXPR_LIST) ? e->as.list.items : e->as.dict.items; it; it = it->next)
+      {
+        s_inline_scan_expr(f, it->expr);
+      }
+      break;
+    case MI_EXPR_PAIR:
+      s_inline_scan_expr(f, e->as.pair.key);
+      s_inline_scan_expr(f, e->as.pair.value);
+      break;
+    case MI_EXPR_BLOCK:
+      s_inline_scan_script(f, e->as.block.script);
+      break;
+    case MI_EXPR_QUAL:
+      s_inline_scan_expr(f, e->as.qual.target);
+      break;
+    case MI_EXPR_COMMAND:
+      s_inline_scan_command(f, e->as.command.head, e->as.command.args, e->as.command.argc);
+      break;
+    default:
+      break;
+  }
+}
+
+static void s_inline_scan_command(MiVmInlineFuncs* f, const MiExpr* head, const MiExprList* args, unsigned int argc)
+{
+  const MiExpr* first = args ? args->expr : NULL;
+  if (s_expr_is_lit_string(head, "set"))
+  {
+    if (argc == 2u && first && first->kind == MI_EXPR_STRING_LITERAL)
+    {
+      s_inline_bind(f, first->as.string_lit.value);
+    }
+    else if (argc == 2u && first && first->kind == MI_EXPR_VAR && !first->as.var.is_indirect)
+    {
+      s_inline_bind(f, first->as.var.name);
+    }
+    else if (argc == 2u && first && first->kind == MI_EXPR_QUAL)
+    {
+      s_inline_bind(f, first->as.qual.member);
+    }
+    else if (!(argc == 2u && first && first->kind == MI_EXPR_INDEX))
+    {
+      f->dynamic = true;
+    }
+  }
+  else if (s_expr_is_lit_string(head, "cmd") || s_expr_is_lit_string(head, "foreach"))
+  {
+    if (first && first->kind == MI_EXPR_STRING_LITERAL)
+    {
+      s_inline_bind(f, first->as.string_lit.value);
+    }
+    else if (first && first->kind == MI_EXPR_VAR && !first->as.var.is_indirect)
+    {
+      s_inline_bind(f, first->as.var.name);
+    }
+    else
+    {
+      f->dynamic = true;
+    }
+
+    // cmd parameters: everything between the name and the body.
+    if (s_expr_is_lit_string(head, "cmd"))
+    {
+      for (const MiExprList* it = args ? args->next : NULL; it && it->next; it = it->next)
+      {
+        if (it->expr && it->expr->kind == MI_EXPR_STRING_LITERAL)
+        {
+          s_inline_bind(f, it->expr->as.string_lit.value);
+        }
+      }
+    }
+  }
+
+  s_inline_scan_expr(f, head);
+  for (const MiExprList* it = args; it; it = it->next)
+  {
+    s_inline_scan_expr(f, it->expr);
+  }
+}
+
+static void s_inline_scan_script(MiVmInlineFuncs* f, const MiScript* script)
+{
+  for (const MiCommandList* it = script ? script->first : NULL; it; it = it->next)
+  {
+    const MiCommand* cmd = it->command;
+    if (!cmd)
+    {
+      continue;
+    }
+    if (cmd->is_include_stmt)
+    {
+      s_inline_bind(f, cmd->include_alias_tok.lexeme);
+    }
+    s_inline_scan_command(f, cmd->head, cmd->args, (unsigned int)cmd->argc);
+  }
+}
+
+// Find the inlinable functions of a top-level script. A function qualifies
+// when it is typed and not variadic, takes no function-typed parameters, its
+// body is `return <expr>` with at most MI_COMPILE_INLINE_MAX_NODES nodes
+// (which rules out recursion), and its declaration is the only binding of
+// its name in the whole script, so no call site can see it rebound.
+static void s_inline_collect(MiVmInlineFuncs* f, const MiScript* script)
+{
+  memset(f, 0, sizeof(*f));
+  for (const MiCommandList* it = script ? script->first : NULL; it; it = it->next)
+  {
+    const MiCommand* cmd = it->command;
+    const MiFuncSig* sig = cmd ? cmd->func_sig : NULL;
+    if (!sig || sig->is_variadic || sig->param_count >= MI_VM_REG_COUNT)
+    {
+      continue;
+    }
+
+    bool plain_params = true;
+    for (int i = 0; i < sig->param_count; ++i)
+    {
+      plain_params = plain_params && !sig->params[i].func_sig;
+    }
+
+    const MiExprList* last = cmd->args;
+    while (last && last->next)
+    {
+      last = last->next;
+    }
+    const MiExpr* body = last ? last->expr : NULL;
+    if (!plain_params || !body || body->kind != MI_EXPR_BLOCK || !body->as.block.script)
+    {
+      continue;
+    }
+
+    const MiCommandList* only = body->as.block.script->first;
+    const MiCommand* ret = only && !only->next ? only->command : NULL;
+    if (!ret || !s_expr_is_lit_string(ret->head, "return") || ret->argc != 1 || !ret->args)
+    {
+      continue;
+    }
+
+    int size = s_inline_expr_size(ret->args->expr, sig);
+    if (size < 0 || size > MI_COMPILE_INLINE_MAX_NODES)
+    {
+      continue;
+    }
+
+    f->funcs = (MiVmInlineFunc*)s_realloc(f->funcs, (f->count + 1u) * sizeof(MiVmInlineFunc));
+    f->funcs[f->count].sig = sig;
+    f->funcs[f->count].value = ret->args->expr;
+    f->funcs[f->count].size = size;
+    f->funcs[f->count].binds = 0;
+    f->count += 1u;
+  }
+
+  if (f->count > 0)
+  {
+    s_inline_scan_script(f, script);
+  }
+}
+
+// Compile a call to an inlinable function in place: the arguments are
+// evaluated in order into registers and the returned expression is compiled
+// over them. Its instructions keep the body's source positions, so runtime
+// errors point into the function. Emits nothing and returns false when the
+// call does not qualify; it then compiles as a regular call.
+static bool s_compile_inline_call(MiVmBuild* b, const MiExpr* e, uint8_t* out)
+{
+  const MiExpr* head = e->as.command.head;
+  if (!b->inline_funcs || b->inline_funcs->dynamic || !head || head->kind != MI_EXPR_STRING_LITERAL)
+  {
+    return false;
+  }
+
+  XSlice name = head->as.string_lit.value;
+  const MiVmInlineFunc* fn = NULL;
+  for (size_t i = 0; i < b->inline_funcs->count && !fn; ++i)
+  {
+    const MiVmInlineFunc* cand = &b->inline_funcs->funcs[i];
+    fn = (cand->binds == 1 && s_slice_eq(cand->sig->name, name)) ? cand : NULL;
+  }
+  if (!fn)
+  {
+    return false;
+  }
+
+  // The declaration must come first in the source, so it has run by the time
+  // the call does; registry commands win over script functions.
+  const MiFuncSig* sig = fn->sig;
+  const MiToken* decl = &sig->name_tok;
+  if (decl->line > head->token.line || (decl->line == head->token.line && decl->column >= head->token.column))
+  {
+    return false;
+  }
+  if ((int)e->as.command.argc != sig->param_count || b->next_reg + sig->param_count + fn->size >= MI_VM_REG_COUNT)
   {
-    mi_error("mi_vm: ran out of registers\n");
-    return 0;
+    return false;
   }
-  return b->next_reg++;
-}
 
-static MiVmOp s_map_unary(MiTokenKind op)
-{
-  switch (op)
+  MiRtValue cmd_v = mi_rt_make_void();
+  if (mi_vm_find_command(b->vm, name, &cmd_v))
   {
-    case MI_TOK_MINUS: return MI_VM_OP_NEG;
-    case MI_TOK_NOT:   return MI_VM_OP_NOT;
-    default:           return MI_VM_OP_NOOP;
+    mi_rt_value_release(b->vm->rt, cmd_v);
+    return false;
   }
-}
 
-static MiVmOp s_map_binary(MiTokenKind op)
-{
-  switch (op)
+  // The call's signature check goes away with it: the typechecker has
+  // matched the argument types against the declared ones. Typed opcodes in
+  // the body are only kept when the variable types prove them as well.
+  uint8_t regs[MI_VM_REG_COUNT];
+  bool proven = true;
+  int i = 0;
+  for (const MiExprList* it = e->as.command.args; it; it = it->next, ++i)
   {
-    case MI_TOK_PLUS:  return MI_VM_OP_ADD;
-    case MI_TOK_MINUS: return MI_VM_OP_SUB;
-    case MI_TOK_STAR:  return MI_VM_OP_MUL;
-    case MI_TOK_SLASH: return MI_VM_OP_DIV;
-    case MI_TOK_EQEQ:  return MI_VM_OP_EQ;
-    case MI_TOK_BANGEQ:return MI_VM_OP_NEQ;
-    case MI_TOK_LT:    return MI_VM_OP_LT;
-    case MI_TOK_LTEQ:  return MI_VM_OP_LTEQ;
-    case MI_TOK_GT:    return MI_VM_OP_GT;
-    case MI_TOK_GTEQ:  return MI_VM_OP_GTEQ;
-    case MI_TOK_AND:   return MI_VM_OP_AND;
-    case MI_TOK_OR:    return MI_VM_OP_OR;
-    default:           return MI_VM_OP_NOOP;
+    MiTypeKind expected = sig->params[i].type;
+    proven = proven && (expected == MI_TYPE_ANY || mi_typecheck_expr_type(b->var_types, it->expr) == expected);
+    regs[i] = s_compile_expr(b, it->expr);
   }
+
+  const MiFuncSig* saved_sig = b->inline_sig;
+  const uint8_t* saved_regs = b->inline_regs;
+  const MiTypecheckVarTypes* saved_types = b->var_types;
+  b->inline_sig = sig;
+  b->inline_regs = regs;
+  b->var_types = proven ? saved_types : NULL;
+  *out = s_compile_expr(b, fn->value);
+  b->inline_sig = saved_sig;
+  b->inline_regs = saved_regs;
+  b->var_types = saved_types;
+  s_set_dbg(b, &head->token);
+  return true;
 }
 
-static void s_chunk_patch_imm(MiVmChunk* c, size_t ins_index, int32_t imm)
+// Scope frame given to an inlined if/while/foreach body. A body that binds
+// no name outside of slot locals runs in the enclosing frame. A loop whose
+// body does bind names gets one frame for the whole loop, emptied at the top
+// of each iteration, instead of a frame pushed and popped per iteration.
+typedef enum MiVmBodyScope
 {
-  if (!c || ins_index >= c->code_count)
+  MI_VM_BODY_SCOPE_NONE,   // no frame of its own
+  MI_VM_BODY_SCOPE_LOOP,   // one frame around the loop; only the loop variable lives there
+  MI_VM_BODY_SCOPE_RESET,  // one frame around the loop, SCOPE_RESET each iteration
+  MI_VM_BODY_SCOPE_ITER,   // SCOPE_PUSH / SCOPE_POP around each run of the body
+} MiVmBodyScope;
+
+// Whether running 'script' and 'e' inline may bind a name in the current frame.
+static bool s_inline_binds(const MiVmBuild* b, const MiScript* script, const MiExpr* e)
+{
+  MiVmScopeNames n;
+  memset(&n, 0, sizeof(n));
+  if (script)
   {
-    return;
+    s_names_collect_script(&n, script);
+  }
+  if (e)
+  {
+    s_names_collect_expr(&n, e);
   }
-  c->code[ins_index].imm = imm;
 
-  // Suppress JMP/JT/JF 0: fallthrough is implicit. 
-  if (imm == 0)
+  bool binds = n.dynamic;
+  for (size_t i = 0; i < n.count && !binds; ++i)
   {
-    MiVmOp op = (MiVmOp)c->code[ins_index].op;
-    if (op == MI_VM_OP_JUMP || op == MI_VM_OP_JUMP_IF_TRUE || op == MI_VM_OP_JUMP_IF_FALSE)
-    {
-      c->code[ins_index].op = (uint8_t)MI_VM_OP_NOOP;
-      c->code[ins_index].a = 0;
-      c->code[ins_index].b = 0;
-      c->code[ins_index].c = 0;
-      c->code[ins_index].imm = 0;
-    }
+    binds = s_local_slot(b, n.names[i]) < 0;
   }
+  free(n.names);
+  return binds;
 }
 
-static bool s_expr_is_lit_string(const MiExpr* e, const char* cstr)
+// 'cond' is evaluated before each iteration (while); 'var_in_scope' is set
+// when the loop variable is bound by name rather than in a slot.
+static MiVmBodyScope s_loop_body_scope(const MiVmBuild* b, const MiScript* body, const MiExpr* cond, bool var_in_scope)
 {
-  if (!e || e->kind != MI_EXPR_STRING_LITERAL)
+  if (s_inline_binds(b, body, NULL))
   {
-    return false;
+    // The condition has to run outside of the body's bindings.
+    return (cond && s_inline_binds(b, NULL, cond)) ? MI_VM_BODY_SCOPE_ITER : MI_VM_BODY_SCOPE_RESET;
   }
-
-  return s_slice_eq(e->as.string_lit.value, x_slice_from_cstr(cstr));
+  return var_in_scope ? MI_VM_BODY_SCOPE_LOOP : MI_VM_BODY_SCOPE_NONE;
 }
 
 static void s_emit_scope_pops(MiVmBuild* b, int count)
@@ -569,10 +2358,228 @@ static void s_compile_script_inline_to_reg(MiVmBuild* b, const MiScript* script,
   }
 }
 
+//----------------------------------------------------------
+// Lazy compilation
+//----------------------------------------------------------
+
+static void s_lazy_unit_release(MiVmLazyUnit* u)
+{
+  if (!u || --u->refs > 0)
+  {
+    return;
+  }
+
+  for (size_t i = 0; i < u->name_count; ++i)
+  {
+    free(u->names[i]->names);
+    free(u->names[i]);
+  }
+  free(u->names);
+  free(u->inline_funcs.funcs);
+  mi_typecheck_var_types_free(&u->var_types);
+  if (u->arena)
+  {
+    x_arena_destroy(u->arena);
+  }
+  free(u->source);
+  free(u);
+}
+
+// Scope names of a chunk compiled in 'u'. They stay alive with the unit, as
+// the bodies nested in the chunk may be compiled after it.
+static MiVmScopeNames* s_lazy_unit_names(MiVmLazyUnit* u)
+{
+  MiVmScopeNames* n = (MiVmScopeNames*)calloc(1u, sizeof(*n));
+  if (!n)
+  {
+    mi_error("mi_compile: out of memory\n");
+    exit(1);
+  }
+  u->names = (MiVmScopeNames**)s_realloc(u->names, (u->name_count + 1u) * sizeof(*u->names));
+  u->names[u->name_count++] = n;
+  return n;
+}
+
+// Chunk for a nested body that is compiled on its first call. Takes over
+// 'locals' (may be NULL) and 'upvals'; the stub already carries the upvalue
+// table, which blocks of it are created from.
+static MiVmChunk* s_lazy_chunk(MiVmBuild* b, const MiScript* script, MiVmLocals* locals, MiVmUpvals* upvals)
+{
+  MiVmLazy* z = (MiVmLazy*)calloc(1u, sizeof(*z));
+  if (!z)
+  {
+    mi_error("mi_compile: out of memory\n");
+    exit(1);
+  }
+  z->unit = b->unit;
+  z->unit->refs += 1;
+  z->script = script;
+  z->var_types = b->var_types;
+  z->outer = b->scope_names;
+  z->inline_funcs = b->inline_funcs;
+  if (locals)
+  {
+    z->locals = *locals;
+    z->has_locals = true;
+    memset(locals, 0, sizeof(*locals));
+  }
+  z->upvals = *upvals;
+  memset(upvals, 0, sizeof(*upvals));
+
+  MiVmChunk* c = s_chunk_create();
+  c->dbg_name = s_slice_dup_heap(x_slice_from_cstr("<block>"));
+  c->dbg_file = s_slice_dup_heap(b->chunk ? b->chunk->dbg_file : x_slice_empty());
+  c->lazy = z;
+  s_chunk_set_upvals(c, &z->upvals);
+  return c;
+}
+
+void mi_compile_lazy_free(MiVmLazy* lazy)
+{
+  if (!lazy)
+  {
+    return;
+  }
+  s_locals_free(&lazy->locals);
+  s_upvals_free(&lazy->upvals);
+  s_lazy_unit_release(lazy->unit);
+  free(lazy);
+}
+
+bool mi_compile_force(MiVmChunk* chunk)
+{
+  if (!chunk || !chunk->lazy)
+  {
+    return true;
+  }
+
+  MiVmLazy* z = chunk->lazy;
+  chunk->lazy = NULL;
+  MiVmNestCtx nest = { z->var_types, z->outer, z->has_locals ? &z->locals : NULL, z->inline_funcs, &z->upvals };
+  MiVmChunk* body = s_vm_compile_script_ast(z->unit->vm, z->script, z->unit, chunk->dbg_name, chunk->dbg_file, true, &nest);
+  mi_compile_lazy_free(z);
+  if (!body)
+  {
+    mi_error_fmt("mi_compile: failed to compile a block of %.*s\n", (int)chunk->dbg_file.length, chunk->dbg_file.ptr);
+    return false;
+  }
+
+  // Blocks and commands already point at the stub: move the body into it.
+  free((void*)chunk->dbg_name.ptr);
+  free((void*)chunk->dbg_file.ptr);
+  for (size_t i = 0; i < chunk->symbol_count; ++i)
+  {
+    free((void*)chunk->symbols[i].ptr);
+  }
+  free(chunk->symbols);
+  free(chunk->symbol_ids);
+  free(chunk->upval_outer);
+  *chunk = *body;
+  free(body);
+  return true;
+}
+
+bool mi_compile_force_all(MiVmChunk* chunk)
+{
+  if (!mi_compile_force(chunk))
+  {
+    return false;
+  }
+  for (size_t i = 0; i < chunk->subchunk_count; ++i)
+  {
+    if (!mi_compile_force_all(chunk->subchunks[i]))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Compile a nested body to a subchunk (left for its first call when the
+// script compiles lazily) and load it as a block. Takes over 'locals' (may be
+// NULL).
+static uint8_t s_compile_block(MiVmBuild* b, const MiScript* script, MiVmLocals* locals)
+{
+  MiVmUpvals upvals;
+  s_upvals_resolve(b, script, locals, &upvals);
+
+  uint8_t r = s_alloc_reg(b);
+  MiVmChunk* sub = NULL;
+  if (b->unit)
+  {
+    sub = s_lazy_chunk(b, script, locals, &upvals);
+  }
+  else
+  {
+    MiVmNestCtx nest = { b->var_types, b->scope_names, locals, b->inline_funcs, &upvals };
+    sub = s_vm_compile_script_ast(b->vm,
+        script,
+        NULL,
+        x_slice_from_cstr("<block>"),
+        b->chunk ? b->chunk->dbg_file : x_slice_empty(),
+        true,
+        &nest);
+  }
+  if (locals)
+  {
+    s_locals_free(locals);
+  }
+  s_upvals_free(&upvals);
+
+  if (!sub)
+  {
+    int32_t k = s_chunk_add_const(b->chunk, mi_rt_make_void());
+    s_emit(b, MI_VM_OP_LOAD_CONST, r, 0, 0, k);
+    return r;
+  }
+
+  int32_t id = s_chunk_add_subchunk(b->chunk, sub);
+  s_emit(b, MI_VM_OP_LOAD_BLOCK, r, 0, 0, id);
+  return r;
+}
+
+// Compile the body block of `cmd name p1..pN [sig] { ... }` with its locals
+// resolved to frame slots. Parameter names must be literals for that.
+static uint8_t s_compile_cmd_body(MiVmBuild* b, const MiExprList* params_it, const MiExpr* body_expr)
+{
+  XSlice params[MI_VM_ARG_STACK_COUNT];
+  uint32_t param_count = 0;
+  bool literal_params = true;
+  for (const MiExprList* cur = params_it; cur && cur->next; cur = cur->next)
+  {
+    const MiExpr* pe = cur->expr;
+    bool is_sig = pe && pe->kind == MI_EXPR_LIST && cur->next->next == NULL;
+    if (is_sig)
+    {
+      continue;
+    }
+    if (!pe || pe->kind != MI_EXPR_STRING_LITERAL || param_count >= MI_VM_ARG_STACK_COUNT)
+    {
+      literal_params = false;
+      break;
+    }
+    params[param_count++] = pe->as.string_lit.value;
+  }
+
+  MiVmLocals locals;
+  if (literal_params)
+  {
+    s_locals_resolve(b, params, param_count, body_expr->as.block.script, &locals);
+  }
+  else
+  {
+    memset(&locals, 0, sizeof(locals));
+    locals.dynamic_params = true;
+  }
+  return s_compile_block(b, body_expr->as.block.script, &locals);
+}
+
 static uint8_t s_compile_command_expr(MiVmBuild* b, const MiExpr* e, bool wants_result)
 {
   uint8_t dst = s_alloc_reg(b);
   uint8_t argc = 0;
+  bool tail_call = b->tail_call;
+  b->tail_call = false;
 
   const MiExpr* head_dbg = (e && e->kind == MI_EXPR_COMMAND) ? e->as.command.head : NULL;
   s_set_dbg(b, head_dbg ? &head_dbg->token : NULL);
@@ -602,8 +2609,7 @@ static uint8_t s_compile_command_expr(MiVmBuild* b, const MiExpr* e, bool wants_
     if (lvalue->kind == MI_EXPR_STRING_LITERAL)
     {
       uint8_t rhs_reg = s_compile_expr(b, rhs);
-      int32_t sym = s_chunk_add_symbol(b->chunk, lvalue->as.string_lit.value);
-      s_emit(b, MI_VM_OP_STORE_VAR, rhs_reg, 0, 0, sym);
+      s_emit_store_name(b, rhs_reg, lvalue->as.string_lit.value);
       if (wants_result)
       {
         s_emit(b, MI_VM_OP_MOV, dst, rhs_reg, 0, 0);
@@ -615,8 +2621,7 @@ static uint8_t s_compile_command_expr(MiVmBuild* b, const MiExpr* e, bool wants_
     if (lvalue->kind == MI_EXPR_VAR && !lvalue->as.var.is_indirect)
     {
       uint8_t rhs_reg = s_compile_expr(b, rhs);
-      int32_t sym = s_chunk_add_symbol(b->chunk, lvalue->as.var.name);
-      s_emit(b, MI_VM_OP_STORE_VAR, rhs_reg, 0, 0, sym);
+      s_emit_store_name(b, rhs_reg, lvalue->as.var.name);
       if (wants_result)
       {
         s_emit(b, MI_VM_OP_MOV, dst, rhs_reg, 0, 0);
@@ -761,7 +2766,7 @@ static uint8_t s_compile_command_expr(MiVmBuild* b, const MiExpr* e, bool wants_
       cur = cur->next;
     }
 
-    uint8_t body_reg = s_compile_expr(b, body_expr);
+    uint8_t body_reg = s_compile_cmd_body(b, params_it, body_expr);
     s_emit(b, MI_VM_OP_ARG_PUSH, body_reg, 0, 0, 0);
     argc += 1;
 
@@ -841,7 +2846,7 @@ cmd_special_form_done:
     int idx = b->loop_depth - 1;
 
     {
-      int pops = b->inline_scope_depth - b->loops[idx].scope_base_depth;
+      int pops = b->inline_scope_depth - b->loops[idx].continue_depth;
       if (pops > 0)
       {
         s_emit_scope_pops(b, pops);
@@ -850,6 +2855,15 @@ cmd_special_form_done:
 
     size_t jmp_index = b->chunk->code_count;
     s_emit(b, MI_VM_OP_JUMP, 0, 0, 0, 0);
+    if (b->loops[idx].step_after_body)
+    {
+      // Patched once the loop's step is emitted.
+      if (b->loops[idx].continue_jump_count < (sizeof(b->loops[idx].continue_jumps) / sizeof(b->loops[idx].continue_jumps[0])))
+      {
+        b->loops[idx].continue_jumps[b->loops[idx].continue_jump_count++] = jmp_index;
+      }
+    }
+    else
     {
       int32_t rel = (int32_t)((int64_t)b->loops[idx].loop_start_ip - (int64_t)(jmp_index + 1u));
       s_chunk_patch_imm(b->chunk, jmp_index, rel);
@@ -861,6 +2875,7 @@ cmd_special_form_done:
   // Returns from the current chunk early. This is mainly useful inside
   // blocks called via CALL_BLOCK, but also works at top level.
   // Any compiler-emitted inlined scopes are cleaned up first.
+  // A call as the returned value compiles to TAIL_CALL.
   if (s_expr_is_lit_string(e->as.command.head, "return"))
   {
     const MiExprList* it = e->as.command.args;
@@ -869,7 +2884,9 @@ cmd_special_form_done:
 
     if (value)
     {
+      b->tail_call = (value->kind == MI_EXPR_COMMAND);
       r = s_compile_expr(b, value);
+      b->tail_call = false;
     }
     else
     {
@@ -925,8 +2942,12 @@ cmd_special_form_done:
 
       if (then_block->kind == MI_EXPR_BLOCK && then_block->as.block.script)
       {
-        s_emit(b, MI_VM_OP_SCOPE_PUSH, 0, 0, 0, 0);
-        b->inline_scope_depth += 1;
+        bool scoped = s_inline_binds(b, then_block->as.block.script, NULL);
+        if (scoped)
+        {
+          s_emit(b, MI_VM_OP_SCOPE_PUSH, 0, 0, 0, 0);
+          b->inline_scope_depth += 1;
+        }
         if (wants_result)
         {
           s_compile_script_inline_to_reg(b, then_block->as.block.script, dst);
@@ -935,8 +2956,11 @@ cmd_special_form_done:
         {
           s_compile_script_inline(b, then_block->as.block.script);
         }
-        s_emit(b, MI_VM_OP_SCOPE_POP, 0, 0, 0, 0);
-        b->inline_scope_depth -= 1;
+        if (scoped)
+        {
+          s_emit(b, MI_VM_OP_SCOPE_POP, 0, 0, 0, 0);
+          b->inline_scope_depth -= 1;
+        }
       }
       else
       {
@@ -992,8 +3016,12 @@ cmd_special_form_done:
 
         if (else_block->kind == MI_EXPR_BLOCK && else_block->as.block.script)
         {
-          s_emit(b, MI_VM_OP_SCOPE_PUSH, 0, 0, 0, 0);
-          b->inline_scope_depth += 1;
+          bool scoped = s_inline_binds(b, else_block->as.block.script, NULL);
+          if (scoped)
+          {
+            s_emit(b, MI_VM_OP_SCOPE_PUSH, 0, 0, 0, 0);
+            b->inline_scope_depth += 1;
+          }
           if (wants_result)
           {
             s_compile_script_inline_to_reg(b, else_block->as.block.script, dst);
@@ -1002,8 +3030,11 @@ cmd_special_form_done:
           {
             s_compile_script_inline(b, else_block->as.block.script);
           }
-          s_emit(b, MI_VM_OP_SCOPE_POP, 0, 0, 0, 0);
-          b->inline_scope_depth -= 1;
+          if (scoped)
+          {
+            s_emit(b, MI_VM_OP_SCOPE_POP, 0, 0, 0, 0);
+            b->inline_scope_depth -= 1;
+          }
         }
         else
         {
@@ -1013,113 +3044,373 @@ cmd_special_form_done:
         break;
       }
 
-      // Unexpected trailing tokens, ignore. 
-      mi_error("if: unexpected tokens after then block\n");
-      break;
+      // Unexpected trailing tokens, ignore. 
+      mi_error("if: unexpected tokens after then block\n");
+      break;
+    }
+
+    // Patch all end jumps to jump here (end label). 
+    for (size_t i = 0; i < end_jump_count; ++i)
+    {
+      size_t jmp_index = end_jumps[i];
+      int32_t rel = (int32_t)((int64_t)b->chunk->code_count - (int64_t)(jmp_index + 1u));
+      s_chunk_patch_imm(b->chunk, jmp_index, rel);
+    }
+
+    return dst;
+  }
+
+  // Special form: while
+  // Grammar (command args):
+  // while <cond> <body_block>
+  // Compiles to:
+  // loop_start:
+  // <cond>
+  // JF cond, loop_end
+  // CALL_BLOCK body
+  // JMP loop_start
+  // loop_end:
+
+  if (s_expr_is_lit_string(e->as.command.head, "while"))
+  {
+    const MiExprList* it = e->as.command.args;
+    const MiExpr* cond = it ? it->expr : NULL;
+    it = it ? it->next : NULL;
+    const MiExpr* body_block = it ? it->expr : NULL;
+
+    if (!cond || !body_block)
+    {
+      mi_error("while: expected cond and body block\n");
+      int32_t k = s_chunk_add_const(b->chunk, mi_rt_make_void());
+      s_emit(b, MI_VM_OP_LOAD_CONST, dst, 0, 0, k);
+      return dst;
+    }
+
+    if (body_block->kind != MI_EXPR_BLOCK || !body_block->as.block.script)
+    {
+      mi_error("while: body must be a literal block\n");
+      int32_t k = s_chunk_add_const(b->chunk, mi_rt_make_void());
+      s_emit(b, MI_VM_OP_LOAD_CONST, dst, 0, 0, k);
+      return dst;
+    }
+
+    // A loop statement has no result, so its destination register is free.
+    if (!wants_result && dst + 1 == b->next_reg)
+    {
+      b->next_reg = dst;
+    }
+    uint8_t loop_regs = b->next_reg;
+    uint8_t saved_reg_high = b->reg_high;
+    b->reg_high = loop_regs;
+
+    // Inline the block body so break/continue can be compiled to jumps.
+    // We still preserve block semantics: variables created inside the body
+    // do not leak and are gone by the next iteration.
+    int loop_scope_base = b->inline_scope_depth;
+    MiVmBodyScope body_scope = s_loop_body_scope(b, body_block->as.block.script, cond, false);
+    if (body_scope == MI_VM_BODY_SCOPE_RESET)
+    {
+      s_emit(b, MI_VM_OP_SCOPE_PUSH, 0, 0, 0, 0);
+      b->inline_scope_depth += 1;
+    }
+
+    size_t loop_start = b->chunk->code_count;
+    if (body_scope == MI_VM_BODY_SCOPE_RESET)
+    {
+      s_emit(b, MI_VM_OP_SCOPE_RESET, 0, 0, 0, 0);
+    }
+
+    uint8_t cond_reg = s_compile_expr(b, cond);
+    b->next_reg = loop_regs;
+
+    // JF cond, <to loop exit>
+    size_t jf_index = b->chunk->code_count;
+    s_emit(b, MI_VM_OP_JUMP_IF_FALSE, cond_reg, 0, 0, 0);
+
+    if (body_scope == MI_VM_BODY_SCOPE_ITER)
+    {
+      s_emit(b, MI_VM_OP_SCOPE_PUSH, 0, 0, 0, 0);
+      b->inline_scope_depth += 1;
+    }
+
+    int loop_idx = -1;
+    if (b->loop_depth < (int)(sizeof(b->loops) / sizeof(b->loops[0])))
+    {
+      loop_idx = b->loop_depth;
+      b->loop_depth += 1;
+      b->loops[loop_idx].loop_start_ip = loop_start;
+      b->loops[loop_idx].break_jump_count = 0;
+      b->loops[loop_idx].scope_base_depth = loop_scope_base;
+      b->loops[loop_idx].continue_depth = (body_scope == MI_VM_BODY_SCOPE_RESET) ? loop_scope_base + 1 : loop_scope_base;
+      b->loops[loop_idx].step_after_body = false;
+    }
+    else
+    {
+      mi_error("while: loop nesting too deep\n");
+    }
+
+    uint8_t saved_reg_base = b->reg_base;
+    b->reg_base = b->next_reg;
+
+    s_compile_script_inline(b, body_block->as.block.script);
+
+    b->reg_base = saved_reg_base;
+
+    if (body_scope == MI_VM_BODY_SCOPE_ITER)
+    {
+      s_emit(b, MI_VM_OP_SCOPE_POP, 0, 0, 0, 0);
+      b->inline_scope_depth -= 1;
     }
 
-    // Patch all end jumps to jump here (end label). 
-    for (size_t i = 0; i < end_jump_count; ++i)
+    // JMP back to loop_start
+    size_t jmp_index = b->chunk->code_count;
+    s_emit(b, MI_VM_OP_JUMP, 0, 0, 0, 0);
     {
-      size_t jmp_index = end_jumps[i];
-      int32_t rel = (int32_t)((int64_t)b->chunk->code_count - (int64_t)(jmp_index + 1u));
-      s_chunk_patch_imm(b->chunk, jmp_index, rel);
+      int32_t rel_back = (int32_t)((int64_t)loop_start - (int64_t)(jmp_index + 1u));
+      s_chunk_patch_imm(b->chunk, jmp_index, rel_back);
+    }
+
+    // Patch JF to jump to the loop exit
+    {
+      int32_t rel_exit = (int32_t)((int64_t)b->chunk->code_count - (int64_t)(jf_index + 1u));
+      s_chunk_patch_imm(b->chunk, jf_index, rel_exit);
+    }
+    if (body_scope == MI_VM_BODY_SCOPE_RESET)
+    {
+      s_emit(b, MI_VM_OP_SCOPE_POP, 0, 0, 0, 0);
+      b->inline_scope_depth -= 1;
+    }
+
+    // loop_end label is here; break leaves the loop scope before jumping
+    size_t loop_end = b->chunk->code_count;
+    s_emit_clear_loop_regs(b, loop_regs);
+    b->reg_high = (saved_reg_high > b->reg_high) ? saved_reg_high : b->reg_high;
+
+    // Patch break jumps to loop_end 
+    if (loop_idx >= 0)
+    {
+      for (size_t bi = 0; bi < b->loops[loop_idx].break_jump_count; ++bi)
+      {
+        size_t bj = b->loops[loop_idx].break_jumps[bi];
+        int32_t rel = (int32_t)((int64_t)loop_end - (int64_t)(bj + 1u));
+        s_chunk_patch_imm(b->chunk, bj, rel);
+      }
+      b->loop_depth -= 1;
     }
 
     return dst;
   }
 
-  // Special form: while
-  // Grammar (command args):
-  // while <cond> <body_block>
-  // Compiles to:
-  // loop_start:
-  // <cond>
-  // JF cond, loop_end
-  // CALL_BLOCK body
-  // JMP loop_start
-  // loop_end:
+  /* Special form: foreach over an int range
+     Grammar (command args):
+    foreach : <varname> <from> <to> [<step>] <body_block>
 
-  if (s_expr_is_lit_string(e->as.command.head, "while"))
+    Notes:
+    - Counts from <from> up to <to> (exclusive), or down when <step> is
+      negative. The bounds and step are evaluated once and must be ints;
+      <step> defaults to 1.
+    - The counter lives in a register the body cannot see: assigning to
+      <varname> inside the body does not change the iteration.
+    - Scopes are handled as for list foreach.
+
+    Compiles to:
+    r, r+1, r+2 = <from>, <to>, <step>
+    FOR_PREP r, end
+    [SCOPE_PUSH]           (unless the body binds nothing by name)
+    body:
+    [SCOPE_RESET]          (when the body itself binds names)
+    <varname> = r
+    <body>
+    step:
+    FOR_LOOP r, body
+    [SCOPE_POP]
+    end:
+*/
+  if (s_expr_is_lit_string(e->as.command.head, "foreach") &&
+      (e->as.command.argc == 4u || e->as.command.argc == 5u))
   {
     const MiExprList* it = e->as.command.args;
-    const MiExpr* cond = it ? it->expr : NULL;
-    it = it ? it->next : NULL;
-    const MiExpr* body_block = it ? it->expr : NULL;
+    const MiExpr* varname_expr = it->expr;
+    const MiExpr* bounds[3] = { NULL, NULL, NULL };
+    it = it->next;
+    for (uint32_t k = 0; k + 2u < e->as.command.argc; ++k, it = it->next)
+    {
+      bounds[k] = it->expr;
+    }
+    const MiExpr* body_block = it->expr;
 
-    if (!cond || !body_block)
+    if (!varname_expr || varname_expr->kind != MI_EXPR_STRING_LITERAL)
     {
-      mi_error("while: expected cond and body block\n");
-      int32_t k = s_chunk_add_const(b->chunk, mi_rt_make_void());
-      s_emit(b, MI_VM_OP_LOAD_CONST, dst, 0, 0, k);
+      mi_error("foreach: varname must be a literal identifier\n");
+      if (wants_result)
+      {
+        int32_t k = s_chunk_add_const(b->chunk, mi_rt_make_void());
+        s_emit(b, MI_VM_OP_LOAD_CONST, dst, 0, 0, k);
+      }
       return dst;
     }
 
-    if (body_block->kind != MI_EXPR_BLOCK || !body_block->as.block.script)
+    if (!body_block || body_block->kind != MI_EXPR_BLOCK || !body_block->as.block.script)
     {
-      mi_error("while: body must be a literal block\n");
-      int32_t k = s_chunk_add_const(b->chunk, mi_rt_make_void());
-      s_emit(b, MI_VM_OP_LOAD_CONST, dst, 0, 0, k);
+      mi_error("foreach: body must be a literal block\n");
+      if (wants_result)
+      {
+        int32_t k = s_chunk_add_const(b->chunk, mi_rt_make_void());
+        s_emit(b, MI_VM_OP_LOAD_CONST, dst, 0, 0, k);
+      }
       return dst;
     }
 
-    size_t loop_start = b->chunk->code_count;
+    // Result of foreach is void when used as an expression. 
+    if (wants_result)
+    {
+      s_emit(b, MI_VM_OP_LOAD_CONST, dst, 0, 0, s_chunk_add_const(b->chunk, mi_rt_make_void()));
+    }
 
-    uint8_t cond_reg = s_compile_expr(b, cond);
+    int32_t foreach_slot = s_local_slot(b, varname_expr->as.string_lit.value);
+    int32_t foreach_sym = (foreach_slot >= 0) ? -1 : s_chunk_add_symbol(b->chunk, varname_expr->as.string_lit.value);
 
-    // JF cond, <to loop end> 
-    size_t jf_index = b->chunk->code_count;
-    s_emit(b, MI_VM_OP_JUMP_IF_FALSE, cond_reg, 0, 0, 0);
+    // A loop statement has no result, so its destination register is free.
+    if (!wants_result && dst + 1 == b->next_reg)
+    {
+      b->next_reg = dst;
+    }
+    uint8_t loop_regs = b->next_reg;
+    uint8_t saved_reg_high = b->reg_high;
+    b->reg_high = loop_regs;
+
+    // Counter, limit and step, in that order (FOR_PREP / FOR_LOOP operands).
+    uint8_t range_reg = loop_regs;
+    for (uint8_t k = 0; k < 3; ++k)
+    {
+      uint8_t want = (uint8_t)(range_reg + k);
+      b->next_reg = want;
+      uint8_t r = 0;
+      if (bounds[k])
+      {
+        r = s_compile_expr(b, bounds[k]);
+      }
+      else
+      {
+        r = s_alloc_reg(b);
+        s_emit(b, MI_VM_OP_LOAD_CONST, r, 0, 0, s_chunk_add_const(b->chunk, mi_rt_make_int(1)));
+      }
+      if (r != want)
+      {
+        s_emit(b, MI_VM_OP_MOV, want, r, 0, 0);
+      }
+    }
+    b->next_reg = (uint8_t)(range_reg + 3u);
+    if (b->next_reg > b->reg_high)
+    {
+      b->reg_high = b->next_reg;
+    }
+
+    size_t prep_index = b->chunk->code_count;
+    s_emit(b, MI_VM_OP_FOR_PREP, range_reg, 0, 0, 0);
+
+    // Under register pressure the range lives in frame slots between
+    // iterations, so the body gets every register back.
+    bool spill_state = loop_regs + 3u > MI_COMPILE_SPILL_AT;
+    int32_t range_slot = -1;
+    if (spill_state)
+    {
+      range_slot = s_spill_slot(b);
+      (void)s_spill_slot(b);
+      (void)s_spill_slot(b);
+      s_emit(b, MI_VM_OP_STORE_LOCAL, (uint8_t)(range_reg + 1u), 0, 0, range_slot + 1);
+      s_emit(b, MI_VM_OP_STORE_LOCAL, (uint8_t)(range_reg + 2u), 0, 0, range_slot + 2);
+    }
 
-    // Inline the block body so break/continue can be compiled to jumps.
-    // We still preserve block semantics by creating a fresh scope per
-    // iteration (variables created inside the body do not leak). 
     int loop_scope_base = b->inline_scope_depth;
-    s_emit(b, MI_VM_OP_SCOPE_PUSH, 0, 0, 0, 0);
-    b->inline_scope_depth += 1;
+    MiVmBodyScope body_scope = s_loop_body_scope(b, body_block->as.block.script, NULL, foreach_slot < 0);
+    if (body_scope != MI_VM_BODY_SCOPE_NONE)
+    {
+      s_emit(b, MI_VM_OP_SCOPE_PUSH, 0, 0, 0, 0);
+      b->inline_scope_depth += 1;
+    }
+
+    size_t body_label = b->chunk->code_count;
+    if (spill_state)
+    {
+      s_emit(b, MI_VM_OP_STORE_LOCAL, range_reg, 0, 0, range_slot);
+    }
+    if (body_scope == MI_VM_BODY_SCOPE_RESET)
+    {
+      s_emit(b, MI_VM_OP_SCOPE_RESET, 0, 0, 0, 0);
+    }
 
     int loop_idx = -1;
     if (b->loop_depth < (int)(sizeof(b->loops) / sizeof(b->loops[0])))
     {
       loop_idx = b->loop_depth;
       b->loop_depth += 1;
-      b->loops[loop_idx].loop_start_ip = loop_start;
+      b->loops[loop_idx].loop_start_ip = body_label;
       b->loops[loop_idx].break_jump_count = 0;
       b->loops[loop_idx].scope_base_depth = loop_scope_base;
+      b->loops[loop_idx].continue_depth = b->inline_scope_depth;
+      b->loops[loop_idx].step_after_body = true;
+      b->loops[loop_idx].continue_jump_count = 0;
     }
     else
     {
-      mi_error("while: loop nesting too deep\n");
+      mi_error("foreach: loop nesting too deep\n");
+    }
+
+    // foreach var = counter (local bind) 
+    if (foreach_slot >= 0)
+    {
+      s_emit(b, MI_VM_OP_STORE_LOCAL, range_reg, 0, 0, foreach_slot);
+    }
+    else
+    {
+      s_emit(b, MI_VM_OP_DEFINE_VAR, range_reg, 0, 0, foreach_sym);
     }
 
     uint8_t saved_reg_base = b->reg_base;
-    b->reg_base = b->next_reg;
+    b->reg_base = spill_state ? loop_regs : b->next_reg;
 
     s_compile_script_inline(b, body_block->as.block.script);
 
     b->reg_base = saved_reg_base;
 
-    s_emit(b, MI_VM_OP_SCOPE_POP, 0, 0, 0, 0);
-    b->inline_scope_depth -= 1;
-
-    // JMP back to loop_start 
-    size_t jmp_index = b->chunk->code_count;
-    s_emit(b, MI_VM_OP_JUMP, 0, 0, 0, 0);
+    size_t step_label = b->chunk->code_count;
+    if (spill_state)
     {
-      int32_t rel_back = (int32_t)((int64_t)loop_start - (int64_t)(jmp_index + 1u));
-      s_chunk_patch_imm(b->chunk, jmp_index, rel_back);
+      for (int32_t k = 0; k < 3; ++k)
+      {
+        s_emit(b, MI_VM_OP_LOAD_LOCAL, (uint8_t)(range_reg + k), 0, 0, range_slot + k);
+      }
+    }
+    {
+      size_t loop_index = b->chunk->code_count;
+      s_emit(b, MI_VM_OP_FOR_LOOP, range_reg, 0, 0, 0);
+      int32_t rel_back = (int32_t)((int64_t)body_label - (int64_t)(loop_index + 1u));
+      s_chunk_patch_imm(b->chunk, loop_index, rel_back);
+    }
+    if (body_scope != MI_VM_BODY_SCOPE_NONE)
+    {
+      s_emit(b, MI_VM_OP_SCOPE_POP, 0, 0, 0, 0);
+      b->inline_scope_depth -= 1;
     }
 
-    // loop_end label is here 
     size_t loop_end = b->chunk->code_count;
+    s_emit_clear_loop_regs(b, loop_regs);
+    b->reg_high = (saved_reg_high > b->reg_high) ? saved_reg_high : b->reg_high;
+    if (spill_state)
+    {
+      s_spill_release(b);
+      s_spill_release(b);
+      s_spill_release(b);
+    }
 
-    // Patch JF to jump to loop_end 
+    // Patch FOR_PREP to skip an empty range 
     {
-      int32_t rel_end = (int32_t)((int64_t)loop_end - (int64_t)(jf_index + 1u));
-      s_chunk_patch_imm(b->chunk, jf_index, rel_end);
+      int32_t rel_end = (int32_t)((int64_t)loop_end - (int64_t)(prep_index + 1u));
+      s_chunk_patch_imm(b->chunk, prep_index, rel_end);
     }
 
-    // Patch break jumps to loop_end 
+    // Patch break jumps to loop_end and continue jumps to the step 
     if (loop_idx >= 0)
     {
       for (size_t bi = 0; bi < b->loops[loop_idx].break_jump_count; ++bi)
@@ -1128,6 +3419,12 @@ cmd_special_form_done:
         int32_t rel = (int32_t)((int64_t)loop_end - (int64_t)(bj + 1u));
         s_chunk_patch_imm(b->chunk, bj, rel);
       }
+      for (size_t ci = 0; ci < b->loops[loop_idx].continue_jump_count; ++ci)
+      {
+        size_t cj = b->loops[loop_idx].continue_jumps[ci];
+        int32_t rel = (int32_t)((int64_t)step_label - (int64_t)(cj + 1u));
+        s_chunk_patch_imm(b->chunk, cj, rel);
+      }
       b->loop_depth -= 1;
     }
 
@@ -1142,21 +3439,26 @@ cmd_special_form_done:
     - <varname> must be a literal identifier (string literal).
     - <expr_list> is evaluated once.
     - The body is inlined so break/continue compile to jumps.
-    - A fresh scope is created for each iteration.
+    - Names the body binds do not outlive their iteration. Rather than a
+      scope per iteration, the loop gets one scope that is emptied at the
+      top of each iteration, and none at all when <varname> has a slot and
+      the body binds nothing by name.
 
     Compiles to:
     list = <expr_list>
     len = LEN(list)
     idx = -1
+    [SCOPE_PUSH]
     inc_label:
     idx = idx + 1
     cond = idx < len
-    JF cond, end
-    SCOPE_PUSH
+    JF cond, exit
+    [SCOPE_RESET]
     <varname> = INDEX(list, idx)
     <body>
-    SCOPE_POP
     JMP inc_label
+    exit:
+    [SCOPE_POP]
     end:
 */
   if (s_expr_is_lit_string(e->as.command.head, "foreach"))
@@ -1207,7 +3509,23 @@ cmd_special_form_done:
       s_emit(b, MI_VM_OP_LOAD_CONST, dst, 0, 0, s_chunk_add_const(b->chunk, mi_rt_make_void()));
     }
 
-    int32_t foreach_sym = s_chunk_add_symbol(b->chunk, varname_expr->as.string_lit.value);
+    int32_t foreach_slot = s_local_slot(b, varname_expr->as.string_lit.value);
+    int32_t foreach_sym = (foreach_slot >= 0) ? -1 : s_chunk_add_symbol(b->chunk, varname_expr->as.string_lit.value);
+
+    // A loop statement has no result, so its destination register is free.
+    if (!wants_result && dst + 1 == b->next_reg)
+    {
+      b->next_reg = dst;
+    }
+    uint8_t loop_regs = b->next_reg;
+    uint8_t saved_reg_high = b->reg_high;
+    b->reg_high = loop_regs;
+
+    // Under register pressure the container and cursor live in frame slots
+    // and are reloaded each step, so the body gets every register back.
+    bool spill_state = loop_regs + 4u > MI_COMPILE_SPILL_AT;
+    int32_t container_slot = -1;
+    int32_t idx_slot = -1;
 
     // In Minima, bare identifiers are parsed as string literals.
     // For foreach, allow iterating a variable by writing its name
@@ -1218,9 +3536,8 @@ cmd_special_form_done:
     uint8_t container_reg = 0;
     if (list_expr->kind == MI_EXPR_STRING_LITERAL)
     {
-      int32_t sym = s_chunk_add_symbol(b->chunk, list_expr->as.string_lit.value);
       container_reg = s_alloc_reg(b);
-      s_emit(b, MI_VM_OP_LOAD_VAR, container_reg, 0, 0, sym);
+      s_emit_load_name(b, container_reg, list_expr->as.string_lit.value);
     }
     else
     {
@@ -1229,20 +3546,49 @@ cmd_special_form_done:
 
     uint8_t idx_reg = s_alloc_reg(b);
     s_emit(b, MI_VM_OP_LOAD_CONST, idx_reg, 0, 0, s_chunk_add_const(b->chunk, mi_rt_make_int(-1)));
+    if (spill_state)
+    {
+      container_slot = s_spill_slot(b);
+      idx_slot = s_spill_slot(b);
+      s_emit(b, MI_VM_OP_STORE_LOCAL, container_reg, 0, 0, container_slot);
+      s_emit(b, MI_VM_OP_STORE_LOCAL, idx_reg, 0, 0, idx_slot);
+    }
+
+    int loop_scope_base = b->inline_scope_depth;
+    MiVmBodyScope body_scope = s_loop_body_scope(b, body_block->as.block.script, NULL, foreach_slot < 0);
+    if (body_scope != MI_VM_BODY_SCOPE_NONE)
+    {
+      s_emit(b, MI_VM_OP_SCOPE_PUSH, 0, 0, 0, 0);
+      b->inline_scope_depth += 1;
+    }
 
     size_t loop_label = b->chunk->code_count;
 
+    if (spill_state)
+    {
+      b->next_reg = loop_regs;
+      container_reg = s_alloc_reg(b);
+      idx_reg = s_alloc_reg(b);
+      s_emit(b, MI_VM_OP_LOAD_LOCAL, container_reg, 0, 0, container_slot);
+      s_emit(b, MI_VM_OP_LOAD_LOCAL, idx_reg, 0, 0, idx_slot);
+    }
+
     uint8_t cond_reg = s_alloc_reg(b);
     uint8_t item_reg = s_alloc_reg(b);
     s_emit(b, MI_VM_OP_ITER_NEXT, cond_reg, container_reg, idx_reg, (int32_t)item_reg);
+    if (spill_state)
+    {
+      s_emit(b, MI_VM_OP_STORE_LOCAL, idx_reg, 0, 0, idx_slot);
+    }
 
-    // JF cond, <to end> 
+    // JF cond, <to exit>
     size_t jf_index = b->chunk->code_count;
     s_emit(b, MI_VM_OP_JUMP_IF_FALSE, cond_reg, 0, 0, 0);
 
-    int loop_scope_base = b->inline_scope_depth;
-    s_emit(b, MI_VM_OP_SCOPE_PUSH, 0, 0, 0, 0);
-    b->inline_scope_depth += 1;
+    if (body_scope == MI_VM_BODY_SCOPE_RESET)
+    {
+      s_emit(b, MI_VM_OP_SCOPE_RESET, 0, 0, 0, 0);
+    }
 
     int loop_idx = -1;
     if (b->loop_depth < (int)(sizeof(b->loops) / sizeof(b->loops[0])))
@@ -1252,6 +3598,8 @@ cmd_special_form_done:
       b->loops[loop_idx].loop_start_ip = loop_label;
       b->loops[loop_idx].break_jump_count = 0;
       b->loops[loop_idx].scope_base_depth = loop_scope_base;
+      b->loops[loop_idx].continue_depth = b->inline_scope_depth;
+      b->loops[loop_idx].step_after_body = false;
     }
     else
     {
@@ -1259,19 +3607,23 @@ cmd_special_form_done:
     }
 
     // foreach var = item (local bind) 
-    s_emit(b, MI_VM_OP_DEFINE_VAR, item_reg, 0, 0, foreach_sym);
+    if (foreach_slot >= 0)
+    {
+      s_emit(b, MI_VM_OP_STORE_LOCAL, item_reg, 0, 0, foreach_slot);
+    }
+    else
+    {
+      s_emit(b, MI_VM_OP_DEFINE_VAR, item_reg, 0, 0, foreach_sym);
+    }
 
     uint8_t saved_reg_base = b->reg_base;
-    b->reg_base = b->next_reg;
+    b->reg_base = spill_state ? loop_regs : b->next_reg;
 
     s_compile_script_inline(b, body_block->as.block.script);
 
     b->reg_base = saved_reg_base;
 
-    s_emit(b, MI_VM_OP_SCOPE_POP, 0, 0, 0, 0);
-    b->inline_scope_depth -= 1;
-
-    // JMP back to loop_label 
+    // JMP back to loop_label
     {
       size_t jmp_index = b->chunk->code_count;
       s_emit(b, MI_VM_OP_JUMP, 0, 0, 0, 0);
@@ -1279,15 +3631,29 @@ cmd_special_form_done:
       s_chunk_patch_imm(b->chunk, jmp_index, rel_back);
     }
 
-    size_t loop_end = b->chunk->code_count;
+    // Patch JF to jump to the loop exit
+    {
+      int32_t rel_exit = (int32_t)((int64_t)b->chunk->code_count - (int64_t)(jf_index + 1u));
+      s_chunk_patch_imm(b->chunk, jf_index, rel_exit);
+    }
+    if (body_scope != MI_VM_BODY_SCOPE_NONE)
+    {
+      s_emit(b, MI_VM_OP_SCOPE_POP, 0, 0, 0, 0);
+      b->inline_scope_depth -= 1;
+    }
 
-    // Patch JF to jump to loop_end 
+    size_t loop_end = b->chunk->code_count;
+    s_emit_clear_loop_regs(b, loop_regs);
+    b->reg_high = (saved_reg_high > b->reg_high) ? saved_reg_high : b->reg_high;
+    if (spill_state)
     {
-      int32_t rel_end = (int32_t)((int64_t)loop_end - (int64_t)(jf_index + 1u));
-      s_chunk_patch_imm(b->chunk, jf_index, rel_end);
+      // The container slot would keep the container alive until frame exit.
+      s_emit(b, MI_VM_OP_STORE_LOCAL, loop_regs, 0, 0, container_slot);
+      s_spill_release(b);
+      s_spill_release(b);
     }
 
-    // Patch break jumps to loop_end 
+    // Patch break jumps to loop_end
     if (loop_idx >= 0)
     {
       for (size_t bi = 0; bi < b->loops[loop_idx].break_jump_count; ++bi)
@@ -1302,7 +3668,18 @@ cmd_special_form_done:
     return dst;
   }
 
-  // Regular command call: it uses the argument stack. 
+  if (MI_COMPILE_INLINE_MAX_NODES > 0)
+  {
+    uint8_t r = 0;
+    if (s_compile_inline_call(b, e, &r))
+    {
+      return r;
+    }
+  }
+
+  // Regular command call: it uses the argument stack. Arguments are pushed as
+  // soon as they are computed, so until the call they may use dst and above.
+  b->next_reg = dst;
   bool preserve_args = (b->arg_expr_depth > 0);
   if (preserve_args)
   {
@@ -1337,10 +3714,18 @@ cmd_special_form_done:
     }
 
     // Fast-path: direct variable reference (non-indirect) can be pushed without staging. 
-    if (arg && arg->kind == MI_EXPR_VAR && !arg->as.var.is_indirect)
+    if (arg && arg->kind == MI_EXPR_VAR && !arg->as.var.is_indirect && s_upval_index(b, arg->as.var.name) < 0)
     {
-      int32_t sym = s_chunk_add_symbol(b->chunk, arg->as.var.name);
-      s_emit(b, MI_VM_OP_ARG_PUSH_VAR_SYM, 0, 0, 0, sym);
+      int32_t slot = s_local_slot(b, arg->as.var.name);
+      if (slot >= 0)
+      {
+        s_emit(b, MI_VM_OP_ARG_PUSH_LOCAL, 0, 0, 0, slot);
+      }
+      else
+      {
+        int32_t sym = s_chunk_add_symbol(b->chunk, arg->as.var.name);
+        s_emit(b, MI_VM_OP_ARG_PUSH_VAR_SYM, 0, 0, 0, sym);
+      }
       argc++;
       it = it->next;
       continue;
@@ -1353,9 +3738,11 @@ cmd_special_form_done:
     uint8_t r = s_compile_expr(b, arg);
     b->arg_expr_depth -= 1;
     s_emit(b, MI_VM_OP_ARG_PUSH, r, 0, 0, 0);
+    b->next_reg = dst;
     argc++;
     it = it->next;
   }
+  b->next_reg = (uint8_t)(dst + 1u);
 
   const MiExpr* head = e->as.command.head;
   if (head && head->kind == MI_EXPR_STRING_LITERAL)
@@ -1370,11 +3757,14 @@ cmd_special_form_done:
     }
     else
     {
+      // An upvalue head was late-bound when the upvalues were resolved.
       MiRtValue cmd_v = mi_rt_make_void();
-      if (mi_vm_find_command(b->vm, name, &cmd_v) && cmd_v.kind == MI_RT_VAL_CMD && cmd_v.as.cmd)
+      if (s_upval_index(b, name) < 0 &&
+          mi_vm_find_command(b->vm, name, &cmd_v) && cmd_v.kind == MI_RT_VAL_CMD && cmd_v.as.cmd)
       {
         int32_t cmd_id = s_chunk_add_cmd_target(b->chunk, name, cmd_v.as.cmd);
-        s_emit(b, MI_VM_OP_CALL_CMD_FAST, dst, argc, 0, cmd_id);
+        bool proven = s_call_args_proven(b, cmd_v.as.cmd, e->as.command.args, (int)argc);
+        s_emit(b, proven ? MI_VM_OP_CALL_CMD_TRUSTED : MI_VM_OP_CALL_CMD_FAST, dst, argc, 0, cmd_id);
         mi_rt_value_release(b->vm->rt, cmd_v);
       }
       else
@@ -1385,9 +3775,8 @@ cmd_special_form_done:
         }
         // Late-bound identifier head (call-by-value). 
         uint8_t head_reg = s_alloc_reg(b);
-        int32_t sym = s_chunk_add_symbol(b->chunk, name);
-        s_emit(b, MI_VM_OP_LOAD_VAR, head_reg, 0, 0, sym);
-        s_emit(b, MI_VM_OP_CALL_CMD_DYN, dst, head_reg, argc, 0);
+        s_emit_load_name(b, head_reg, name);
+        s_emit(b, (tail_call && !preserve_args) ? MI_VM_OP_TAIL_CALL : MI_VM_OP_CALL_CMD_DYN, dst, head_reg, argc, 0);
       }
     }
 
@@ -1400,7 +3789,7 @@ cmd_special_form_done:
 
   // Dynamic head: compute name into a register and do dynamic lookup.
   uint8_t head_reg = s_compile_expr(b, head);
-  s_emit(b, MI_VM_OP_CALL_CMD_DYN, dst, head_reg, argc, 0);
+  s_emit(b, (tail_call && !preserve_args) ? MI_VM_OP_TAIL_CALL : MI_VM_OP_CALL_CMD_DYN, dst, head_reg, argc, 0);
 
   if (preserve_args)
   {
@@ -1409,7 +3798,7 @@ cmd_special_form_done:
   return dst;
 }
 
-static uint8_t s_compile_expr(MiVmBuild* b, const MiExpr* e)
+static uint8_t s_compile_expr_node(MiVmBuild* b, const MiExpr* e)
 {
   if (!e)
   {
@@ -1467,6 +3856,16 @@ static uint8_t s_compile_expr(MiVmBuild* b, const MiExpr* e)
 
     case MI_EXPR_VAR:
       {
+        if (b->inline_sig && !e->as.var.is_indirect)
+        {
+          // Parameter of the function being inlined: already in a register.
+          int p = s_inline_param_index(b->inline_sig, e->as.var.name);
+          if (p >= 0)
+          {
+            return b->inline_regs[p];
+          }
+        }
+
         uint8_t r = s_alloc_reg(b);
         if (e->as.var.is_indirect)
         {
@@ -1486,15 +3885,16 @@ static uint8_t s_compile_expr(MiVmBuild* b, const MiExpr* e)
           return r;
         }
 
-        int32_t sym = s_chunk_add_symbol(b->chunk, e->as.var.name);
-        s_emit(b, MI_VM_OP_LOAD_VAR, r, 0, 0, sym);
+        s_emit_load_name(b, r, e->as.var.name);
         return r;
       }
 
     case MI_EXPR_QUAL:
       {
         // target::member
+        uint8_t mark = b->next_reg;
         uint8_t base = s_compile_expr(b, e->as.qual.target);
+        b->next_reg = mark;
         uint8_t r = s_alloc_reg(b);
         int32_t mem_sym = s_chunk_add_symbol(b->chunk, e->as.qual.member);
         s_emit(b, MI_VM_OP_LOAD_MEMBER, r, base, 0, mem_sym);
@@ -1503,8 +3903,11 @@ static uint8_t s_compile_expr(MiVmBuild* b, const MiExpr* e)
 
     case MI_EXPR_UNARY:
       {
-        uint8_t r = s_alloc_reg(b);
+        // Operands are computed first so the result can take their register.
+        uint8_t mark = b->next_reg;
         uint8_t x = s_compile_expr(b, e->as.unary.expr);
+        b->next_reg = mark;
+        uint8_t r = s_alloc_reg(b);
         MiVmOp op = s_map_unary(e->as.unary.op);
         s_emit(b, op, r, x, 0, 0);
         return r;
@@ -1512,10 +3915,32 @@ static uint8_t s_compile_expr(MiVmBuild* b, const MiExpr* e)
 
     case MI_EXPR_BINARY:
       {
-        uint8_t r = s_alloc_reg(b);
+        uint8_t mark = b->next_reg;
         uint8_t a = s_compile_expr(b, e->as.binary.left);
+
+        // Under register pressure the left operand waits in a frame slot
+        // while the right one is computed.
+        int32_t spill = -1;
+        if (a >= mark && b->next_reg >= MI_COMPILE_SPILL_AT && !s_expr_is_leaf(e->as.binary.right))
+        {
+          spill = s_spill_slot(b);
+          s_emit(b, MI_VM_OP_STORE_LOCAL, a, 0, 0, spill);
+          b->next_reg = mark;
+        }
+
         uint8_t c = s_compile_expr(b, e->as.binary.right);
-        MiVmOp op = s_map_binary(e->as.binary.op);
+        if (spill >= 0)
+        {
+          a = s_alloc_reg(b);
+          s_emit(b, MI_VM_OP_LOAD_LOCAL, a, 0, 0, spill);
+          s_spill_release(b);
+        }
+
+        MiVmOp op = s_typed_binary(s_map_binary(e->as.binary.op),
+            mi_typecheck_expr_type(b->var_types, e->as.binary.left),
+            mi_typecheck_expr_type(b->var_types, e->as.binary.right));
+        b->next_reg = mark;
+        uint8_t r = s_alloc_reg(b);
         s_emit(b, op, r, a, c, 0);
         return r;
       }
@@ -1525,27 +3950,11 @@ static uint8_t s_compile_expr(MiVmBuild* b, const MiExpr* e)
 
     case MI_EXPR_BLOCK:
       {
-        uint8_t r = s_alloc_reg(b);
         // Block literals (including function bodies lowered to blocks) are
         // already validated by the top-level typecheck pass. Re-typechecking
         // nested scripts in isolation would lose function-context typing
         // (e.g. arg(i) inside a func body) and outer-scope information.
-        MiVmChunk* sub = s_vm_compile_script_ast(b->vm,
-            e->as.block.script,
-            NULL,
-            x_slice_from_cstr("<block>"),
-            b->chunk ? b->chunk->dbg_file : x_slice_empty(),
-            true);
-        if (!sub)
-        {
-          int32_t k = s_chunk_add_const(b->chunk, mi_rt_make_void());
-          s_emit(b, MI_VM_OP_LOAD_CONST, r, 0, 0, k);
-          return r;
-        }
-
-        int32_t id = s_chunk_add_subchunk(b->chunk, sub);
-        s_emit(b, MI_VM_OP_LOAD_BLOCK, r, 0, 0, id);
-        return r;
+        return s_compile_block(b, e->as.block.script, NULL);
       }
     case MI_EXPR_LIST:
       {
@@ -1557,6 +3966,7 @@ static uint8_t s_compile_expr(MiVmBuild* b, const MiExpr* e)
         {
           uint8_t item_reg = s_compile_expr(b, it->expr);
           s_emit(b, MI_VM_OP_LIST_PUSH, r, item_reg, 0, 0);
+          b->next_reg = (uint8_t)(r + 1u);
           it = it->next;
         }
 
@@ -1587,6 +3997,7 @@ static uint8_t s_compile_expr(MiVmBuild* b, const MiExpr* e)
           uint8_t v_reg = s_compile_expr(b, pe->as.pair.value);
 
           s_emit(b, MI_VM_OP_STORE_INDEX, dict_reg, k_reg, v_reg, 0);
+          b->next_reg = (uint8_t)(dict_reg + 1u);
           it = it->next;
         }
 
@@ -1608,9 +4019,11 @@ static uint8_t s_compile_expr(MiVmBuild* b, const MiExpr* e)
 
     case MI_EXPR_INDEX:
       {
-        uint8_t r = s_alloc_reg(b);
+        uint8_t mark = b->next_reg;
         uint8_t base_reg = s_compile_expr(b, e->as.index.target);
         uint8_t key_reg = s_compile_expr(b, e->as.index.index);
+        b->next_reg = mark;
+        uint8_t r = s_alloc_reg(b);
         s_emit(b, MI_VM_OP_INDEX, r, base_reg, key_reg, 0);
         return r;
       }
@@ -1626,10 +4039,16 @@ static uint8_t s_compile_expr(MiVmBuild* b, const MiExpr* e)
   }
 }
 
-static MiVmChunk* s_vm_compile_script_ast(MiVm* vm, const MiScript* script, XArena* arena, XSlice dbg_name, XSlice dbg_file, bool skip_typecheck)
+static uint8_t s_compile_expr(MiVmBuild* b, const MiExpr* e)
 {
-  (void) arena;
+  uint8_t mark = b->next_reg;
+  uint8_t r = s_compile_expr_node(b, e);
+  s_settle_regs(b, mark, r);
+  return r;
+}
 
+static MiVmChunk* s_vm_compile_script_ast(MiVm* vm, const MiScript* script, MiVmLazyUnit* unit, XSlice dbg_name, XSlice dbg_file, bool skip_typecheck, const MiVmNestCtx* nest)
+{
   if (!vm || !script)
   {
     return NULL;
@@ -1656,6 +4075,18 @@ static MiVmChunk* s_vm_compile_script_ast(MiVm* vm, const MiScript* script, XAre
   // pass; it will not execute variables or commands.
   mi_fold_constants_ast(NULL, script);
 
+  // Variable types are solved once over the whole script (after folding) and
+  // shared with every nested block compiled from it.
+  const MiTypecheckVarTypes* var_types = nest ? nest->var_types : NULL;
+  MiTypecheckVarTypes own_var_types;
+  memset(&own_var_types, 0, sizeof(own_var_types));
+  if (!var_types)
+  {
+    MiTypecheckVarTypes* solved = unit ? &unit->var_types : &own_var_types;
+    mi_typecheck_var_types(script, vm, solved);
+    var_types = solved;
+  }
+
   MiVmChunk* chunk = s_chunk_create();
 
   // Attach debug identity to the chunk. This also enables per-instruction
@@ -1669,6 +4100,8 @@ static MiVmChunk* s_vm_compile_script_ast(MiVm* vm, const MiScript* script, XAre
   b.vm = vm;
   b.chunk = chunk;
   b.next_reg = 0;
+  b.var_types = var_types;
+  b.unit = unit;
 
   // Collect names of typed `func` declarations in this script.
   // These are lowered to cmd(...) for runtime, but we keep their names
@@ -1771,6 +4204,7 @@ static MiVmChunk* s_vm_compile_script_ast(MiVm* vm, const MiScript* script, XAre
                   (const char*)prev->path.ptr);
             }
             free(include_aliases);
+            mi_typecheck_var_types_free(&own_var_types);
             return NULL;
           }
 
@@ -1805,6 +4239,7 @@ static MiVmChunk* s_vm_compile_script_ast(MiVm* vm, const MiScript* script, XAre
             if (!p)
             {
               free(include_aliases);
+              mi_typecheck_var_types_free(&own_var_types);
               mi_error("mi_compile: out of memory\n");
               return NULL;
             }
@@ -1828,6 +4263,59 @@ static MiVmChunk* s_vm_compile_script_ast(MiVm* vm, const MiScript* script, XAre
 
   free(include_aliases);
 
+  // Names this chunk's frame may bind, visible to the slot resolution of the
+  // user command bodies nested in it.
+  const MiVmLocals* locals = nest ? nest->locals : NULL;
+  MiVmScopeNames own_names;
+  memset(&own_names, 0, sizeof(own_names));
+  MiVmScopeNames* names = unit ? s_lazy_unit_names(unit) : &own_names;
+  names->parent = nest ? nest->outer : NULL;
+  s_names_collect_script(names, script);
+  if (locals)
+  {
+    for (int32_t i = 0; i < locals->count; ++i)
+    {
+      s_names_add(names, locals->names[i]);
+    }
+  }
+  if (locals)
+  {
+    for (uint32_t i = 0; i < locals->param_count; ++i)
+    {
+      s_names_add(names, locals->param_names[i]);
+    }
+    names->dynamic = names->dynamic || locals->dynamic_params || locals->dynamic;
+  }
+  b.scope_names = names;
+  b.locals = locals;
+  b.upvals = nest ? nest->upvals : NULL;
+  s_chunk_set_upvals(chunk, b.upvals);
+  b.spill_base = (locals && locals->count > 0) ? (uint32_t)locals->count : 0u;
+
+  MiVmInlineFuncs own_inline;
+  memset(&own_inline, 0, sizeof(own_inline));
+  if (nest)
+  {
+    b.inline_funcs = nest->inline_funcs;
+  }
+  else if (MI_COMPILE_INLINE_MAX_NODES > 0)
+  {
+    MiVmInlineFuncs* collected = unit ? &unit->inline_funcs : &own_inline;
+    s_inline_collect(collected, script);
+    b.inline_funcs = collected;
+  }
+
+  if (locals && locals->count > 0)
+  {
+    chunk->local_count = (uint32_t)locals->count;
+    if (locals->param_count > 0)
+    {
+      chunk->param_slots = (int32_t*)s_realloc(NULL, locals->param_count * sizeof(int32_t));
+      memcpy(chunk->param_slots, locals->param_slots, locals->param_count * sizeof(int32_t));
+      chunk->param_slot_count = locals->param_count;
+    }
+  }
+
   const MiCommandList* it = script ? script->first : NULL;
   while (it)
   {
@@ -1851,8 +4339,16 @@ static MiVmChunk* s_vm_compile_script_ast(MiVm* vm, const MiScript* script, XAre
       fake.as.command.argc = (unsigned int)cmd->argc;
 
       uint8_t dst = s_compile_command_expr(&b, &fake, true);
-      int32_t sym = s_chunk_add_symbol(b.chunk, cmd->include_alias_tok.lexeme);
-      s_emit(&b, MI_VM_OP_STORE_VAR, dst, 0, 0, sym);
+      int32_t slot = s_local_slot(&b, cmd->include_alias_tok.lexeme);
+      if (slot >= 0)
+      {
+        s_emit(&b, MI_VM_OP_STORE_LOCAL, dst, 0, 0, slot);
+      }
+      else
+      {
+        int32_t sym = s_chunk_add_symbol(b.chunk, cmd->include_alias_tok.lexeme);
+        s_emit(&b, MI_VM_OP_STORE_VAR, dst, 0, 0, sym);
+      }
       it = it->next;
       continue;
     }
@@ -1872,6 +4368,16 @@ static MiVmChunk* s_vm_compile_script_ast(MiVm* vm, const MiScript* script, XAre
   s_set_dbg(&b, NULL);
   s_emit(&b, MI_VM_OP_HALT, 0, 0, 0, 0);
 
+  if (b.spill_high > 0)
+  {
+    chunk->local_count = b.spill_base + b.spill_high;
+  }
+
+  (void) mi_peephole_chunk(chunk);
+  mi_typecheck_var_types_free(&own_var_types);
+  free(own_names.names);
+  free(own_inline.funcs);
+
   return chunk;
 }
 
@@ -1881,7 +4387,7 @@ MiVmChunk* mi_compile_vm_script(MiVm* vm, const MiScript* script)
   {
     return NULL;
   }
-  return s_vm_compile_script_ast(vm, script, NULL, x_slice_empty(), x_slice_empty(), false);
+  return s_vm_compile_script_ast(vm, script, NULL, x_slice_empty(), x_slice_empty(), false, NULL);
 }
 
 MiVmChunk* mi_compile_vm_script_ex(MiVm* vm, const MiScript* script, XSlice dbg_name, XSlice dbg_file)
@@ -1891,5 +4397,23 @@ MiVmChunk* mi_compile_vm_script_ex(MiVm* vm, const MiScript* script, XSlice dbg_
     return NULL;
   }
 
-  return s_vm_compile_script_ast(vm, script, NULL, dbg_name, dbg_file, false);
+  return s_vm_compile_script_ast(vm, script, NULL, dbg_name, dbg_file, false, NULL);
+}
+
+MiVmChunk* mi_compile_vm_script_lazy(MiVm* vm, const MiScript* script, XArena* arena, char* source, XSlice dbg_name, XSlice dbg_file)
+{
+  MiVmLazyUnit* unit = (MiVmLazyUnit*)calloc(1u, sizeof(*unit));
+  if (!unit)
+  {
+    mi_error("mi_compile: out of memory\n");
+    exit(1);
+  }
+  unit->vm = vm;
+  unit->arena = arena;
+  unit->source = source;
+  unit->refs = 1;
+
+  MiVmChunk* chunk = (vm && script) ? s_vm_compile_script_ast(vm, script, unit, dbg_name, dbg_file, false, NULL) : NULL;
+  s_lazy_unit_release(unit);
+  return chunk;
 }
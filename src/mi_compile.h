@@ -2,11 +2,26 @@
 #define MI_COMPILE_H
 
 #include <stdx_string.h>
+#include <stdx_arena.h>
 
 #include "mi_vm.h"
 
 typedef struct MiScript MiScript;
 
+// Calls to a typed `func` declared earlier at the top level of the same
+// script are inlined when its body is a single `return` of at most this many
+// expression nodes over its parameters. Define it to 0 to disable inlining.
+#ifndef MI_COMPILE_INLINE_MAX_NODES
+#define MI_COMPILE_INLINE_MAX_NODES 8
+#endif
+
+// Expression temporaries are released as soon as they are consumed. Once this
+// many registers are live, operands that must survive the evaluation of
+// another subexpression are parked in frame slots instead.
+#ifndef MI_COMPILE_SPILL_AT
+#define MI_COMPILE_SPILL_AT (MI_VM_REG_COUNT - 8)
+#endif
+
 /**
  * Compile an already-parsed AST script into VM bytecode (MiVmChunk).
  * The compiler will deep-copy any strings/constants into chunk-owned memory.
@@ -21,4 +36,24 @@ MiVmChunk* mi_compile_vm_script(MiVm* vm, const MiScript* script);
  */
 MiVmChunk* mi_compile_vm_script_ex(MiVm* vm, const MiScript* script, XSlice dbg_name, XSlice dbg_file);
 
+/* Compile the top level of a script now and its block and command bodies on
+ * their first call (mi_compile_force()). The script is still typechecked as a
+ * whole up front. Takes ownership of the arena holding the AST and of the
+ * source text it points into (malloc'd; either may be NULL): both are freed
+ * once no body is left to compile, or with the chunks.
+ */
+MiVmChunk* mi_compile_vm_script_lazy(MiVm* vm, const MiScript* script, XArena* arena, char* source, XSlice dbg_name, XSlice dbg_file);
+
+/* Compile a chunk left pending by mi_compile_vm_script_lazy() in place (its
+ * own bodies stay pending). No-op for compiled chunks. The result still has
+ * to be verified before it runs.
+ */
+bool mi_compile_force(MiVmChunk* chunk);
+
+/* mi_compile_force() for a chunk and everything nested in it. */
+bool mi_compile_force_all(MiVmChunk* chunk);
+
+/* Free a pending body (mi_vm_chunk_destroy() of an uncompiled chunk). */
+void mi_compile_lazy_free(MiVmLazy* lazy);
+
 #endif // MI_COMPILE_H
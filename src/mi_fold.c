@@ -17,12 +17,12 @@ static MiRtValue s_eval_binary_string(MiTokenKind op, const MiRtValue* a, const
 
   if (op == MI_TOK_EQEQ)
   {
-    bool equals = x_slice_eq(a->as.s, b->as.s);
+    bool equals = x_slice_eq(mi_rt_value_slice(*a), mi_rt_value_slice(*b));
     return mi_rt_make_bool(equals);
   }
   else if (op == MI_TOK_BANGEQ)
   {
-    bool equals = x_slice_eq(a->as.s, b->as.s);
+    bool equals = x_slice_eq(mi_rt_value_slice(*a), mi_rt_value_slice(*b));
     return mi_rt_make_bool(!equals);
   }
   else
@@ -44,6 +44,27 @@ static MiRtValue s_eval_binary_numeric(MiTokenKind op, const MiRtValue* a, const
     return mi_rt_make_void();
   }
 
+  // Fold int op int in 64-bit integers to match the VM (no rounding through
+  // double above 2^53; overflow wraps).
+  if (a->kind == MI_RT_VAL_INT && b->kind == MI_RT_VAL_INT)
+  {
+    unsigned long long ua = (unsigned long long)a->as.i;
+    unsigned long long ub = (unsigned long long)b->as.i;
+    switch (op)
+    {
+      case MI_TOK_PLUS:   return mi_rt_make_int((long long)(ua + ub));
+      case MI_TOK_MINUS:  return mi_rt_make_int((long long)(ua - ub));
+      case MI_TOK_STAR:   return mi_rt_make_int((long long)(ua * ub));
+      case MI_TOK_EQEQ:   return mi_rt_make_bool(a->as.i == b->as.i);
+      case MI_TOK_BANGEQ: return mi_rt_make_bool(a->as.i != b->as.i);
+      case MI_TOK_LT:     return mi_rt_make_bool(a->as.i < b->as.i);
+      case MI_TOK_LTEQ:   return mi_rt_make_bool(a->as.i <= b->as.i);
+      case MI_TOK_GT:     return mi_rt_make_bool(a->as.i > b->as.i);
+      case MI_TOK_GTEQ:   return mi_rt_make_bool(a->as.i >= b->as.i);
+      default:            break;
+    }
+  }
+
   double da = 0.0;
   double db = 0.0;
 
@@ -161,12 +182,12 @@ static MiRtValue mi_eval_expr_ast(MiRuntime* rt, const MiExpr* expr)
             mi_error("indirect variable name must evaluate to string\n");
             return mi_rt_make_void();
           }
-          if (name_v.as.s.length == 0)
+          name = mi_rt_value_slice(name_v);
+          if (name.length == 0)
           {
             mi_error("indirect variable name cannot be empty\n");
             return mi_rt_make_void();
           }
-          name = name_v.as.s;
         }
 
         if (!mi_rt_var_get(rt, name, &v))
@@ -363,7 +384,7 @@ static void s_fold_replace_with_literal(MiExpr* expr, MiRtValue v)
       break;
     case MI_RT_VAL_STRING:
       expr->kind = MI_EXPR_STRING_LITERAL;
-      expr->as.string_lit.value = v.as.s;
+      expr->as.string_lit.value = mi_rt_value_slice(v);
       break;
     case MI_RT_VAL_VOID:
       expr->kind = MI_EXPR_VOID_LITERAL;
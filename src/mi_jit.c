@@ -0,0 +1,1305 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mi_jit.h"
+#include "mi_log.h"
+
+#if MI_VM_JIT
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+//----------------------------------------------------------
+// Code buffer
+//----------------------------------------------------------
+
+struct MiJitCode
+{
+  uint8_t*  mem;        // Executable mapping: entry trampoline, then one template per instruction
+  size_t    mem_size;
+  uint32_t* pc_offsets; // Native offset of each instruction; [code_count] exits off the end
+  uint8_t*  pc_native;  // 0 where the instruction is left to the interpreter
+  size_t    code_count;
+  char*     listing;    // Annotated listing for mi_jit_dump(), NULL unless requested
+  size_t  (*aot)(MiJitFrame* frame, size_t pc); // Set instead of mem by mi_jit_adopt()
+};
+
+typedef size_t (*MiJitEntryFn)(MiJitFrame* frame, const void* target);
+
+typedef enum MiJitReg
+{
+  R_AX = 0, R_CX, R_DX, R_BX, R_SP, R_BP, R_SI, R_DI,
+  R_8, R_9, R_10, R_11, R_12, R_13, R_14, R_15
+} MiJitReg;
+
+// Pinned for the whole run of the generated code (all callee-saved, so they
+// survive the calls into mi_vm.c).
+#define JIT_REGS   R_BX   // frame->regs
+#define JIT_FRAME  R_12   // frame
+#define JIT_LOCALS R_13   // frame->locals
+#define JIT_VM     R_14   // frame->vm
+
+typedef enum MiJitCond
+{
+  CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_BE = 0x6, CC_A = 0x7,
+  CC_L = 0xC, CC_GE = 0xD, CC_LE = 0xE, CC_G = 0xF
+} MiJitCond;
+
+typedef struct MiJitFixup
+{
+  size_t   at;        // Offset of the rel32 to patch
+  uint32_t target_pc;
+} MiJitFixup;
+
+// Forward label inside one template.
+typedef struct MiJitLabel
+{
+  const char* name;
+  size_t      at[4];
+  int         count;
+} MiJitLabel;
+
+typedef struct MiJitAsm
+{
+  uint8_t*    buf;
+  size_t      len;
+  size_t      cap;
+
+  MiJitFixup* fixups;
+  size_t      fixup_count;
+  size_t      fixup_cap;
+
+  bool        listing;
+  char*       text;
+  size_t      text_len;
+  size_t      text_cap;
+} MiJitAsm;
+
+// Layout of a register or slot value.
+#define V_SIZE ((int32_t)sizeof(MiRtValue))
+#define V_KIND ((int32_t)offsetof(MiRtValue, kind))
+#define V_AS   ((int32_t)offsetof(MiRtValue, as))
+
+static const char* s_reg64[16] =
+{
+  "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+  "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"
+};
+
+static const char* s_reg32[16] =
+{
+  "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi",
+  "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d"
+};
+
+static const char* s_cc_name(MiJitCond cc)
+{
+  switch (cc)
+  {
+    case CC_B:  return "b";
+    case CC_AE: return "ae";
+    case CC_E:  return "e";
+    case CC_NE: return "ne";
+    case CC_BE: return "be";
+    case CC_A:  return "a";
+    case CC_L:  return "l";
+    case CC_GE: return "ge";
+    case CC_LE: return "le";
+    default:    return "g";
+  }
+}
+
+static MiJitCond s_cc_not(MiJitCond cc)
+{
+  return (MiJitCond)(cc ^ 1);
+}
+
+static void* s_grow(void* ptr, size_t* cap, size_t need, size_t elem)
+{
+  if (need <= *cap)
+  {
+    return ptr;
+  }
+  size_t n = *cap ? *cap : 256u;
+  while (n < need)
+  {
+    n *= 2u;
+  }
+  void* p = realloc(ptr, n * elem);
+  if (!p)
+  {
+    mi_error("mi_jit: out of memory\n");
+    exit(1);
+  }
+  *cap = n;
+  return p;
+}
+
+static void s_text(MiJitAsm* a, const char* s)
+{
+  size_t len = strlen(s);
+  a->text = (char*)s_grow(a->text, &a->text_cap, a->text_len + len + 1u, 1u);
+  memcpy(a->text + a->text_len, s, len + 1u);
+  a->text_len += len;
+}
+
+// Listing line for the machine instruction emitted since 'start'.
+static void s_note(MiJitAsm* a, size_t start, const char* fmt, ...)
+{
+  if (!a->listing)
+  {
+    return;
+  }
+
+  char hex[40];
+  size_t h = 0;
+  hex[0] = '\0';
+  for (size_t i = start; i < a->len && h + 4 < sizeof(hex); ++i)
+  {
+    h += (size_t)snprintf(hex + h, sizeof(hex) - h, "%02X ", a->buf[i]);
+  }
+
+  char ins[128];
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(ins, sizeof(ins), fmt, args);
+  va_end(args);
+
+  char line[200];
+  snprintf(line, sizeof(line), "    %06zx  %-36s %s\n", start, hex, ins);
+  s_text(a, line);
+}
+
+static const char* s_mem_text(char out[32], MiJitReg base, int32_t disp)
+{
+  if (disp < 0)
+  {
+    snprintf(out, 32, "[%s-0x%x]", s_reg64[base], (unsigned)-disp);
+  }
+  else
+  {
+    snprintf(out, 32, "[%s+0x%x]", s_reg64[base], (unsigned)disp);
+  }
+  return out;
+}
+
+//----------------------------------------------------------
+// x86-64 encoder
+//----------------------------------------------------------
+
+static void s_byte(MiJitAsm* a, uint8_t v)
+{
+  a->buf = (uint8_t*)s_grow(a->buf, &a->cap, a->len + 1u, 1u);
+  a->buf[a->len++] = v;
+}
+
+static void s_u32(MiJitAsm* a, uint32_t v)
+{
+  for (int i = 0; i < 4; ++i)
+  {
+    s_byte(a, (uint8_t)(v >> (8 * i)));
+  }
+}
+
+static void s_patch32(MiJitAsm* a, size_t at, uint32_t v)
+{
+  for (int i = 0; i < 4; ++i)
+  {
+    a->buf[at + (size_t)i] = (uint8_t)(v >> (8 * i));
+  }
+}
+
+static void s_rex(MiJitAsm* a, bool w, int reg, int base)
+{
+  uint8_t rex = (uint8_t)(0x40 | (w ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((base & 8) ? 1 : 0));
+  if (rex != 0x40)
+  {
+    s_byte(a, rex);
+  }
+}
+
+// ModRM (+SIB) and displacement for [base + disp]. A displacement is always
+// encoded, so rbp/r13 bases need no special case.
+static void s_modrm_mem(MiJitAsm* a, int reg, MiJitReg base, int32_t disp)
+{
+  bool d8 = disp >= -128 && disp <= 127;
+  s_byte(a, (uint8_t)((d8 ? 0x40 : 0x80) | ((reg & 7) << 3) | (base & 7)));
+  if ((base & 7) == R_SP)
+  {
+    s_byte(a, 0x24);
+  }
+  if (d8)
+  {
+    s_byte(a, (uint8_t)(int8_t)disp);
+  }
+  else
+  {
+    s_u32(a, (uint32_t)disp);
+  }
+}
+
+static void s_modrm_rr(MiJitAsm* a, int reg, int rm)
+{
+  s_byte(a, (uint8_t)(0xC0 | ((reg & 7) << 3) | (rm & 7)));
+}
+
+// mov r64, qword [base+disp]
+static void s_load64(MiJitAsm* a, MiJitReg dst, MiJitReg base, int32_t disp)
+{
+  char m[32];
+  size_t at = a->len;
+  s_rex(a, true, dst, base);
+  s_byte(a, 0x8B);
+  s_modrm_mem(a, dst, base, disp);
+  s_note(a, at, "mov %s, qword %s", s_reg64[dst], s_mem_text(m, base, disp));
+}
+
+// mov qword [base+disp], r64
+static void s_store64(MiJitAsm* a, MiJitReg base, int32_t disp, MiJitReg src)
+{
+  char m[32];
+  size_t at = a->len;
+  s_rex(a, true, src, base);
+  s_byte(a, 0x89);
+  s_modrm_mem(a, src, base, disp);
+  s_note(a, at, "mov qword %s, %s", s_mem_text(m, base, disp), s_reg64[src]);
+}
+
+// mov dword [base+disp], imm32 (or qword, sign-extended)
+static void s_store_imm(MiJitAsm* a, bool qword, MiJitReg base, int32_t disp, int32_t imm)
+{
+  char m[32];
+  size_t at = a->len;
+  s_rex(a, qword, 0, base);
+  s_byte(a, 0xC7);
+  s_modrm_mem(a, 0, base, disp);
+  s_u32(a, (uint32_t)imm);
+  s_note(a, at, "mov %s %s, %d", qword ? "qword" : "dword", s_mem_text(m, base, disp), imm);
+}
+
+// cmp dword [base+disp], imm8 (or byte)
+static void s_cmp_imm8(MiJitAsm* a, bool byte, MiJitReg base, int32_t disp, int8_t imm)
+{
+  char m[32];
+  size_t at = a->len;
+  s_rex(a, false, 0, base);
+  s_byte(a, byte ? 0x80 : 0x83);
+  s_modrm_mem(a, 7, base, disp);
+  s_byte(a, (uint8_t)imm);
+  s_note(a, at, "cmp %s %s, %d", byte ? "byte" : "dword", s_mem_text(m, base, disp), imm);
+}
+
+typedef enum MiJitAlu
+{
+  ALU_ADD,
+  ALU_SUB,
+  ALU_CMP,
+  ALU_IMUL
+} MiJitAlu;
+
+// <alu> r64, qword [base+disp]
+static void s_alu_load(MiJitAsm* a, MiJitAlu op, MiJitReg dst, MiJitReg base, int32_t disp)
+{
+  static const char* names[] = { "add", "sub", "cmp", "imul" };
+  char m[32];
+  size_t at = a->len;
+  s_rex(a, true, dst, base);
+  switch (op)
+  {
+    case ALU_ADD: s_byte(a, 0x03); break;
+    case ALU_SUB: s_byte(a, 0x2B); break;
+    case ALU_CMP: s_byte(a, 0x3B); break;
+    default:      s_byte(a, 0x0F); s_byte(a, 0xAF); break;
+  }
+  s_modrm_mem(a, dst, base, disp);
+  s_note(a, at, "%s %s, qword %s", names[op], s_reg64[dst], s_mem_text(m, base, disp));
+}
+
+// add/sub/cmp r64, r64
+static void s_alu_rr(MiJitAsm* a, MiJitAlu op, MiJitReg dst, MiJitReg src)
+{
+  static const char* names[] = { "add", "sub", "cmp" };
+  size_t at = a->len;
+  s_rex(a, true, src, dst);
+  s_byte(a, op == ALU_ADD ? 0x01 : op == ALU_SUB ? 0x29 : 0x39);
+  s_modrm_rr(a, src, dst);
+  s_note(a, at, "%s %s, %s", names[op], s_reg64[dst], s_reg64[src]);
+}
+
+static void s_mov_rr(MiJitAsm* a, MiJitReg dst, MiJitReg src)
+{
+  size_t at = a->len;
+  s_rex(a, true, src, dst);
+  s_byte(a, 0x89);
+  s_modrm_rr(a, src, dst);
+  s_note(a, at, "mov %s, %s", s_reg64[dst], s_reg64[src]);
+}
+
+static void s_mov_imm64(MiJitAsm* a, MiJitReg dst, uint64_t v)
+{
+  size_t at = a->len;
+  s_rex(a, true, 0, dst);
+  s_byte(a, (uint8_t)(0xB8 + (dst & 7)));
+  s_u32(a, (uint32_t)v);
+  s_u32(a, (uint32_t)(v >> 32));
+  s_note(a, at, "mov %s, 0x%llx", s_reg64[dst], (unsigned long long)v);
+}
+
+static void s_mov_imm32(MiJitAsm* a, MiJitReg dst, uint32_t v)
+{
+  size_t at = a->len;
+  s_rex(a, false, 0, dst);
+  s_byte(a, (uint8_t)(0xB8 + (dst & 7)));
+  s_u32(a, v);
+  s_note(a, at, "mov %s, %u", s_reg32[dst], v);
+}
+
+// lea r64, [base+disp]
+static void s_lea(MiJitAsm* a, MiJitReg dst, MiJitReg base, int32_t disp)
+{
+  char m[32];
+  size_t at = a->len;
+  s_rex(a, true, dst, base);
+  s_byte(a, 0x8D);
+  s_modrm_mem(a, dst, base, disp);
+  s_note(a, at, "lea %s, %s", s_reg64[dst], s_mem_text(m, base, disp));
+}
+
+typedef enum MiJitSse
+{
+  SSE_LOAD = 0x10,
+  SSE_ADD  = 0x58,
+  SSE_MUL  = 0x59,
+  SSE_SUB  = 0x5C,
+  SSE_DIV  = 0x5E,
+  SSE_UCOMI = 0x2E
+} MiJitSse;
+
+// <op>sd xmm, qword [base+disp]  (ucomisd for SSE_UCOMI)
+static void s_sse_load(MiJitAsm* a, MiJitSse op, int xmm, MiJitReg base, int32_t disp)
+{
+  const char* name = "movsd";
+  switch (op)
+  {
+    case SSE_ADD:   name = "addsd"; break;
+    case SSE_MUL:   name = "mulsd"; break;
+    case SSE_SUB:   name = "subsd"; break;
+    case SSE_DIV:   name = "divsd"; break;
+    case SSE_UCOMI: name = "ucomisd"; break;
+    default: break;
+  }
+  char m[32];
+  size_t at = a->len;
+  s_byte(a, op == SSE_UCOMI ? 0x66 : 0xF2);
+  s_rex(a, false, xmm, base);
+  s_byte(a, 0x0F);
+  s_byte(a, (uint8_t)op);
+  s_modrm_mem(a, xmm, base, disp);
+  s_note(a, at, "%s xmm%d, qword %s", name, xmm, s_mem_text(m, base, disp));
+}
+
+// movsd qword [base+disp], xmm
+static void s_sse_store(MiJitAsm* a, MiJitReg base, int32_t disp, int xmm)
+{
+  char m[32];
+  size_t at = a->len;
+  s_byte(a, 0xF2);
+  s_rex(a, false, xmm, base);
+  s_byte(a, 0x0F);
+  s_byte(a, 0x11);
+  s_modrm_mem(a, xmm, base, disp);
+  s_note(a, at, "movsd qword %s, xmm%d", s_mem_text(m, base, disp), xmm);
+}
+
+// setcc al; movzx eax, al
+static void s_setcc_eax(MiJitAsm* a, MiJitCond cc)
+{
+  size_t at = a->len;
+  s_byte(a, 0x0F);
+  s_byte(a, (uint8_t)(0x90 + cc));
+  s_byte(a, 0xC0);
+  s_note(a, at, "set%s al", s_cc_name(cc));
+  at = a->len;
+  s_byte(a, 0x0F);
+  s_byte(a, 0xB6);
+  s_byte(a, 0xC0);
+  s_note(a, at, "movzx eax, al");
+}
+
+static void s_test_al(MiJitAsm* a)
+{
+  size_t at = a->len;
+  s_byte(a, 0x84);
+  s_byte(a, 0xC0);
+  s_note(a, at, "test al, al");
+}
+
+static void s_push(MiJitAsm* a, MiJitReg r)
+{
+  size_t at = a->len;
+  s_rex(a, false, 0, r);
+  s_byte(a, (uint8_t)(0x50 + (r & 7)));
+  s_note(a, at, "push %s", s_reg64[r]);
+}
+
+static void s_pop(MiJitAsm* a, MiJitReg r)
+{
+  size_t at = a->len;
+  s_rex(a, false, 0, r);
+  s_byte(a, (uint8_t)(0x58 + (r & 7)));
+  s_note(a, at, "pop %s", s_reg64[r]);
+}
+
+// Absolute call through rax (helpers may be anywhere in the address space).
+static void s_call(MiJitAsm* a, const void* fn, const char* name)
+{
+  uint64_t addr;
+  memcpy(&addr, &fn, sizeof(addr) < sizeof(fn) ? sizeof(addr) : sizeof(fn));
+  size_t at = a->len;
+  s_rex(a, true, 0, R_AX);
+  s_byte(a, 0xB8);
+  s_u32(a, (uint32_t)addr);
+  s_u32(a, (uint32_t)(addr >> 32));
+  s_byte(a, 0xFF);
+  s_byte(a, 0xD0);
+  s_note(a, at, "call %s", name);
+}
+
+#define S_CALL(a, fn) s_call((a), (const void*)(uintptr_t)&(fn), #fn)
+
+// jcc/jmp to a label of the current template.
+static void s_jump_label(MiJitAsm* a, bool cond, MiJitCond cc, MiJitLabel* l)
+{
+  size_t at = a->len;
+  if (cond)
+  {
+    s_byte(a, 0x0F);
+    s_byte(a, (uint8_t)(0x80 + cc));
+  }
+  else
+  {
+    s_byte(a, 0xE9);
+  }
+  if (l->count < (int)(sizeof(l->at) / sizeof(l->at[0])))
+  {
+    l->at[l->count++] = a->len;
+  }
+  s_u32(a, 0);
+  if (cond)
+  {
+    s_note(a, at, "j%s %s", s_cc_name(cc), l->name);
+  }
+  else
+  {
+    s_note(a, at, "jmp %s", l->name);
+  }
+}
+
+static void s_bind(MiJitAsm* a, MiJitLabel* l)
+{
+  for (int i = 0; i < l->count; ++i)
+  {
+    s_patch32(a, l->at[i], (uint32_t)(a->len - (l->at[i] + 4u)));
+  }
+  if (a->listing)
+  {
+    char line[64];
+    snprintf(line, sizeof(line), "  %s:\n", l->name);
+    s_text(a, line);
+  }
+}
+
+// jcc/jmp to the template of another instruction (patched once all are emitted).
+static void s_jump_pc(MiJitAsm* a, bool cond, MiJitCond cc, uint32_t target_pc)
+{
+  size_t at = a->len;
+  if (cond)
+  {
+    s_byte(a, 0x0F);
+    s_byte(a, (uint8_t)(0x80 + cc));
+  }
+  else
+  {
+    s_byte(a, 0xE9);
+  }
+  a->fixups = (MiJitFixup*)s_grow(a->fixups, &a->fixup_cap, a->fixup_count + 1u, sizeof(MiJitFixup));
+  a->fixups[a->fixup_count].at = a->len;
+  a->fixups[a->fixup_count].target_pc = target_pc;
+  a->fixup_count += 1;
+  s_u32(a, 0);
+  if (cond)
+  {
+    s_note(a, at, "j%s @%04u", s_cc_name(cc), target_pc);
+  }
+  else
+  {
+    s_note(a, at, "jmp @%04u", target_pc);
+  }
+}
+
+// jmp to an offset already emitted.
+static void s_jump_back(MiJitAsm* a, size_t target, const char* name)
+{
+  size_t at = a->len;
+  s_byte(a, 0xE9);
+  s_u32(a, (uint32_t)(target - (a->len + 4u)));
+  s_note(a, at, "jmp %s", name);
+}
+
+//----------------------------------------------------------
+// Templates
+//----------------------------------------------------------
+
+typedef struct MiJitCtx
+{
+  MiJitAsm*        a;
+  const MiVmChunk* chunk;
+  size_t           epilogue;
+} MiJitCtx;
+
+static int32_t s_reg_disp(uint8_t r)
+{
+  return (int32_t)r * V_SIZE;
+}
+
+// Leave to the interpreter, which resumes at pc.
+static void s_emit_exit(MiJitCtx* x, uint32_t pc)
+{
+  s_mov_imm32(x->a, R_AX, pc);
+  s_jump_back(x->a, x->epilogue, "exit");
+}
+
+// Run the instruction with the interpreter's handler.
+static void s_emit_step(MiJitCtx* x, uint32_t pc)
+{
+  s_mov_rr(x->a, R_DI, JIT_FRAME);
+  s_mov_imm32(x->a, R_SI, pc);
+  S_CALL(x->a, mi_vm_jit_step);
+}
+
+// A scalar is about to be written over the value at [base+disp]: heap values
+// are released first (strings and scalars carry no reference count). Callers
+// only do this after their guards proved every source operand a scalar, so
+// the release never frees something still to be read.
+static void s_emit_release(MiJitCtx* x, MiJitReg base, int32_t disp)
+{
+  MiJitLabel keep = { "keep", {0}, 0 };
+  s_cmp_imm8(x->a, false, base, disp + V_KIND, (int8_t)MI_RT_VAL_STRING);
+  s_jump_label(x->a, true, CC_BE, &keep);
+  s_mov_rr(x->a, R_DI, JIT_VM);
+  s_lea(x->a, R_SI, base, disp);
+  S_CALL(x->a, mi_vm_jit_release);
+  s_bind(x->a, &keep);
+}
+
+static void s_emit_set_int_rax(MiJitCtx* x, MiJitReg base, int32_t disp)
+{
+  s_store_imm(x->a, true, base, disp + V_KIND, (int32_t)MI_RT_VAL_INT);
+  s_store64(x->a, base, disp + V_AS, R_AX);
+}
+
+static void s_emit_set_float_xmm0(MiJitCtx* x, MiJitReg base, int32_t disp)
+{
+  s_store_imm(x->a, true, base, disp + V_KIND, (int32_t)MI_RT_VAL_FLOAT);
+  s_sse_store(x->a, base, disp + V_AS, 0);
+}
+
+static void s_emit_set_bool_eax(MiJitCtx* x, MiJitReg base, int32_t disp)
+{
+  s_store_imm(x->a, true, base, disp + V_KIND, (int32_t)MI_RT_VAL_BOOL);
+  s_store64(x->a, base, disp + V_AS, R_AX);
+}
+
+static void s_emit_guard(MiJitCtx* x, uint8_t r, MiRtValueKind kind, MiJitLabel* fail)
+{
+  s_cmp_imm8(x->a, false, JIT_REGS, s_reg_disp(r) + V_KIND, (int8_t)kind);
+  s_jump_label(x->a, true, CC_NE, fail);
+}
+
+// [dst] = [src]: copied inline when neither side holds a heap value.
+static void s_emit_copy(MiJitCtx* x, MiJitReg dst_base, int32_t dst, MiJitReg src_base, int32_t src)
+{
+  MiJitLabel slow = { "assign", {0}, 0 };
+  MiJitLabel done = { "done", {0}, 0 };
+  s_cmp_imm8(x->a, false, src_base, src + V_KIND, (int8_t)MI_RT_VAL_STRING);
+  s_jump_label(x->a, true, CC_A, &slow);
+  s_cmp_imm8(x->a, false, dst_base, dst + V_KIND, (int8_t)MI_RT_VAL_STRING);
+  s_jump_label(x->a, true, CC_A, &slow);
+  for (int32_t w = 0; w < V_SIZE; w += 8)
+  {
+    s_load64(x->a, R_AX, src_base, src + w);
+    s_store64(x->a, dst_base, dst + w, R_AX);
+  }
+  s_jump_label(x->a, false, CC_E, &done);
+  s_bind(x->a, &slow);
+  s_mov_rr(x->a, R_DI, JIT_VM);
+  s_lea(x->a, R_SI, dst_base, dst);
+  s_lea(x->a, R_DX, src_base, src);
+  S_CALL(x->a, mi_vm_jit_assign);
+  s_bind(x->a, &done);
+}
+
+static void s_emit_load_const(MiJitCtx* x, MiVmIns ins)
+{
+  const MiRtValue* k = &x->chunk->consts[ins.imm];
+  int32_t dst = s_reg_disp(ins.a);
+  if (k->kind > MI_RT_VAL_STRING)
+  {
+    s_mov_rr(x->a, R_DI, JIT_VM);
+    s_lea(x->a, R_SI, JIT_REGS, dst);
+    s_mov_imm64(x->a, R_DX, (uint64_t)(uintptr_t)k);
+    S_CALL(x->a, mi_vm_jit_assign);
+    return;
+  }
+
+  s_emit_release(x, JIT_REGS, dst);
+  for (int32_t w = 0; w < V_SIZE; w += 8)
+  {
+    uint64_t word;
+    memcpy(&word, (const uint8_t*)k + w, sizeof(word));
+    s_mov_imm64(x->a, R_AX, word);
+    s_store64(x->a, JIT_REGS, dst + w, R_AX);
+  }
+}
+
+static void s_emit_int_arith(MiJitCtx* x, MiJitAlu op, MiVmIns ins)
+{
+  s_emit_release(x, JIT_REGS, s_reg_disp(ins.a));
+  s_load64(x->a, R_AX, JIT_REGS, s_reg_disp(ins.b) + V_AS);
+  s_alu_load(x->a, op, R_AX, JIT_REGS, s_reg_disp(ins.c) + V_AS);
+  s_emit_set_int_rax(x, JIT_REGS, s_reg_disp(ins.a));
+}
+
+static void s_emit_float_arith(MiJitCtx* x, MiJitSse op, MiVmIns ins)
+{
+  s_emit_release(x, JIT_REGS, s_reg_disp(ins.a));
+  s_sse_load(x->a, SSE_LOAD, 0, JIT_REGS, s_reg_disp(ins.b) + V_AS);
+  s_sse_load(x->a, op, 0, JIT_REGS, s_reg_disp(ins.c) + V_AS);
+  s_emit_set_float_xmm0(x, JIT_REGS, s_reg_disp(ins.a));
+}
+
+// Flags for regs[b] <cmp> regs[c] as ints; returns the condition that holds.
+static MiJitCond s_emit_int_cmp(MiJitCtx* x, MiVmOp cmp, uint8_t b, uint8_t c)
+{
+  s_load64(x->a, R_AX, JIT_REGS, s_reg_disp(b) + V_AS);
+  s_alu_load(x->a, ALU_CMP, R_AX, JIT_REGS, s_reg_disp(c) + V_AS);
+  switch (cmp)
+  {
+    case MI_VM_OP_EQ:   return CC_E;
+    case MI_VM_OP_NEQ:  return CC_NE;
+    case MI_VM_OP_LT:   return CC_L;
+    case MI_VM_OP_LTEQ: return CC_LE;
+    case MI_VM_OP_GT:   return CC_G;
+    default:            return CC_GE;
+  }
+}
+
+// Flags for regs[b] <cmp> regs[c] as floats (LT..GTEQ). The operands are
+// ordered so the condition is false when either side is NaN.
+static MiJitCond s_emit_float_cmp(MiJitCtx* x, MiVmOp cmp, uint8_t b, uint8_t c)
+{
+  bool swap = (cmp == MI_VM_OP_LT || cmp == MI_VM_OP_LTEQ);
+  s_sse_load(x->a, SSE_LOAD, 0, JIT_REGS, s_reg_disp(swap ? c : b) + V_AS);
+  s_sse_load(x->a, SSE_UCOMI, 0, JIT_REGS, s_reg_disp(swap ? b : c) + V_AS);
+  return (cmp == MI_VM_OP_LT || cmp == MI_VM_OP_GT) ? CC_A : CC_AE;
+}
+
+static void s_emit_set_cmp(MiJitCtx* x, MiJitCond cc, uint8_t dst)
+{
+  s_setcc_eax(x->a, cc);
+  s_emit_set_bool_eax(x, JIT_REGS, s_reg_disp(dst));
+}
+
+// ADD/SUB/MUL/DIV: int and float operands inline, anything else through the
+// interpreter's handler.
+static void s_emit_generic_arith(MiJitCtx* x, MiVmIns ins, uint32_t pc)
+{
+  MiJitLabel flt = { "float", {0}, 0 };
+  MiJitLabel slow = { "slow", {0}, 0 };
+  MiJitLabel done = { "done", {0}, 0 };
+  MiVmOp op = (MiVmOp)ins.op;
+
+  if (op != MI_VM_OP_DIV)
+  {
+    // int / int is a float, so DIV only has the float path.
+    s_emit_guard(x, ins.b, MI_RT_VAL_INT, &flt);
+    s_emit_guard(x, ins.c, MI_RT_VAL_INT, &slow);
+    s_emit_int_arith(x, op == MI_VM_OP_ADD ? ALU_ADD : op == MI_VM_OP_SUB ? ALU_SUB : ALU_IMUL, ins);
+    s_jump_label(x->a, false, CC_E, &done);
+    s_bind(x->a, &flt);
+  }
+  s_emit_guard(x, ins.b, MI_RT_VAL_FLOAT, &slow);
+  s_emit_guard(x, ins.c, MI_RT_VAL_FLOAT, &slow);
+  s_emit_float_arith(x, op == MI_VM_OP_ADD ? SSE_ADD : op == MI_VM_OP_SUB ? SSE_SUB : op == MI_VM_OP_MUL ? SSE_MUL : SSE_DIV, ins);
+  s_jump_label(x->a, false, CC_E, &done);
+  s_bind(x->a, &slow);
+  s_emit_step(x, pc);
+  s_bind(x->a, &done);
+}
+
+// EQ..GTEQ: int operands inline.
+static void s_emit_generic_cmp(MiJitCtx* x, MiVmIns ins, uint32_t pc)
+{
+  MiJitLabel slow = { "slow", {0}, 0 };
+  MiJitLabel done = { "done", {0}, 0 };
+  s_emit_guard(x, ins.b, MI_RT_VAL_INT, &slow);
+  s_emit_guard(x, ins.c, MI_RT_VAL_INT, &slow);
+  s_emit_release(x, JIT_REGS, s_reg_disp(ins.a));
+  s_emit_set_cmp(x, s_emit_int_cmp(x, (MiVmOp)ins.op, ins.b, ins.c), ins.a);
+  s_jump_label(x->a, false, CC_E, &done);
+  s_bind(x->a, &slow);
+  s_emit_step(x, pc);
+  s_bind(x->a, &done);
+}
+
+// JUMP_IF_NOT_<cmp>: int operands inline, the rest asks mi_vm_jit_holds().
+static void s_emit_generic_jump_cmp(MiJitCtx* x, MiVmIns ins, uint32_t pc, uint32_t target)
+{
+  MiJitLabel slow = { "slow", {0}, 0 };
+  MiJitLabel done = { "done", {0}, 0 };
+  MiVmOp cmp = (MiVmOp)(MI_VM_OP_EQ + (ins.op - MI_VM_OP_JUMP_IF_NOT_EQ));
+  s_emit_guard(x, ins.b, MI_RT_VAL_INT, &slow);
+  s_emit_guard(x, ins.c, MI_RT_VAL_INT, &slow);
+  s_jump_pc(x->a, true, s_cc_not(s_emit_int_cmp(x, cmp, ins.b, ins.c)), target);
+  s_jump_label(x->a, false, CC_E, &done);
+  s_bind(x->a, &slow);
+  s_mov_rr(x->a, R_DI, JIT_FRAME);
+  s_mov_imm32(x->a, R_SI, pc);
+  S_CALL(x->a, mi_vm_jit_holds);
+  s_test_al(x->a);
+  s_jump_pc(x->a, true, CC_E, target);
+  s_bind(x->a, &done);
+}
+
+static void s_emit_jump_truthy(MiJitCtx* x, MiVmIns ins, bool on_true, uint32_t target)
+{
+  MiJitLabel slow = { "slow", {0}, 0 };
+  MiJitLabel done = { "done", {0}, 0 };
+  int32_t r = s_reg_disp(ins.a);
+  s_emit_guard(x, ins.a, MI_RT_VAL_BOOL, &slow);
+  s_cmp_imm8(x->a, true, JIT_REGS, r + V_AS, 0);
+  s_jump_pc(x->a, true, on_true ? CC_NE : CC_E, target);
+  s_jump_label(x->a, false, CC_E, &done);
+  s_bind(x->a, &slow);
+  s_lea(x->a, R_DI, JIT_REGS, r);
+  S_CALL(x->a, mi_vm_jit_truthy);
+  s_test_al(x->a);
+  s_jump_pc(x->a, true, on_true ? CC_NE : CC_E, target);
+  s_bind(x->a, &done);
+}
+
+// ADD_LOCAL_CONST / SUB_LOCAL_CONST: int slot and int constant inline.
+static void s_emit_local_const(MiJitCtx* x, MiVmIns ins, uint32_t pc)
+{
+  const MiRtValue* k = &x->chunk->consts[ins.b];
+  if (k->kind != MI_RT_VAL_INT)
+  {
+    s_emit_step(x, pc);
+    return;
+  }
+
+  MiJitLabel slow = { "slow", {0}, 0 };
+  MiJitLabel done = { "done", {0}, 0 };
+  int32_t slot = (int32_t)ins.imm * V_SIZE;
+  s_cmp_imm8(x->a, false, JIT_LOCALS, slot + V_KIND, (int8_t)MI_RT_VAL_INT);
+  s_jump_label(x->a, true, CC_NE, &slow);
+  s_emit_release(x, JIT_REGS, s_reg_disp(ins.a));
+  s_load64(x->a, R_AX, JIT_LOCALS, slot + V_AS);
+  s_mov_imm64(x->a, R_CX, (uint64_t)k->as.i);
+  s_alu_rr(x->a, ins.op == MI_VM_OP_ADD_LOCAL_CONST ? ALU_ADD : ALU_SUB, R_AX, R_CX);
+  s_emit_set_int_rax(x, JIT_REGS, s_reg_disp(ins.a));
+  s_store64(x->a, JIT_LOCALS, slot + V_AS, R_AX);
+  s_jump_label(x->a, false, CC_E, &done);
+  s_bind(x->a, &slow);
+  s_emit_step(x, pc);
+  s_bind(x->a, &done);
+}
+
+static void s_emit_clear_regs(MiJitCtx* x, MiVmIns ins)
+{
+  for (uint32_t i = 0; i < ins.b; ++i)
+  {
+    int32_t r = s_reg_disp((uint8_t)(ins.a + i));
+    s_emit_release(x, JIT_REGS, r);
+    for (int32_t w = 0; w < V_SIZE; w += 8)
+    {
+      s_store_imm(x->a, true, JIT_REGS, r + w, 0);
+    }
+  }
+}
+
+// FOR_PREP: the interpreter reports ranges that are not ints or have a
+// zero step.
+static void s_emit_for_prep(MiJitCtx* x, MiVmIns ins, uint32_t pc, uint32_t target)
+{
+  MiJitLabel slow = { "slow", {0}, 0 };
+  MiJitLabel up = { "up", {0}, 0 };
+  MiJitLabel done = { "done", {0}, 0 };
+  int32_t i = s_reg_disp(ins.a) + V_AS;
+  int32_t limit = s_reg_disp((uint8_t)(ins.a + 1)) + V_AS;
+  int32_t step = s_reg_disp((uint8_t)(ins.a + 2)) + V_AS;
+  for (uint8_t k = 0; k < 3; ++k)
+  {
+    s_emit_guard(x, (uint8_t)(ins.a + k), MI_RT_VAL_INT, &slow);
+  }
+  s_mov_imm32(x->a, R_AX, 0);
+  s_alu_load(x->a, ALU_CMP, R_AX, JIT_REGS, step);
+  s_jump_label(x->a, true, CC_E, &slow);
+  s_jump_label(x->a, true, CC_L, &up);
+  s_load64(x->a, R_AX, JIT_REGS, i);
+  s_alu_load(x->a, ALU_CMP, R_AX, JIT_REGS, limit);
+  s_jump_pc(x->a, true, CC_LE, target);
+  s_jump_label(x->a, false, CC_E, &done);
+  s_bind(x->a, &up);
+  s_load64(x->a, R_AX, JIT_REGS, i);
+  s_alu_load(x->a, ALU_CMP, R_AX, JIT_REGS, limit);
+  s_jump_pc(x->a, true, CC_GE, target);
+  s_jump_label(x->a, false, CC_E, &done);
+  s_bind(x->a, &slow);
+  s_emit_exit(x, pc);
+  s_bind(x->a, &done);
+}
+
+// FOR_LOOP: compares the distance left with the step (see
+// s_vm_for_continues), then bumps the counter in place. The guard keeps a
+// counter that is not an int (only possible in hand-made code) away from
+// the payload store.
+static void s_emit_for_loop(MiJitCtx* x, MiVmIns ins, uint32_t pc, uint32_t target)
+{
+  MiJitLabel slow = { "slow", {0}, 0 };
+  MiJitLabel up = { "up", {0}, 0 };
+  MiJitLabel next = { "next", {0}, 0 };
+  MiJitLabel done = { "done", {0}, 0 };
+  int32_t i = s_reg_disp(ins.a) + V_AS;
+  int32_t limit = s_reg_disp((uint8_t)(ins.a + 1)) + V_AS;
+  int32_t step = s_reg_disp((uint8_t)(ins.a + 2)) + V_AS;
+  s_emit_guard(x, ins.a, MI_RT_VAL_INT, &slow);
+  s_mov_imm32(x->a, R_AX, 0);
+  s_alu_load(x->a, ALU_CMP, R_AX, JIT_REGS, step);
+  s_jump_label(x->a, true, CC_L, &up);
+  s_load64(x->a, R_AX, JIT_REGS, i);
+  s_alu_load(x->a, ALU_SUB, R_AX, JIT_REGS, limit);
+  s_mov_imm32(x->a, R_CX, 0);
+  s_alu_load(x->a, ALU_SUB, R_CX, JIT_REGS, step);
+  s_alu_rr(x->a, ALU_CMP, R_AX, R_CX);
+  s_jump_label(x->a, true, CC_BE, &done);
+  s_jump_label(x->a, false, CC_E, &next);
+  s_bind(x->a, &up);
+  s_load64(x->a, R_AX, JIT_REGS, limit);
+  s_alu_load(x->a, ALU_SUB, R_AX, JIT_REGS, i);
+  s_alu_load(x->a, ALU_CMP, R_AX, JIT_REGS, step);
+  s_jump_label(x->a, true, CC_BE, &done);
+  s_bind(x->a, &next);
+  s_load64(x->a, R_AX, JIT_REGS, i);
+  s_alu_load(x->a, ALU_ADD, R_AX, JIT_REGS, step);
+  s_store64(x->a, JIT_REGS, i, R_AX);
+  s_jump_pc(x->a, false, CC_E, target);
+  s_bind(x->a, &slow);
+  s_emit_exit(x, pc);
+  s_bind(x->a, &done);
+}
+
+static MiJitCond s_int_cond(MiVmOp op)
+{
+  switch (op)
+  {
+    case MI_VM_OP_EQ_INT:   case MI_VM_OP_JUMP_IF_NOT_EQ_INT:   return CC_E;
+    case MI_VM_OP_NEQ_INT:  case MI_VM_OP_JUMP_IF_NOT_NEQ_INT:  return CC_NE;
+    case MI_VM_OP_LT_INT:   case MI_VM_OP_JUMP_IF_NOT_LT_INT:   return CC_L;
+    case MI_VM_OP_LTEQ_INT: case MI_VM_OP_JUMP_IF_NOT_LTEQ_INT: return CC_LE;
+    case MI_VM_OP_GT_INT:   case MI_VM_OP_JUMP_IF_NOT_GT_INT:   return CC_G;
+    default:                                                    return CC_GE;
+  }
+}
+
+// Emit the template of the instruction at pc. Returns false when the
+// instruction is left to the interpreter (the template is just an exit).
+static bool s_emit_ins(MiJitCtx* x, uint32_t pc)
+{
+  MiVmIns ins = x->chunk->code[pc];
+  uint32_t target = (uint32_t)((int64_t)pc + 1 + ins.imm);
+
+  switch ((MiVmOp)ins.op)
+  {
+    case MI_VM_OP_NOOP:
+      return true;
+
+    case MI_VM_OP_LOAD_CONST:
+      s_emit_load_const(x, ins);
+      return true;
+
+    case MI_VM_OP_MOV:
+      s_emit_copy(x, JIT_REGS, s_reg_disp(ins.a), JIT_REGS, s_reg_disp(ins.b));
+      return true;
+
+    case MI_VM_OP_LOAD_LOCAL:
+      s_emit_copy(x, JIT_REGS, s_reg_disp(ins.a), JIT_LOCALS, ins.imm * V_SIZE);
+      return true;
+
+    case MI_VM_OP_STORE_LOCAL:
+      s_emit_copy(x, JIT_LOCALS, ins.imm * V_SIZE, JIT_REGS, s_reg_disp(ins.a));
+      return true;
+
+    case MI_VM_OP_ADD_INT: s_emit_int_arith(x, ALU_ADD, ins); return true;
+    case MI_VM_OP_SUB_INT: s_emit_int_arith(x, ALU_SUB, ins); return true;
+    case MI_VM_OP_MUL_INT: s_emit_int_arith(x, ALU_IMUL, ins); return true;
+
+    case MI_VM_OP_ADD_FLOAT: s_emit_float_arith(x, SSE_ADD, ins); return true;
+    case MI_VM_OP_SUB_FLOAT: s_emit_float_arith(x, SSE_SUB, ins); return true;
+    case MI_VM_OP_MUL_FLOAT: s_emit_float_arith(x, SSE_MUL, ins); return true;
+    case MI_VM_OP_DIV_FLOAT: s_emit_float_arith(x, SSE_DIV, ins); return true;
+
+    case MI_VM_OP_EQ_INT:
+    case MI_VM_OP_NEQ_INT:
+    case MI_VM_OP_LT_INT:
+    case MI_VM_OP_LTEQ_INT:
+    case MI_VM_OP_GT_INT:
+    case MI_VM_OP_GTEQ_INT:
+      s_emit_release(x, JIT_REGS, s_reg_disp(ins.a));
+      s_load64(x->a, R_AX, JIT_REGS, s_reg_disp(ins.b) + V_AS);
+      s_alu_load(x->a, ALU_CMP, R_AX, JIT_REGS, s_reg_disp(ins.c) + V_AS);
+      s_emit_set_cmp(x, s_int_cond((MiVmOp)ins.op), ins.a);
+      return true;
+
+    case MI_VM_OP_LT_FLOAT:
+    case MI_VM_OP_LTEQ_FLOAT:
+    case MI_VM_OP_GT_FLOAT:
+    case MI_VM_OP_GTEQ_FLOAT:
+      {
+        MiVmOp cmp = (MiVmOp)(MI_VM_OP_LT + (ins.op - MI_VM_OP_LT_FLOAT));
+        s_emit_release(x, JIT_REGS, s_reg_disp(ins.a));
+        s_emit_set_cmp(x, s_emit_float_cmp(x, cmp, ins.b, ins.c), ins.a);
+      }
+      return true;
+
+    case MI_VM_OP_JUMP_IF_NOT_EQ_INT:
+    case MI_VM_OP_JUMP_IF_NOT_NEQ_INT:
+    case MI_VM_OP_JUMP_IF_NOT_LT_INT:
+    case MI_VM_OP_JUMP_IF_NOT_LTEQ_INT:
+    case MI_VM_OP_JUMP_IF_NOT_GT_INT:
+    case MI_VM_OP_JUMP_IF_NOT_GTEQ_INT:
+      s_load64(x->a, R_AX, JIT_REGS, s_reg_disp(ins.b) + V_AS);
+      s_alu_load(x->a, ALU_CMP, R_AX, JIT_REGS, s_reg_disp(ins.c) + V_AS);
+      s_jump_pc(x->a, true, s_cc_not(s_int_cond((MiVmOp)ins.op)), target);
+      return true;
+
+    case MI_VM_OP_ADD:
+    case MI_VM_OP_SUB:
+    case MI_VM_OP_MUL:
+    case MI_VM_OP_DIV:
+      s_emit_generic_arith(x, ins, pc);
+      return true;
+
+    case MI_VM_OP_EQ:
+    case MI_VM_OP_NEQ:
+    case MI_VM_OP_LT:
+    case MI_VM_OP_LTEQ:
+    case MI_VM_OP_GT:
+    case MI_VM_OP_GTEQ:
+      s_emit_generic_cmp(x, ins, pc);
+      return true;
+
+    case MI_VM_OP_JUMP_IF_NOT_EQ:
+    case MI_VM_OP_JUMP_IF_NOT_NEQ:
+    case MI_VM_OP_JUMP_IF_NOT_LT:
+    case MI_VM_OP_JUMP_IF_NOT_LTEQ:
+    case MI_VM_OP_JUMP_IF_NOT_GT:
+    case MI_VM_OP_JUMP_IF_NOT_GTEQ:
+      s_emit_generic_jump_cmp(x, ins, pc, target);
+      return true;
+
+    case MI_VM_OP_JUMP:
+      s_jump_pc(x->a, false, CC_E, target);
+      return true;
+
+    case MI_VM_OP_JUMP_IF_TRUE:
+    case MI_VM_OP_JUMP_IF_FALSE:
+      s_emit_jump_truthy(x, ins, ins.op == MI_VM_OP_JUMP_IF_TRUE, target);
+      return true;
+
+    case MI_VM_OP_ADD_LOCAL_CONST:
+    case MI_VM_OP_SUB_LOCAL_CONST:
+      s_emit_local_const(x, ins, pc);
+      return true;
+
+    case MI_VM_OP_CLEAR_REGS:
+      s_emit_clear_regs(x, ins);
+      return true;
+
+    case MI_VM_OP_FOR_PREP:
+      s_emit_for_prep(x, ins, pc, target);
+      return true;
+
+    case MI_VM_OP_FOR_LOOP:
+      s_emit_for_loop(x, ins, pc, target);
+      return true;
+
+    case MI_VM_OP_MOD:
+    case MI_VM_OP_ITER_NEXT:
+    case MI_VM_OP_INDEX:
+    case MI_VM_OP_STORE_INDEX:
+    case MI_VM_OP_LEN:
+    case MI_VM_OP_LOAD_VAR:
+    case MI_VM_OP_STORE_VAR:
+    case MI_VM_OP_LOAD_UPVAL:
+    case MI_VM_OP_STORE_UPVAL:
+    case MI_VM_OP_ADD_VAR_CONST:
+    case MI_VM_OP_SUB_VAR_CONST:
+    case MI_VM_OP_SCOPE_PUSH:
+    case MI_VM_OP_SCOPE_POP:
+    case MI_VM_OP_SCOPE_RESET:
+    case MI_VM_OP_ARG_CLEAR:
+      s_emit_step(x, pc);
+      return true;
+
+    default:
+      // Calls, returns and the rarer opcodes run in the interpreter.
+      s_emit_exit(x, pc);
+      return false;
+  }
+}
+
+//----------------------------------------------------------
+// Public API
+//----------------------------------------------------------
+
+MiJitCode* mi_jit_compile(const MiVmChunk* chunk, bool listing)
+{
+  // Kinds are stored as one qword (clearing the compact layout's aux word),
+  // which needs the payload to start at offset 8.
+  if (!chunk || chunk->code_count == 0 || chunk->code_count > UINT32_MAX / 2u ||
+      sizeof(MiRtValueKind) != 4u || V_KIND != 0 || V_AS != 8)
+  {
+    return NULL;
+  }
+
+  MiJitAsm a;
+  memset(&a, 0, sizeof(a));
+  a.listing = listing;
+
+  MiJitCode* code = (MiJitCode*)calloc(1, sizeof(*code));
+  if (!code)
+  {
+    return NULL;
+  }
+  code->code_count = chunk->code_count;
+  code->pc_offsets = (uint32_t*)malloc((chunk->code_count + 1u) * sizeof(uint32_t));
+  code->pc_native = (uint8_t*)malloc(chunk->code_count + 1u);
+  if (!code->pc_offsets || !code->pc_native)
+  {
+    mi_jit_free(code);
+    return NULL;
+  }
+
+  // Entry: size_t fn(MiJitFrame* frame, const void* target). Five pushes
+  // keep the stack 16-byte aligned for the helper calls.
+  if (listing)
+  {
+    s_text(&a, "  entry:\n");
+  }
+  s_push(&a, R_BX);
+  s_push(&a, R_12);
+  s_push(&a, R_13);
+  s_push(&a, R_14);
+  s_push(&a, R_15);
+  s_mov_rr(&a, JIT_FRAME, R_DI);
+  s_load64(&a, JIT_REGS, JIT_FRAME, (int32_t)offsetof(MiJitFrame, regs));
+  s_load64(&a, JIT_LOCALS, JIT_FRAME, (int32_t)offsetof(MiJitFrame, locals));
+  s_load64(&a, JIT_VM, JIT_FRAME, (int32_t)offsetof(MiJitFrame, vm));
+  {
+    size_t at = a.len;
+    s_byte(&a, 0xFF);
+    s_byte(&a, 0xE6);
+    s_note(&a, at, "jmp rsi");
+  }
+
+  MiJitCtx x;
+  x.a = &a;
+  x.chunk = chunk;
+  x.epilogue = a.len;
+  if (listing)
+  {
+    s_text(&a, "  exit:\n");
+  }
+  s_pop(&a, R_15);
+  s_pop(&a, R_14);
+  s_pop(&a, R_13);
+  s_pop(&a, R_12);
+  s_pop(&a, R_BX);
+  {
+    size_t at = a.len;
+    s_byte(&a, 0xC3);
+    s_note(&a, at, "ret");
+  }
+
+  for (size_t pc = 0; pc < chunk->code_count; ++pc)
+  {
+    if (listing)
+    {
+      const MiVmIns* ins = &chunk->code[pc];
+      char line[96];
+      snprintf(line, sizeof(line), "  @%04zu  %-6s a=%u b=%u c=%u imm=%d\n",
+          pc, mi_vm_op_name((MiVmOp)ins->op), ins->a, ins->b, ins->c, (int)ins->imm);
+      s_text(&a, line);
+    }
+    code->pc_offsets[pc] = (uint32_t)a.len;
+    code->pc_native[pc] = s_emit_ins(&x, (uint32_t)pc) ? 1u : 0u;
+  }
+  if (listing)
+  {
+    s_text(&a, "  @end\n");
+  }
+  code->pc_offsets[chunk->code_count] = (uint32_t)a.len;
+  code->pc_native[chunk->code_count] = 0u;
+  s_emit_exit(&x, (uint32_t)chunk->code_count);
+
+  for (size_t i = 0; i < a.fixup_count; ++i)
+  {
+    const MiJitFixup* f = &a.fixups[i];
+    s_patch32(&a, f->at, (uint32_t)(code->pc_offsets[f->target_pc] - (f->at + 4u)));
+  }
+  free(a.fixups);
+
+  // Copy into a fresh mapping, then make it executable (never both at once).
+  long page = sysconf(_SC_PAGESIZE);
+  size_t page_size = page > 0 ? (size_t)page : 4096u;
+  size_t size = (a.len + page_size - 1u) / page_size * page_size;
+  void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED)
+  {
+    free(a.buf);
+    free(a.text);
+    mi_jit_free(code);
+    return NULL;
+  }
+  memcpy(mem, a.buf, a.len);
+  free(a.buf);
+  if (mprotect(mem, size, PROT_READ | PROT_EXEC) != 0)
+  {
+    munmap(mem, size);
+    free(a.text);
+    mi_jit_free(code);
+    return NULL;
+  }
+
+  code->mem = (uint8_t*)mem;
+  code->mem_size = size;
+  code->listing = a.text;
+  return code;
+}
+
+MiJitCode* mi_jit_adopt(size_t (*fn)(MiJitFrame* frame, size_t pc), const uint8_t* native, size_t code_count)
+{
+  MiJitCode* code = (MiJitCode*)calloc(1, sizeof(*code));
+  if (!code)
+  {
+    return NULL;
+  }
+  code->aot = fn;
+  code->code_count = code_count;
+  code->pc_native = (uint8_t*)malloc(code_count + 1u);
+  if (!code->pc_native)
+  {
+    free(code);
+    return NULL;
+  }
+  memcpy(code->pc_native, native, code_count);
+  code->pc_native[code_count] = 0u;
+  return code;
+}
+
+void mi_jit_free(MiJitCode* code)
+{
+  if (!code)
+  {
+    return;
+  }
+  if (code->mem)
+  {
+    munmap(code->mem, code->mem_size);
+  }
+  free(code->pc_offsets);
+  free(code->pc_native);
+  free(code->listing);
+  free(code);
+}
+
+bool mi_jit_is_native(const MiJitCode* code, size_t pc)
+{
+  return pc < code->code_count && code->pc_native[pc] != 0u;
+}
+
+size_t mi_jit_enter(const MiJitCode* code, MiJitFrame* frame, size_t pc)
+{
+  if (code->aot)
+  {
+    return code->aot(frame, pc);
+  }
+
+  MiJitEntryFn fn;
+  const uint8_t* entry = code->mem;
+  memcpy(&fn, &entry, sizeof(fn));
+  return fn(frame, code->mem + code->pc_offsets[pc]);
+}
+
+void mi_jit_dump(const MiJitCode* code, const MiVmChunk* chunk)
+{
+  if (!code || code->aot)
+  {
+    return;
+  }
+  printf("=== JIT %.*s (%zu ins -> %u bytes) ===\n",
+      (int)chunk->dbg_name.length, chunk->dbg_name.ptr ? chunk->dbg_name.ptr : "",
+      code->code_count, code->pc_offsets[code->code_count]);
+  if (code->listing)
+  {
+    fputs(code->listing, stdout);
+  }
+  printf("\n");
+}
+
+#else // !MI_VM_JIT
+
+MiJitCode* mi_jit_compile(const MiVmChunk* chunk, bool listing)
+{
+  (void)chunk;
+  (void)listing;
+  return NULL;
+}
+
+MiJitCode* mi_jit_adopt(size_t (*fn)(MiJitFrame* frame, size_t pc), const uint8_t* native, size_t code_count)
+{
+  (void)fn;
+  (void)native;
+  (void)code_count;
+  return NULL;
+}
+
+void mi_jit_free(MiJitCode* code)
+{
+  (void)code;
+}
+
+bool mi_jit_is_native(const MiJitCode* code, size_t pc)
+{
+  (void)code;
+  (void)pc;
+  return false;
+}
+
+size_t mi_jit_enter(const MiJitCode* code, MiJitFrame* frame, size_t pc)
+{
+  (void)code;
+  (void)frame;
+  return pc;
+}
+
+void mi_jit_dump(const MiJitCode* code, const MiVmChunk* chunk)
+{
+  (void)code;
+  (void)chunk;
+}
+
+#endif // MI_VM_JIT
@@ -0,0 +1,97 @@
+#ifndef MI_JIT_H
+#define MI_JIT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mi_vm.h"
+
+/**
+ * Baseline template JIT for x86-64 (System V).
+ *
+ * A hot chunk is translated instruction by instruction: register moves,
+ * typed arithmetic, compares and jumps become inline machine code with
+ * guards on the operand kinds; variable, index and iterator opcodes call
+ * back into the interpreter's own handlers (mi_vm_jit_step). Calls, returns
+ * and the remaining opcodes are left to the interpreter: the generated code
+ * returns the pc of the instruction to run there, and the interpreter
+ * re-enters at its next loop back-edge, frame entry or call return.
+ *
+ * Every instruction is an entry point. Values stay in the frame's register
+ * window and slot frame, so nothing needs to be reconstructed on exit.
+ */
+
+typedef struct MiJitCode MiJitCode;
+
+// What generated code runs against. Filled by the interpreter on each entry.
+typedef struct MiJitFrame
+{
+  MiVm*            vm;
+  const MiVmChunk* chunk;
+  MiRtValue*       regs;    // Register window of the running frame.
+  MiRtValue*       locals;  // Slot frame of the running command (vm->locals + local_base).
+} MiJitFrame;
+
+/**
+ * Translate a verified chunk to native code.
+ * @param chunk   Chunk to translate (its subchunks are not visited).
+ * @param listing Keep an annotated listing of the generated code for mi_jit_dump().
+ * @return The compiled code, or NULL when the JIT is unavailable or out of memory.
+ */
+MiJitCode* mi_jit_compile(const MiVmChunk* chunk, bool listing);
+
+/**
+ * Wrap a chunk function built ahead of time (see mi_aot.h) so the VM runs it
+ * like JIT output.
+ * @param fn         Runs the chunk from pc; returns like mi_jit_enter().
+ * @param native     1 for each instruction fn runs natively (copied).
+ * @param code_count Instruction count of the chunk.
+ * @return The wrapper, or NULL when the JIT is unavailable or out of memory.
+ */
+MiJitCode* mi_jit_adopt(size_t (*fn)(MiJitFrame* frame, size_t pc), const uint8_t* native, size_t code_count);
+
+/**
+ * Free code returned by mi_jit_compile() or mi_jit_adopt(). NULL is ignored.
+ */
+void mi_jit_free(MiJitCode* code);
+
+/**
+ * Whether the instruction at pc runs natively. Entering at an instruction
+ * the JIT leaves to the interpreter would return straight away.
+ */
+bool mi_jit_is_native(const MiJitCode* code, size_t pc);
+
+/**
+ * Run compiled code from instruction pc.
+ * @return pc of the first instruction the interpreter has to run, or
+ *         code_count when execution fell off the end of the chunk.
+ */
+size_t mi_jit_enter(const MiJitCode* code, MiJitFrame* frame, size_t pc);
+
+/**
+ * Print the generated code (requires listing = true at compile time) to stdout.
+ */
+void mi_jit_dump(const MiJitCode* code, const MiVmChunk* chunk);
+
+//----------------------------------------------------------
+// Slow paths called from generated code (implemented in mi_vm.c)
+//----------------------------------------------------------
+
+// Release a heap value about to be overwritten with a scalar; leaves it void.
+void mi_vm_jit_release(MiVm* vm, MiRtValue* v);
+
+// *dst = *src with reference counting (mi_rt_value_assign).
+void mi_vm_jit_assign(MiVm* vm, MiRtValue* dst, const MiRtValue* src);
+
+// Run the instruction at pc with the interpreter's handler. Only for opcodes
+// that do not change frames or pc.
+void mi_vm_jit_step(MiJitFrame* frame, uint32_t pc);
+
+// Truthiness used by JUMP_IF_TRUE / JUMP_IF_FALSE.
+bool mi_vm_jit_truthy(const MiRtValue* v);
+
+// Whether the compare of a generic JUMP_IF_NOT_<cmp> at pc holds.
+bool mi_vm_jit_holds(MiJitFrame* frame, uint32_t pc);
+
+#endif // MI_JIT_H
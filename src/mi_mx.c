@@ -1,4 +1,6 @@
 #include "mi_mx.h"
+#include "mi_verify.h"
+#include "mi_compile.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -354,7 +356,7 @@ static bool s_save_chunk(FILE* f, const MiVmChunk* c, const MiMixChunkMap* map)
         break;
       case MI_RT_VAL_STRING:
         if (!s_write_u8(f, MI_MX_CONST_STRING)) return false;
-        if (!s_write_slice(f, v.as.s)) return false;
+        if (!s_write_slice(f, mi_rt_value_slice(v))) return false;
         break;
       default:
         return false;
@@ -422,6 +424,36 @@ static bool s_save_chunk(FILE* f, const MiVmChunk* c, const MiMixChunkMap* map)
     }
   }
 
+  // Slot-resolved locals (user command bodies).
+  if (!s_write_u32(f, c->local_count))
+  {
+    return false;
+  }
+  if (!s_write_u32(f, c->param_slot_count))
+  {
+    return false;
+  }
+  for (uint32_t i = 0; i < c->param_slot_count; ++i)
+  {
+    if (!s_write_u32(f, (uint32_t)c->param_slots[i]))
+    {
+      return false;
+    }
+  }
+
+  // Upvalues (blocks created inside command bodies).
+  if (!s_write_u32(f, c->upval_count))
+  {
+    return false;
+  }
+  for (uint32_t i = 0; i < c->upval_count; ++i)
+  {
+    if (!s_write_u32(f, (uint32_t)c->upval_outer[i]))
+    {
+      return false;
+    }
+  }
+
   // Debug info: optional payload, but the presence byte is always encoded.
   // This keeps the stream layout stable across versions (version is only a
   // compatibility gate: file_version <= MI_MX_VERSION).
@@ -461,18 +493,20 @@ bool mi_mx_save_file(const MiVmChunk* entry, const char* filename)
     return false;
   }
 
-  MiMixChunkMap map = {0};
-  MiMixChunkList list = {0};
-  if (!s_collect_chunks_dfs(entry, &map, &list))
+  FILE* f = fopen(filename, "wb");
+  if (!f)
   {
-    s_map_destroy(&map);
-    s_list_destroy(&list);
     return false;
   }
 
-  FILE* f = fopen(filename, "wb");
-  if (!f)
+  // Bodies still waiting for their first call are compiled now, so programs
+  // loaded from MX never compile anything at run time.
+  MiMixChunkMap map = {0};
+  MiMixChunkList list = {0};
+  if (!mi_compile_force_all((MiVmChunk*)entry) || !s_collect_chunks_dfs(entry, &map, &list))
   {
+    fclose(f);
+    (void)remove(filename);
     s_map_destroy(&map);
     s_list_destroy(&list);
     return false;
@@ -684,6 +718,67 @@ static bool s_load_chunk(FILE* f, XArena* arena, MiVmChunk* out, uint32_t versio
     }
   }
 
+  // Slot-resolved locals; older files bind every local by name.
+  if (version >= 4u)
+  {
+    uint32_t param_n = 0;
+    if (!s_read_u32(f, &out->local_count) || !s_read_u32(f, &param_n))
+    {
+      return false;
+    }
+    if (param_n)
+    {
+      out->param_slots = (int32_t*)x_arena_alloc_zero(arena, (size_t)param_n * sizeof(int32_t));
+      if (!out->param_slots)
+      {
+        return false;
+      }
+    }
+    out->param_slot_count = param_n;
+
+    for (uint32_t i = 0; i < param_n; ++i)
+    {
+      uint32_t slot = 0;
+      if (!s_read_u32(f, &slot))
+      {
+        return false;
+      }
+      out->param_slots[i] = (int32_t)slot;
+      if (out->param_slots[i] >= (int32_t)out->local_count)
+      {
+        return false;
+      }
+    }
+  }
+
+  if (version >= 5u)
+  {
+    uint32_t upval_n = 0;
+    if (!s_read_u32(f, &upval_n) || upval_n > out->symbol_count)
+    {
+      return false;
+    }
+    if (upval_n)
+    {
+      out->upval_outer = (int32_t*)x_arena_alloc_zero(arena, (size_t)upval_n * sizeof(int32_t));
+      if (!out->upval_outer)
+      {
+        return false;
+      }
+    }
+    out->upval_count = upval_n;
+
+    for (uint32_t i = 0; i < upval_n; ++i)
+    {
+      uint32_t outer = 0;
+      if (!s_read_u32(f, &outer))
+      {
+        return false;
+      }
+      out->upval_outer[i] = (int32_t)outer;
+    }
+  }
+
   // Debug info: always encoded as a presence byte + optional payload.
   // Do not gate this on file version; version is only used as a compatibility
   // check (file_version <= MI_MX_VERSION).
@@ -730,48 +825,33 @@ static bool s_load_chunk(FILE* f, XArena* arena, MiVmChunk* out, uint32_t versio
   return true;
 }
 
-bool mi_mx_load_file(MiVm* vm, const char* filename, MiMixProgram* out_program)
+// Load a program from an open stream. The caller closes it.
+static bool s_load_stream(MiVm* vm, FILE* f, MiMixProgram* out_program)
 {
-  if (!vm || !filename || !out_program)
-  {
-    return false;
-  }
-
   memset(out_program, 0, sizeof(*out_program));
 
-  FILE* f = fopen(filename, "rb");
-  if (!f)
-  {
-    return false;
-  }
-
   MiMixHeader h;
   if (fread(&h, sizeof(h), 1, f) != 1)
   {
-    fclose(f);
     return false;
   }
 
   if (h.magic[0] != MI_MX_MAGIC_0 || h.magic[1] != MI_MX_MAGIC_1 || h.magic[2] != MI_MX_MAGIC_2 || h.magic[3] != MI_MX_MAGIC_3)
   {
-    fclose(f);
     return false;
   }
   if (h.version < 1u || h.version > MI_MX_VERSION)
   {
-    fclose(f);
     return false;
   }
   if (h.chunk_count == 0 || h.entry_chunk_index >= h.chunk_count)
   {
-    fclose(f);
     return false;
   }
 
   XArena* arena = x_arena_create(64u * 1024u);
   if (!arena)
   {
-    fclose(f);
     return false;
   }
 
@@ -780,7 +860,6 @@ bool mi_mx_load_file(MiVm* vm, const char* filename, MiMixProgram* out_program)
   if (!chunks || !subidx)
   {
     x_arena_destroy(arena);
-    fclose(f);
     return false;
   }
 
@@ -824,7 +903,12 @@ bool mi_mx_load_file(MiVm* vm, const char* filename, MiMixProgram* out_program)
     }
   }
 
-  fclose(f);
+  // A damaged or foreign file is rejected here rather than trusted by the
+  // dispatch loop.
+  for (uint32_t i = 0; ok && i < h.chunk_count; ++i)
+  {
+    ok = mi_verify_chunk(chunks[i]);
+  }
 
   if (!ok)
   {
@@ -839,6 +923,46 @@ bool mi_mx_load_file(MiVm* vm, const char* filename, MiMixProgram* out_program)
   return true;
 }
 
+bool mi_mx_load_file(MiVm* vm, const char* filename, MiMixProgram* out_program)
+{
+  if (!vm || !filename || !out_program)
+  {
+    return false;
+  }
+
+  FILE* f = fopen(filename, "rb");
+  if (!f)
+  {
+    memset(out_program, 0, sizeof(*out_program));
+    return false;
+  }
+
+  bool ok = s_load_stream(vm, f, out_program);
+  fclose(f);
+  return ok;
+}
+
+bool mi_mx_load_memory(MiVm* vm, const void* data, size_t size, MiMixProgram* out_program)
+{
+  if (!vm || !data || !out_program)
+  {
+    return false;
+  }
+
+  // The chunk reader works on streams; go through an anonymous temp file
+  // rather than a second, in-memory reader.
+  FILE* f = tmpfile();
+  if (!f)
+  {
+    memset(out_program, 0, sizeof(*out_program));
+    return false;
+  }
+
+  bool ok = fwrite(data, 1, size, f) == size && fseek(f, 0, SEEK_SET) == 0 && s_load_stream(vm, f, out_program);
+  fclose(f);
+  return ok;
+}
+
 void mi_mx_program_destroy(MiMixProgram* p)
 {
   if (!p)
@@ -846,6 +970,15 @@ void mi_mx_program_destroy(MiMixProgram* p)
     return;
   }
 
+  // Execution copies are allocated by the VM on first run, outside the arena.
+  for (size_t i = 0; i < p->chunk_count; ++i)
+  {
+    if (p->chunks && p->chunks[i])
+    {
+      mi_vm_chunk_release_exec(p->chunks[i]);
+    }
+  }
+
   if (p->arena)
   {
     x_arena_destroy(p->arena);
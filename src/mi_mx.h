@@ -43,6 +43,12 @@ bool mi_mx_peek_file_version(const char* filename, uint32_t* out_version);
  */
 bool mi_mx_load_file(MiVm* vm, const char* filename, MiMixProgram* out_program);
 
+/**
+ * Load a MIX program from an in-memory copy of a MX file (as embedded in
+ * AOT objects). Same rules as mi_mx_load_file().
+ */
+bool mi_mx_load_memory(MiVm* vm, const void* data, size_t size, MiMixProgram* out_program);
+
 /**
  * Free all memory owned by a loaded MX program.
  */
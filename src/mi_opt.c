@@ -0,0 +1,1258 @@
+#include "mi_opt.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#if MI_VM_REG_COUNT > 32
+#error "mi_opt: register sets are 32-bit masks"
+#endif
+
+#define MI_OPT_ALL_REGS   0xFFFFFFFFu
+#define MI_OPT_UNKNOWN    (-1)
+#define MI_OPT_UNVISITED  (-2)
+
+//----------------------------------------------------------
+// Instruction info
+//----------------------------------------------------------
+
+// Registers an instruction reads, always writes (kills) and may write
+// (clobbers, a superset of kills).
+typedef struct MiOptRegs
+{
+  uint32_t reads;
+  uint32_t kills;
+  uint32_t clobbers;
+} MiOptRegs;
+
+static bool s_is_cond_jump(MiVmOp op)
+{
+  switch (op)
+  {
+    case MI_VM_OP_JUMP_IF_TRUE:
+    case MI_VM_OP_JUMP_IF_FALSE:
+    case MI_VM_OP_JUMP_IF_NOT_EQ:
+    case MI_VM_OP_JUMP_IF_NOT_NEQ:
+    case MI_VM_OP_JUMP_IF_NOT_LT:
+    case MI_VM_OP_JUMP_IF_NOT_LTEQ:
+    case MI_VM_OP_JUMP_IF_NOT_GT:
+    case MI_VM_OP_JUMP_IF_NOT_GTEQ:
+    case MI_VM_OP_JUMP_IF_NOT_EQ_INT:
+    case MI_VM_OP_JUMP_IF_NOT_NEQ_INT:
+    case MI_VM_OP_JUMP_IF_NOT_LT_INT:
+    case MI_VM_OP_JUMP_IF_NOT_LTEQ_INT:
+    case MI_VM_OP_JUMP_IF_NOT_GT_INT:
+    case MI_VM_OP_JUMP_IF_NOT_GTEQ_INT:
+    case MI_VM_OP_FOR_PREP:
+    case MI_VM_OP_FOR_LOOP:
+      return true;
+    default:
+      return false;
+  }
+}
+
+static bool s_is_jump(MiVmOp op)
+{
+  return op == MI_VM_OP_JUMP || s_is_cond_jump(op);
+}
+
+// Control never reaches the next instruction.
+static bool s_no_fallthrough(MiVmOp op)
+{
+  return op == MI_VM_OP_JUMP || op == MI_VM_OP_RETURN || op == MI_VM_OP_HALT;
+}
+
+static bool s_is_typed_binary(MiVmOp op)
+{
+  return op >= MI_VM_OP_ADD_INT && op <= MI_VM_OP_GTEQ_FLOAT;
+}
+
+// Writes its destination register and nothing else, never faults and never
+// calls out. These may be removed when the result is unused, or executed
+// speculatively in front of a loop.
+static bool s_is_pure(MiVmOp op)
+{
+  switch (op)
+  {
+    case MI_VM_OP_LOAD_CONST:
+    case MI_VM_OP_LOAD_BLOCK:
+    case MI_VM_OP_MOV:
+    case MI_VM_OP_LIST_NEW:
+    case MI_VM_OP_DICT_NEW:
+    case MI_VM_OP_LOAD_LOCAL:
+      return true;
+    default:
+      return s_is_typed_binary(op);
+  }
+}
+
+static bool s_reg_bit(uint8_t r, uint32_t* mask)
+{
+  if (r >= MI_VM_REG_COUNT)
+  {
+    return false;
+  }
+  *mask |= (uint32_t)1u << r;
+  return true;
+}
+
+// Register operands of an instruction. Unknown opcodes read and may write
+// every register. Returns false when an operand is outside the VM window.
+static bool s_ins_regs(MiVmIns ins, MiOptRegs* out)
+{
+  MiOptRegs u = {0u, 0u, 0u};
+  bool ok = true;
+
+  switch ((MiVmOp)ins.op)
+  {
+    case MI_VM_OP_NOOP:
+    case MI_VM_OP_ARG_CLEAR:
+    case MI_VM_OP_ARG_PUSH_CONST:
+    case MI_VM_OP_ARG_PUSH_VAR_SYM:
+    case MI_VM_OP_ARG_PUSH_SYM:
+    case MI_VM_OP_ARG_PUSH_LOCAL:
+    case MI_VM_OP_ARG_SAVE:
+    case MI_VM_OP_ARG_RESTORE:
+    case MI_VM_OP_SCOPE_PUSH:
+    case MI_VM_OP_SCOPE_POP:
+    case MI_VM_OP_SCOPE_RESET:
+    case MI_VM_OP_JUMP:
+    case MI_VM_OP_HALT:
+      break;
+
+    case MI_VM_OP_LOAD_CONST:
+    case MI_VM_OP_LOAD_BLOCK:
+    case MI_VM_OP_LIST_NEW:
+    case MI_VM_OP_DICT_NEW:
+    case MI_VM_OP_LOAD_VAR:
+    case MI_VM_OP_LOAD_LOCAL:
+    case MI_VM_OP_LOAD_UPVAL:
+    case MI_VM_OP_CALL_CMD:
+    case MI_VM_OP_CALL_CMD_FAST:
+    case MI_VM_OP_CALL_CMD_FAST_VAR:
+    case MI_VM_OP_CALL_CMD_TRUSTED:
+    case MI_VM_OP_ADD_VAR_CONST:
+    case MI_VM_OP_SUB_VAR_CONST:
+    case MI_VM_OP_ADD_LOCAL_CONST:
+    case MI_VM_OP_SUB_LOCAL_CONST:
+      ok = s_reg_bit(ins.a, &u.kills);
+      break;
+
+    case MI_VM_OP_MOV:
+    case MI_VM_OP_LEN:
+    case MI_VM_OP_NEG:
+    case MI_VM_OP_NOT:
+    case MI_VM_OP_LOAD_MEMBER:
+    case MI_VM_OP_LOAD_INDIRECT_VAR:
+    case MI_VM_OP_CALL_CMD_DYN:
+    case MI_VM_OP_TAIL_CALL:
+    case MI_VM_OP_CALL_BLOCK:
+      ok = s_reg_bit(ins.b, &u.reads) && s_reg_bit(ins.a, &u.kills);
+      break;
+
+    case MI_VM_OP_STORE_VAR:
+    case MI_VM_OP_DEFINE_VAR:
+    case MI_VM_OP_STORE_LOCAL:
+    case MI_VM_OP_STORE_UPVAL:
+    case MI_VM_OP_ARG_PUSH:
+    case MI_VM_OP_JUMP_IF_TRUE:
+    case MI_VM_OP_JUMP_IF_FALSE:
+    case MI_VM_OP_RETURN:
+      ok = s_reg_bit(ins.a, &u.reads);
+      break;
+
+    case MI_VM_OP_LIST_PUSH:
+    case MI_VM_OP_STORE_MEMBER:
+      ok = s_reg_bit(ins.a, &u.reads) && s_reg_bit(ins.b, &u.reads);
+      break;
+
+    case MI_VM_OP_STORE_INDEX:
+      ok = s_reg_bit(ins.a, &u.reads) && s_reg_bit(ins.b, &u.reads) && s_reg_bit(ins.c, &u.reads);
+      break;
+
+    case MI_VM_OP_CLEAR_REGS:
+      for (uint32_t i = 0; ok && i < ins.b; ++i)
+      {
+        ok = s_reg_bit((uint8_t)(ins.a + i), &u.kills);
+      }
+      break;
+
+    case MI_VM_OP_FOR_PREP:
+    case MI_VM_OP_FOR_LOOP:
+      for (uint32_t i = 0; ok && i < 3u; ++i)
+      {
+        ok = s_reg_bit((uint8_t)(ins.a + i), &u.reads);
+      }
+      if (ok && ins.op == MI_VM_OP_FOR_LOOP)
+      {
+        // The counter only moves when the loop goes round again.
+        ok = s_reg_bit(ins.a, &u.clobbers);
+      }
+      break;
+
+    case MI_VM_OP_ITER_NEXT:
+      ok = s_reg_bit(ins.b, &u.reads) && s_reg_bit(ins.c, &u.reads) &&
+        s_reg_bit(ins.a, &u.kills) && s_reg_bit(ins.c, &u.clobbers) &&
+        s_reg_bit((uint8_t)(ins.imm & 0xFF), &u.clobbers);
+      break;
+
+    case MI_VM_OP_INDEX:
+    case MI_VM_OP_ADD:
+    case MI_VM_OP_SUB:
+    case MI_VM_OP_MUL:
+    case MI_VM_OP_DIV:
+    case MI_VM_OP_MOD:
+    case MI_VM_OP_EQ:
+    case MI_VM_OP_NEQ:
+    case MI_VM_OP_LT:
+    case MI_VM_OP_LTEQ:
+    case MI_VM_OP_GT:
+    case MI_VM_OP_GTEQ:
+    case MI_VM_OP_AND:
+    case MI_VM_OP_OR:
+    case MI_VM_OP_ADD_INT:
+    case MI_VM_OP_SUB_INT:
+    case MI_VM_OP_MUL_INT:
+    case MI_VM_OP_ADD_FLOAT:
+    case MI_VM_OP_SUB_FLOAT:
+    case MI_VM_OP_MUL_FLOAT:
+    case MI_VM_OP_DIV_FLOAT:
+    case MI_VM_OP_EQ_INT:
+    case MI_VM_OP_NEQ_INT:
+    case MI_VM_OP_LT_INT:
+    case MI_VM_OP_LTEQ_INT:
+    case MI_VM_OP_GT_INT:
+    case MI_VM_OP_GTEQ_INT:
+    case MI_VM_OP_LT_FLOAT:
+    case MI_VM_OP_LTEQ_FLOAT:
+    case MI_VM_OP_GT_FLOAT:
+    case MI_VM_OP_GTEQ_FLOAT:
+      ok = s_reg_bit(ins.b, &u.reads) && s_reg_bit(ins.c, &u.reads) && s_reg_bit(ins.a, &u.kills);
+      break;
+
+    case MI_VM_OP_JUMP_IF_NOT_EQ:
+    case MI_VM_OP_JUMP_IF_NOT_NEQ:
+    case MI_VM_OP_JUMP_IF_NOT_LT:
+    case MI_VM_OP_JUMP_IF_NOT_LTEQ:
+    case MI_VM_OP_JUMP_IF_NOT_GT:
+    case MI_VM_OP_JUMP_IF_NOT_GTEQ:
+    case MI_VM_OP_JUMP_IF_NOT_EQ_INT:
+    case MI_VM_OP_JUMP_IF_NOT_NEQ_INT:
+    case MI_VM_OP_JUMP_IF_NOT_LT_INT:
+    case MI_VM_OP_JUMP_IF_NOT_LTEQ_INT:
+    case MI_VM_OP_JUMP_IF_NOT_GT_INT:
+    case MI_VM_OP_JUMP_IF_NOT_GTEQ_INT:
+      ok = s_reg_bit(ins.b, &u.reads) && s_reg_bit(ins.c, &u.reads);
+      break;
+
+    default:
+      u.reads = MI_OPT_ALL_REGS;
+      u.clobbers = MI_OPT_ALL_REGS;
+      break;
+  }
+
+  u.clobbers |= u.kills;
+  *out = u;
+  return ok;
+}
+
+// Frame slot written by an instruction, -1 for none. Unknown opcodes are
+// reported through *any.
+static int64_t s_ins_slot_write(MiVmIns ins, bool* any)
+{
+  switch ((MiVmOp)ins.op)
+  {
+    case MI_VM_OP_STORE_LOCAL:
+    case MI_VM_OP_ADD_LOCAL_CONST:
+    case MI_VM_OP_SUB_LOCAL_CONST:
+      return ins.imm;
+    default:
+      {
+        MiOptRegs u;
+        s_ins_regs(ins, &u);
+        if (u.clobbers == MI_OPT_ALL_REGS)
+        {
+          *any = true;
+        }
+      }
+      return -1;
+  }
+}
+
+//----------------------------------------------------------
+// Control-flow graph
+//----------------------------------------------------------
+
+typedef struct MiOptCfg
+{
+  size_t  n;            // instruction count
+  size_t  count;        // block count
+  size_t* block_of;     // per instruction: owning block
+  size_t* start;        // per block: first instruction
+  size_t* end;          // per block: one past the last instruction
+  int64_t* succ;        // per block: two successor blocks, -1 for none
+} MiOptCfg;
+
+static size_t s_jump_target(const MiVmIns* code, size_t ip)
+{
+  return (size_t)((int64_t)ip + 1 + (int64_t)code[ip].imm);
+}
+
+static void s_cfg_free(MiOptCfg* g)
+{
+  free(g->block_of);
+  free(g->start);
+  free(g->end);
+  free(g->succ);
+  memset(g, 0, sizeof(*g));
+}
+
+// Split code into basic blocks. Fails on jumps leaving [0, n].
+static bool s_cfg_build(const MiVmChunk* c, MiOptCfg* g)
+{
+  size_t n = c->code_count;
+  memset(g, 0, sizeof(*g));
+  g->n = n;
+  if (n == 0)
+  {
+    return false;
+  }
+
+  uint8_t* leader = (uint8_t*)calloc(n + 1, 1);
+  g->block_of = (size_t*)malloc(n * sizeof(size_t));
+  if (!leader || !g->block_of)
+  {
+    free(leader);
+    s_cfg_free(g);
+    return false;
+  }
+
+  leader[0] = 1;
+  for (size_t ip = 0; ip < n; ++ip)
+  {
+    MiVmOp op = (MiVmOp)c->code[ip].op;
+    if (s_is_jump(op))
+    {
+      int64_t t = (int64_t)ip + 1 + (int64_t)c->code[ip].imm;
+      if (t < 0 || t > (int64_t)n)
+      {
+        free(leader);
+        s_cfg_free(g);
+        return false;
+      }
+      leader[t] = 1;
+    }
+    if (s_is_jump(op) || s_no_fallthrough(op))
+    {
+      leader[ip + 1] = 1;
+    }
+  }
+
+  size_t count = 0;
+  for (size_t ip = 0; ip < n; ++ip)
+  {
+    count += leader[ip];
+  }
+
+  g->count = count;
+  g->start = (size_t*)malloc(count * sizeof(size_t));
+  g->end = (size_t*)malloc(count * sizeof(size_t));
+  g->succ = (int64_t*)malloc(count * 2 * sizeof(int64_t));
+  if (!g->start || !g->end || !g->succ)
+  {
+    free(leader);
+    s_cfg_free(g);
+    return false;
+  }
+
+  size_t b = 0;
+  for (size_t ip = 0; ip < n; ++ip)
+  {
+    if (leader[ip] && ip > 0)
+    {
+      g->end[b++] = ip;
+    }
+    if (leader[ip])
+    {
+      g->start[b] = ip;
+    }
+    g->block_of[ip] = b;
+  }
+  g->end[b] = n;
+  free(leader);
+
+  for (b = 0; b < count; ++b)
+  {
+    size_t last = g->end[b] - 1;
+    MiVmOp op = (MiVmOp)c->code[last].op;
+    int64_t* s = &g->succ[b * 2];
+    s[0] = -1;
+    s[1] = -1;
+    if (!s_no_fallthrough(op) && g->end[b] < n)
+    {
+      s[0] = (int64_t)g->block_of[g->end[b]];
+    }
+    if (s_is_jump(op))
+    {
+      size_t t = s_jump_target(c->code, last);
+      if (t < n)
+      {
+        s[1] = (int64_t)g->block_of[t];
+      }
+    }
+  }
+  return true;
+}
+
+// Registers live before each instruction; live[n] is the (empty) set at exit.
+static bool s_live_compute(const MiVmChunk* c, const MiOptCfg* g, uint32_t* live)
+{
+  uint32_t* in = (uint32_t*)calloc(g->count, sizeof(uint32_t));
+  if (!in)
+  {
+    return false;
+  }
+
+  bool changed = true;
+  while (changed)
+  {
+    changed = false;
+    for (size_t b = g->count; b-- > 0;)
+    {
+      uint32_t l = 0u;
+      for (int k = 0; k < 2; ++k)
+      {
+        int64_t s = g->succ[b * 2 + k];
+        if (s >= 0)
+        {
+          l |= in[s];
+        }
+      }
+      for (size_t ip = g->end[b]; ip-- > g->start[b];)
+      {
+        MiOptRegs u;
+        s_ins_regs(c->code[ip], &u);
+        l = (l & ~u.kills) | u.reads;
+      }
+      if (l != in[b])
+      {
+        in[b] = l;
+        changed = true;
+      }
+    }
+  }
+
+  for (size_t b = 0; b < g->count; ++b)
+  {
+    uint32_t l = 0u;
+    for (int k = 0; k < 2; ++k)
+    {
+      int64_t s = g->succ[b * 2 + k];
+      if (s >= 0)
+      {
+        l |= in[s];
+      }
+    }
+    for (size_t ip = g->end[b]; ip-- > g->start[b];)
+    {
+      MiOptRegs u;
+      s_ins_regs(c->code[ip], &u);
+      l = (l & ~u.kills) | u.reads;
+      live[ip] = l;
+    }
+  }
+  live[g->n] = 0u;
+
+  free(in);
+  return true;
+}
+
+//----------------------------------------------------------
+// Code rewriting
+//----------------------------------------------------------
+
+// Rewrite the code without the instructions flagged in drop, placing the
+// hoist_count instructions listed in hoist (also flagged) in front of
+// instruction head. Jumps from outside [head, tail] that target head enter
+// through the hoisted instructions; jumps to a dropped instruction land on
+// the next one kept. dbg_lines/dbg_cols move along with their instructions.
+static bool s_code_rewrite(MiVmChunk* c, const uint8_t* drop, size_t head, size_t tail, const size_t* hoist, size_t hoist_count)
+{
+  size_t n = c->code_count;
+  MiVmIns* src = (MiVmIns*)malloc(n * sizeof(MiVmIns));
+  uint32_t* src_lines = c->dbg_lines ? (uint32_t*)malloc(n * sizeof(uint32_t)) : NULL;
+  uint32_t* src_cols = c->dbg_cols ? (uint32_t*)malloc(n * sizeof(uint32_t)) : NULL;
+  size_t* new_index = (size_t*)malloc((n + 1) * sizeof(size_t));
+  if (!src || !new_index || (c->dbg_lines && !src_lines) || (c->dbg_cols && !src_cols))
+  {
+    free(src);
+    free(src_lines);
+    free(src_cols);
+    free(new_index);
+    return false;
+  }
+  memcpy(src, c->code, n * sizeof(MiVmIns));
+  if (src_lines)
+  {
+    memcpy(src_lines, c->dbg_lines, n * sizeof(uint32_t));
+  }
+  if (src_cols)
+  {
+    memcpy(src_cols, c->dbg_cols, n * sizeof(uint32_t));
+  }
+
+  size_t entry = 0;
+  size_t w = 0;
+  for (size_t ip = 0; ip < n; ++ip)
+  {
+    if (hoist_count && ip == head)
+    {
+      entry = w;
+      w += hoist_count;
+    }
+    new_index[ip] = w;
+    if (!drop[ip])
+    {
+      w += 1;
+    }
+  }
+  new_index[n] = w;
+
+  w = 0;
+  for (size_t ip = 0; ip < n; ++ip)
+  {
+    if (hoist_count && ip == head)
+    {
+      for (size_t k = 0; k < hoist_count; ++k)
+      {
+        size_t h = hoist[k];
+        c->code[w] = src[h];
+        if (src_lines)
+        {
+          c->dbg_lines[w] = src_lines[h];
+        }
+        if (src_cols)
+        {
+          c->dbg_cols[w] = src_cols[h];
+        }
+        w += 1;
+      }
+    }
+    if (drop[ip])
+    {
+      continue;
+    }
+
+    MiVmIns ins = src[ip];
+    if (s_is_jump((MiVmOp)ins.op))
+    {
+      size_t t = s_jump_target(src, ip);
+      bool from_outside = ip < head || ip > tail;
+      size_t nt = (hoist_count && t == head && from_outside) ? entry : new_index[t];
+      ins.imm = (int32_t)((int64_t)nt - (int64_t)(w + 1));
+    }
+    c->code[w] = ins;
+    if (src_lines)
+    {
+      c->dbg_lines[w] = src_lines[ip];
+    }
+    if (src_cols)
+    {
+      c->dbg_cols[w] = src_cols[ip];
+    }
+    w += 1;
+  }
+  c->code_count = w;
+
+  free(src);
+  free(src_lines);
+  free(src_cols);
+  free(new_index);
+  return true;
+}
+
+//----------------------------------------------------------
+// Constant propagation
+//----------------------------------------------------------
+
+// Constants worth propagating: scalars, which registers hold by value.
+static bool s_const_is_scalar(const MiVmChunk* c, int32_t k)
+{
+  if (k < 0 || (size_t)k >= c->const_count)
+  {
+    return false;
+  }
+  MiRtValueKind kind = c->consts[k].kind;
+  return kind == MI_RT_VAL_INT || kind == MI_RT_VAL_FLOAT || kind == MI_RT_VAL_BOOL || kind == MI_RT_VAL_VOID;
+}
+
+// Index of a scalar constant in the pool, appending it when missing.
+// Floats are matched bit for bit so 0.0 and -0.0 stay apart.
+static int32_t s_const_intern(MiVmChunk* c, MiRtValue v)
+{
+  for (size_t i = 0; i < c->const_count; ++i)
+  {
+    const MiRtValue* k = &c->consts[i];
+    if (k->kind != v.kind)
+    {
+      continue;
+    }
+    if ((v.kind == MI_RT_VAL_INT && k->as.i == v.as.i) ||
+        (v.kind == MI_RT_VAL_FLOAT && memcmp(&k->as.f, &v.as.f, sizeof(double)) == 0) ||
+        (v.kind == MI_RT_VAL_BOOL && k->as.b == v.as.b))
+    {
+      return (int32_t)i;
+    }
+  }
+
+  if (c->const_count >= (size_t)INT32_MAX)
+  {
+    return MI_OPT_UNKNOWN;
+  }
+  if (c->const_count == c->const_capacity)
+  {
+    size_t new_cap = c->const_capacity ? c->const_capacity * 2u : 64u;
+    MiRtValue* p = (MiRtValue*)realloc(c->consts, new_cap * sizeof(*c->consts));
+    if (!p)
+    {
+      return MI_OPT_UNKNOWN;
+    }
+    c->consts = p;
+    c->const_capacity = new_cap;
+  }
+  c->consts[c->const_count] = v;
+  return (int32_t)c->const_count++;
+}
+
+// Evaluate a typed binary instruction on two constants, as the VM would.
+// Returns the result's constant index or MI_OPT_UNKNOWN.
+static int32_t s_const_fold(MiVmChunk* c, MiVmOp op, int32_t kb, int32_t kc)
+{
+  if (kb < 0 || kc < 0)
+  {
+    return MI_OPT_UNKNOWN;
+  }
+  MiRtValue x = c->consts[kb];
+  MiRtValue y = c->consts[kc];
+  MiRtValueKind want = (op >= MI_VM_OP_ADD_FLOAT && op <= MI_VM_OP_DIV_FLOAT) || op >= MI_VM_OP_LT_FLOAT ?
+    MI_RT_VAL_FLOAT : MI_RT_VAL_INT;
+  if (x.kind != want || y.kind != want)
+  {
+    return MI_OPT_UNKNOWN;
+  }
+
+  unsigned long long ux = (unsigned long long)x.as.i;
+  unsigned long long uy = (unsigned long long)y.as.i;
+  MiRtValue r;
+  switch (op)
+  {
+    case MI_VM_OP_ADD_INT:    r = mi_rt_make_int((long long)(ux + uy)); break;
+    case MI_VM_OP_SUB_INT:    r = mi_rt_make_int((long long)(ux - uy)); break;
+    case MI_VM_OP_MUL_INT:    r = mi_rt_make_int((long long)(ux * uy)); break;
+    case MI_VM_OP_ADD_FLOAT:  r = mi_rt_make_float(x.as.f + y.as.f); break;
+    case MI_VM_OP_SUB_FLOAT:  r = mi_rt_make_float(x.as.f - y.as.f); break;
+    case MI_VM_OP_MUL_FLOAT:  r = mi_rt_make_float(x.as.f * y.as.f); break;
+    case MI_VM_OP_DIV_FLOAT:  r = mi_rt_make_float(x.as.f / y.as.f); break;
+    case MI_VM_OP_EQ_INT:     r = mi_rt_make_bool(x.as.i == y.as.i); break;
+    case MI_VM_OP_NEQ_INT:    r = mi_rt_make_bool(x.as.i != y.as.i); break;
+    case MI_VM_OP_LT_INT:     r = mi_rt_make_bool(x.as.i < y.as.i); break;
+    case MI_VM_OP_LTEQ_INT:   r = mi_rt_make_bool(x.as.i <= y.as.i); break;
+    case MI_VM_OP_GT_INT:     r = mi_rt_make_bool(x.as.i > y.as.i); break;
+    case MI_VM_OP_GTEQ_INT:   r = mi_rt_make_bool(x.as.i >= y.as.i); break;
+    case MI_VM_OP_LT_FLOAT:   r = mi_rt_make_bool(x.as.f < y.as.f); break;
+    case MI_VM_OP_LTEQ_FLOAT: r = mi_rt_make_bool(x.as.f <= y.as.f); break;
+    case MI_VM_OP_GT_FLOAT:   r = mi_rt_make_bool(x.as.f > y.as.f); break;
+    case MI_VM_OP_GTEQ_FLOAT: r = mi_rt_make_bool(x.as.f >= y.as.f); break;
+    default:                  return MI_OPT_UNKNOWN;
+  }
+
+  // NaN never compares equal, so it would be appended on every visit.
+  if (r.kind == MI_RT_VAL_FLOAT && r.as.f != r.as.f)
+  {
+    return MI_OPT_UNKNOWN;
+  }
+  return s_const_intern(c, r);
+}
+
+// Outcome of a conditional jump on known constants: 1 taken, 0 not taken,
+// -1 unknown.
+static int s_const_branch(const MiVmChunk* c, MiVmIns ins, const int32_t* regs)
+{
+  MiVmOp op = (MiVmOp)ins.op;
+  if (op == MI_VM_OP_JUMP_IF_TRUE || op == MI_VM_OP_JUMP_IF_FALSE)
+  {
+    int32_t k = regs[ins.a];
+    if (k < 0)
+    {
+      return -1;
+    }
+    MiRtValue v = c->consts[k];
+    bool is_true = false;
+    switch (v.kind)
+    {
+      case MI_RT_VAL_BOOL:  is_true = v.as.b; break;
+      case MI_RT_VAL_INT:   is_true = v.as.i != 0; break;
+      case MI_RT_VAL_FLOAT: is_true = v.as.f != 0.0; break;
+      case MI_RT_VAL_VOID:  is_true = false; break;
+      default:              return -1;
+    }
+    return (op == MI_VM_OP_JUMP_IF_TRUE) == is_true ? 1 : 0;
+  }
+
+  if (op >= MI_VM_OP_JUMP_IF_NOT_EQ_INT && op <= MI_VM_OP_JUMP_IF_NOT_GTEQ_INT)
+  {
+    int32_t kb = regs[ins.b];
+    int32_t kc = regs[ins.c];
+    if (kb < 0 || kc < 0 || c->consts[kb].kind != MI_RT_VAL_INT || c->consts[kc].kind != MI_RT_VAL_INT)
+    {
+      return -1;
+    }
+    long long x = c->consts[kb].as.i;
+    long long y = c->consts[kc].as.i;
+    bool holds;
+    switch (op)
+    {
+      case MI_VM_OP_JUMP_IF_NOT_EQ_INT:   holds = (x == y); break;
+      case MI_VM_OP_JUMP_IF_NOT_NEQ_INT:  holds = (x != y); break;
+      case MI_VM_OP_JUMP_IF_NOT_LT_INT:   holds = (x < y); break;
+      case MI_VM_OP_JUMP_IF_NOT_LTEQ_INT: holds = (x <= y); break;
+      case MI_VM_OP_JUMP_IF_NOT_GT_INT:   holds = (x > y); break;
+      default:                            holds = (x >= y); break;
+    }
+    return holds ? 0 : 1;
+  }
+  return -1;
+}
+
+// Transfer one instruction over the known constants of the registers
+// (regs[32]) and frame slots. MI_OPT_UNKNOWN marks a non-constant.
+static void s_const_step(MiVmChunk* c, MiVmIns ins, int32_t* regs, int32_t* slots)
+{
+  MiVmOp op = (MiVmOp)ins.op;
+  bool slot_ok = ins.imm >= 0 && (uint32_t)ins.imm < c->local_count;
+
+  switch (op)
+  {
+    case MI_VM_OP_LOAD_CONST:
+      regs[ins.a] = s_const_is_scalar(c, ins.imm) ? ins.imm : MI_OPT_UNKNOWN;
+      return;
+    case MI_VM_OP_MOV:
+      regs[ins.a] = regs[ins.b];
+      return;
+    case MI_VM_OP_LOAD_LOCAL:
+      regs[ins.a] = slot_ok ? slots[ins.imm] : MI_OPT_UNKNOWN;
+      return;
+    case MI_VM_OP_STORE_LOCAL:
+      if (slot_ok)
+      {
+        slots[ins.imm] = regs[ins.a];
+      }
+      return;
+    case MI_VM_OP_ADD_LOCAL_CONST:
+    case MI_VM_OP_SUB_LOCAL_CONST:
+      if (slot_ok)
+      {
+        slots[ins.imm] = MI_OPT_UNKNOWN;
+      }
+      regs[ins.a] = MI_OPT_UNKNOWN;
+      return;
+    default:
+      break;
+  }
+
+  if (s_is_typed_binary(op))
+  {
+    regs[ins.a] = s_const_fold(c, op, regs[ins.b], regs[ins.c]);
+    return;
+  }
+
+  MiOptRegs u;
+  s_ins_regs(ins, &u);
+  for (uint32_t r = 0; r < MI_VM_REG_COUNT; ++r)
+  {
+    if (u.clobbers & ((uint32_t)1u << r))
+    {
+      regs[r] = MI_OPT_UNKNOWN;
+    }
+  }
+}
+
+// Meet src into dst; returns true when dst changed.
+static bool s_const_meet(int32_t* dst, const int32_t* src, size_t count)
+{
+  bool changed = false;
+  for (size_t i = 0; i < count; ++i)
+  {
+    int32_t m = dst[i];
+    if (m == MI_OPT_UNVISITED)
+    {
+      m = src[i];
+    }
+    else if (m != src[i])
+    {
+      m = MI_OPT_UNKNOWN;
+    }
+    if (m != dst[i])
+    {
+      dst[i] = m;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+static void s_pass_constprop(MiVmChunk* c, MiOptStats* stats)
+{
+  MiOptCfg g;
+  if (!s_cfg_build(c, &g))
+  {
+    return;
+  }
+
+  size_t width = MI_VM_REG_COUNT + (size_t)c->local_count;
+  int32_t* in = (int32_t*)malloc(g.count * width * sizeof(int32_t));
+  int32_t* cur = (int32_t*)malloc(width * sizeof(int32_t));
+  uint8_t* queued = (uint8_t*)calloc(g.count, 1);
+  if (!in || !cur || !queued)
+  {
+    free(in);
+    free(cur);
+    free(queued);
+    s_cfg_free(&g);
+    return;
+  }
+
+  // Registers and slots hold nothing known on entry.
+  for (size_t i = 0; i < g.count * width; ++i)
+  {
+    in[i] = MI_OPT_UNVISITED;
+  }
+  for (size_t i = 0; i < width; ++i)
+  {
+    in[i] = MI_OPT_UNKNOWN;
+  }
+  queued[0] = 1;
+
+  bool pending = true;
+  while (pending)
+  {
+    pending = false;
+    for (size_t b = 0; b < g.count; ++b)
+    {
+      if (!queued[b])
+      {
+        continue;
+      }
+      queued[b] = 0;
+
+      memcpy(cur, &in[b * width], width * sizeof(int32_t));
+      for (size_t ip = g.start[b]; ip < g.end[b]; ++ip)
+      {
+        s_const_step(c, c->code[ip], cur, cur + MI_VM_REG_COUNT);
+      }
+      for (int k = 0; k < 2; ++k)
+      {
+        int64_t s = g.succ[b * 2 + k];
+        if (s >= 0 && s_const_meet(&in[(size_t)s * width], cur, width))
+        {
+          queued[s] = 1;
+          pending = true;
+        }
+      }
+    }
+  }
+
+  // Rewrite with the fixed point. Blocks never visited are left for dce.
+  for (size_t b = 0; b < g.count; ++b)
+  {
+    if (in[b * width] == MI_OPT_UNVISITED)
+    {
+      continue;
+    }
+    memcpy(cur, &in[b * width], width * sizeof(int32_t));
+    int32_t* regs = cur;
+    int32_t* slots = cur + MI_VM_REG_COUNT;
+    for (size_t ip = g.start[b]; ip < g.end[b]; ++ip)
+    {
+      MiVmIns* ins = &c->code[ip];
+      MiVmOp op = (MiVmOp)ins->op;
+
+      if (op == MI_VM_OP_LOAD_LOCAL && ins->imm >= 0 && (uint32_t)ins->imm < c->local_count &&
+          slots[ins->imm] >= 0)
+      {
+        ins->op = (uint8_t)MI_VM_OP_LOAD_CONST;
+        ins->imm = slots[ins->imm];
+        stats->const_loads += 1;
+      }
+      else if (op == MI_VM_OP_MOV && regs[ins->b] >= 0)
+      {
+        ins->op = (uint8_t)MI_VM_OP_LOAD_CONST;
+        ins->imm = regs[ins->b];
+        ins->b = 0;
+        stats->const_loads += 1;
+      }
+      else if (s_is_typed_binary(op))
+      {
+        int32_t k = s_const_fold(c, op, regs[ins->b], regs[ins->c]);
+        if (k >= 0)
+        {
+          ins->op = (uint8_t)MI_VM_OP_LOAD_CONST;
+          ins->b = 0;
+          ins->c = 0;
+          ins->imm = k;
+          stats->const_folds += 1;
+        }
+      }
+      else if (s_is_cond_jump(op))
+      {
+        int taken = s_const_branch(c, *ins, regs);
+        if (taken >= 0)
+        {
+          ins->op = (uint8_t)(taken ? MI_VM_OP_JUMP : MI_VM_OP_NOOP);
+          ins->a = 0;
+          ins->b = 0;
+          ins->c = 0;
+          if (!taken)
+          {
+            ins->imm = 0;
+          }
+          stats->const_branches += 1;
+        }
+      }
+
+      s_const_step(c, *ins, regs, slots);
+    }
+  }
+
+  free(in);
+  free(cur);
+  free(queued);
+  s_cfg_free(&g);
+}
+
+//----------------------------------------------------------
+// Dead code elimination
+//----------------------------------------------------------
+
+// One round: drop unreachable blocks, NOOPs, jumps to the next instruction
+// and pure writes of dead registers. Returns the number of instructions
+// removed.
+static size_t s_dce_round(MiVmChunk* c, MiOptStats* stats)
+{
+  MiOptCfg g;
+  if (!s_cfg_build(c, &g))
+  {
+    return 0;
+  }
+
+  size_t n = c->code_count;
+  uint8_t* reach = (uint8_t*)calloc(g.count, 1);
+  size_t* stack = (size_t*)malloc(g.count * sizeof(size_t));
+  uint8_t* drop = (uint8_t*)calloc(n, 1);
+  uint32_t* live = (uint32_t*)malloc((n + 1) * sizeof(uint32_t));
+  if (!reach || !stack || !drop || !live || !s_live_compute(c, &g, live))
+  {
+    free(reach);
+    free(stack);
+    free(drop);
+    free(live);
+    s_cfg_free(&g);
+    return 0;
+  }
+
+  size_t sp = 0;
+  reach[0] = 1;
+  stack[sp++] = 0;
+  while (sp > 0)
+  {
+    size_t b = stack[--sp];
+    for (int k = 0; k < 2; ++k)
+    {
+      int64_t s = g.succ[b * 2 + k];
+      if (s >= 0 && !reach[s])
+      {
+        reach[s] = 1;
+        stack[sp++] = (size_t)s;
+      }
+    }
+  }
+
+  size_t unreachable = 0;
+  size_t dead = 0;
+  for (size_t b = 0; b < g.count; ++b)
+  {
+    for (size_t ip = g.start[b]; ip < g.end[b]; ++ip)
+    {
+      MiVmIns ins = c->code[ip];
+      MiVmOp op = (MiVmOp)ins.op;
+      if (!reach[b])
+      {
+        drop[ip] = 1;
+        unreachable += 1;
+      }
+      else if (op == MI_VM_OP_NOOP || (op == MI_VM_OP_JUMP && ins.imm == 0))
+      {
+        drop[ip] = 1;
+        dead += 1;
+      }
+      else if (s_is_pure(op) && !(live[ip + 1] & ((uint32_t)1u << ins.a)))
+      {
+        // A pure op falls through, so live[ip + 1] is its live-out set.
+        drop[ip] = 1;
+        dead += 1;
+      }
+    }
+  }
+
+  // Keep the chunk terminated even if every path loops forever.
+  if (n > 0 && unreachable + dead == n)
+  {
+    drop[n - 1] = 0;
+    if (unreachable)
+    {
+      unreachable -= 1;
+    }
+    else
+    {
+      dead -= 1;
+    }
+  }
+
+  size_t removed = 0;
+  if (unreachable + dead > 0 && s_code_rewrite(c, drop, 0, 0, NULL, 0))
+  {
+    stats->dce_unreachable += unreachable;
+    stats->dce_dead += dead;
+    removed = unreachable + dead;
+  }
+
+  free(reach);
+  free(stack);
+  free(drop);
+  free(live);
+  s_cfg_free(&g);
+  return removed;
+}
+
+static void s_pass_dce(MiVmChunk* c, MiOptStats* stats)
+{
+  // Removing a dead write can leave its operands' writes dead in turn.
+  while (s_dce_round(c, stats) > 0)
+  {
+  }
+}
+
+//----------------------------------------------------------
+// Loop-invariant code motion
+//----------------------------------------------------------
+
+// Hoist what can move out of the loop [head, tail] into hoist (in order) and
+// flag it in drop. A register qualifies when its only write in the loop is a
+// side-effect free instruction on invariant operands, and it is dead both on
+// entry to the loop and at every exit, so computing it once up front cannot
+// be observed.
+static size_t s_licm_collect(const MiVmChunk* c, const uint32_t* live, size_t head, size_t tail, uint8_t* drop, size_t* hoist)
+{
+  size_t n = c->code_count;
+
+  // Entered only at head: no jump from outside lands inside.
+  for (size_t ip = 0; ip < n; ++ip)
+  {
+    if ((ip < head || ip > tail) && s_is_jump((MiVmOp)c->code[ip].op))
+    {
+      size_t t = s_jump_target(c->code, ip);
+      if (t > head && t <= tail)
+      {
+        return 0;
+      }
+    }
+  }
+
+  uint8_t defs[MI_VM_REG_COUNT] = {0};
+  uint32_t exit_live = 0u;
+  bool any_slot = false;
+  for (size_t ip = head; ip <= tail; ++ip)
+  {
+    MiVmIns ins = c->code[ip];
+    MiOptRegs u;
+    s_ins_regs(ins, &u);
+    for (uint32_t r = 0; r < MI_VM_REG_COUNT; ++r)
+    {
+      if ((u.clobbers & ((uint32_t)1u << r)) && defs[r] < 2)
+      {
+        defs[r] += 1;
+      }
+    }
+    if (s_is_jump((MiVmOp)ins.op))
+    {
+      size_t t = s_jump_target(c->code, ip);
+      if (t < head || t > tail)
+      {
+        exit_live |= live[t];
+      }
+    }
+    if (ip == tail && !s_no_fallthrough((MiVmOp)ins.op))
+    {
+      exit_live |= live[tail + 1];
+    }
+    s_ins_slot_write(ins, &any_slot);
+  }
+
+  uint32_t inv = 0u;
+  for (uint32_t r = 0; r < MI_VM_REG_COUNT; ++r)
+  {
+    if (defs[r] == 0)
+    {
+      inv |= (uint32_t)1u << r;
+    }
+  }
+
+  size_t count = 0;
+  for (size_t ip = head; ip <= tail; ++ip)
+  {
+    MiVmIns ins = c->code[ip];
+    MiVmOp op = (MiVmOp)ins.op;
+    uint32_t dst = (uint32_t)1u << ins.a;
+    bool movable = false;
+
+    switch (op)
+    {
+      case MI_VM_OP_LOAD_CONST:
+        movable = true;
+        break;
+      case MI_VM_OP_LOAD_LOCAL:
+        movable = !any_slot && ins.imm >= 0 && (uint32_t)ins.imm < c->local_count;
+        for (size_t k = head; movable && k <= tail; ++k)
+        {
+          bool unused = false;
+          movable = s_ins_slot_write(c->code[k], &unused) != (int64_t)ins.imm;
+        }
+        break;
+      case MI_VM_OP_MOV:
+        movable = (inv >> ins.b) & 1u;
+        break;
+      default:
+        movable = s_is_typed_binary(op) && ((inv >> ins.b) & 1u) && ((inv >> ins.c) & 1u);
+        break;
+    }
+
+    if (!movable || defs[ins.a] != 1 || (live[head] & dst) || (exit_live & dst))
+    {
+      continue;
+    }
+    drop[ip] = 1;
+    hoist[count++] = ip;
+    inv |= dst;
+  }
+  return count;
+}
+
+// Loops are the ranges [head, tail] closed by a backward jump at tail.
+// Tries them innermost (shortest) first and rewrites the first one with
+// something to hoist; returns false when no loop has anything.
+static bool s_licm_round(MiVmChunk* c, MiOptStats* stats)
+{
+  MiOptCfg g;
+  if (!s_cfg_build(c, &g))
+  {
+    return false;
+  }
+
+  size_t n = c->code_count;
+  uint32_t* live = (uint32_t*)malloc((n + 1) * sizeof(uint32_t));
+  uint8_t* drop = (uint8_t*)malloc(n);
+  uint8_t* tried = (uint8_t*)calloc(n, 1);
+  size_t* hoist = (size_t*)malloc(n * sizeof(size_t));
+  bool ok = live && drop && tried && hoist && s_live_compute(c, &g, live);
+  s_cfg_free(&g);
+
+  bool hoisted = false;
+  while (ok && !hoisted)
+  {
+    size_t tail = n;
+    for (size_t j = 0; j < n; ++j)
+    {
+      if (tried[j] || !s_is_jump((MiVmOp)c->code[j].op) || s_jump_target(c->code, j) > j)
+      {
+        continue;
+      }
+      if (tail == n || j - s_jump_target(c->code, j) < tail - s_jump_target(c->code, tail))
+      {
+        tail = j;
+      }
+    }
+    if (tail == n)
+    {
+      break;
+    }
+    tried[tail] = 1;
+
+    size_t head = s_jump_target(c->code, tail);
+    memset(drop, 0, n);
+    size_t count = s_licm_collect(c, live, head, tail, drop, hoist);
+    if (count > 0 && s_code_rewrite(c, drop, head, tail, hoist, count))
+    {
+      stats->licm_hoisted += count;
+      stats->licm_loops += 1;
+      hoisted = true;
+    }
+  }
+
+  free(live);
+  free(drop);
+  free(tried);
+  free(hoist);
+  return hoisted;
+}
+
+static void s_pass_licm(MiVmChunk* c, MiOptStats* stats)
+{
+  while (s_licm_round(c, stats))
+  {
+  }
+}
+
+//----------------------------------------------------------
+// Entry point
+//----------------------------------------------------------
+
+static bool s_chunk_regs_ok(const MiVmChunk* c)
+{
+  for (size_t ip = 0; ip < c->code_count; ++ip)
+  {
+    MiOptRegs u;
+    if (!s_ins_regs(c->code[ip], &u))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+void mi_opt_chunk(MiVmChunk* chunk, MiOptStats* stats)
+{
+  MiOptStats scratch;
+  if (!stats)
+  {
+    memset(&scratch, 0, sizeof(scratch));
+    stats = &scratch;
+  }
+  if (!chunk)
+  {
+    return;
+  }
+
+  stats->code_before += chunk->code_count;
+  if (chunk->code_count > 0 && s_chunk_regs_ok(chunk))
+  {
+    s_pass_constprop(chunk, stats);
+    s_pass_dce(chunk, stats);
+    s_pass_licm(chunk, stats);
+  }
+  stats->code_after += chunk->code_count;
+
+  for (size_t i = 0; i < chunk->subchunk_count; ++i)
+  {
+    mi_opt_chunk(chunk->subchunks[i], stats);
+  }
+}
@@ -0,0 +1,47 @@
+#ifndef MI_OPT_H
+#define MI_OPT_H
+
+#include <stddef.h>
+
+#include "mi_vm.h"
+
+/**
+ * What each pass of mi_opt_chunk() did, summed over a chunk and its subchunks.
+ */
+typedef struct MiOptStats
+{
+  size_t code_before;       // instructions before optimizing
+  size_t code_after;        // instructions after optimizing
+
+  size_t const_loads;       // constprop: LOAD_LOCAL/MOV of a known constant turned into LOAD_CONST
+  size_t const_folds;       // constprop: typed operations on constants folded to LOAD_CONST
+  size_t const_branches;    // constprop: conditional jumps with a known outcome resolved
+
+  size_t licm_hoisted;      // licm: instructions moved in front of their loop
+  size_t licm_loops;        // licm: loops something was hoisted out of
+
+  size_t dce_unreachable;   // dce: instructions no path reaches
+  size_t dce_dead;          // dce: unread register writes, NOOPs and jumps to the next instruction
+} MiOptStats;
+
+/**
+ * Optimize a compiled chunk and its subchunks over their control-flow graphs:
+ *  - constprop: constants held in registers and frame slots are propagated
+ *    into later loads, typed operations on them are folded and conditional
+ *    jumps on them are resolved;
+ *  - dce: unreachable blocks and side-effect free writes of registers that
+ *    are never read are removed;
+ *  - licm: side-effect free instructions whose operands do not change inside
+ *    a loop are hoisted in front of it.
+ *
+ * Only frame-private state (registers and slot locals) is tracked: named
+ * variables can be rebound by any call, so loads of them are left alone.
+ * Expects peephole output and works in place. Jump offsets and
+ * dbg_lines/dbg_cols are remapped to the rewritten code. Chunks addressing
+ * registers outside the VM window are skipped.
+ * @param chunk Chunk to rewrite.
+ * @param stats Accumulates per pass results; may be NULL.
+ */
+void mi_opt_chunk(MiVmChunk* chunk, MiOptStats* stats);
+
+#endif // MI_OPT_H
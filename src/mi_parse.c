@@ -515,7 +515,9 @@ static MiExprList* s_expr_list_append(MiParser* p, MiExprList* list, MiExpr* exp
   return list;
 }
 
-static MiCommandList* s_command_list_append(MiParser* p, MiCommandList* list, MiCommand* cmd)
+// Appends after *tail (the last node, or NULL for an empty list) so building a
+// long statement list stays linear.
+static MiCommandList* s_command_list_append(MiParser* p, MiCommandList* list, MiCommandList** tail, MiCommand* cmd)
 {
   MiCommandList* node = (MiCommandList*)x_arena_alloc_zero(p->arena, sizeof(MiCommandList));
   if (!node)
@@ -528,15 +530,12 @@ static MiCommandList* s_command_list_append(MiParser* p, MiCommandList* list, Mi
 
   if (!list)
   {
+    *tail = node;
     return node;
   }
 
-  MiCommandList* it = list;
-  while (it->next)
-  {
-    it = it->next;
-  }
-  it->next = node;
+  (*tail)->next = node;
+  *tail = node;
   return list;
 }
 
@@ -1667,6 +1666,20 @@ static MiCommand* s_parse_foreach_stmt(MiParser* p, MiToken foreach_tok)
   MiExpr* list_expr = s_parse_expr(p);
   if (!list_expr) return NULL;
 
+  // Integer range: foreach(i, from, to) or foreach(i, from, to, step)
+  MiExpr* range_to = NULL;
+  MiExpr* range_step = NULL;
+  if (s_parser_match(p, MI_TOK_COMMA))
+  {
+    range_to = s_parse_expr(p);
+    if (!range_to) return NULL;
+    if (s_parser_match(p, MI_TOK_COMMA))
+    {
+      range_step = s_parse_expr(p);
+      if (!range_step) return NULL;
+    }
+  }
+
   if (!s_parser_expect(p, MI_TOK_RPAREN, "Expected ')' after foreach header")) return NULL;
 
   // foreach requires a literal body block (compiler expects a block expr)
@@ -1686,14 +1699,25 @@ static MiCommand* s_parse_foreach_stmt(MiParser* p, MiToken foreach_tok)
   if (!varname) return NULL;
 
   MiExprList* args = NULL;
+  int argc = 3;
   args = s_expr_list_append(p, args, varname);
   args = s_expr_list_append(p, args, list_expr);
+  if (range_to)
+  {
+    args = s_expr_list_append(p, args, range_to);
+    argc += 1;
+  }
+  if (range_step)
+  {
+    args = s_expr_list_append(p, args, range_step);
+    argc += 1;
+  }
   args = s_expr_list_append(p, args, body);
 
   MiExpr* head = s_cstr_as_string(p, "foreach");
   if (!head) return NULL;
 
-  return s_new_command(p, head, 3, args, foreach_tok);
+  return s_new_command(p, head, argc, args, foreach_tok);
 }
 
 static MiCommand* s_parse_include_stmt(MiParser* p, MiToken kw_tok, const char* head_name)
@@ -1867,6 +1891,7 @@ static MiScript* s_parse_script(MiParser* p, bool stop_at_rbrace)
   }
 
   MiCommandList* list = NULL;
+  MiCommandList* tail = NULL;
   size_t count = 0;
 
   while (!p->had_error)
@@ -1897,7 +1922,7 @@ static MiScript* s_parse_script(MiParser* p, bool stop_at_rbrace)
       break;
     }
 
-    list = s_command_list_append(p, list, cmd);
+    list = s_command_list_append(p, list, &tail, cmd);
     count = count + 1;
   }
 
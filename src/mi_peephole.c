@@ -0,0 +1,498 @@
+#include "mi_peephole.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+//----------------------------------------------------------
+// Instruction info
+//----------------------------------------------------------
+
+static bool s_is_jump(MiVmOp op)
+{
+  switch (op)
+  {
+    case MI_VM_OP_JUMP:
+    case MI_VM_OP_JUMP_IF_TRUE:
+    case MI_VM_OP_JUMP_IF_FALSE:
+    case MI_VM_OP_JUMP_IF_NOT_EQ:
+    case MI_VM_OP_JUMP_IF_NOT_NEQ:
+    case MI_VM_OP_JUMP_IF_NOT_LT:
+    case MI_VM_OP_JUMP_IF_NOT_LTEQ:
+    case MI_VM_OP_JUMP_IF_NOT_GT:
+    case MI_VM_OP_JUMP_IF_NOT_GTEQ:
+    case MI_VM_OP_JUMP_IF_NOT_EQ_INT:
+    case MI_VM_OP_JUMP_IF_NOT_NEQ_INT:
+    case MI_VM_OP_JUMP_IF_NOT_LT_INT:
+    case MI_VM_OP_JUMP_IF_NOT_LTEQ_INT:
+    case MI_VM_OP_JUMP_IF_NOT_GT_INT:
+    case MI_VM_OP_JUMP_IF_NOT_GTEQ_INT:
+    case MI_VM_OP_FOR_PREP:
+    case MI_VM_OP_FOR_LOOP:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Fused compare-and-branch opcode for a compare, or NOOP if it has none.
+static MiVmOp s_compare_jump_op(MiVmOp op)
+{
+  switch (op)
+  {
+    case MI_VM_OP_EQ:       return MI_VM_OP_JUMP_IF_NOT_EQ;
+    case MI_VM_OP_NEQ:      return MI_VM_OP_JUMP_IF_NOT_NEQ;
+    case MI_VM_OP_LT:       return MI_VM_OP_JUMP_IF_NOT_LT;
+    case MI_VM_OP_LTEQ:     return MI_VM_OP_JUMP_IF_NOT_LTEQ;
+    case MI_VM_OP_GT:       return MI_VM_OP_JUMP_IF_NOT_GT;
+    case MI_VM_OP_GTEQ:     return MI_VM_OP_JUMP_IF_NOT_GTEQ;
+    case MI_VM_OP_EQ_INT:   return MI_VM_OP_JUMP_IF_NOT_EQ_INT;
+    case MI_VM_OP_NEQ_INT:  return MI_VM_OP_JUMP_IF_NOT_NEQ_INT;
+    case MI_VM_OP_LT_INT:   return MI_VM_OP_JUMP_IF_NOT_LT_INT;
+    case MI_VM_OP_LTEQ_INT: return MI_VM_OP_JUMP_IF_NOT_LTEQ_INT;
+    case MI_VM_OP_GT_INT:   return MI_VM_OP_JUMP_IF_NOT_GT_INT;
+    case MI_VM_OP_GTEQ_INT: return MI_VM_OP_JUMP_IF_NOT_GTEQ_INT;
+    default:                return MI_VM_OP_NOOP;
+  }
+}
+
+static bool s_is_add_or_sub(MiVmOp op)
+{
+  return op == MI_VM_OP_ADD || op == MI_VM_OP_ADD_INT || op == MI_VM_OP_ADD_FLOAT ||
+    op == MI_VM_OP_SUB || op == MI_VM_OP_SUB_INT || op == MI_VM_OP_SUB_FLOAT;
+}
+
+// Register operands read by an instruction. Unknown opcodes are treated as
+// reading every register so the pass stays conservative.
+static bool s_ins_reads_reg(MiVmIns ins, uint8_t r)
+{
+  switch ((MiVmOp)ins.op)
+  {
+    case MI_VM_OP_NOOP:
+    case MI_VM_OP_LOAD_CONST:
+    case MI_VM_OP_LOAD_BLOCK:
+    case MI_VM_OP_LIST_NEW:
+    case MI_VM_OP_DICT_NEW:
+    case MI_VM_OP_LOAD_VAR:
+    case MI_VM_OP_ARG_CLEAR:
+    case MI_VM_OP_ARG_PUSH_CONST:
+    case MI_VM_OP_ARG_PUSH_VAR_SYM:
+    case MI_VM_OP_ARG_PUSH_SYM:
+    case MI_VM_OP_ARG_SAVE:
+    case MI_VM_OP_ARG_RESTORE:
+    case MI_VM_OP_CALL_CMD:
+    case MI_VM_OP_CALL_CMD_FAST:
+    case MI_VM_OP_CALL_CMD_FAST_VAR:
+    case MI_VM_OP_CALL_CMD_TRUSTED:
+    case MI_VM_OP_SCOPE_PUSH:
+    case MI_VM_OP_SCOPE_POP:
+    case MI_VM_OP_SCOPE_RESET:
+    case MI_VM_OP_JUMP:
+    case MI_VM_OP_HALT:
+    case MI_VM_OP_ADD_VAR_CONST:
+    case MI_VM_OP_SUB_VAR_CONST:
+    case MI_VM_OP_LOAD_LOCAL:
+    case MI_VM_OP_ARG_PUSH_LOCAL:
+    case MI_VM_OP_ADD_LOCAL_CONST:
+    case MI_VM_OP_SUB_LOCAL_CONST:
+    case MI_VM_OP_CLEAR_REGS:
+    case MI_VM_OP_LOAD_UPVAL:
+      return false;
+
+    case MI_VM_OP_STORE_VAR:
+    case MI_VM_OP_STORE_UPVAL:
+    case MI_VM_OP_DEFINE_VAR:
+    case MI_VM_OP_STORE_LOCAL:
+    case MI_VM_OP_ARG_PUSH:
+    case MI_VM_OP_JUMP_IF_TRUE:
+    case MI_VM_OP_JUMP_IF_FALSE:
+    case MI_VM_OP_RETURN:
+      return ins.a == r;
+
+    case MI_VM_OP_MOV:
+    case MI_VM_OP_LEN:
+    case MI_VM_OP_NEG:
+    case MI_VM_OP_NOT:
+    case MI_VM_OP_LOAD_MEMBER:
+    case MI_VM_OP_LOAD_INDIRECT_VAR:
+    case MI_VM_OP_CALL_CMD_DYN:
+    case MI_VM_OP_TAIL_CALL:
+    case MI_VM_OP_CALL_BLOCK:
+      return ins.b == r;
+
+    case MI_VM_OP_LIST_PUSH:
+    case MI_VM_OP_STORE_MEMBER:
+      return ins.a == r || ins.b == r;
+
+    case MI_VM_OP_ITER_NEXT:
+    case MI_VM_OP_INDEX:
+    case MI_VM_OP_ADD:
+    case MI_VM_OP_SUB:
+    case MI_VM_OP_MUL:
+    case MI_VM_OP_DIV:
+    case MI_VM_OP_MOD:
+    case MI_VM_OP_EQ:
+    case MI_VM_OP_NEQ:
+    case MI_VM_OP_LT:
+    case MI_VM_OP_LTEQ:
+    case MI_VM_OP_GT:
+    case MI_VM_OP_GTEQ:
+    case MI_VM_OP_AND:
+    case MI_VM_OP_OR:
+    case MI_VM_OP_JUMP_IF_NOT_EQ:
+    case MI_VM_OP_JUMP_IF_NOT_NEQ:
+    case MI_VM_OP_JUMP_IF_NOT_LT:
+    case MI_VM_OP_JUMP_IF_NOT_LTEQ:
+    case MI_VM_OP_JUMP_IF_NOT_GT:
+    case MI_VM_OP_JUMP_IF_NOT_GTEQ:
+    case MI_VM_OP_ADD_INT:
+    case MI_VM_OP_SUB_INT:
+    case MI_VM_OP_MUL_INT:
+    case MI_VM_OP_ADD_FLOAT:
+    case MI_VM_OP_SUB_FLOAT:
+    case MI_VM_OP_MUL_FLOAT:
+    case MI_VM_OP_DIV_FLOAT:
+    case MI_VM_OP_EQ_INT:
+    case MI_VM_OP_NEQ_INT:
+    case MI_VM_OP_LT_INT:
+    case MI_VM_OP_LTEQ_INT:
+    case MI_VM_OP_GT_INT:
+    case MI_VM_OP_GTEQ_INT:
+    case MI_VM_OP_LT_FLOAT:
+    case MI_VM_OP_LTEQ_FLOAT:
+    case MI_VM_OP_GT_FLOAT:
+    case MI_VM_OP_GTEQ_FLOAT:
+    case MI_VM_OP_JUMP_IF_NOT_EQ_INT:
+    case MI_VM_OP_JUMP_IF_NOT_NEQ_INT:
+    case MI_VM_OP_JUMP_IF_NOT_LT_INT:
+    case MI_VM_OP_JUMP_IF_NOT_LTEQ_INT:
+    case MI_VM_OP_JUMP_IF_NOT_GT_INT:
+    case MI_VM_OP_JUMP_IF_NOT_GTEQ_INT:
+      return ins.b == r || ins.c == r;
+
+    case MI_VM_OP_STORE_INDEX:
+      return ins.a == r || ins.b == r || ins.c == r;
+
+    case MI_VM_OP_FOR_PREP:
+    case MI_VM_OP_FOR_LOOP:
+      return r >= ins.a && r - ins.a < 3;
+
+    default:
+      return true;
+  }
+}
+
+static bool s_ins_writes_reg(MiVmIns ins, uint8_t r)
+{
+  switch ((MiVmOp)ins.op)
+  {
+    case MI_VM_OP_LOAD_CONST:
+    case MI_VM_OP_LOAD_BLOCK:
+    case MI_VM_OP_MOV:
+    case MI_VM_OP_LIST_NEW:
+    case MI_VM_OP_DICT_NEW:
+    case MI_VM_OP_INDEX:
+    case MI_VM_OP_LEN:
+    case MI_VM_OP_NEG:
+    case MI_VM_OP_NOT:
+    case MI_VM_OP_ADD:
+    case MI_VM_OP_SUB:
+    case MI_VM_OP_MUL:
+    case MI_VM_OP_DIV:
+    case MI_VM_OP_MOD:
+    case MI_VM_OP_EQ:
+    case MI_VM_OP_NEQ:
+    case MI_VM_OP_LT:
+    case MI_VM_OP_LTEQ:
+    case MI_VM_OP_GT:
+    case MI_VM_OP_GTEQ:
+    case MI_VM_OP_AND:
+    case MI_VM_OP_OR:
+    case MI_VM_OP_LOAD_VAR:
+    case MI_VM_OP_LOAD_MEMBER:
+    case MI_VM_OP_LOAD_INDIRECT_VAR:
+    case MI_VM_OP_CALL_CMD:
+    case MI_VM_OP_CALL_CMD_FAST:
+    case MI_VM_OP_CALL_CMD_FAST_VAR:
+    case MI_VM_OP_CALL_CMD_TRUSTED:
+    case MI_VM_OP_CALL_CMD_DYN:
+    case MI_VM_OP_TAIL_CALL:
+    case MI_VM_OP_CALL_BLOCK:
+    case MI_VM_OP_ADD_VAR_CONST:
+    case MI_VM_OP_SUB_VAR_CONST:
+    case MI_VM_OP_LOAD_LOCAL:
+    case MI_VM_OP_LOAD_UPVAL:
+    case MI_VM_OP_ADD_LOCAL_CONST:
+    case MI_VM_OP_SUB_LOCAL_CONST:
+    case MI_VM_OP_ADD_INT:
+    case MI_VM_OP_SUB_INT:
+    case MI_VM_OP_MUL_INT:
+    case MI_VM_OP_ADD_FLOAT:
+    case MI_VM_OP_SUB_FLOAT:
+    case MI_VM_OP_MUL_FLOAT:
+    case MI_VM_OP_DIV_FLOAT:
+    case MI_VM_OP_EQ_INT:
+    case MI_VM_OP_NEQ_INT:
+    case MI_VM_OP_LT_INT:
+    case MI_VM_OP_LTEQ_INT:
+    case MI_VM_OP_GT_INT:
+    case MI_VM_OP_GTEQ_INT:
+    case MI_VM_OP_LT_FLOAT:
+    case MI_VM_OP_LTEQ_FLOAT:
+    case MI_VM_OP_GT_FLOAT:
+    case MI_VM_OP_GTEQ_FLOAT:
+      return ins.a == r;
+
+    // ITER_NEXT may leave the item register untouched on the last step, so
+    // only the flag register counts as a definite write.
+    case MI_VM_OP_ITER_NEXT:
+      return ins.a == r;
+
+    case MI_VM_OP_CLEAR_REGS:
+      return r >= ins.a && r - ins.a < ins.b;
+
+    default:
+      return false;
+  }
+}
+
+//----------------------------------------------------------
+// Liveness
+//----------------------------------------------------------
+
+// True if some path starting at 'ip' reads register 'r' before writing it.
+static bool s_reg_live_from(const MiVmIns* code, size_t count, size_t ip, uint8_t r, uint8_t* visited)
+{
+  while (ip < count)
+  {
+    if (visited[ip])
+    {
+      return false;
+    }
+    visited[ip] = 1;
+
+    MiVmIns ins = code[ip];
+    MiVmOp op = (MiVmOp)ins.op;
+    if (s_ins_reads_reg(ins, r))
+    {
+      return true;
+    }
+    if (s_ins_writes_reg(ins, r))
+    {
+      return false;
+    }
+    if (op == MI_VM_OP_RETURN || op == MI_VM_OP_HALT)
+    {
+      return false;
+    }
+
+    if (s_is_jump(op))
+    {
+      int64_t target = (int64_t)ip + 1 + (int64_t)ins.imm;
+      if (target < 0 || target > (int64_t)count)
+      {
+        return true;
+      }
+      if (op == MI_VM_OP_JUMP)
+      {
+        ip = (size_t)target;
+        continue;
+      }
+      if (s_reg_live_from(code, count, (size_t)target, r, visited))
+      {
+        return true;
+      }
+    }
+    ip += 1;
+  }
+  return false;
+}
+
+static bool s_reg_dead_at(const MiVmIns* code, size_t count, size_t ip, uint8_t r, uint8_t* visited)
+{
+  memset(visited, 0, count);
+  return !s_reg_live_from(code, count, ip, r, visited);
+}
+
+//----------------------------------------------------------
+// Peephole pass
+//----------------------------------------------------------
+
+static bool s_run_has_target(const uint8_t* is_target, size_t start, size_t len)
+{
+  for (size_t k = 1; k < len; ++k)
+  {
+    if (is_target[start + k])
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t mi_peephole_chunk(MiVmChunk* chunk)
+{
+  if (!chunk || chunk->code_count < 2)
+  {
+    return 0;
+  }
+
+  const size_t n = chunk->code_count;
+  MiVmIns*  src        = (MiVmIns*)malloc(n * sizeof(MiVmIns));
+  uint8_t*  is_target  = (uint8_t*)calloc(n + 1, 1);
+  uint8_t*  visited    = (uint8_t*)malloc(n);
+  size_t*   new_index  = (size_t*)malloc((n + 1) * sizeof(size_t));
+  int64_t*  old_target = (int64_t*)malloc(n * sizeof(int64_t));
+  if (!src || !is_target || !visited || !new_index || !old_target)
+  {
+    free(src);
+    free(is_target);
+    free(visited);
+    free(new_index);
+    free(old_target);
+    return 0;
+  }
+  memcpy(src, chunk->code, n * sizeof(MiVmIns));
+
+  for (size_t i = 0; i < n; ++i)
+  {
+    if (s_is_jump((MiVmOp)src[i].op))
+    {
+      int64_t t = (int64_t)i + 1 + (int64_t)src[i].imm;
+      if (t < 0 || t > (int64_t)n)
+      {
+        // Malformed jump: leave the chunk alone.
+        free(src);
+        free(is_target);
+        free(visited);
+        free(new_index);
+        free(old_target);
+        return 0;
+      }
+      is_target[t] = 1;
+    }
+  }
+
+  size_t w = 0;
+  size_t i = 0;
+  while (i < n)
+  {
+    MiVmIns ins = src[i];
+    MiVmOp op = (MiVmOp)ins.op;
+    size_t run = 1;
+    size_t dbg_from = i;
+    old_target[w] = -1;
+
+    // $x = $x (+|-) const, for named variables and slot locals alike
+    if ((op == MI_VM_OP_LOAD_VAR || op == MI_VM_OP_LOAD_LOCAL) && i + 3 < n && !s_run_has_target(is_target, i, 4))
+    {
+      bool is_local = op == MI_VM_OP_LOAD_LOCAL;
+      MiVmIns k = src[i + 1];
+      MiVmIns arith = src[i + 2];
+      MiVmIns st = src[i + 3];
+      uint8_t rx = ins.a;
+      uint8_t ry = k.a;
+      uint8_t rz = arith.a;
+      if (k.op == MI_VM_OP_LOAD_CONST && k.imm >= 0 && k.imm <= 0xFF && rx != ry &&
+          s_is_add_or_sub((MiVmOp)arith.op) && arith.b == rx && arith.c == ry &&
+          st.op == (is_local ? MI_VM_OP_STORE_LOCAL : MI_VM_OP_STORE_VAR) && st.a == rz && st.imm == ins.imm &&
+          (rx == rz || s_reg_dead_at(src, n, i + 4, rx, visited)) &&
+          (ry == rz || s_reg_dead_at(src, n, i + 4, ry, visited)))
+      {
+        bool is_add = arith.op == MI_VM_OP_ADD || arith.op == MI_VM_OP_ADD_INT || arith.op == MI_VM_OP_ADD_FLOAT;
+        if (is_local)
+        {
+          ins.op = (uint8_t)(is_add ? MI_VM_OP_ADD_LOCAL_CONST : MI_VM_OP_SUB_LOCAL_CONST);
+        }
+        else
+        {
+          ins.op = (uint8_t)(is_add ? MI_VM_OP_ADD_VAR_CONST : MI_VM_OP_SUB_VAR_CONST);
+        }
+        ins.a = rz;
+        ins.b = (uint8_t)k.imm;
+        ins.c = 0;
+        run = 4;
+        dbg_from = i + 2;
+      }
+    }
+
+    // cmp rA, rB, rC ; JF rA -> JUMP_IF_NOT_<cmp> rB, rC
+    if (run == 1 && s_compare_jump_op(op) != MI_VM_OP_NOOP && i + 1 < n && !s_run_has_target(is_target, i, 2))
+    {
+      MiVmIns jf = src[i + 1];
+      if (jf.op == MI_VM_OP_JUMP_IF_FALSE && jf.a == ins.a)
+      {
+        int64_t t = (int64_t)i + 2 + (int64_t)jf.imm;
+        memset(visited, 0, n);
+        bool live = s_reg_live_from(src, n, i + 2, ins.a, visited) ||
+          s_reg_live_from(src, n, (size_t)t, ins.a, visited);
+        if (!live)
+        {
+          ins.op = (uint8_t)s_compare_jump_op(op);
+          ins.a = 0;
+          ins.imm = 0;
+          old_target[w] = t;
+          run = 2;
+        }
+      }
+    }
+
+    // APV sym ; CALLF a, argc, cmd -> CALLFV a, argc, sym, cmd
+    if (run == 1 && op == MI_VM_OP_ARG_PUSH_VAR_SYM && ins.imm >= 0 && ins.imm <= 0xFF &&
+        i + 1 < n && !s_run_has_target(is_target, i, 2))
+    {
+      MiVmIns call = src[i + 1];
+      if (call.op == MI_VM_OP_CALL_CMD_FAST && call.b >= 1)
+      {
+        uint8_t sym = (uint8_t)ins.imm;
+        ins = call;
+        ins.op = MI_VM_OP_CALL_CMD_FAST_VAR;
+        ins.c = sym;
+        run = 2;
+        dbg_from = i + 1;
+      }
+    }
+
+    if (run == 1 && s_is_jump(op))
+    {
+      old_target[w] = (int64_t)i + 1 + (int64_t)ins.imm;
+    }
+
+    for (size_t k = 0; k < run; ++k)
+    {
+      new_index[i + k] = w;
+    }
+
+    chunk->code[w] = ins;
+    if (chunk->dbg_lines)
+    {
+      chunk->dbg_lines[w] = chunk->dbg_lines[dbg_from];
+    }
+    if (chunk->dbg_cols)
+    {
+      chunk->dbg_cols[w] = chunk->dbg_cols[dbg_from];
+    }
+    w += 1;
+    i += run;
+  }
+  new_index[n] = w;
+
+  // Re-point jumps at the compacted code.
+  for (size_t j = 0; j < w; ++j)
+  {
+    if (old_target[j] >= 0)
+    {
+      chunk->code[j].imm = (int32_t)((int64_t)new_index[old_target[j]] - (int64_t)(j + 1));
+    }
+  }
+
+  size_t removed = n - w;
+  chunk->code_count = w;
+
+  free(src);
+  free(is_target);
+  free(visited);
+  free(new_index);
+  free(old_target);
+  return removed;
+}
@@ -0,0 +1,23 @@
+#ifndef MI_PEEPHOLE_H
+#define MI_PEEPHOLE_H
+
+#include <stddef.h>
+
+#include "mi_vm.h"
+
+/**
+ * Fuse common instruction runs of a compiled chunk into superinstructions:
+ *  - LOAD_VAR/LOAD_CONST/ADD|SUB/STORE_VAR on the same variable -> ADD_VAR_CONST / SUB_VAR_CONST
+ *    (LOAD_LOCAL/STORE_LOCAL on the same slot map to ADD_LOCAL_CONST / SUB_LOCAL_CONST)
+ *  - EQ..GTEQ followed by JUMP_IF_FALSE                          -> JUMP_IF_NOT_<cmp>
+ *    (int-typed compares map to JUMP_IF_NOT_<cmp>_INT)
+ *  - ARG_PUSH_VAR_SYM followed by CALL_CMD_FAST                  -> CALL_CMD_FAST_VAR
+ *
+ * Works in place. Jump offsets and dbg_lines/dbg_cols are remapped to the
+ * compacted code. Subchunks are not visited.
+ * @param chunk Chunk to rewrite.
+ * @return Number of instructions removed.
+ */
+size_t mi_peephole_chunk(MiVmChunk* chunk);
+
+#endif // MI_PEEPHOLE_H
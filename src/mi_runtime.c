@@ -28,17 +28,110 @@ static void* s_realloc(void* ptr, size_t size)
   return p;
 }
 
-static void s_scope_init(MiScopeFrame* f, size_t chunk_size, MiScopeFrame* parent)
+static void s_scope_init(MiRuntime* rt, MiScopeFrame* f, MiScopeFrame* parent)
 {
-  f->arena = x_arena_create(chunk_size);
-  if (!f->arena)
-  {
-    mi_error("mi_runtime: out of memory\n");
-    exit(1);
-  }
+  f->rt = rt;
+  f->arena = NULL;
   f->vars = NULL;
+  f->open_upvals = NULL;
   f->parent = parent;
   f->next_free = NULL;
+  f->kept_blocks = NULL;
+  f->on_stack = false;
+  f->stack_below = NULL;
+  f->refs = 0u;
+  f->parent_held = false;
+}
+
+//----------------------------------------------------------
+// Scope stack
+//----------------------------------------------------------
+
+#define MI_RT_SCOPE_BLOCK_SIZE (64u * 1024u)
+#define MI_RT_SCOPE_ALIGN      16u
+
+static MiScopeMark s_scope_stack_mark(const MiRuntime* rt)
+{
+  MiScopeMark m;
+  m.block = rt->scope_block;
+  m.top = rt->scope_block ? rt->scope_block->top : 0u;
+  return m;
+}
+
+// Bump 'size' bytes off the scope stack, moving on to the next block (or
+// linking a new one) when the current one is full.
+static void* s_scope_stack_alloc(MiRuntime* rt, size_t size)
+{
+  size = (size + (MI_RT_SCOPE_ALIGN - 1u)) & ~(size_t)(MI_RT_SCOPE_ALIGN - 1u);
+
+  MiScopeBlock* blk = rt->scope_block;
+  if (!blk || blk->top + size > blk->size)
+  {
+    MiScopeBlock* next = blk ? blk->next : NULL;
+    if (!next || next->size < size)
+    {
+      // No spare block large enough: link a new one in front of the spare.
+      size_t bytes = size > MI_RT_SCOPE_BLOCK_SIZE ? size : MI_RT_SCOPE_BLOCK_SIZE;
+      MiScopeBlock* fresh = (MiScopeBlock*)s_realloc(NULL, sizeof(*fresh) + bytes);
+      fresh->bytes = (uint8_t*)(fresh + 1);
+      fresh->size = bytes;
+      fresh->prev = blk;
+      fresh->next = next;
+      if (next)
+      {
+        next->prev = fresh;
+      }
+      if (blk)
+      {
+        blk->next = fresh;
+      }
+      next = fresh;
+    }
+    next->top = 0u;
+    blk = next;
+    rt->scope_block = blk;
+  }
+
+  void* p = blk->bytes + blk->top;
+  blk->top += size;
+  return p;
+}
+
+// Pop everything above 'm'. Blocks past it stay linked for reuse.
+static void s_scope_stack_rewind(MiRuntime* rt, MiScopeMark m)
+{
+  if (!m.block)
+  {
+    // Taken before the first block existed: empty the stack down to it.
+    MiScopeBlock* first = rt->scope_block;
+    while (first && first->prev)
+    {
+      first = first->prev;
+    }
+    m.block = first;
+  }
+  rt->scope_block = m.block;
+  if (m.block)
+  {
+    m.block->top = m.top;
+  }
+}
+
+static void s_scope_stack_free(MiRuntime* rt)
+{
+  MiScopeBlock* blk = rt->scope_block;
+  while (blk && blk->prev)
+  {
+    blk = blk->prev;
+  }
+  while (blk)
+  {
+    MiScopeBlock* next = blk->next;
+    free(blk);
+    blk = next;
+  }
+  rt->scope_block = NULL;
+  rt->scope_top = NULL;
 }
 
 static MiRtVar* s_var_find_in_frame_id(const MiScopeFrame* frame, uint32_t sym_id)
@@ -61,6 +154,114 @@ static MiRtVar* s_var_find_in_frame_id(const MiScopeFrame* frame, uint32_t sym_i
   return NULL;
 }
 
+static void s_scope_touch(MiRuntime* rt, MiScopeFrame* frame)
+{
+  frame->version = ++rt->scope_serial;
+}
+
+// A binding of sym_id changed in a way call sites may have cached.
+static void s_sym_touch(MiRuntime* rt, uint32_t sym_id)
+{
+  if ((size_t)sym_id < rt->sym_count && ++rt->sym_versions[sym_id] == 0u)
+  {
+    rt->sym_versions[sym_id] = 1u;
+  }
+}
+
+static void s_var_assign(MiRuntime* rt, MiRtVar* v, MiRtValue value)
+{
+  if (v->value.kind == MI_RT_VAL_CMD || value.kind == MI_RT_VAL_CMD)
+  {
+    s_sym_touch(rt, v->sym_id);
+  }
+  mi_rt_value_assign(rt, &v->value, value);
+}
+
+static void s_var_create(MiRuntime* rt, MiScopeFrame* frame, uint32_t sym_id, MiRtValue value)
+{
+  MiRtVar* v = NULL;
+  if (frame == rt->scope_top)
+  {
+    v = (MiRtVar*)s_scope_stack_alloc(rt, sizeof(MiRtVar));
+  }
+  else
+  {
+    // Heap, root and detached frames, or a stack frame with another one above.
+    if (!frame->arena)
+    {
+      frame->arena = x_arena_create(rt->scope_chunk_size);
+    }
+    v = frame->arena ? (MiRtVar*)x_arena_alloc(frame->arena, sizeof(MiRtVar)) : NULL;
+    if (!v)
+    {
+      mi_error("mi_runtime: out of memory");
+      exit(1);
+    }
+  }
+
+  v->sym_id = sym_id;
+  v->value = mi_rt_make_void();
+  mi_rt_value_assign(rt, &v->value, value);
+  v->next = frame->vars;
+  frame->vars = v;
+
+  s_scope_touch(rt, frame);
+  s_sym_touch(rt, sym_id);
+  if (frame != &rt->root && (size_t)sym_id < rt->sym_count)
+  {
+    rt->sym_shadows[sym_id]++;
+  }
+}
+
+// Move the values of the frame's captured bindings into their upvalues.
+static void s_upvals_close(MiRuntime* rt, MiScopeFrame* frame)
+{
+  MiRtUpval* up = frame->open_upvals;
+  while (up)
+  {
+    MiRtUpval* next = up->next_open;
+    up->closed = *up->var;
+    up->closed.next = NULL;
+    mi_rt_value_retain(rt, up->closed.value);
+    up->var = &up->closed;
+    up->frame = NULL;
+    up->next_open = NULL;
+    up = next;
+  }
+  frame->open_upvals = NULL;
+}
+
+// Release the blocks 'frame' kept (see mi_rt_scope_keep_block).
+static void s_scope_release_kept(MiRuntime* rt, MiScopeFrame* frame)
+{
+  MiRtBlock* b = frame->kept_blocks;
+  frame->kept_blocks = NULL;
+  while (b)
+  {
+    MiRtBlock* next = b->kept_next;
+    b->kept_next = NULL;
+    mi_rt_value_release(rt, mi_rt_make_block(b));
+    b = next;
+  }
+}
+
+// Release the values bound in a non-root frame that is going away.
+static void s_var_release_frame(MiRuntime* rt, MiScopeFrame* frame)
+{
+  s_upvals_close(rt, frame);
+
+  MiRtVar* it = frame->vars;
+  while (it)
+  {
+    if ((size_t)it->sym_id < rt->sym_count)
+    {
+      rt->sym_shadows[it->sym_id]--;
+    }
+    mi_rt_value_release(rt, it->value);
+    it = it->next;
+  }
+}
+
 static void* s_value_payload_ptr(MiRtValue v)
 {
   switch (v.kind)
@@ -127,7 +328,23 @@ static void s_value_pre_destroy(MiRuntime* rt, MiRtValue v)
   }
   else if (v.kind == MI_RT_VAL_BLOCK && v.as.block)
   {
-    // Blocks currently don't own their env/payload memory. 
+    // Blocks don't own their payload, only their upvalues and a held env.
+    MiRtBlock* b = v.as.block;
+    if (b->env_held)
+    {
+      b->env_held = false;
+      mi_rt_scope_release(rt, b->env);
+    }
+    if (b->upvals)
+    {
+      for (uint32_t i = 0u; i < b->upval_count; ++i)
+      {
+        mi_rt_upval_release(rt, b->upvals[i]);
+      }
+      mi_heap_release_payload(&rt->heap, b->upvals);
+      b->upvals = NULL;
+      b->upval_count = 0u;
+    }
   }
   else if (v.kind == MI_RT_VAL_CMD && v.as.cmd)
   {
@@ -172,11 +389,23 @@ void mi_rt_init(MiRuntime* rt)
     exit(1);
   }
   rt->root.vars = NULL;
+  rt->root.open_upvals = NULL;
   rt->root.parent = NULL;
   rt->root.next_free = NULL;
+  rt->root.on_stack = false;
+  rt->root.stack_below = NULL;
+  rt->root.refs = 0u;
+  rt->root.parent_held = false;
+  rt->root.kept_blocks = NULL;
+  rt->scope_serial = 0u;
+  s_scope_touch(rt, &rt->root);
 
   rt->current = &rt->root;
   rt->free_frames = NULL;
+  rt->held_frames = NULL;
+  rt->held_changed = false;
+  rt->scope_block = NULL;
+  rt->scope_top = NULL;
 
   rt->commands = NULL;
   rt->command_count = 0u;
@@ -186,8 +415,13 @@ void mi_rt_init(MiRuntime* rt)
 
 
   rt->sym_names = NULL;
+  rt->sym_hashes = NULL;
   rt->sym_count = 0u;
   rt->sym_capacity = 0u;
+  rt->sym_slots = NULL;
+  rt->sym_slot_capacity = 0u;
+  rt->sym_versions = NULL;
+  rt->sym_shadows = NULL;
 }
 
 void mi_rt_shutdown(MiRuntime* rt)
@@ -204,6 +438,7 @@ void mi_rt_shutdown(MiRuntime* rt)
   }
 
   // Release all values stored in the root scope. 
+  s_scope_release_kept(rt, &rt->root);
   {
     MiRtVar* it = rt->root.vars;
     while (it)
@@ -214,6 +449,17 @@ void mi_rt_shutdown(MiRuntime* rt)
     rt->root.vars = NULL;
   }
 
+  // Frames still held are only held by each other now; their values go
+  // with the heap.
+  mi_rt_scope_collect(rt);
+  while (rt->held_frames)
+  {
+    MiScopeFrame* f = rt->held_frames;
+    rt->held_frames = f->next_free;
+    f->next_free = rt->free_frames;
+    rt->free_frames = f;
+  }
+
   // Destroy cached/free frames. Values were released on pop, so just free arenas. 
   while (rt->free_frames)
   {
@@ -227,6 +473,7 @@ void mi_rt_shutdown(MiRuntime* rt)
     }
     free(f);
   }
+  s_scope_stack_free(rt);
 
   // Release user commands array (names are interned via heap and released below). 
   if (rt->commands)
@@ -247,8 +494,17 @@ void mi_rt_shutdown(MiRuntime* rt)
     free(rt->sym_names);
     rt->sym_names = NULL;
   }
+  free(rt->sym_hashes);
+  rt->sym_hashes = NULL;
+  free(rt->sym_slots);
+  rt->sym_slots = NULL;
+  free(rt->sym_versions);
+  rt->sym_versions = NULL;
+  free(rt->sym_shadows);
+  rt->sym_shadows = NULL;
   rt->sym_count = 0u;
   rt->sym_capacity = 0u;
+  rt->sym_slot_capacity = 0u;
 
   // Destroy root arena last (it owns scope vars allocations). 
   if (rt->root.arena)
@@ -273,6 +529,85 @@ MiHeapStats mi_rt_heap_stats(const MiRuntime* rt)
   return mi_heap_stats(&rt->heap);
 }
 
+static uint32_t s_sym_hash(XSlice name)
+{
+  uint32_t h = 2166136261u; // FNV-1a 32
+  for (size_t i = 0u; i < name.length; ++i)
+  {
+    h = h ^ (uint32_t)(uint8_t)name.ptr[i];
+    h = h * 16777619u;
+  }
+  return h;
+}
+
+// Rebuild the symbol index with 'new_cap' slots from the stored hashes.
+static bool s_sym_index_grow(MiRuntime* rt, size_t new_cap)
+{
+  uint32_t* slots = (uint32_t*)calloc(new_cap, sizeof(uint32_t));
+  if (!slots)
+  {
+    return false;
+  }
+
+  size_t mask = new_cap - 1u;
+  for (size_t id = 0u; id < rt->sym_count; ++id)
+  {
+    size_t i = (size_t)rt->sym_hashes[id] & mask;
+    while (slots[i] != 0u)
+    {
+      i = (i + 1u) & mask;
+    }
+    slots[i] = (uint32_t)id + 1u;
+  }
+
+  free(rt->sym_slots);
+  rt->sym_slots = slots;
+  rt->sym_slot_capacity = new_cap;
+  return true;
+}
+
+// Probe the symbol index for 'name'. Returns the id, or UINT32_MAX with
+// *out_slot set to the empty slot where it would be inserted.
+static uint32_t s_sym_lookup(const MiRuntime* rt, XSlice name, uint32_t hash, size_t* out_slot)
+{
+  size_t mask = rt->sym_slot_capacity - 1u;
+  size_t slot = (size_t)hash & mask;
+  if (rt->sym_slot_capacity)
+  {
+    while (rt->sym_slots[slot] != 0u)
+    {
+      uint32_t id = rt->sym_slots[slot] - 1u;
+      if (rt->sym_hashes[id] == hash && x_slice_eq(rt->sym_names[id], name))
+      {
+        return id;
+      }
+      slot = (slot + 1u) & mask;
+    }
+  }
+  *out_slot = slot;
+  return UINT32_MAX;
+}
+
+bool mi_rt_sym_find(const MiRuntime* rt, XSlice name, uint32_t* out_sym_id)
+{
+  if (!rt)
+  {
+    return false;
+  }
+
+  size_t slot = 0u;
+  uint32_t id = s_sym_lookup(rt, name, s_sym_hash(name), &slot);
+  if (id == UINT32_MAX)
+  {
+    return false;
+  }
+  if (out_sym_id)
+  {
+    *out_sym_id = id;
+  }
+  return true;
+}
+
 uint32_t mi_rt_sym_intern(MiRuntime* rt, XSlice name)
 {
   if (!rt)
@@ -280,12 +615,12 @@ uint32_t mi_rt_sym_intern(MiRuntime* rt, XSlice name)
     return 0u;
   }
 
-  for (size_t i = 0u; i < rt->sym_count; ++i)
+  uint32_t hash = s_sym_hash(name);
+  size_t slot = 0u;
+  uint32_t found = s_sym_lookup(rt, name, hash, &slot);
+  if (found != UINT32_MAX)
   {
-    if (x_slice_eq(rt->sym_names[i], name))
-    {
-      return (uint32_t)i;
-    }
+    return found;
   }
 
   if (rt->sym_count == rt->sym_capacity)
@@ -297,9 +632,38 @@ uint32_t mi_rt_sym_intern(MiRuntime* rt, XSlice name)
       return 0u;
     }
     rt->sym_names = new_names;
+    uint32_t* new_hashes = (uint32_t*)realloc(rt->sym_hashes, new_cap * sizeof(uint32_t));
+    if (!new_hashes)
+    {
+      return 0u;
+    }
+    rt->sym_hashes = new_hashes;
+    uint32_t* new_versions = (uint32_t*)realloc(rt->sym_versions, new_cap * sizeof(uint32_t));
+    if (!new_versions)
+    {
+      return 0u;
+    }
+    rt->sym_versions = new_versions;
+    uint32_t* new_shadows = (uint32_t*)realloc(rt->sym_shadows, new_cap * sizeof(uint32_t));
+    if (!new_shadows)
+    {
+      return 0u;
+    }
+    rt->sym_shadows = new_shadows;
     rt->sym_capacity = new_cap;
   }
 
+  // Keep the index at most half full.
+  bool rehash = (rt->sym_count + 1u) * 2u > rt->sym_slot_capacity;
+  if (rehash)
+  {
+    size_t new_cap = rt->sym_slot_capacity ? rt->sym_slot_capacity * 2u : 128u;
+    if (!s_sym_index_grow(rt, new_cap))
+    {
+      return 0u;
+    }
+  }
+
   size_t alloc_size = name.length + 1u;
   char* copy = (char*)mi_heap_alloc_buffer(&rt->heap, alloc_size);
   if (!copy)
@@ -312,9 +676,24 @@ uint32_t mi_rt_sym_intern(MiRuntime* rt, XSlice name)
   }
   copy[name.length] = '\0';
 
-  rt->sym_names[rt->sym_count] = x_slice_init(copy, name.length);
+  uint32_t id = (uint32_t)rt->sym_count;
+  rt->sym_names[id] = x_slice_init(copy, name.length);
+  rt->sym_hashes[id] = hash;
+  rt->sym_versions[id] = 1u;
+  rt->sym_shadows[id] = 0u;
   rt->sym_count++;
-  return (uint32_t)(rt->sym_count - 1u);
+
+  if (rehash)
+  {
+    size_t mask = rt->sym_slot_capacity - 1u;
+    slot = (size_t)hash & mask;
+    while (rt->sym_slots[slot] != 0u)
+    {
+      slot = (slot + 1u) & mask;
+    }
+  }
+  rt->sym_slots[slot] = id + 1u;
+  return id;
 }
 
 XSlice mi_rt_sym_name(const MiRuntime* rt, uint32_t sym_id)
@@ -364,12 +743,6 @@ void mi_rt_value_release(MiRuntime* rt, MiRtValue v)
     return;
   }
 
-  if (hdr->kind == MI_OBJ_BLOCK && hdr->refcount == 1)
-  {
-    MiRtBlock* b = (MiRtBlock*)p;
-    printf("FREE BLOCK %p block_kind=%d ptr=%p env=%p\n", b, b->kind, b->ptr, b->env);
-  }
-
   // If this is the last reference, release children before freeing. 
   if (hdr->refcount == 1u)
   {
@@ -486,6 +859,26 @@ void mi_rt_scope_push_with_parent(MiRuntime* rt, MiScopeFrame* parent)
     return;
   }
 
+  MiScopeMark mark = s_scope_stack_mark(rt);
+  MiScopeFrame* f = (MiScopeFrame*)s_scope_stack_alloc(rt, sizeof(MiScopeFrame));
+  s_scope_init(rt, f, parent);
+  f->on_stack = true;
+  f->stack_mark = mark;
+  f->vars_mark = s_scope_stack_mark(rt);
+  f->stack_below = rt->scope_top;
+  rt->scope_top = f;
+  s_scope_touch(rt, f);
+
+  rt->current = f;
+}
+
+void mi_rt_scope_push_heap(MiRuntime* rt, MiScopeFrame* parent)
+{
+  if (!rt)
+  {
+    return;
+  }
+
   MiScopeFrame* f = NULL;
   if (rt->free_frames)
   {
@@ -496,13 +889,15 @@ void mi_rt_scope_push_with_parent(MiRuntime* rt, MiScopeFrame* parent)
     f->parent = parent;
     x_arena_reset(f->arena);
     f->vars = NULL;
+    f->refs = 0u;
+    f->parent_held = false;
   }
   else
   {
     f = (MiScopeFrame*)s_realloc(NULL, sizeof(MiScopeFrame));
-    s_scope_init(f, rt->scope_chunk_size, parent);
-    f->rt = rt;
+    s_scope_init(rt, f, parent);
   }
+  s_scope_touch(rt, f);
 
   rt->current = f;
 }
@@ -515,8 +910,8 @@ MiScopeFrame* mi_rt_scope_create_detached(MiRuntime* rt, MiScopeFrame* parent)
   }
 
   MiScopeFrame* f = (MiScopeFrame*)s_realloc(NULL, sizeof(MiScopeFrame));
-  s_scope_init(f, rt->scope_chunk_size, parent);
-  f->rt = rt;
+  s_scope_init(rt, f, parent);
+  s_scope_touch(rt, f);
   return f;
 }
 
@@ -528,17 +923,36 @@ void mi_rt_scope_destroy_detached(MiRuntime* rt, MiScopeFrame* frame)
   }
 
   // Release values stored in this frame before freeing heap objects. 
-  MiRtVar* it = frame->vars;
-  while (it)
-  {
-    mi_rt_value_release(rt, it->value);
-    it = it->next;
-  }
+  s_scope_release_kept(rt, frame);
+  s_var_release_frame(rt, frame);
 
   x_arena_destroy(frame->arena);
   free(frame);
 }
 
+// References to 'frame' that only its own bindings hold: blocks (or bodies
+// of commands) kept nowhere else whose env is the frame. They go away with
+// the bindings, so they don't keep the frame alive.
+static uint32_t s_scope_self_refs(const MiScopeFrame* frame)
+{
+  uint32_t n = 0u;
+  for (const MiRtVar* it = frame->vars; it && n < frame->refs; it = it->next)
+  {
+    MiRtValue v = it->value;
+    if (v.kind == MI_RT_VAL_CMD && v.as.cmd && !v.as.cmd->is_native &&
+        mi_heap_header_from_payload(v.as.cmd)->refcount == 1u)
+    {
+      v = v.as.cmd->body;
+    }
+    if (v.kind == MI_RT_VAL_BLOCK && v.as.block && v.as.block->env == frame && v.as.block->env_held &&
+        mi_heap_header_from_payload(v.as.block)->refcount == 1u)
+    {
+      n += 1u;
+    }
+  }
+  return n;
+}
+
 void mi_rt_scope_pop(MiRuntime* rt)
 {
   if (!rt || !rt->current || rt->current == &rt->root)
@@ -547,21 +961,138 @@ void mi_rt_scope_pop(MiRuntime* rt)
   }
 
   MiScopeFrame* dead = rt->current;
+  s_scope_release_kept(rt, dead);
 
-  // Release all values stored in this frame before the arena is reused. 
-  MiRtVar* it = dead->vars;
-  while (it)
+  if (!dead->on_stack && dead->refs > s_scope_self_refs(dead))
   {
-    mi_rt_value_release(rt, it->value);
-    it = it->next;
+    // A block still uses the frame as env: keep it, its bindings and the
+    // frames it chains to until the block goes away.
+    rt->current = dead->parent;
+    dead->parent_held = dead->parent && !dead->parent->on_stack;
+    if (dead->parent_held)
+    {
+      mi_rt_scope_retain(dead->parent);
+    }
+    dead->next_free = rt->held_frames;
+    rt->held_frames = dead;
+    rt->held_changed = true;
+    return;
   }
 
+  // Release all values stored in this frame before the arena is reused. 
+  s_var_release_frame(rt, dead);
+
   rt->current = dead->parent;
 
+  if (dead->on_stack)
+  {
+    // Also drops frames left above it by an unwound error.
+    x_arena_destroy(dead->arena);
+    rt->scope_top = dead->stack_below;
+    s_scope_stack_rewind(rt, dead->stack_mark);
+    return;
+  }
+
   dead->next_free = rt->free_frames;
   rt->free_frames = dead;
 }
 
+void mi_rt_scope_keep_block(MiRuntime* rt, MiScopeFrame* frame, MiRtBlock* block)
+{
+  if (!block)
+  {
+    return;
+  }
+  if (!frame)
+  {
+    mi_rt_value_release(rt, mi_rt_make_block(block));
+    return;
+  }
+  block->kept_next = frame->kept_blocks;
+  frame->kept_blocks = block;
+}
+
+void mi_rt_scope_retain(MiScopeFrame* frame)
+{
+  if (frame)
+  {
+    frame->refs += 1u;
+  }
+}
+
+void mi_rt_scope_release(MiRuntime* rt, MiScopeFrame* frame)
+{
+  if (frame && frame->refs > 0u)
+  {
+    frame->refs -= 1u;
+    rt->held_changed = true;
+  }
+}
+
+void mi_rt_scope_collect(MiRuntime* rt)
+{
+  if (!rt || !rt->held_changed)
+  {
+    return;
+  }
+  rt->held_changed = false;
+
+  // Recycling a frame releases its parent, which may free that one in turn.
+  bool progress = true;
+  while (progress)
+  {
+    progress = false;
+    MiScopeFrame** link = &rt->held_frames;
+    while (*link)
+    {
+      MiScopeFrame* f = *link;
+      if (f->refs > s_scope_self_refs(f))
+      {
+        link = &f->next_free;
+        continue;
+      }
+
+      *link = f->next_free;
+      s_var_release_frame(rt, f);
+      if (f->parent_held)
+      {
+        f->parent_held = false;
+        mi_rt_scope_release(rt, f->parent);
+      }
+      f->next_free = rt->free_frames;
+      rt->free_frames = f;
+      progress = true;
+    }
+  }
+}
+
+void mi_rt_scope_reset(MiRuntime* rt)
+{
+  if (!rt || !rt->current || rt->current == &rt->root || !rt->current->vars)
+  {
+    return;
+  }
+
+  MiScopeFrame* f = rt->current;
+  s_scope_release_kept(rt, f);
+  if (!f->on_stack && f->refs > s_scope_self_refs(f))
+  {
+    MiScopeFrame* parent = f->parent;
+    mi_rt_scope_pop(rt);
+    mi_rt_scope_push_heap(rt, parent);
+    return;
+  }
+
+  s_var_release_frame(rt, f);
+  x_arena_reset(f->arena);
+  if (f == rt->scope_top)
+  {
+    s_scope_stack_rewind(rt, f->vars_mark);
+  }
+  f->vars = NULL;
+  s_scope_touch(rt, f);
+}
+
 bool mi_rt_var_get_id(MiRuntime* rt, uint32_t sym_id, MiRtValue* out_value)
 {
   if (!rt)
@@ -621,24 +1152,13 @@ void mi_rt_var_set_from_id(MiScopeFrame* start, uint32_t sym_id, MiRtValue value
     MiRtVar* v = s_var_find_in_frame_id(f, sym_id);
     if (v)
     {
-      mi_rt_value_assign(rt, &v->value, value);
+      s_var_assign(rt, v, value);
       return;
     }
     f = f->parent;
   }
 
-  MiRtVar* v = (MiRtVar*)x_arena_alloc(start->arena, sizeof(MiRtVar));
-  if (!v)
-  {
-    mi_error("mi_runtime: out of memory");
-    exit(1);
-  }
-
-  v->sym_id = sym_id;
-  v->value = mi_rt_make_void();
-  mi_rt_value_assign(rt, &v->value, value);
-  v->next = start->vars;
-  start->vars = v;
+  s_var_create(rt, start, sym_id, value);
 }
 
 void mi_rt_var_set_id(MiRuntime* rt, uint32_t sym_id, MiRtValue value)
@@ -654,24 +1174,13 @@ void mi_rt_var_set_id(MiRuntime* rt, uint32_t sym_id, MiRtValue value)
     MiRtVar* v = s_var_find_in_frame_id(f, sym_id);
     if (v)
     {
-      mi_rt_value_assign(rt, &v->value, value);
+      s_var_assign(rt, v, value);
       return;
     }
     f = f->parent;
   }
 
-  MiRtVar* v = (MiRtVar*)x_arena_alloc(rt->current->arena, sizeof(MiRtVar));
-  if (!v)
-  {
-    mi_error("mi_runtime: out of memory");
-    exit(1);
-  }
-
-  v->sym_id = sym_id;
-  v->value = mi_rt_make_void();
-  mi_rt_value_assign(rt, &v->value, value);
-  v->next = rt->current->vars;
-  rt->current->vars = v;
+  s_var_create(rt, rt->current, sym_id, value);
 }
 
 void mi_rt_var_define_id(MiRuntime* rt, uint32_t sym_id, MiRtValue value)
@@ -684,22 +1193,92 @@ void mi_rt_var_define_id(MiRuntime* rt, uint32_t sym_id, MiRtValue value)
   MiRtVar* v = s_var_find_in_frame_id(rt->current, sym_id);
   if (v)
   {
-    mi_rt_value_assign(rt, &v->value, value);
+    s_var_assign(rt, v, value);
     return;
   }
 
-  v = (MiRtVar*)x_arena_alloc(rt->current->arena, sizeof(MiRtVar));
-  if (!v)
+  s_var_create(rt, rt->current, sym_id, value);
+}
+
+MiRtVar* mi_rt_var_find_in(MiScopeFrame* frame, uint32_t sym_id)
+{
+  return s_var_find_in_frame_id(frame, sym_id);
+}
+
+void mi_rt_var_assign(MiRuntime* rt, MiRtVar* var, MiRtValue value)
+{
+  if (!rt || !var)
   {
-    mi_error("mi_runtime: out of memory");
+    return;
+  }
+  s_var_assign(rt, var, value);
+}
+
+MiRtUpval* mi_rt_upval_capture(MiRuntime* rt, MiScopeFrame* frame, MiRtVar* var)
+{
+  if (!rt || !frame || !var)
+  {
+    return NULL;
+  }
+
+  for (MiRtUpval* up = frame->open_upvals; up; up = up->next_open)
+  {
+    if (up->var == var)
+    {
+      up->refs += 1u;
+      return up;
+    }
+  }
+
+  MiRtUpval* up = (MiRtUpval*)mi_heap_alloc_buffer(&rt->heap, sizeof(MiRtUpval));
+  if (!up)
+  {
+    mi_error("mi_runtime: out of memory\n");
     exit(1);
   }
+  up->var = var;
+  up->closed.sym_id = var->sym_id;
+  up->closed.value = mi_rt_make_void();
+  up->closed.next = NULL;
+  up->frame = frame;
+  up->next_open = frame->open_upvals;
+  up->refs = 1u;
+  frame->open_upvals = up;
+  return up;
+}
 
-  v->sym_id = sym_id;
-  v->value = mi_rt_make_void();
-  mi_rt_value_assign(rt, &v->value, value);
-  v->next = rt->current->vars;
-  rt->current->vars = v;
+void mi_rt_upval_retain(MiRtUpval* up)
+{
+  if (up)
+  {
+    up->refs += 1u;
+  }
+}
+
+void mi_rt_upval_release(MiRuntime* rt, MiRtUpval* up)
+{
+  if (!rt || !up || --up->refs > 0u)
+  {
+    return;
+  }
+
+  if (up->frame)
+  {
+    MiRtUpval** link = &up->frame->open_upvals;
+    while (*link && *link != up)
+    {
+      link = &(*link)->next_open;
+    }
+    if (*link)
+    {
+      *link = up->next_open;
+    }
+  }
+  else
+  {
+    mi_rt_value_release(rt, up->closed.value);
+  }
+  mi_heap_release_payload(&rt->heap, up);
 }
 
 bool mi_rt_var_get(const MiRuntime* rt, XSlice name, MiRtValue* out_value)
@@ -825,12 +1404,13 @@ static uint64_t s_hash_value(MiRtValue v)
       }
     case MI_RT_VAL_STRING:
       {
-        if (!v.as.s.ptr)
+        XSlice s = mi_rt_value_slice(v);
+        if (!s.ptr)
         {
           return 0u;
         }
-        uint64_t h = s_hash_bytes(v.as.s.ptr, v.as.s.length);
-        return s_hash_u64(h ^ (uint64_t)v.as.s.length);
+        uint64_t h = s_hash_bytes(s.ptr, s.length);
+        return s_hash_u64(h ^ (uint64_t)s.length);
       }
     case MI_RT_VAL_LIST:
       return s_hash_u64((uint64_t)(uintptr_t)v.as.list);
@@ -838,8 +1418,9 @@ static uint64_t s_hash_value(MiRtValue v)
       return s_hash_u64((uint64_t)(uintptr_t)v.as.dict);
     case MI_RT_VAL_KVREF:
       {
-        uint64_t a = (uint64_t)(uintptr_t)v.as.kvref.dict;
-        uint64_t b = (uint64_t)v.as.kvref.entry_index;
+        MiRtKvRef r = mi_rt_value_kvref(v);
+        uint64_t a = (uint64_t)(uintptr_t)r.dict;
+        uint64_t b = (uint64_t)r.entry_index;
         return s_hash_u64(a ^ s_hash_u64(b + 0x9E3779B97F4A7C15ULL));
       }
     case MI_RT_VAL_BLOCK:
@@ -875,13 +1456,17 @@ static bool s_value_key_eq(MiRtValue a, MiRtValue b)
         return aa == bb;
       }
     case MI_RT_VAL_STRING:
-      return x_slice_eq(a.as.s, b.as.s);
+      return x_slice_eq(mi_rt_value_slice(a), mi_rt_value_slice(b));
     case MI_RT_VAL_LIST:
       return a.as.list == b.as.list;
     case MI_RT_VAL_DICT:
       return a.as.dict == b.as.dict;
     case MI_RT_VAL_KVREF:
-      return a.as.kvref.dict == b.as.kvref.dict && a.as.kvref.entry_index == b.as.kvref.entry_index;
+      {
+        MiRtKvRef ra = mi_rt_value_kvref(a);
+        MiRtKvRef rb = mi_rt_value_kvref(b);
+        return ra.dict == rb.dict && ra.entry_index == rb.entry_index;
+      }
     case MI_RT_VAL_BLOCK:
       return a.as.block == b.as.block;
     case MI_RT_VAL_PAIR:
@@ -1189,6 +1774,10 @@ MiRtBlock* mi_rt_block_create(MiRuntime* rt)
   b->ptr = NULL;
   b->env = NULL;
   b->id = 0u;
+  b->upvals = NULL;
+  b->upval_count = 0u;
+  b->env_held = false;
+  b->kept_next = NULL;
   return b;
 }
 
@@ -1364,7 +1953,13 @@ MiRtValue mi_rt_make_string_slice(XSlice s)
 {
   MiRtValue out;
   out.kind = MI_RT_VAL_STRING;
+#if MI_RT_VALUE_COMPACT
+  MI_ASSERT(s.length <= UINT32_MAX);
+  out.aux = (uint32_t)s.length;
+  out.as.str = s.ptr;
+#else
   out.as.s = s;
+#endif
   return out;
 }
 
@@ -1388,8 +1983,14 @@ MiRtValue mi_rt_make_kvref(MiRtDict* dict, size_t entry_index)
 {
   MiRtValue out;
   out.kind = MI_RT_VAL_KVREF;
+#if MI_RT_VALUE_COMPACT
+  MI_ASSERT(entry_index <= UINT32_MAX);
+  out.aux = (uint32_t)entry_index;
+  out.as.dict = dict;
+#else
   out.as.kvref.dict = dict;
   out.as.kvref.entry_index = entry_index;
+#endif
   return out;
 }
 
@@ -23,6 +23,7 @@ typedef struct MiRtDict MiRtDict;
 typedef struct MiRtBlock MiRtBlock;
 typedef struct MiRtCmd MiRtCmd;
 typedef struct MiScopeFrame MiScopeFrame;
+typedef struct MiRtUpval MiRtUpval;
 
 /* Forward decl to avoid circular include with mi_vm.h. */
 struct MiVm;
@@ -49,25 +50,75 @@ typedef enum MiRtValueKind
   MI_RT_VAL_TYPE
 } MiRtValueKind;
 
+/* Value layout. The compact layout keeps MiRtValue at 16 bytes (instead of 24)
+   by storing the length of a string, or the entry index of a KVREF, next to
+   the kind tag so the payload is a single pointer-sized word. Strings are then
+   limited to 4 GiB. Build with MI_RT_VALUE_COMPACT=0 for the wide layout.
+   Read string and KVREF payloads through mi_rt_value_slice()/mi_rt_value_kvref(). */
+#ifndef MI_RT_VALUE_COMPACT
+#define MI_RT_VALUE_COMPACT 1
+#endif
+
 struct MiRtValue
 {
   MiRtValueKind kind;
+#if MI_RT_VALUE_COMPACT
+  uint32_t      aux; /* MI_RT_VAL_STRING: length; MI_RT_VAL_KVREF: entry index. */
+#endif
 
   union
   {
     long long  i;
     double     f;
     bool       b;
+#if MI_RT_VALUE_COMPACT
+    const char* str;
+#else
     XSlice     s;
+    MiRtKvRef   kvref;
+#endif
     MiRtPair*  pair;
     MiRtList*  list;
-    MiRtDict*  dict;
-    MiRtKvRef   kvref;
+    MiRtDict*  dict; /* Also the dict of a KVREF in the compact layout. */
     MiRtBlock* block;
     MiRtCmd*   cmd;
   } as;
 };
 
+/**
+ * String payload of a MI_RT_VAL_STRING value.
+ * @param v String runtime value.
+ * @return  Slice referencing the string bytes (not copied).
+ */
+static inline XSlice mi_rt_value_slice(MiRtValue v)
+{
+#if MI_RT_VALUE_COMPACT
+  XSlice s;
+  s.ptr = v.as.str;
+  s.length = (size_t)v.aux;
+  return s;
+#else
+  return v.as.s;
+#endif
+}
+
+/**
+ * Payload of a MI_RT_VAL_KVREF value.
+ * @param v KVREF runtime value.
+ * @return  Dict and entry index the value refers to.
+ */
+static inline MiRtKvRef mi_rt_value_kvref(MiRtValue v)
+{
+#if MI_RT_VALUE_COMPACT
+  MiRtKvRef r;
+  r.dict = v.as.dict;
+  r.entry_index = (size_t)v.aux;
+  return r;
+#else
+  return v.as.kvref;
+#endif
+}
+
 /* Native (C) command signature used by first-class command values. */
 typedef MiRtValue (*MiRtNativeFn)(struct MiVm* vm, XSlice cmd_name, int argc, const MiRtValue* argv);
 
@@ -146,6 +197,13 @@ struct MiRtBlock
   void*         ptr;      // AST payloads
   MiScopeFrame* env;      // Defining environment (VM blocks)
   uint32_t      id;       // VM chunk id or user id
+  // Bindings the body reads or writes by upvalue index (VM blocks whose
+  // chunk has upvalues). env is then the creating frame's lexical parent
+  // rather than the creating frame itself. Owned by the block.
+  MiRtUpval**   upvals;
+  uint32_t      upval_count;
+  bool          env_held;  // The block retains env (mi_rt_scope_retain)
+  MiRtBlock*    kept_next; // Next in the kept_blocks of the frame keeping it
 };
 
 //----------------------------------------------------------
@@ -159,17 +217,78 @@ typedef struct MiRtVar
   struct MiRtVar*   next;
 } MiRtVar;
 
+// A binding captured by a block. While the frame holding it is alive the
+// upvalue points at the frame's variable, so both see every store; when the
+// frame is popped or reset the value moves into the upvalue itself.
+struct MiRtUpval
+{
+  MiRtVar*          var;        // The binding; &closed once closed.
+  MiRtVar           closed;
+  MiScopeFrame*     frame;      // Frame holding var while open, else NULL.
+  struct MiRtUpval* next_open;
+  uint32_t          refs;
+};
+
+/* Upvalue for 'var', a binding of 'frame', shared with any block that
+   captured it already. The caller owns one reference. */
+MiRtUpval* mi_rt_upval_capture(MiRuntime* rt, MiScopeFrame* frame, MiRtVar* var);
+void       mi_rt_upval_retain(MiRtUpval* up);
+void       mi_rt_upval_release(MiRuntime* rt, MiRtUpval* up);
+
 /* Create/destroy detached scope frames (not tied to rt->current push/pop). */
 MiScopeFrame* mi_rt_scope_create(MiRuntime* rt, MiScopeFrame* parent);
 void          mi_rt_scope_destroy(MiRuntime* rt, MiScopeFrame* frame);
 
+// Frames pushed by mi_rt_scope_push() and mi_rt_scope_push_with_parent(), and
+// their variables, are carved from a stack of blocks that never move, so a
+// frame pointer stays valid for as long as the frame lives. Blocks past the
+// top are kept for the next push.
+typedef struct MiScopeBlock
+{
+  struct MiScopeBlock* prev;
+  struct MiScopeBlock* next;
+  size_t               size;
+  size_t               top;
+  uint8_t*             bytes;
+} MiScopeBlock;
+
+/* A position on the scope stack. */
+typedef struct MiScopeMark
+{
+  MiScopeBlock* block;
+  size_t        top;
+} MiScopeMark;
+
 typedef struct MiScopeFrame
 {
   MiRuntime*           rt;
-  XArena*              arena;
+  XArena*              arena;     // Variable storage off the stack; created on first use.
   MiRtVar*             vars;
+  MiRtUpval*           open_upvals; // Upvalues still pointing into vars.
   struct MiScopeFrame* parent;
   struct MiScopeFrame* next_free;
+  // Changes whenever the set of bindings in this frame does (a variable is
+  // created, the frame is reused). Drawn from MiRuntime.scope_serial, so a
+  // recycled frame never repeats a version; inline caches key on it.
+  uint64_t             version;
+  // Blocks the frame holds a reference to until its bindings go, linked by
+  // kept_next (see mi_rt_scope_keep_block).
+  struct MiRtBlock*    kept_blocks;
+
+  // Frames on the scope stack: where the stack stood before the frame and
+  // after its header, and the stack frame pushed before it. Variables are
+  // bumped onto the stack while no other stack frame is above this one.
+  bool                 on_stack;
+  MiScopeMark          stack_mark;
+  MiScopeMark          vars_mark;
+  struct MiScopeFrame* stack_below;
+
+  // Heap frames kept as env by blocks (see mi_rt_scope_retain). A frame
+  // popped while retained keeps its bindings, and a reference to its parent
+  // when parent_held, on MiRuntime.held_frames (linked by next_free) until
+  // mi_rt_scope_collect() finds nothing else holds it.
+  uint32_t             refs;
+  bool                 parent_held;
 } MiScopeFrame;
 
 typedef struct MiExprList MiExprList;
@@ -194,9 +313,14 @@ struct MiRuntime
 
   MiScopeFrame      root;
   MiScopeFrame*     current;
-  MiScopeFrame*     free_frames;
+  MiScopeFrame*     free_frames;    // Popped heap frames, for reuse.
+  MiScopeFrame*     held_frames;    // Popped heap frames blocks still use (see mi_rt_scope_collect).
+  bool              held_changed;   // A frame was held or released since the last collect.
   size_t            scope_chunk_size;
 
+  MiScopeBlock*     scope_block;    // Block holding the top of the scope stack.
+  MiScopeFrame*     scope_top;      // Newest frame on the scope stack, or NULL.
+
   MiRtUserCommand*  commands;
   size_t            command_count;
   size_t            command_capacity;
@@ -204,14 +328,29 @@ struct MiRuntime
   MiRtExecBlockFn   exec_block;
 
   XSlice*           sym_names;
+  uint32_t*         sym_hashes;     // Hash of each name, parallel to sym_names.
   size_t            sym_count;
   size_t            sym_capacity;
+
+  // Open-addressed index over sym_names: slot holds sym_id + 1, 0 when empty.
+  uint32_t*         sym_slots;
+  size_t            sym_slot_capacity; // Power of two.
+
+  // Binding state per symbol, parallel to sym_names. sym_versions changes
+  // whenever a variable with that name is created or a command stored in one
+  // is replaced; sym_shadows counts live bindings outside the root scope.
+  // Together they let call sites cache "this name is not shadowed".
+  uint32_t*         sym_versions;
+  uint32_t*         sym_shadows;
+
+  uint64_t          scope_serial;   // Last MiScopeFrame.version handed out.
 };
 
 MiHeapStats mi_rt_heap_stats(const MiRuntime* rt);
 
 uint32_t  mi_rt_sym_intern(MiRuntime* rt, XSlice name);
 XSlice    mi_rt_sym_name(const MiRuntime* rt, uint32_t sym_id);
+bool      mi_rt_sym_find(const MiRuntime* rt, XSlice name, uint32_t* out_sym_id);
 
 bool      mi_rt_var_get_id(MiRuntime* rt, uint32_t sym_id, MiRtValue* out);
 bool      mi_rt_var_get_from_id(MiScopeFrame* start, uint32_t sym_id, MiRtValue* out);
@@ -219,6 +358,12 @@ void      mi_rt_var_set_from_id(MiScopeFrame* start, uint32_t sym_id, MiRtValue
 void      mi_rt_var_define_id(MiRuntime* rt, uint32_t sym_id, MiRtValue value);
 void      mi_rt_var_set_id(MiRuntime* rt, uint32_t sym_id, MiRtValue value);
 
+/* Binding of sym_id in 'frame' itself (parents are not searched), or NULL.
+   The pointer stays valid while frame->version is unchanged. */
+MiRtVar*  mi_rt_var_find_in(MiScopeFrame* frame, uint32_t sym_id);
+/* Store into a binding returned by mi_rt_var_find_in(). */
+void      mi_rt_var_assign(MiRuntime* rt, MiRtVar* var, MiRtValue value);
+
 //----------------------------------------------------------
 // Refcount helpers
 //----------------------------------------------------------
@@ -256,12 +401,22 @@ void mi_rt_scope_push(MiRuntime* rt);
 
 /**
  * Push a new scope frame with an explicit parent frame.
- * This is used by the VM to implement lexical scoping for blocks.
+ * This is used by the VM to implement lexical scoping for blocks. The frame
+ * lives on the scope stack, so nothing may refer to it once it is popped.
  * @param rt     Runtime instance.
  * @param parent Parent frame to chain to (may be NULL for root).
  */
 void mi_rt_scope_push_with_parent(MiRuntime* rt, MiScopeFrame* parent);
 
+/**
+ * Push a new scope frame allocated on the heap rather than the scope stack.
+ * Blocks keep the frame they were created in as their env, so the VM pushes
+ * frames of code that creates blocks this way; no stack frame is ever an env.
+ * @param rt     Runtime instance.
+ * @param parent Parent frame to chain to (may be NULL for root).
+ */
+void mi_rt_scope_push_heap(MiRuntime* rt, MiScopeFrame* parent);
+
 /**
  * Push a new scope frame with an explicit parent.
  * This is used by VM blocks to implement lexical-ish environment chains.
@@ -275,6 +430,50 @@ void mi_rt_scope_push_with_parent(MiRuntime* rt, MiScopeFrame* parent);
  */
 void mi_rt_scope_pop(MiRuntime* rt);
 
+/**
+ * Drop every variable of the current scope frame but keep the frame, as if
+ * it had been popped and pushed again. The root frame is left alone. A
+ * retained frame is popped and replaced by a new one instead, so the blocks
+ * holding it keep their bindings.
+ * @param rt Runtime instance.
+ */
+void mi_rt_scope_reset(MiRuntime* rt);
+
+/**
+ * Keep a heap frame (see mi_rt_scope_push_heap) alive past its pop, for a
+ * block that uses it as env. Frames that are never popped (the root,
+ * detached frames) may be retained too; it has no effect on them.
+ * @param frame Frame to retain (may be NULL).
+ */
+void mi_rt_scope_retain(MiScopeFrame* frame);
+
+/**
+ * Drop a reference taken with mi_rt_scope_retain(). A popped frame is
+ * recycled by the next mi_rt_scope_collect() once nothing holds it.
+ * @param rt    Runtime instance.
+ * @param frame Frame to release (may be NULL).
+ */
+void mi_rt_scope_release(MiRuntime* rt, MiScopeFrame* frame);
+
+/**
+ * Recycle the popped frames that no block outside of their own bindings
+ * holds any more. Such cycles (a frame binding a block whose env it is) are
+ * common, so the VM runs this whenever a call returns. Does nothing unless
+ * a frame was held or released since the last run.
+ * @param rt Runtime instance.
+ */
+void mi_rt_scope_collect(MiRuntime* rt);
+
+/**
+ * Hand the reference to 'block' over to 'frame', which drops it when the
+ * frame is popped or reset. A cache keyed on the frame and its version can
+ * then return the block again without keeping the frame alive itself.
+ * @param rt    Runtime instance.
+ * @param frame Frame that keeps the block.
+ * @param block Block whose reference the frame takes over.
+ */
+void mi_rt_scope_keep_block(MiRuntime* rt, MiScopeFrame* frame, MiRtBlock* block);
+
 /**
  * Look up a variable by name.
  * @param rt        Runtime instance.
@@ -405,7 +604,7 @@ MiRtValue mi_rt_make_bool(bool v);
 
 /**
  * Create a string runtime value from a slice.
- * The slice is not copied.
+ * The slice is not copied. In the compact layout the length must fit in 32 bits.
  * @param s String slice.
  * @return  String runtime value.
  */
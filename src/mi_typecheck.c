@@ -2,6 +2,7 @@
 #include "mi_log.h"
 #include "mi_vm.h"
 
+#include <stdlib.h>
 #include <string.h>
 
 //----------------------------------------------------------
@@ -1123,7 +1124,447 @@ bool mi_typecheck_script(const MiScript* script, MiVm* vm, XSlice dbg_file, MiTy
   return true;
 }
 
+//----------------------------------------------------------
+// Variable types for code generation
+//----------------------------------------------------------
+
+// The checking pass above walks statements in order, so the type it holds for
+// a name is only valid at that point of the script; a loop body or a callee
+// can still rebind it. This pass is flow-insensitive instead: every binding of
+// a name anywhere in the script (nested blocks and function bodies included)
+// is joined, and the name only keeps a concrete type if they all agree. That
+// is what the compiler needs before it can drop runtime kind checks.
+
+#define MI_TC_TYPE_UNSET ((MiTypeKind)-1)
+
+typedef struct MiTcVarPass
+{
+  MiTypecheckVarTypes* vars;
+  MiVm*                vm;
+  bool                 changed;
+  bool                 dynamic;  // A binding whose name is not known statically
+  int                  body_depth;  // Function bodies being walked; 0 is the module scope
+} MiTcVarPass;
+
+static int s_var_find(const MiTypecheckVarTypes* vars, XSlice name)
+{
+  if (!vars)
+  {
+    return -1;
+  }
+  for (int i = 0; i < vars->count; ++i)
+  {
+    if (s_slice_eq(vars->names[i], name))
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static void s_var_bind(MiTcVarPass* p, XSlice name, MiTypeKind type)
+{
+  // Module globals can be reassigned from any script that includes this one
+  // (m::x = ...), so only function locals and parameters get a static type.
+  if (p->body_depth == 0)
+  {
+    type = MI_TYPE_ANY;
+  }
+  if (type == MI_TC_TYPE_UNSET)
+  {
+    return;
+  }
+
+  MiTypecheckVarTypes* vars = p->vars;
+  int idx = s_var_find(vars, name);
+  if (idx < 0)
+  {
+    if (vars->count == vars->capacity)
+    {
+      int new_cap = vars->capacity ? vars->capacity * 2 : 16;
+      XSlice* names = (XSlice*)realloc(vars->names, (size_t)new_cap * sizeof(XSlice));
+      MiTypeKind* types = names ? (MiTypeKind*)realloc(vars->types, (size_t)new_cap * sizeof(MiTypeKind)) : NULL;
+      if (names)
+      {
+        vars->names = names;
+      }
+      if (!names || !types)
+      {
+        p->dynamic = true;
+        return;
+      }
+      vars->types = types;
+      vars->capacity = new_cap;
+    }
+
+    // Names that also resolve to a registered command may be read before the
+    // script assigns them.
+    if (p->vm && mi_vm_find_command(p->vm, name, NULL))
+    {
+      type = MI_TYPE_ANY;
+    }
+    vars->names[vars->count] = name;
+    vars->types[vars->count] = type;
+    vars->count += 1;
+    p->changed = true;
+    return;
+  }
+
+  MiTypeKind cur = vars->types[idx];
+  MiTypeKind next = (cur == MI_TC_TYPE_UNSET || cur == type) ? type : MI_TYPE_ANY;
+  if (next != cur)
+  {
+    vars->types[idx] = next;
+    p->changed = true;
+  }
+}
+
+// 'missing' is the type of a name with no binding yet: MI_TC_TYPE_UNSET while
+// solving, MI_TYPE_ANY once the bindings are final.
+static MiTypeKind s_var_expr_type(const MiTypecheckVarTypes* vars, const MiExpr* e, MiTypeKind missing)
+{
+  if (!e)
+  {
+    return MI_TYPE_VOID;
+  }
+
+  switch (e->kind)
+  {
+    case MI_EXPR_INT_LITERAL: return MI_TYPE_INT;
+    case MI_EXPR_FLOAT_LITERAL: return MI_TYPE_FLOAT;
+    case MI_EXPR_STRING_LITERAL: return MI_TYPE_STRING;
+    case MI_EXPR_BOOL_LITERAL: return MI_TYPE_BOOL;
+    case MI_EXPR_VOID_LITERAL: return MI_TYPE_VOID;
+    case MI_EXPR_BLOCK: return MI_TYPE_BLOCK;
+    case MI_EXPR_LIST: return MI_TYPE_LIST;
+    case MI_EXPR_DICT: return MI_TYPE_DICT;
+
+    case MI_EXPR_VAR:
+      {
+        if (e->as.var.is_indirect)
+        {
+          return MI_TYPE_ANY;
+        }
+        int idx = s_var_find(vars, e->as.var.name);
+        return idx < 0 ? missing : vars->types[idx];
+      }
+
+    case MI_EXPR_UNARY:
+      {
+        MiTypeKind t = s_var_expr_type(vars, e->as.unary.expr, missing);
+        if (t == MI_TC_TYPE_UNSET)
+        {
+          return t;
+        }
+        if (e->as.unary.op == MI_TOK_NOT)
+        {
+          return t == MI_TYPE_BOOL ? MI_TYPE_BOOL : MI_TYPE_ANY;
+        }
+        if (e->as.unary.op == MI_TOK_MINUS)
+        {
+          return s_is_numeric(t) ? t : MI_TYPE_ANY;
+        }
+        return MI_TYPE_ANY;
+      }
+
+    case MI_EXPR_BINARY:
+      {
+        MiTokenKind op = e->as.binary.op;
+        MiTypeKind lt = s_var_expr_type(vars, e->as.binary.left, missing);
+        MiTypeKind rt = s_var_expr_type(vars, e->as.binary.right, missing);
+        if (lt == MI_TC_TYPE_UNSET || rt == MI_TC_TYPE_UNSET)
+        {
+          return MI_TC_TYPE_UNSET;
+        }
+
+        if (op == MI_TOK_AND || op == MI_TOK_OR)
+        {
+          return (lt == MI_TYPE_BOOL && rt == MI_TYPE_BOOL) ? MI_TYPE_BOOL : MI_TYPE_ANY;
+        }
+
+        if (!s_is_numeric(lt) || !s_is_numeric(rt))
+        {
+          return MI_TYPE_ANY;
+        }
+
+        switch (op)
+        {
+          case MI_TOK_EQEQ:
+          case MI_TOK_BANGEQ:
+          case MI_TOK_LT:
+          case MI_TOK_LTEQ:
+          case MI_TOK_GT:
+          case MI_TOK_GTEQ:
+            return MI_TYPE_BOOL;
+          case MI_TOK_SLASH:
+            return MI_TYPE_FLOAT;
+          case MI_TOK_PLUS:
+          case MI_TOK_MINUS:
+          case MI_TOK_STAR:
+            return (lt == MI_TYPE_FLOAT || rt == MI_TYPE_FLOAT) ? MI_TYPE_FLOAT : MI_TYPE_INT;
+          default:
+            return MI_TYPE_ANY;
+        }
+      }
+
+    case MI_EXPR_COMMAND:
+      {
+        // Nested assignment evaluates to its right-hand side.
+        const MiExpr* head = e->as.command.head;
+        if (head && head->kind == MI_EXPR_STRING_LITERAL &&
+            s_slice_eq(head->as.string_lit.value, x_slice_from_cstr("set")) &&
+            e->as.command.argc == 2u && e->as.command.args && e->as.command.args->next)
+        {
+          return s_var_expr_type(vars, e->as.command.args->next->expr, missing);
+        }
+        return MI_TYPE_ANY;
+      }
+
+    default:
+      return MI_TYPE_ANY;
+  }
+}
+
+static void s_var_walk_script(MiTcVarPass* p, const MiScript* script);
+static void s_var_walk_expr(MiTcVarPass* p, const MiExpr* e);
+
+static void s_var_walk_expr_list(MiTcVarPass* p, const MiExprList* it)
+{
+  while (it)
+  {
+    s_var_walk_expr(p, it->expr);
+    it = it->next;
+  }
+}
+
+static void s_var_walk_command(MiTcVarPass* p, const MiExpr* e)
+{
+  const MiExpr* head = e->as.command.head;
+  const MiExprList* args = e->as.command.args;
+  unsigned int argc = e->as.command.argc;
+  XSlice name = (head && head->kind == MI_EXPR_STRING_LITERAL) ? head->as.string_lit.value : x_slice_empty();
+
+  if (s_slice_eq(name, x_slice_from_cstr("set")))
+  {
+    const MiExpr* lvalue = (argc == 2u && args) ? args->expr : NULL;
+    const MiExpr* rhs = (argc == 2u && args && args->next) ? args->next->expr : NULL;
+    if (lvalue && lvalue->kind == MI_EXPR_STRING_LITERAL)
+    {
+      s_var_bind(p, lvalue->as.string_lit.value, s_var_expr_type(p->vars, rhs, MI_TC_TYPE_UNSET));
+    }
+    else if (lvalue && lvalue->kind == MI_EXPR_VAR && !lvalue->as.var.is_indirect)
+    {
+      s_var_bind(p, lvalue->as.var.name, s_var_expr_type(p->vars, rhs, MI_TC_TYPE_UNSET));
+    }
+    else if (!lvalue || (lvalue->kind != MI_EXPR_QUAL && lvalue->kind != MI_EXPR_INDEX))
+    {
+      p->dynamic = true;
+    }
+  }
+  else if (s_slice_eq(name, x_slice_from_cstr("cmd")) && argc >= 2u)
+  {
+    // cmd(name, param..., [sig,] block). The typed signature list, when
+    // present, is [ret_type, fixed_count, t0..tN-1, variadic_type_or_-1] and
+    // its parameter types are enforced at every call.
+    const MiExpr* items[MI_VM_ARG_STACK_COUNT];
+    unsigned int n = 0;
+    for (const MiExprList* it = args; it && n < MI_VM_ARG_STACK_COUNT; it = it->next)
+    {
+      items[n++] = it->expr;
+    }
+    if (n != argc)
+    {
+      p->dynamic = true;
+      return;
+    }
+
+    const MiExpr* sig = (argc >= 3u && items[argc - 2] && items[argc - 2]->kind == MI_EXPR_LIST) ? items[argc - 2] : NULL;
+    unsigned int param_end = sig ? argc - 2 : argc - 1;
+
+    MiTypeKind sig_types[MI_VM_ARG_STACK_COUNT];
+    unsigned int sig_count = 0;
+    if (sig)
+    {
+      for (const MiExprList* it = sig->as.list.items; it && sig_count < MI_VM_ARG_STACK_COUNT; it = it->next)
+      {
+        if (!it->expr || it->expr->kind != MI_EXPR_INT_LITERAL)
+        {
+          sig_count = 0;
+          break;
+        }
+        sig_types[sig_count++] = (MiTypeKind)it->expr->as.int_lit.value;
+      }
+    }
+    bool sig_ok = sig_count == (param_end - 1u) + 3u;
+
+    if (items[0] && items[0]->kind == MI_EXPR_STRING_LITERAL)
+    {
+      s_var_bind(p, items[0]->as.string_lit.value, MI_TYPE_FUNC);
+    }
+    else
+    {
+      p->dynamic = true;
+    }
+
+    p->body_depth += 1;
+    for (unsigned int i = 1; i < param_end; ++i)
+    {
+      if (!items[i] || items[i]->kind != MI_EXPR_STRING_LITERAL)
+      {
+        p->dynamic = true;
+        continue;
+      }
+      s_var_bind(p, items[i]->as.string_lit.value, sig_ok ? sig_types[2u + (i - 1u)] : MI_TYPE_ANY);
+    }
+    s_var_walk_expr(p, head);
+    s_var_walk_expr_list(p, args);
+    p->body_depth -= 1;
+    return;
+  }
+  else if (s_slice_eq(name, x_slice_from_cstr("foreach")))
+  {
+    // foreach(i, from, to[, step]) counts in ints; list items can be anything.
+    const MiExpr* var = args ? args->expr : NULL;
+    if (var && var->kind == MI_EXPR_STRING_LITERAL)
+    {
+      s_var_bind(p, var->as.string_lit.value, (argc == 4u || argc == 5u) ? MI_TYPE_INT : MI_TYPE_ANY);
+    }
+    else
+    {
+      p->dynamic = true;
+    }
+  }
+
+  s_var_walk_expr(p, head);
+  s_var_walk_expr_list(p, args);
+}
+
+static void s_var_walk_expr(MiTcVarPass* p, const MiExpr* e)
+{
+  if (!e)
+  {
+    return;
+  }
+
+  switch (e->kind)
+  {
+    case MI_EXPR_VAR:
+      if (e->as.var.is_indirect)
+      {
+        s_var_walk_expr(p, e->as.var.name_expr);
+      }
+      break;
+    case MI_EXPR_INDEX:
+      s_var_walk_expr(p, e->as.index.target);
+      s_var_walk_expr(p, e->as.index.index);
+      break;
+    case MI_EXPR_UNARY:
+      s_var_walk_expr(p, e->as.unary.expr);
+      break;
+    case MI_EXPR_BINARY:
+      s_var_walk_expr(p, e->as.binary.left);
+      s_var_walk_expr(p, e->as.binary.right);
+      break;
+    case MI_EXPR_LIST:
+      s_var_walk_expr_list(p, e->as.list.items);
+      break;
+    case MI_EXPR_DICT:
+      s_var_walk_expr_list(p, e->as.dict.items);
+      break;
+    case MI_EXPR_PAIR:
+      s_var_walk_expr(p, e->as.pair.key);
+      s_var_walk_expr(p, e->as.pair.value);
+      break;
+    case MI_EXPR_BLOCK:
+      s_var_walk_script(p, e->as.block.script);
+      break;
+    case MI_EXPR_QUAL:
+      s_var_walk_expr(p, e->as.qual.target);
+      break;
+    case MI_EXPR_COMMAND:
+      s_var_walk_command(p, e);
+      break;
+    default:
+      break;
+  }
+}
+
+static void s_var_walk_script(MiTcVarPass* p, const MiScript* script)
+{
+  const MiCommandList* it = script ? script->first : NULL;
+  while (it)
+  {
+    const MiCommand* c = it->command;
+    if (c)
+    {
+      if (c->is_include_stmt)
+      {
+        s_var_bind(p, c->include_alias_tok.lexeme, MI_TYPE_ANY);
+      }
 
+      MiExpr fake;
+      memset(&fake, 0, sizeof(fake));
+      fake.kind = MI_EXPR_COMMAND;
+      fake.as.command.head = c->head;
+      fake.as.command.args = c->args;
+      fake.as.command.argc = (unsigned int)c->argc;
+      s_var_walk_command(p, &fake);
+    }
+    it = it->next;
+  }
+}
+
+void mi_typecheck_var_types(const MiScript* script, MiVm* vm, MiTypecheckVarTypes* out)
+{
+  if (!out)
+  {
+    return;
+  }
+  memset(out, 0, sizeof(*out));
+
+  MiTcVarPass p;
+  memset(&p, 0, sizeof(p));
+  p.vars = out;
+  p.vm = vm;
+
+  // Bindings only move up (unset -> concrete -> any), so this settles.
+  do
+  {
+    p.changed = false;
+    s_var_walk_script(&p, script);
+  } while (p.changed && !p.dynamic);
+
+  if (p.dynamic)
+  {
+    // Any name may be rebound through a computed name; keep nothing.
+    mi_typecheck_var_types_free(out);
+    return;
+  }
+
+  for (int i = 0; i < out->count; ++i)
+  {
+    if (out->types[i] == MI_TC_TYPE_UNSET)
+    {
+      out->types[i] = MI_TYPE_ANY;
+    }
+  }
+}
+
+void mi_typecheck_var_types_free(MiTypecheckVarTypes* vars)
+{
+  if (!vars)
+  {
+    return;
+  }
+  free(vars->names);
+  free(vars->types);
+  memset(vars, 0, sizeof(*vars));
+}
+
+MiTypeKind mi_typecheck_expr_type(const MiTypecheckVarTypes* vars, const MiExpr* e)
+{
+  return s_var_expr_type(vars, e, MI_TYPE_ANY);
+}
 
 static void s_mi_print_source_line_tc(XSlice source, int line, int column)
 {
@@ -16,4 +16,35 @@ bool mi_typecheck_script(const MiScript* script, MiVm* vm, XSlice dbg_file, MiTy
 
 void mi_typecheck_print_error(XSlice source, const MiTypecheckError* err);
 
+/**
+ * Flow-insensitive variable types used by the compiler to select typed opcodes.
+ * A name is listed with a concrete type only when every binding of it anywhere
+ * in the script (assignments, typed parameters, nested blocks and function
+ * bodies) produces that type. Names bound at module scope are always
+ * MI_TYPE_ANY, since other scripts can assign them as module members.
+ * Unlisted names are MI_TYPE_ANY.
+ */
+typedef struct MiTypecheckVarTypes
+{
+  XSlice*     names;
+  MiTypeKind* types;
+  int         count;
+  int         capacity;
+} MiTypecheckVarTypes;
+
+/**
+ * Compute variable types for a whole script. The result is empty when the
+ * script assigns through computed names. Release it with
+ * mi_typecheck_var_types_free().
+ */
+void mi_typecheck_var_types(const MiScript* script, MiVm* vm, MiTypecheckVarTypes* out);
+
+void mi_typecheck_var_types_free(MiTypecheckVarTypes* vars);
+
+/**
+ * Static type of an expression given the variable types from
+ * mi_typecheck_var_types(), or MI_TYPE_ANY when it is not known.
+ */
+MiTypeKind mi_typecheck_expr_type(const MiTypecheckVarTypes* vars, const MiExpr* e);
+
 #endif
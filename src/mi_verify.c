@@ -0,0 +1,353 @@
+#include "mi_verify.h"
+#include "mi_log.h"
+#include "mi_parse.h"
+
+#include <stdint.h>
+
+//----------------------------------------------------------
+// Operand checks
+//----------------------------------------------------------
+
+// Operand roles, one bit each; an instruction's layout is a combination.
+#define MI_VERIFY_A     (1u << 0)  // a is a register
+#define MI_VERIFY_B     (1u << 1)  // b is a register
+#define MI_VERIFY_C     (1u << 2)  // c is a register
+#define MI_VERIFY_CONST (1u << 3)  // imm indexes consts
+#define MI_VERIFY_SYM   (1u << 4)  // imm indexes symbols
+#define MI_VERIFY_CMD   (1u << 5)  // imm indexes commands
+#define MI_VERIFY_SUB   (1u << 6)  // imm indexes subchunks
+#define MI_VERIFY_LOCAL (1u << 7)  // imm is a frame slot
+#define MI_VERIFY_JUMP  (1u << 8)  // imm is a pc-relative jump
+#define MI_VERIFY_UPVAL (1u << 9)  // imm indexes upvalues
+#define MI_VERIFY_BAD   (1u << 31) // not valid in stored code
+
+#define MI_VERIFY_ABC   (MI_VERIFY_A | MI_VERIFY_B | MI_VERIFY_C)
+
+static uint32_t s_op_layout(MiVmOp op)
+{
+  switch (op)
+  {
+    case MI_VM_OP_NOOP:
+    case MI_VM_OP_ARG_CLEAR:
+    case MI_VM_OP_ARG_SAVE:
+    case MI_VM_OP_ARG_RESTORE:
+    case MI_VM_OP_SCOPE_PUSH:
+    case MI_VM_OP_SCOPE_POP:
+    case MI_VM_OP_SCOPE_RESET:
+    case MI_VM_OP_HALT:
+    case MI_VM_OP_CLEAR_REGS:        // range checked by the caller
+      return 0u;
+
+    case MI_VM_OP_LIST_NEW:
+    case MI_VM_OP_DICT_NEW:
+    case MI_VM_OP_ARG_PUSH:
+    case MI_VM_OP_RETURN:
+      return MI_VERIFY_A;
+
+    case MI_VM_OP_MOV:
+    case MI_VM_OP_LIST_PUSH:
+    case MI_VM_OP_LEN:
+    case MI_VM_OP_NEG:
+    case MI_VM_OP_NOT:
+    case MI_VM_OP_LOAD_INDIRECT_VAR:
+    case MI_VM_OP_CALL_BLOCK:
+    case MI_VM_OP_CALL_CMD_DYN:      // imm checked by the caller
+    case MI_VM_OP_TAIL_CALL:
+      return MI_VERIFY_A | MI_VERIFY_B;
+
+    case MI_VM_OP_ITER_NEXT:         // imm checked by the caller
+    case MI_VM_OP_INDEX:
+    case MI_VM_OP_STORE_INDEX:
+    case MI_VM_OP_ADD:
+    case MI_VM_OP_SUB:
+    case MI_VM_OP_MUL:
+    case MI_VM_OP_DIV:
+    case MI_VM_OP_MOD:
+    case MI_VM_OP_EQ:
+    case MI_VM_OP_NEQ:
+    case MI_VM_OP_LT:
+    case MI_VM_OP_LTEQ:
+    case MI_VM_OP_GT:
+    case MI_VM_OP_GTEQ:
+    case MI_VM_OP_AND:
+    case MI_VM_OP_OR:
+    case MI_VM_OP_ADD_INT:
+    case MI_VM_OP_SUB_INT:
+    case MI_VM_OP_MUL_INT:
+    case MI_VM_OP_ADD_FLOAT:
+    case MI_VM_OP_SUB_FLOAT:
+    case MI_VM_OP_MUL_FLOAT:
+    case MI_VM_OP_DIV_FLOAT:
+    case MI_VM_OP_EQ_INT:
+    case MI_VM_OP_NEQ_INT:
+    case MI_VM_OP_LT_INT:
+    case MI_VM_OP_LTEQ_INT:
+    case MI_VM_OP_GT_INT:
+    case MI_VM_OP_GTEQ_INT:
+    case MI_VM_OP_LT_FLOAT:
+    case MI_VM_OP_LTEQ_FLOAT:
+    case MI_VM_OP_GT_FLOAT:
+    case MI_VM_OP_GTEQ_FLOAT:
+      return MI_VERIFY_ABC;
+
+    case MI_VM_OP_LOAD_CONST:
+      return MI_VERIFY_A | MI_VERIFY_CONST;
+    case MI_VM_OP_LOAD_BLOCK:
+      return MI_VERIFY_A | MI_VERIFY_SUB;
+    case MI_VM_OP_ARG_PUSH_CONST:
+      return MI_VERIFY_CONST;
+
+    case MI_VM_OP_LOAD_VAR:
+    case MI_VM_OP_STORE_VAR:
+    case MI_VM_OP_DEFINE_VAR:
+      return MI_VERIFY_A | MI_VERIFY_SYM;
+    case MI_VM_OP_LOAD_MEMBER:
+    case MI_VM_OP_STORE_MEMBER:
+      return MI_VERIFY_A | MI_VERIFY_B | MI_VERIFY_SYM;
+    case MI_VM_OP_ARG_PUSH_VAR_SYM:
+    case MI_VM_OP_ARG_PUSH_SYM:
+      return MI_VERIFY_SYM;
+    case MI_VM_OP_ADD_VAR_CONST:     // b checked by the caller
+    case MI_VM_OP_SUB_VAR_CONST:
+      return MI_VERIFY_A | MI_VERIFY_SYM;
+
+    case MI_VM_OP_CALL_CMD:
+    case MI_VM_OP_CALL_CMD_FAST:
+    case MI_VM_OP_CALL_CMD_FAST_VAR: // c checked by the caller
+    case MI_VM_OP_CALL_CMD_TRUSTED:
+      return MI_VERIFY_A | MI_VERIFY_CMD;
+
+    case MI_VM_OP_LOAD_LOCAL:
+    case MI_VM_OP_STORE_LOCAL:
+      return MI_VERIFY_A | MI_VERIFY_LOCAL;
+    case MI_VM_OP_ARG_PUSH_LOCAL:
+      return MI_VERIFY_LOCAL;
+    case MI_VM_OP_ADD_LOCAL_CONST:   // b checked by the caller
+    case MI_VM_OP_SUB_LOCAL_CONST:
+      return MI_VERIFY_A | MI_VERIFY_LOCAL;
+
+    case MI_VM_OP_LOAD_UPVAL:
+    case MI_VM_OP_STORE_UPVAL:
+      return MI_VERIFY_A | MI_VERIFY_UPVAL;
+
+    case MI_VM_OP_JUMP:
+      return MI_VERIFY_JUMP;
+    case MI_VM_OP_JUMP_IF_TRUE:
+    case MI_VM_OP_JUMP_IF_FALSE:
+    case MI_VM_OP_FOR_PREP:          // a+2 checked by the caller
+    case MI_VM_OP_FOR_LOOP:
+      return MI_VERIFY_A | MI_VERIFY_JUMP;
+    case MI_VM_OP_JUMP_IF_NOT_EQ:
+    case MI_VM_OP_JUMP_IF_NOT_NEQ:
+    case MI_VM_OP_JUMP_IF_NOT_LT:
+    case MI_VM_OP_JUMP_IF_NOT_LTEQ:
+    case MI_VM_OP_JUMP_IF_NOT_GT:
+    case MI_VM_OP_JUMP_IF_NOT_GTEQ:
+    case MI_VM_OP_JUMP_IF_NOT_EQ_INT:
+    case MI_VM_OP_JUMP_IF_NOT_NEQ_INT:
+    case MI_VM_OP_JUMP_IF_NOT_LT_INT:
+    case MI_VM_OP_JUMP_IF_NOT_LTEQ_INT:
+    case MI_VM_OP_JUMP_IF_NOT_GT_INT:
+    case MI_VM_OP_JUMP_IF_NOT_GTEQ_INT:
+      return MI_VERIFY_B | MI_VERIFY_C | MI_VERIFY_JUMP;
+
+    // Quickened forms are only ever written to exec_code.
+    default:
+      return MI_VERIFY_BAD;
+  }
+}
+
+static bool s_index_ok(int32_t index, size_t count)
+{
+  return index >= 0 && (size_t)index < count;
+}
+
+// Why 'ins' at 'pc' can not run unchecked, or NULL when it can.
+static const char* s_check_ins(const MiVmChunk* chunk, size_t pc, MiVmIns ins)
+{
+  uint32_t layout = s_op_layout((MiVmOp)ins.op);
+  if (layout & MI_VERIFY_BAD)
+  {
+    return "unknown opcode";
+  }
+
+  if (((layout & MI_VERIFY_A) && ins.a >= MI_VM_REG_COUNT) ||
+      ((layout & MI_VERIFY_B) && ins.b >= MI_VM_REG_COUNT) ||
+      ((layout & MI_VERIFY_C) && ins.c >= MI_VM_REG_COUNT))
+  {
+    return "register out of range";
+  }
+  if ((layout & MI_VERIFY_CONST) && !s_index_ok(ins.imm, chunk->const_count))
+  {
+    return "const index out of range";
+  }
+  if ((layout & MI_VERIFY_SYM) && !s_index_ok(ins.imm, chunk->symbol_count))
+  {
+    return "symbol index out of range";
+  }
+  if ((layout & MI_VERIFY_CMD) && (!chunk->cmd_names || !chunk->cmd_targets || !s_index_ok(ins.imm, chunk->cmd_count)))
+  {
+    return "command index out of range";
+  }
+  if ((layout & MI_VERIFY_SUB) && (!s_index_ok(ins.imm, chunk->subchunk_count) || !chunk->subchunks[ins.imm]))
+  {
+    return "subchunk index out of range";
+  }
+  if ((layout & MI_VERIFY_LOCAL) && !s_index_ok(ins.imm, chunk->local_count))
+  {
+    return "frame slot out of range";
+  }
+  if ((layout & MI_VERIFY_UPVAL) && !s_index_ok(ins.imm, chunk->upval_count))
+  {
+    return "upvalue index out of range";
+  }
+  if (layout & MI_VERIFY_JUMP)
+  {
+    int64_t target = (int64_t)pc + 1 + (int64_t)ins.imm;
+    if (target < 0 || target > (int64_t)chunk->code_count)
+    {
+      return "jump target out of range";
+    }
+  }
+
+  switch ((MiVmOp)ins.op)
+  {
+    case MI_VM_OP_LOAD_BLOCK:
+      // The block may share upvalues of this chunk, named by index.
+      {
+        const MiVmChunk* sub = chunk->subchunks[ins.imm];
+        if (sub->upval_count > 0 && !sub->upval_outer)
+        {
+          return "missing upvalue table";
+        }
+        for (uint32_t i = 0; i < sub->upval_count; ++i)
+        {
+          if (sub->upval_outer[i] >= (int32_t)chunk->upval_count)
+          {
+            return "enclosing upvalue index out of range";
+          }
+        }
+      }
+      return NULL;
+
+    case MI_VM_OP_ITER_NEXT:
+      return s_index_ok(ins.imm, MI_VM_REG_COUNT) ? NULL : "item register out of range";
+
+    case MI_VM_OP_CALL_CMD_DYN:
+    case MI_VM_OP_TAIL_CALL:
+      // The VM keeps its call site cache index here once the site has run.
+      return ins.imm == 0 ? NULL : "dynamic call site is not fresh";
+
+    case MI_VM_OP_CALL_CMD_FAST_VAR:
+      return ins.c < chunk->symbol_count ? NULL : "symbol index out of range";
+
+    case MI_VM_OP_ADD_VAR_CONST:
+    case MI_VM_OP_SUB_VAR_CONST:
+    case MI_VM_OP_ADD_LOCAL_CONST:
+    case MI_VM_OP_SUB_LOCAL_CONST:
+      return ins.b < chunk->const_count ? NULL : "const index out of range";
+
+    case MI_VM_OP_CLEAR_REGS:
+      return (uint32_t)ins.a + ins.b <= MI_VM_REG_COUNT ? NULL : "register out of range";
+
+    case MI_VM_OP_FOR_PREP:
+    case MI_VM_OP_FOR_LOOP:
+      return (uint32_t)ins.a + 2u < MI_VM_REG_COUNT ? NULL : "register out of range";
+
+    default:
+      return NULL;
+  }
+}
+
+// Argument types of a trusted call were proven when it was compiled; what is
+// left to check is that the target linked now takes that many arguments.
+static bool s_trusted_call_fits(const MiVmChunk* chunk, MiVmIns ins)
+{
+  if (!chunk->cmd_targets || !s_index_ok(ins.imm, chunk->cmd_count) || !chunk->cmd_targets[ins.imm])
+  {
+    return false;
+  }
+
+  const MiRtCmd* c = chunk->cmd_targets[ins.imm];
+  const MiFuncTypeSig* sig = c->sig;
+  if (!sig)
+  {
+    return !c->is_native && c->param_count == ins.b;
+  }
+  return sig->is_variadic ? (int)ins.b >= sig->param_count : (int)ins.b == sig->param_count;
+}
+
+//----------------------------------------------------------
+// Public API
+//----------------------------------------------------------
+
+bool mi_verify_chunk(MiVmChunk* chunk)
+{
+  if (!chunk)
+  {
+    return false;
+  }
+  if (chunk->verified)
+  {
+    return true;
+  }
+  if (chunk->lazy)
+  {
+    // Verified once compiled, before its first run.
+    return true;
+  }
+
+  if ((chunk->code_count > 0 && !chunk->code) ||
+      (chunk->const_count > 0 && !chunk->consts) ||
+      (chunk->symbol_count > 0 && !chunk->symbols) ||
+      (chunk->subchunk_count > 0 && !chunk->subchunks) ||
+      (chunk->upval_count > 0 && !chunk->upval_outer) ||
+      chunk->upval_count > chunk->symbol_count)
+  {
+    mi_error_fmt("verify: %.*s: missing tables\n", (int)chunk->dbg_name.length, chunk->dbg_name.ptr);
+    return false;
+  }
+
+  for (uint32_t i = 0; i < chunk->param_slot_count; ++i)
+  {
+    if (chunk->param_slots[i] >= (int32_t)chunk->local_count)
+    {
+      mi_error_fmt("verify: %.*s: parameter %u has no frame slot\n", (int)chunk->dbg_name.length, chunk->dbg_name.ptr, (unsigned)i);
+      return false;
+    }
+  }
+
+  for (size_t pc = 0; pc < chunk->code_count; ++pc)
+  {
+    // A trusted site whose target no longer fits falls back to a checked call.
+    if (chunk->code[pc].op == MI_VM_OP_CALL_CMD_TRUSTED && !s_trusted_call_fits(chunk, chunk->code[pc]))
+    {
+      chunk->code[pc].op = MI_VM_OP_CALL_CMD_FAST;
+    }
+
+    if (chunk->code[pc].op == MI_VM_OP_LOAD_BLOCK)
+    {
+      chunk->captures_env = true;
+    }
+
+    const char* why = s_check_ins(chunk, pc, chunk->code[pc]);
+    if (why)
+    {
+      mi_error_fmt("verify: %.*s: ip=%zu op=%u: %s\n", (int)chunk->dbg_name.length, chunk->dbg_name.ptr, pc, (unsigned)chunk->code[pc].op, why);
+      return false;
+    }
+  }
+
+  // Marked before visiting subchunks so a chunk reachable from itself ends
+  // the walk instead of recursing forever.
+  chunk->verified = true;
+  for (size_t i = 0; i < chunk->subchunk_count; ++i)
+  {
+    if (!mi_verify_chunk(chunk->subchunks[i]))
+    {
+      chunk->verified = false;
+      return false;
+    }
+  }
+  return true;
+}
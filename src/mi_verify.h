@@ -0,0 +1,26 @@
+#ifndef MI_VERIFY_H
+#define MI_VERIFY_H
+
+#include <stdbool.h>
+
+#include "mi_vm.h"
+
+/**
+ * Check once what the dispatch loop would otherwise have to check on every
+ * instruction:
+ *  - every opcode is one the compiler emits (quickened forms are rejected);
+ *  - register operands are inside the MI_VM_REG_COUNT window;
+ *  - const, symbol, command, subchunk and frame slot indices are in range;
+ *  - jump targets land inside the chunk (or on its end);
+ *  - CALL_CMD_TRUSTED targets are linked and take that many arguments
+ *    (sites that do not are turned back into checked CALL_CMD_FAST).
+ *
+ * On success the chunk and its subchunks are marked verified, and the VM runs
+ * them without per-instruction validation. Chunks already marked are not
+ * visited again. The first problem found is reported with mi_error_fmt.
+ * @param chunk Chunk to verify.
+ * @return true if the chunk and all its subchunks are well formed.
+ */
+bool mi_verify_chunk(MiVmChunk* chunk);
+
+#endif // MI_VERIFY_H
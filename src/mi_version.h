@@ -1,7 +1,7 @@
 #ifndef MI_VERSION_H
 #define MI_VERSION_H
 
-#define MINIMA_VERSION_MAJOR 1  // Bump this whenever the bytecode / serialization layout changes.
+#define MINIMA_VERSION_MAJOR 5  // Bump this whenever the bytecode / serialization layout changes.
 #define MINIMA_VERSION_MINOR 0
 #define MINIMA_VERSION_PATCH 0
 #define MINIMA_VERSION (MINIMA_VERSION_MAJOR * 10000 + MINIMA_VERSION_MINOR * 100 + MINIMA_VERSION_PATCH)
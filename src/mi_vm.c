@@ -21,6 +21,9 @@ static const MiVmApi s_vm_api =
 #include "mi_log.h"
 #include "mi_mx.h"
 #include "mi_compile.h"
+#include "mi_verify.h"
+#include "mi_jit.h"
+#include "mi_aot.h"
 #include "stdx_string.h"
 
 #include <stdio.h>
@@ -182,8 +185,11 @@ static void s_vm_report_error(MiVm* vm, const char* msg)
   // Print call stack (most recent last). 
   if (vm->call_depth > 0)
   {
+    // Deep recursion would flood the report; show the innermost frames.
+    const int max_shown = 32;
+    int lowest = (vm->call_depth > max_shown) ? vm->call_depth - max_shown : 0;
     mi_error("Call stack:\n");
-    for (int i = vm->call_depth - 1; i >= 0; i -= 1)
+    for (int i = vm->call_depth - 1; i >= lowest; i -= 1)
     {
       MiVmCallFrame* fr = &vm->call_stack[i];
       if (fr->caller_chunk && fr->caller_chunk->dbg_file.ptr && fr->caller_chunk->dbg_file.length > 0 &&
@@ -222,6 +228,10 @@ static void s_vm_report_error(MiVm* vm, const char* msg)
         }
       }
     }
+    if (lowest > 0)
+    {
+      mi_error_fmt("  ... %d more\n", lowest);
+    }
   }
 
   if (file.ptr && file.length > 0 && line > 0)
@@ -252,11 +262,44 @@ static void* s_realloc(void* ptr, size_t size)
   return p;
 }
 
-static void s_vm_reg_set(MiVm* vm, uint8_t r, MiRtValue v)
+static inline void s_vm_reg_set(MiVm* vm, MiRtValue* regs, uint8_t r, MiRtValue v)
 {
   MI_ASSERT(vm);
   MI_ASSERT(r < MI_VM_REG_COUNT);
-  mi_rt_value_assign(vm->rt, &vm->regs[r], v);
+  mi_rt_value_assign(vm->rt, &regs[r], v);
+}
+
+// Typed opcodes write scalar results in place. Scalars carry no refcount, so
+// only a heap value being overwritten needs releasing.
+static inline MiRtValue* s_vm_reg_scalar(MiVm* vm, MiRtValue* regs, uint8_t r)
+{
+  MiRtValue* dst = &regs[r];
+  if (dst->kind > MI_RT_VAL_STRING)
+  {
+    mi_rt_value_release(vm->rt, *dst);
+  }
+  return dst;
+}
+
+static inline void s_vm_reg_set_int(MiVm* vm, MiRtValue* regs, uint8_t r, long long v)
+{
+  MiRtValue* dst = s_vm_reg_scalar(vm, regs, r);
+  dst->kind = MI_RT_VAL_INT;
+  dst->as.i = v;
+}
+
+static inline void s_vm_reg_set_float(MiVm* vm, MiRtValue* regs, uint8_t r, double v)
+{
+  MiRtValue* dst = s_vm_reg_scalar(vm, regs, r);
+  dst->kind = MI_RT_VAL_FLOAT;
+  dst->as.f = v;
+}
+
+static inline void s_vm_reg_set_bool(MiVm* vm, MiRtValue* regs, uint8_t r, bool v)
+{
+  MiRtValue* dst = s_vm_reg_scalar(vm, regs, r);
+  dst->kind = MI_RT_VAL_BOOL;
+  dst->as.b = v;
 }
 
 static uint32_t s_vm_chunk_sym_id(MiVm* vm, MiVmChunk* chunk, int32_t sym_index)
@@ -289,16 +332,24 @@ static uint32_t s_vm_chunk_sym_id(MiVm* vm, MiVmChunk* chunk, int32_t sym_index)
 }
 
 
-static void s_vm_arg_clear(MiVm* vm)
+// Release the args above 'base' and pop them.
+static void s_vm_arg_drop(MiVm* vm, int base)
 {
   MI_ASSERT(vm);
-  MI_ASSERT(vm->arg_top >= 0);
+  MI_ASSERT(base >= 0);
   MI_ASSERT(vm->arg_top <= MI_VM_ARG_STACK_COUNT);
-  for (int i = 0; i < vm->arg_top; ++i)
+  for (int i = base; i < vm->arg_top; ++i)
   {
     mi_rt_value_assign(vm->rt, &vm->arg_stack[i], mi_rt_make_void());
   }
-  vm->arg_top = 0;
+  vm->arg_top = base;
+}
+
+// Args below arg_base belong to calls still in progress (a native running a
+// callback borrows its window of the stack), so clearing stops there.
+static void s_vm_arg_clear(MiVm* vm)
+{
+  s_vm_arg_drop(vm, vm->arg_base);
 }
 
 static bool s_slice_eq(const XSlice a, const XSlice b)
@@ -425,41 +476,96 @@ static bool s_vm_check_sig(MiVm* vm, const MiFuncTypeSig* sig, XSlice cmd_name,
 //----------------------------------------------------------
 
 static MiRtValue s_vm_exec_block_value(MiVm* vm, MiRtValue block_value, const MiVmChunk* caller_chunk, size_t caller_ip);
+static MiRtValue s_vm_run(MiVm* vm, const MiVmChunk* chunk);
 
-static void s_vm_call_stack_push(MiVm* vm, MiVmCallFrameKind kind, XSlice name, const MiVmChunk* caller_chunk, size_t caller_ip)
+static inline const MiRtValue* s_vm_frame_argv(const MiVmCallFrame* f)
 {
-  if (!vm)
+  return f->argc > 0 ? f->regs + MI_VM_REG_COUNT : NULL;
+}
+
+#define MI_VM_REG_BLOCK_SLOTS 4096u
+
+// Reserve a window of 'count' registers on top of the register stack.
+static MiRtValue* s_vm_regs_push(MiVm* vm, size_t count)
+{
+  MiVmRegBlock* blk = vm->reg_block;
+  if (!blk || blk->top + count > blk->count)
   {
-    return;
+    MiVmRegBlock* next = blk ? blk->next : NULL;
+    if (!next || next->count < count)
+    {
+      // No spare block large enough: link a new one in front of the spare.
+      size_t slots = count > MI_VM_REG_BLOCK_SLOTS ? count : MI_VM_REG_BLOCK_SLOTS;
+      MiVmRegBlock* fresh = (MiVmRegBlock*)s_realloc(NULL, sizeof(*fresh));
+      fresh->slots = (MiRtValue*)s_realloc(NULL, slots * sizeof(MiRtValue));
+      for (size_t i = 0; i < slots; ++i)
+      {
+        fresh->slots[i] = mi_rt_make_void();
+      }
+      fresh->count = slots;
+      fresh->top = 0u;
+      fresh->prev = blk;
+      fresh->next = next;
+      if (next)
+      {
+        next->prev = fresh;
+      }
+      if (blk)
+      {
+        blk->next = fresh;
+      }
+      next = fresh;
+    }
+    blk = next;
+    vm->reg_block = blk;
   }
 
-  if (vm->call_depth < 0)
+  MiRtValue* window = blk->slots + blk->top;
+  blk->top += count;
+  return window;
+}
+
+// Release the innermost window. Slots outside live windows are kept void.
+static void s_vm_regs_pop(MiVm* vm, MiRtValue* window, size_t count)
+{
+  MiVmRegBlock* blk = vm->reg_block;
+  for (size_t i = 0; i < count; ++i)
   {
-    vm->call_depth = 0;
+    MiRtValue* r = &window[i];
+    if (r->kind != MI_RT_VAL_VOID)
+    {
+      mi_rt_value_release(vm->rt, *r);
+      *r = mi_rt_make_void();
+    }
   }
-  if (vm->call_depth >= (int)MI_VM_CALL_STACK_MAX)
+  blk->top -= count;
+  if (blk->top == 0u && blk->prev)
   {
-    // Drop frames instead of crashing; trace becomes less useful but program runs. 
-    return;
+    vm->reg_block = blk->prev;
   }
-
-  MiVmCallFrame* f = &vm->call_stack[vm->call_depth++];
-  f->kind = kind;
-  f->name = name;
-  f->caller_chunk = caller_chunk;
-  f->caller_ip = caller_ip;
 }
 
-static void s_vm_call_stack_pop(MiVm* vm)
+// Push a call record; NULL when the call would exceed MI_VM_CALL_STACK_MAX.
+static MiVmCallFrame* s_vm_call_stack_push(MiVm* vm, MiVmCallFrameKind kind, XSlice name, const MiVmChunk* caller_chunk, size_t caller_ip)
 {
-  if (!vm)
+  if (vm->call_depth >= (int)MI_VM_CALL_STACK_MAX)
   {
-    return;
+    return NULL;
   }
-  if (vm->call_depth > 0)
+
+  if (vm->call_depth == vm->call_capacity)
   {
-    vm->call_depth -= 1;
+    vm->call_capacity = vm->call_capacity ? vm->call_capacity * 2 : 64;
+    vm->call_stack = (MiVmCallFrame*)s_realloc(vm->call_stack, (size_t)vm->call_capacity * sizeof(MiVmCallFrame));
   }
+
+  MiVmCallFrame* f = &vm->call_stack[vm->call_depth++];
+  memset(f, 0, sizeof(*f));
+  f->kind = kind;
+  f->name = name;
+  f->caller_chunk = caller_chunk;
+  f->caller_ip = caller_ip;
+  return f;
 }
 
 static const char* s_vm_kind_name(MiRtValueKind kind)
@@ -502,7 +608,12 @@ static void s_vm_print_value_inline_depth(const MiRtValue* v, int depth)
     case MI_RT_VAL_INT:    printf("%lld", v->as.i); break;
     case MI_RT_VAL_FLOAT:  printf("%g", v->as.f); break;
     case MI_RT_VAL_BOOL:   printf("%s", v->as.b ? "true" : "false"); break;
-    case MI_RT_VAL_STRING: printf("%.*s", (int)v->as.s.length, v->as.s.ptr); break;
+    case MI_RT_VAL_STRING:
+    {
+      XSlice str = mi_rt_value_slice(*v);
+      printf("%.*s", (int)str.length, str.ptr);
+      break;
+    }
     case MI_RT_VAL_DICT:
     {
       const MiRtDict* d = v->as.dict;
@@ -575,7 +686,12 @@ static void s_vm_value_to_string(char* out, size_t cap, const MiRtValue* v)
     case MI_RT_VAL_INT:    (void)snprintf(out, cap, "%lld", v->as.i); break;
     case MI_RT_VAL_FLOAT:  (void)snprintf(out, cap, "%g", v->as.f); break;
     case MI_RT_VAL_BOOL:   (void)snprintf(out, cap, "%s", v->as.b ? "true" : "false"); break;
-    case MI_RT_VAL_STRING: (void)snprintf(out, cap, "%.*s", (int)v->as.s.length, v->as.s.ptr); break;
+    case MI_RT_VAL_STRING:
+    {
+      XSlice str = mi_rt_value_slice(*v);
+      (void)snprintf(out, cap, "%.*s", (int)str.length, str.ptr);
+      break;
+    }
     case MI_RT_VAL_LIST:   (void)snprintf(out, cap, "[list]"); break;
     case MI_RT_VAL_DICT:   (void)snprintf(out, cap, "[dict]"); break;
     case MI_RT_VAL_KVREF:  (void)snprintf(out, cap, "<kvref>"); break;
@@ -693,9 +809,9 @@ static MiRtValue s_vm_cmd_len(MiVm* vm, void* user, int argc, const MiRtValue* a
     return mi_rt_make_int(2);
   }
 
-  if (v.kind == MI_RT_VAL_STRING && v.as.s.ptr)
+  if (v.kind == MI_RT_VAL_STRING && mi_rt_value_slice(v).ptr)
   {
-    return mi_rt_make_int((int64_t)v.as.s.length);
+    return mi_rt_make_int((int64_t)mi_rt_value_slice(v).length);
   }
 
   mi_error("len: unsupported type\n");
@@ -809,9 +925,7 @@ static MiRtValue s_vm_cmd_assert(MiVm* vm, void* user, int argc, const MiRtValue
   {
     if (argv[1].kind == MI_RT_VAL_STRING)
     {
-      MiRtValue one;
-      one.kind = MI_RT_VAL_STRING;
-      one.as.s = argv[1].as.s;
+      MiRtValue one = mi_rt_make_string_slice(mi_rt_value_slice(argv[1]));
       (void)s_vm_cmd_fatal(vm, NULL, 1, &one);
     }
     else
@@ -841,7 +955,7 @@ static MiRtValue s_vm_cmd_type(MiVm* vm, void* user, int argc, const MiRtValue*
     return mi_rt_make_void();
   }
 
-  XSlice s = argv[0].as.s;
+  XSlice s = mi_rt_value_slice(argv[0]);
   if (s_slice_eq(s, x_slice_from_cstr("()")) || s_slice_eq(s, x_slice_from_cstr("void")))
   {
     return mi_rt_make_type(MI_RT_VAL_VOID);
@@ -943,7 +1057,7 @@ static void s_vm_trace_print_frame(const MiVmChunk* chunk, size_t ip, const char
     return;
   }
 
-  const MiVmIns ins = chunk->code[ip];
+  const MiVmIns ins = chunk->exec_code ? chunk->exec_code[ip] : chunk->code[ip];
   const char* opname = s_op_name((MiVmOp)ins.op);
 
   printf("  %s %s %s:%u:%u ip=%zu %s a=%u b=%u c=%u imm=%d\n",
@@ -1135,7 +1249,7 @@ static MiRtValue s_vm_cmd_set(MiVm* vm, void* user, int argc, const MiRtValue* a
     return mi_rt_make_void();
   }
 
-  (void) mi_rt_var_set(vm->rt, argv[0].as.s, argv[1]);
+  (void) mi_rt_var_set(vm->rt, mi_rt_value_slice(argv[0]), argv[1]);
   return argv[1];
 }
 
@@ -1151,51 +1265,205 @@ static MiRtValue s_vm_cmd_call(MiVm* vm, void* user, int argc, const MiRtValue*
   return s_vm_exec_block_value(vm, argv[0], vm->dbg_chunk, vm->dbg_ip);
 }
 
-static MiRtValue s_vm_exec_cmd_value(MiVm* vm, XSlice cmd_name, MiRtValue cmd_value, int argc, const MiRtValue* argv)
+// Reserve 'count' void slots on the locals stack; returns the frame base.
+static size_t s_vm_locals_push(MiVm* vm, uint32_t count)
 {
-  if (!vm || !vm->rt)
+  size_t base = vm->local_top;
+  if (count == 0u)
   {
-    return mi_rt_make_void();
+    return base;
   }
 
-  if (cmd_value.kind != MI_RT_VAL_CMD || !cmd_value.as.cmd)
+  size_t need = base + (size_t)count;
+  if (need > vm->local_capacity)
   {
-    return mi_rt_make_void();
+    size_t new_cap = vm->local_capacity ? vm->local_capacity : 64u;
+    while (new_cap < need)
+    {
+      new_cap *= 2u;
+    }
+    vm->locals = (MiRtValue*)s_realloc(vm->locals, new_cap * sizeof(MiRtValue));
+    vm->local_capacity = new_cap;
   }
 
-  MiRtCmd* c = cmd_value.as.cmd;
+  for (size_t i = base; i < need; ++i)
+  {
+    vm->locals[i] = mi_rt_make_void();
+  }
+  vm->local_top = need;
+  return base;
+}
 
-  if (c->is_native)
+// Release every slot above 'base' and drop them from the locals stack.
+static void s_vm_locals_pop(MiVm* vm, size_t base)
+{
+  while (vm->local_top > base)
   {
-    /* Enforce declared signature when available.
-       Native host commands are expected to provide one.
-       Legacy builtins may still have sig == NULL. */
-    if (c->sig)
-    {
-      if (!s_vm_check_sig(vm, c->sig, cmd_name, argc, argv))
-      {
-        return mi_rt_make_void();
-      }
-    }
+    vm->local_top -= 1;
+    mi_rt_value_release(vm->rt, vm->locals[vm->local_top]);
+    vm->locals[vm->local_top] = mi_rt_make_void();
+  }
+}
+
+// Push a scope frame for code of 'chunk'. Blocks it creates keep the frame as
+// their env, so such code gets heap frames; everything else bumps the scope
+// stack.
+static inline void s_vm_scope_push(MiVm* vm, const MiVmChunk* chunk, MiScopeFrame* parent)
+{
+  if (chunk->captures_env)
+  {
+    mi_rt_scope_push_heap(vm->rt, parent);
+  }
+  else
+  {
+    mi_rt_scope_push_with_parent(vm->rt, parent);
+  }
+}
 
-    if (c->native_fn2)
+// Give frame 'f' a body running 'sub', the chunk of block 'body': a new scope
+// under the block's env (the current scope when it has none), the block's
+// upvalues, a fresh register window above the caller's (so calls neither save
+// nor restore registers), its locals, and an empty arg frame. The args follow
+// the window's registers. With take_args they are the top 'argc' entries of
+// the arg stack and are moved there without touching refcounts; otherwise
+// argv is copied.
+static void s_vm_frame_enter(MiVm* vm, MiVmCallFrame* f, const MiVmChunk* sub, MiRtBlock* body,
+    int argc, const MiRtValue* argv, bool take_args)
+{
+  MiRtValue* regs = s_vm_regs_push(vm, MI_VM_REG_COUNT + (size_t)argc);
+  if (take_args)
+  {
+    int base = vm->arg_top - argc;
+    for (int i = 0; i < argc; ++i)
     {
-      return c->native_fn2(vm, c->native_user, argc, argv);
+      regs[MI_VM_REG_COUNT + i] = vm->arg_stack[base + i];
+      vm->arg_stack[base + i] = mi_rt_make_void();
     }
-
-    if (c->native_fn)
+    vm->arg_top = base;
+  }
+  else
+  {
+    for (int i = 0; i < argc; ++i)
     {
-      return c->native_fn(vm, cmd_name, argc, argv);
+      regs[MI_VM_REG_COUNT + i] = argv[i];
+      mi_rt_value_retain(vm->rt, argv[i]);
     }
+  }
 
-    mi_error("mi_vm: native cmd missing function pointer\n");
-    return mi_rt_make_void();
+  f->regs = regs;
+  f->argc = argc;
+  vm->regs = regs;
+  vm->cur_argc = argc;
+  vm->cur_argv = s_vm_frame_argv(f);
+
+  s_vm_scope_push(vm, sub, body->env ? body->env : vm->rt->current);
+  f->scope = vm->rt->current;
+  if (body->upvals)
+  {
+    // The upvalues go with the block: keep it for as long as they are used.
+    f->closure = mi_rt_make_block(body);
+    mi_rt_value_retain(vm->rt, f->closure);
+  }
+  vm->upvals = body->upvals;
+
+  f->local_base = s_vm_locals_push(vm, sub->local_count);
+  vm->local_base = f->local_base;
+
+  vm->arg_base = vm->arg_top;
+}
+
+// Release what the body of frame 'f' owns: locals, scope, register window and
+// the block holding its upvalues.
+static void s_vm_frame_exit(MiVm* vm, MiVmCallFrame* f)
+{
+  s_vm_locals_pop(vm, f->local_base);
+  mi_rt_scope_pop(vm->rt);
+  s_vm_regs_pop(vm, f->regs, MI_VM_REG_COUNT + (size_t)f->argc);
+  mi_rt_value_release(vm->rt, f->closure);
+  f->closure = mi_rt_make_void();
+  if (vm->rt->held_frames)
+  {
+    // The scope may only have been kept for blocks in the window just popped.
+    mi_rt_scope_collect(vm->rt);
+  }
+}
+
+// Push a frame for running 'sub' (see s_vm_frame_enter).
+static MiVmCallFrame* s_vm_frame_push(MiVm* vm, MiVmCallFrameKind kind, XSlice name, const MiVmChunk* sub, MiRtBlock* body,
+    int argc, const MiRtValue* argv, bool take_args, uint8_t ret_reg, const MiVmChunk* caller_chunk, size_t caller_ip)
+{
+  MiVmCallFrame* f = s_vm_call_stack_push(vm, kind, name, caller_chunk, caller_ip);
+  if (!f)
+  {
+    s_vm_report_error(vm, "call stack overflow");
+    return NULL;
+  }
+
+  f->caller_regs = vm->regs;
+  f->caller_local_base = vm->local_base;
+  f->caller_scope = vm->rt->current;
+  f->caller_argc = vm->cur_argc;
+  f->caller_argv = vm->cur_argv;
+  f->caller_arg_base = vm->arg_base;
+  f->caller_upvals = vm->upvals;
+  f->ret_reg = ret_reg;
+
+  s_vm_frame_enter(vm, f, sub, body, argc, argv, take_args);
+  return f;
+}
+
+// Pop the innermost frame, releasing its storage and restoring its caller.
+static void s_vm_frame_pop(MiVm* vm)
+{
+  MiVmCallFrame* f = &vm->call_stack[vm->call_depth - 1];
+
+  s_vm_frame_exit(vm, f);
+  vm->local_base = f->caller_local_base;
+  /* Restore caller scope even when the callee's lexical parent differs. */
+  vm->rt->current = f->caller_scope;
+  vm->regs = f->caller_regs;
+  vm->cur_argc = f->caller_argc;
+  vm->cur_argv = f->caller_argv;
+  vm->upvals = f->caller_upvals;
+
+  s_vm_arg_clear(vm);
+  vm->arg_base = f->caller_arg_base;
+  mi_rt_value_release(vm->rt, f->self);
+  vm->call_depth -= 1;
+}
+
+// Compile a body left for its first call (mi_compile_vm_script_lazy) and
+// verify it; its parent was verified without it.
+static bool s_vm_chunk_force(const MiVmChunk* chunk)
+{
+  if (!mi_compile_force((MiVmChunk*)chunk) || !mi_verify_chunk((MiVmChunk*)chunk))
+  {
+    mi_error("mi_vm: block failed to compile; not running it\n");
+    return false;
   }
+  return true;
+}
 
+// Check a call of user command 'c' before any frame is touched. Reports and
+// returns NULL when its body is invalid or the arguments do not fit. A
+// trusted call site had its arguments proven by the compiler.
+static const MiVmChunk* s_vm_cmd_check_call(MiVm* vm, XSlice cmd_name, MiRtCmd* c, int argc, const MiRtValue* argv, bool trusted)
+{
   if (c->body.kind != MI_RT_VAL_BLOCK || !c->body.as.block || c->body.as.block->kind != MI_RT_BLOCK_VM_CHUNK)
   {
     mi_error("mi_vm: invalid cmd body\n");
-    return mi_rt_make_void();
+    return NULL;
+  }
+
+  const MiVmChunk* sub = (const MiVmChunk*)c->body.as.block->ptr;
+  if (sub->lazy && !s_vm_chunk_force(sub))
+  {
+    return NULL;
+  }
+
+  if (trusted)
+  {
+    return sub;
   }
 
   /* Enforce declared signature when available. */
@@ -1203,7 +1471,7 @@ static MiRtValue s_vm_exec_cmd_value(MiVm* vm, XSlice cmd_name, MiRtValue cmd_va
   {
     if (!s_vm_check_sig(vm, c->sig, cmd_name, argc, argv))
     {
-      return mi_rt_make_void();
+      return NULL;
     }
   }
   else
@@ -1211,120 +1479,218 @@ static MiRtValue s_vm_exec_cmd_value(MiVm* vm, XSlice cmd_name, MiRtValue cmd_va
     if ((uint32_t)argc != c->param_count)
     {
       mi_error_fmt("%.*s: expected %u args, got %d\n", (int)cmd_name.length, cmd_name.ptr, (unsigned)c->param_count, argc);
-      return mi_rt_make_void();
+      return NULL;
     }
   }
 
-  MiRtBlock* b = c->body.as.block;
-  MiVmChunk* sub = (MiVmChunk*)b->ptr;
-  MiScopeFrame* caller = vm->rt->current;
-  MiScopeFrame* parent = b->env ? b->env : caller;
+  return sub;
+}
+
+// Bind the arguments of the frame just entered for 'c' to its parameters.
+static void s_vm_frame_bind_params(MiVm* vm, MiVmCallFrame* f, MiRtCmd* c, const MiVmChunk* sub)
+{
+  // Parameters the compiler resolved to slots skip the scope frame entirely.
+  const MiRtValue* args = vm->cur_argv;
+  const int32_t* param_slots = (sub->param_slot_count == c->param_count) ? sub->param_slots : NULL;
+  for (uint32_t i = 0; i < c->param_count; ++i)
+  {
+    int32_t slot = param_slots ? param_slots[i] : -1;
+    if (slot >= 0 && (uint32_t)slot < sub->local_count)
+    {
+      mi_rt_value_assign(vm->rt, &vm->locals[f->local_base + (size_t)slot], args[i]);
+    }
+    else
+    {
+      (void)mi_rt_var_define(vm->rt, c->param_names[i], args[i]);
+    }
+  }
+}
 
-/* Preserve current call argument context so argc()/arg() inside the user command
-   refer to the arguments passed to this command call (not to nested builtins). */
-int saved_cur_argc = vm->cur_argc;
-const MiRtValue* saved_cur_argv = vm->cur_argv;
-vm->cur_argc = argc;
-vm->cur_argv = argv;
+// Push a frame running user command 'c'. Reports and returns NULL when the
+// arguments do not fit its signature (not checked for trusted call sites).
+static MiVmCallFrame* s_vm_frame_push_cmd(MiVm* vm, XSlice cmd_name, MiRtCmd* c, int argc, const MiRtValue* argv,
+    bool trusted, bool take_args, uint8_t ret_reg, const MiVmChunk* caller_chunk, size_t caller_ip)
+{
+  const MiVmChunk* sub = s_vm_cmd_check_call(vm, cmd_name, c, argc, argv, trusted);
+  if (!sub)
+  {
+    return NULL;
+  }
 
-  /* Preserve VM-reserved regs across call (same as call:). */
-  MiRtValue saved_vm_regs[7];
-  for (int i = 0; i < 7; ++i)
+  /* argc()/arg() inside the user command refer to the arguments passed to
+     this call (not to nested builtins). */
+  MiVmCallFrame* f = s_vm_frame_push(vm, MI_VM_CALL_FRAME_USER_CMD, cmd_name, sub, c->body.as.block, argc, argv, take_args,
+      ret_reg, caller_chunk, caller_ip);
+  if (!f)
   {
-    saved_vm_regs[i] = vm->regs[1 + i];
-    mi_rt_value_retain(vm->rt, saved_vm_regs[i]);
+    return NULL;
   }
 
-  mi_rt_scope_push_with_parent(vm->rt, parent);
+  s_vm_frame_bind_params(vm, f, c, sub);
+  return f;
+}
 
-  for (uint32_t i = 0; i < c->param_count; ++i)
+// Whether a TAIL_CALL head can replace the running frame.
+static inline bool s_vm_tail_call_ok(MiRtValue head)
+{
+  if (head.kind != MI_RT_VAL_CMD || !head.as.cmd || head.as.cmd->is_native)
   {
-    (void)mi_rt_var_define(vm->rt, c->param_names[i], argv[(int)i]);
+    return false;
   }
+  MiRtValue body = head.as.cmd->body;
+  return body.kind == MI_RT_VAL_BLOCK && body.as.block && body.as.block->env;
+}
 
-  s_vm_call_stack_push(vm, MI_VM_CALL_FRAME_USER_CMD, cmd_name, vm->dbg_chunk, vm->dbg_ip);
-  MiRtValue ret = mi_vm_execute(vm, sub);
-  s_vm_call_stack_pop(vm);
+// Tail call: run user command 'c' in place of the innermost frame, with the
+// top 'argc' entries of the arg stack as its arguments. The frame keeps its
+// caller state, so the result goes straight to the original caller; its
+// 'scope_pops' inlined scopes, locals, scope and registers are released
+// first, so a chain of tail calls
+// runs in constant space. Only commands with a lexical env qualify: a
+// dynamic parent would otherwise lose the frame being replaced. Returns the
+// callee chunk, or NULL (with the frame untouched) when the call does not
+// qualify or fails its checks, which are reported.
+static const MiVmChunk* s_vm_frame_replace_cmd(MiVm* vm, XSlice cmd_name, MiRtValue cmd_value, int argc, int scope_pops)
+{
+  MiRtCmd* c = cmd_value.as.cmd;
+  int base = vm->arg_top - argc;
+  const MiVmChunk* sub = s_vm_cmd_check_call(vm, cmd_name, c, argc, &vm->arg_stack[base], false);
+  if (!sub)
+  {
+    return NULL;
+  }
 
-  mi_rt_scope_pop(vm->rt);
-  vm->rt->current = caller;
+  // The caller's register holding the command goes away with its window;
+  // the frame keeps it alive instead.
+  MiVmCallFrame* f = &vm->call_stack[vm->call_depth - 1];
+  MiRtValue prev_self = f->self;
+  mi_rt_value_retain(vm->rt, cmd_value);
+  f->self = cmd_value;
 
-vm->cur_argc = saved_cur_argc;
-vm->cur_argv = saved_cur_argv;
+  for (int i = 0; i < scope_pops; ++i)
+  {
+    mi_rt_scope_pop(vm->rt);
+  }
+  s_vm_frame_exit(vm, f);
+  mi_rt_value_release(vm->rt, prev_self);
 
-  for (int i = 0; i < 7; ++i)
+  // Drop what the replaced body left below the args; the args then move
+  // into the new window and the frame's arg stack is empty again.
+  int frame_arg_base = vm->arg_base;
+  for (int i = frame_arg_base; i < base; ++i)
   {
-    mi_rt_value_assign(vm->rt, &vm->regs[1 + i], saved_vm_regs[i]);
-    mi_rt_value_release(vm->rt, saved_vm_regs[i]);
+    mi_rt_value_release(vm->rt, vm->arg_stack[i]);
+    vm->arg_stack[i] = mi_rt_make_void();
   }
-  s_vm_arg_clear(vm);
 
-  return ret;
+  f->kind = MI_VM_CALL_FRAME_USER_CMD;
+  f->name = cmd_name;
+  s_vm_frame_enter(vm, f, sub, c->body.as.block, argc, NULL, true);
+  vm->arg_top = frame_arg_base;
+  vm->arg_base = frame_arg_base;
+  s_vm_frame_bind_params(vm, f, c, sub);
+  return sub;
 }
 
-static MiRtValue s_vm_exec_block_value(MiVm* vm, MiRtValue block_value, const MiVmChunk* caller_chunk, size_t caller_ip)
+// Push a frame running a block value. Blocks take no arguments.
+static MiVmCallFrame* s_vm_frame_push_block(MiVm* vm, MiRtValue block_value, uint8_t ret_reg, const MiVmChunk* caller_chunk, size_t caller_ip)
 {
-  if (!vm || !vm->rt)
-  {
-    return mi_rt_make_void();
-  }
-
   if (block_value.kind != MI_RT_VAL_BLOCK || !block_value.as.block)
   {
     mi_error("call: expected block");
-    return mi_rt_make_void();
+    return NULL;
   }
 
   MiRtBlock* b = block_value.as.block;
   if (b->kind != MI_RT_BLOCK_VM_CHUNK || !b->ptr)
   {
     mi_error("call: expected VM block");
-    return mi_rt_make_void();
+    return NULL;
+  }
+  if (((const MiVmChunk*)b->ptr)->lazy && !s_vm_chunk_force((const MiVmChunk*)b->ptr))
+  {
+    return NULL;
+  }
+
+  /* Blocks have their own argument context (empty), so argc()/arg() inside
+     the block do not observe caller args. */
+  return s_vm_frame_push(vm, MI_VM_CALL_FRAME_BLOCK, x_slice_init(NULL, 0), (const MiVmChunk*)b->ptr, b,
+      0, NULL, false, ret_reg, caller_chunk, caller_ip);
+}
+
+// Run native command 'c' on arguments already checked against its signature.
+static MiRtValue s_vm_exec_native(MiVm* vm, XSlice cmd_name, MiRtCmd* c, int argc, const MiRtValue* argv)
+{
+  if (c->native_fn2)
+  {
+    return c->native_fn2(vm, c->native_user, argc, argv);
   }
 
-  MiVmChunk* sub = (MiVmChunk*)b->ptr;
-  MiScopeFrame* caller = vm->rt->current;
-  MiScopeFrame* parent = b->env ? b->env : caller;
+  if (c->native_fn)
+  {
+    return c->native_fn(vm, cmd_name, argc, argv);
+  }
 
-/* Blocks have their own argument context (empty). Preserve outer context so
-   argc()/arg() inside the block do not accidentally observe caller args. */
-int saved_cur_argc = vm->cur_argc;
-const MiRtValue* saved_cur_argv = vm->cur_argv;
-vm->cur_argc = 0;
-vm->cur_argv = NULL;
+  mi_error("mi_vm: native cmd missing function pointer\n");
+  return mi_rt_make_void();
+}
 
-  s_vm_call_stack_push(vm, MI_VM_CALL_FRAME_BLOCK, x_slice_init(NULL, 0), caller_chunk, caller_ip);
+// Call a command from native code (or a call site that cannot switch frames).
+// User commands run to completion in a nested interpreter loop.
+static MiRtValue s_vm_exec_cmd_value(MiVm* vm, XSlice cmd_name, MiRtValue cmd_value, int argc, const MiRtValue* argv)
+{
+  if (!vm || !vm->rt)
+  {
+    return mi_rt_make_void();
+  }
 
-  /* CALL ABI:
-     - r0 is return value
-     - r1-r7 are VM-reserved and preserved across calls
-     - r8+ are caller-saved (clobbered)
-     - arg stack is not preserved across calls */
-  MiRtValue saved_vm_regs[7];
-  for (int i = 0; i < 7; ++i)
+  if (cmd_value.kind != MI_RT_VAL_CMD || !cmd_value.as.cmd)
   {
-    saved_vm_regs[i] = vm->regs[1 + i];
-    mi_rt_value_retain(vm->rt, saved_vm_regs[i]);
+    return mi_rt_make_void();
   }
 
-  mi_rt_scope_push_with_parent(vm->rt, parent);
-  MiRtValue ret = mi_vm_execute(vm, sub);
-  mi_rt_scope_pop(vm->rt);
-  /* Restore caller scope even when the block's lexical parent differs. */
-  vm->rt->current = caller;
+  MiRtCmd* c = cmd_value.as.cmd;
+
+  if (c->is_native)
+  {
+    /* Enforce declared signature when available.
+       Native host commands are expected to provide one.
+       Legacy builtins may still have sig == NULL. */
+    if (c->sig)
+    {
+      if (!s_vm_check_sig(vm, c->sig, cmd_name, argc, argv))
+      {
+        return mi_rt_make_void();
+      }
+    }
+
+    return s_vm_exec_native(vm, cmd_name, c, argc, argv);
+  }
 
-  for (int i = 0; i < 7; ++i)
+  if (!s_vm_frame_push_cmd(vm, cmd_name, c, argc, argv, false, false, 0, vm->dbg_chunk, vm->dbg_ip))
   {
-    mi_rt_value_assign(vm->rt, &vm->regs[1 + i], saved_vm_regs[i]);
-    mi_rt_value_release(vm->rt, saved_vm_regs[i]);
+    return mi_rt_make_void();
   }
-  s_vm_arg_clear(vm);
 
-  vm->cur_argc = saved_cur_argc;
-  vm->cur_argv = saved_cur_argv;
+  MiRtValue ret = s_vm_run(vm, (const MiVmChunk*)c->body.as.block->ptr);
+  s_vm_frame_pop(vm);
+  return ret;
+}
+
+static MiRtValue s_vm_exec_block_value(MiVm* vm, MiRtValue block_value, const MiVmChunk* caller_chunk, size_t caller_ip)
+{
+  if (!vm || !vm->rt)
+  {
+    return mi_rt_make_void();
+  }
 
-  s_vm_call_stack_pop(vm);
+  if (!s_vm_frame_push_block(vm, block_value, 0, caller_chunk, caller_ip))
+  {
+    return mi_rt_make_void();
+  }
 
+  MiRtValue ret = s_vm_run(vm, (const MiVmChunk*)block_value.as.block->ptr);
+  s_vm_frame_pop(vm);
   return ret;
 }
 
@@ -1396,7 +1762,7 @@ static MiRtValue s_vm_cmd_cmd(MiVm* vm, void* user, int argc, const MiRtValue* a
       return mi_rt_make_void();
     }
 
-    param_names[i] = pn.as.s;
+    param_names[i] = mi_rt_value_slice(pn);
   }
 
   MiRtCmd* c = mi_rt_cmd_create(vm->rt, param_count, param_names, body);
@@ -1489,8 +1855,10 @@ static MiRtValue s_vm_cmd_cmd(MiVm* vm, void* user, int argc, const MiRtValue* a
     c->sig = sig;
   }
 
-  /* Store command object in the current scope. */
-  (void)mi_rt_var_set(vm->rt, argv[0].as.s, mi_rt_make_cmd(c));
+  /* Store command object in the current scope, which takes the only reference. */
+  MiRtValue cmd_v = mi_rt_make_cmd(c);
+  (void)mi_rt_var_set(vm->rt, mi_rt_value_slice(argv[0]), cmd_v);
+  mi_rt_value_release(vm->rt, cmd_v);
   return mi_rt_make_void();
 }
 
@@ -1899,7 +2267,9 @@ static MiVmNativeDll* s_vm_native_dll_find(MiVm* vm, const char* path)
   return NULL;
 }
 
-static MiVmNativeDll* s_vm_native_dll_get_or_load(MiVm* vm, const char* path)
+// Load a native module (who = "include") or an AOT object (who = "aot"),
+// once per path.
+static MiVmNativeDll* s_vm_native_dll_get_or_load(MiVm* vm, const char* path, const char* who)
 {
   if (!vm || !path || !path[0])
   {
@@ -1922,10 +2292,10 @@ static MiVmNativeDll* s_vm_native_dll_get_or_load(MiVm* vm, const char* path)
   if (!handle)
   {
 #ifdef _WIN32
-    mi_error_fmt("include: failed to load dll: %s\n", path);
+    mi_error_fmt("%s: failed to load dll: %s\n", who, path);
 #else
     const char* e = dlerror();
-    mi_error_fmt("include: failed to load so: %s (%s)\n", path, e ? e : "unknown");
+    mi_error_fmt("%s: failed to load so: %s (%s)\n", who, path, e ? e : "unknown");
 #endif
     return NULL;
   }
@@ -1933,20 +2303,25 @@ static MiVmNativeDll* s_vm_native_dll_get_or_load(MiVm* vm, const char* path)
   MiModuleCountFn count_fn = NULL;
   MiModuleNameFn name_fn = NULL;
   MiModuleRegisterFn reg_fn = NULL;
+  MiAotImageFn aot_fn = NULL;
 
 #ifdef _WIN32
   count_fn = (MiModuleCountFn)GetProcAddress((HMODULE)handle, "mi_module_count");
   name_fn = (MiModuleNameFn)GetProcAddress((HMODULE)handle, "mi_module_name");
   reg_fn = (MiModuleRegisterFn)GetProcAddress((HMODULE)handle, "mi_module_register");
+  aot_fn = (MiAotImageFn)GetProcAddress((HMODULE)handle, MI_AOT_IMAGE_SYMBOL);
 #else
   count_fn = (MiModuleCountFn)dlsym(handle, "mi_module_count");
   name_fn = (MiModuleNameFn)dlsym(handle, "mi_module_name");
   reg_fn = (MiModuleRegisterFn)dlsym(handle, "mi_module_register");
+  // Through an object pointer: ISO C has no cast from void* to a function pointer.
+  *(void**)&aot_fn = dlsym(handle, MI_AOT_IMAGE_SYMBOL);
 #endif
 
-  if (!count_fn || !name_fn || !reg_fn)
+  bool is_module = count_fn && name_fn && reg_fn;
+  if (strcmp(who, "aot") == 0 ? !aot_fn : !is_module)
   {
-    mi_error_fmt("include: native module missing required exports: %s\n", path);
+    mi_error_fmt("%s: %s missing required exports: %s\n", who, strcmp(who, "aot") == 0 ? "AOT object" : "native module", path);
 #ifdef _WIN32
     FreeLibrary((HMODULE)handle);
 #else
@@ -1985,15 +2360,50 @@ static MiVmNativeDll* s_vm_native_dll_get_or_load(MiVm* vm, const char* path)
   out->module_count = count_fn;
   out->module_name = name_fn;
   out->module_register = reg_fn;
+  out->aot_image = aot_fn;
   vm->native_dll_count += 1u;
   return out;
 }
 
-static char* s_read_text_file_arena(XArena* arena, const char* path, size_t* out_len)
+const MiAotImage* mi_vm_load_aot_image(MiVm* vm, const char* path)
 {
-  if (out_len)
+  if (!vm || !path || !path[0])
   {
-    *out_len = 0;
+    return NULL;
+  }
+
+  // A bare file name would make dlopen search the library path instead.
+  char local[1024];
+  if (!strchr(path, '/') && !strchr(path, '\\'))
+  {
+    (void)snprintf(local, sizeof(local), "./%s", path);
+    path = local;
+  }
+
+  MiVmNativeDll* dll = s_vm_native_dll_get_or_load(vm, path, "aot");
+  if (!dll || !dll->aot_image)
+  {
+    if (dll)
+    {
+      mi_error_fmt("aot: not an AOT object: %s\n", path);
+    }
+    return NULL;
+  }
+
+  const MiAotImage* image = dll->aot_image();
+  if (!image || image->abi != MI_AOT_ABI || image->value_size != (uint32_t)sizeof(MiRtValue))
+  {
+    mi_error_fmt("aot: %s was built for a different minima build; rebuild it with --aot\n", path);
+    return NULL;
+  }
+  return image;
+}
+
+static char* s_read_text_file_arena(XArena* arena, const char* path, size_t* out_len)
+{
+  if (out_len)
+  {
+    *out_len = 0;
   }
 
   if (!arena)
@@ -2224,7 +2634,7 @@ static MiRtValue s_vm_load_native_module(MiVm* vm, XSlice module_path)
     return mi_rt_make_void();
   }
 
-  MiVmNativeDll* dll = s_vm_native_dll_get_or_load(vm, dll_path.buf);
+  MiVmNativeDll* dll = s_vm_native_dll_get_or_load(vm, dll_path.buf, "include");
   if (!dll)
   {
     return mi_rt_make_void();
@@ -2298,7 +2708,7 @@ static MiRtValue s_vm_cmd_include(MiVm* vm, void* user, int argc, const MiRtValu
     return mi_rt_make_void();
   }
 
-  XSlice module = argv[0].as.s;
+  XSlice module = mi_rt_value_slice(argv[0]);
   if (!module.length)
   {
     mi_error("include: empty path\n");
@@ -2570,6 +2980,27 @@ void mi_vm_set_modules_dir(MiVm* vm, const char* path)
   }
 }
 
+void mi_vm_set_jit(MiVm* vm, MiVmJitMode mode)
+{
+  if (!vm)
+  {
+    return;
+  }
+  vm->jit_mode = MI_VM_JIT ? mode : MI_VM_JIT_OFF;
+
+  // Tests set it low so the native code of every chunk runs.
+  const char* threshold = getenv("MINIMA_JIT_THRESHOLD");
+  vm->jit_threshold = MI_VM_JIT_THRESHOLD;
+  if (threshold && threshold[0])
+  {
+    unsigned long n = strtoul(threshold, NULL, 10);
+    if (n >= 1u)
+    {
+      vm->jit_threshold = n < UINT32_MAX ? (uint32_t)n : UINT32_MAX - 1u;
+    }
+  }
+}
+
 void mi_vm_init(MiVm* vm, MiRuntime* rt)
 {
   memset(vm, 0, sizeof(*vm));
@@ -2585,11 +3016,10 @@ void mi_vm_init(MiVm* vm, MiRuntime* rt)
   vm->cache_dir_set = false;
   (void)x_fs_path_set(&vm->cache_dir, "");
   vm->arg_top = 0;
+  vm->arg_base = 0;
 
-  for (int i = 0; i < MI_VM_REG_COUNT; ++i)
-  {
-    vm->regs[i] = mi_rt_make_void();
-  }
+  // Host window: registers in use while no chunk is running.
+  vm->regs = s_vm_regs_push(vm, MI_VM_REG_COUNT);
   for (int i = 0; i < MI_VM_ARG_STACK_COUNT; ++i)
   {
     vm->arg_stack[i] = mi_rt_make_void();
@@ -2748,13 +3178,40 @@ void mi_vm_shutdown(MiVm* vm)
     return;
   }
 
-  for (int i = 0; i < MI_VM_REG_COUNT; ++i)
+  if (vm->regs)
+  {
+    s_vm_regs_pop(vm, vm->regs, MI_VM_REG_COUNT);
+  }
+  MiVmRegBlock* blk = vm->reg_block;
+  while (blk && blk->prev)
+  {
+    blk = blk->prev;
+  }
+  while (blk)
   {
-    mi_rt_value_release(vm->rt, vm->regs[i]);
-    vm->regs[i] = mi_rt_make_void();
+    MiVmRegBlock* next = blk->next;
+    free(blk->slots);
+    free(blk);
+    blk = next;
   }
+  vm->reg_block = NULL;
+  vm->regs = NULL;
+  free(vm->call_stack);
+  vm->call_stack = NULL;
+  vm->call_depth = 0;
+  vm->call_capacity = 0;
   s_vm_arg_clear(vm);
 
+  for (size_t i = 0; i < vm->local_top; ++i)
+  {
+    mi_rt_value_release(vm->rt, vm->locals[i]);
+  }
+  free(vm->locals);
+  vm->locals = NULL;
+  vm->local_top = 0u;
+  vm->local_capacity = 0u;
+  vm->local_base = 0u;
+
   if (vm->commands)
   {
     for (size_t i = 0; i < vm->command_count; ++i)
@@ -2767,6 +3224,9 @@ void mi_vm_shutdown(MiVm* vm)
   vm->commands = NULL;
   vm->command_count = 0;
   vm->command_capacity = 0;
+  free(vm->command_index);
+  vm->command_index = NULL;
+  vm->command_index_capacity = 0;
 
   if (vm->modules)
   {
@@ -2825,6 +3285,7 @@ void mi_vm_shutdown(MiVm* vm)
       vm->native_dlls[i].module_count = NULL;
       vm->native_dlls[i].module_name = NULL;
       vm->native_dlls[i].module_register = NULL;
+      vm->native_dlls[i].aot_image = NULL;
     }
     free(vm->native_dlls);
   }
@@ -2919,16 +3380,15 @@ bool mi_vm_register_native(MiVm* vm, XSlice name, const MiFuncTypeSig* sig, MiVm
   }
   MiRtValue v = mi_rt_make_cmd(c);
 
-  for (size_t i = 0; i < vm->command_count; ++i)
+  uint32_t sym_id = mi_rt_sym_intern(vm->rt, name);
+  if ((size_t)sym_id < vm->command_index_capacity && vm->command_index[sym_id] != 0u)
   {
-    if (s_slice_eq(vm->commands[i].name, name))
-    {
-      mi_rt_value_release(vm->rt, vm->commands[i].value);
-      vm->commands[i].value = v;
-      mi_rt_value_retain(vm->rt, v);
-      (void)mi_rt_var_set(vm->rt, name, v);
-      return true;
-    }
+    MiVmCommandEntry* e = &vm->commands[vm->command_index[sym_id] - 1u];
+    mi_rt_value_release(vm->rt, e->value);
+    e->value = v;
+    mi_rt_value_retain(vm->rt, v);
+    (void)mi_rt_var_set(vm->rt, name, v);
+    return true;
   }
 
   if (vm->command_count == vm->command_capacity)
@@ -2938,10 +3398,24 @@ bool mi_vm_register_native(MiVm* vm, XSlice name, const MiFuncTypeSig* sig, MiVm
     vm->command_capacity = new_cap;
   }
 
+  if ((size_t)sym_id >= vm->command_index_capacity)
+  {
+    size_t new_cap = vm->command_index_capacity ? vm->command_index_capacity : 64u;
+    while (new_cap <= (size_t)sym_id)
+    {
+      new_cap *= 2u;
+    }
+    vm->command_index = (uint32_t*)s_realloc(vm->command_index, new_cap * sizeof(*vm->command_index));
+    memset(vm->command_index + vm->command_index_capacity, 0,
+        (new_cap - vm->command_index_capacity) * sizeof(*vm->command_index));
+    vm->command_index_capacity = new_cap;
+  }
+
   vm->commands[vm->command_count].name = name;
   vm->commands[vm->command_count].value = v;
   mi_rt_value_retain(vm->rt, v);
   vm->command_count++;
+  vm->command_index[sym_id] = (uint32_t)vm->command_count;
 
   (void)mi_rt_var_define(vm->rt, name, v);
   return true;
@@ -3199,20 +3673,20 @@ bool mi_vm_find_command(MiVm* vm, XSlice name, MiRtValue* out_cmd)
     return false;
   }
 
-  for (size_t i = 0; i < vm->command_count; ++i)
+  // Names that were never interned cannot have been registered.
+  uint32_t sym_id = 0u;
+  if (!mi_rt_sym_find(vm->rt, name, &sym_id) ||
+      (size_t)sym_id >= vm->command_index_capacity || vm->command_index[sym_id] == 0u)
   {
-    if (s_slice_eq(vm->commands[i].name, name))
-    {
-      if (out_cmd)
-      {
-        *out_cmd = vm->commands[i].value;
-        mi_rt_value_retain(vm->rt, *out_cmd);
-      }
-      return true;
-    }
+    return false;
   }
 
-  return false;
+  if (out_cmd)
+  {
+    *out_cmd = vm->commands[vm->command_index[sym_id] - 1u].value;
+    mi_rt_value_retain(vm->rt, *out_cmd);
+  }
+  return true;
 }
 
 MiVmCommandFn mi_vm_find_command_fn(MiVm* vm, XSlice name)
@@ -3459,6 +3933,10 @@ static void s_vm_chunk_destroy_ex(MiVmChunk* chunk, MiVmChunk** stack, size_t de
   }
 
   free(chunk->code);
+  mi_vm_chunk_release_exec(chunk);
+  mi_compile_lazy_free(chunk->lazy);
+  free(chunk->param_slots);
+  free(chunk->upval_outer);
 
   if (chunk->consts)
   {
@@ -3466,7 +3944,7 @@ static void s_vm_chunk_destroy_ex(MiVmChunk* chunk, MiVmChunk** stack, size_t de
     {
       if (chunk->consts[i].kind == MI_RT_VAL_STRING)
       {
-        free((void*)chunk->consts[i].as.s.ptr);
+        free((void*)mi_rt_value_slice(chunk->consts[i]).ptr);
       }
     }
     free(chunk->consts);
@@ -3517,6 +3995,37 @@ static void s_vm_chunk_destroy_ex(MiVmChunk* chunk, MiVmChunk** stack, size_t de
   free(chunk);
 }
 
+void mi_vm_chunk_release_exec(MiVmChunk* chunk)
+{
+  if (!chunk)
+  {
+    return;
+  }
+
+  free(chunk->exec_code);
+  free(chunk->exec_deopts);
+  free(chunk->exec_cmd_cache);
+  free(chunk->exec_member_cache);
+  free(chunk->exec_block_cache);
+  for (size_t i = 0; i < chunk->exec_dyn_count; ++i)
+  {
+    free(chunk->exec_dyn_cache[i].name);
+  }
+  free(chunk->exec_dyn_cache);
+  mi_jit_free(chunk->jit);
+
+  chunk->exec_code = NULL;
+  chunk->exec_deopts = NULL;
+  chunk->exec_cmd_cache = NULL;
+  chunk->exec_member_cache = NULL;
+  chunk->exec_block_cache = NULL;
+  chunk->exec_dyn_cache = NULL;
+  chunk->exec_dyn_count = 0;
+  chunk->exec_dyn_capacity = 0;
+  chunk->jit = NULL;
+  chunk->jit_hits = 0;
+}
+
 void mi_vm_chunk_destroy(MiVmChunk* chunk)
 {
   s_vm_chunk_destroy_ex(chunk, NULL, 0);
@@ -3537,6 +4046,29 @@ static MiRtValue s_vm_binary_numeric(MiVmOp op, const MiRtValue* a, const MiRtVa
     return mi_rt_make_void();
   }
 
+  // int op int stays in 64-bit integers; going through double would lose
+  // precision above 2^53. Overflow wraps.
+  if (a->kind == MI_RT_VAL_INT && b->kind == MI_RT_VAL_INT)
+  {
+    unsigned long long ua = (unsigned long long) a->as.i;
+    unsigned long long ub = (unsigned long long) b->as.i;
+    switch (op)
+    {
+      case MI_VM_OP_ADD:  return mi_rt_make_int((long long) (ua + ub));
+      case MI_VM_OP_SUB:  return mi_rt_make_int((long long) (ua - ub));
+      case MI_VM_OP_MUL:  return mi_rt_make_int((long long) (ua * ub));
+      case MI_VM_OP_DIV:  return mi_rt_make_float((double) a->as.i / (double) b->as.i);
+      case MI_VM_OP_MOD:
+        if (b->as.i == 0)
+        {
+          mi_error("mi_vm: modulo by zero\n");
+          return mi_rt_make_void();
+        }
+        return mi_rt_make_int(b->as.i == -1 ? 0 : a->as.i % b->as.i);
+      default:            return mi_rt_make_void();
+    }
+  }
+
   bool is_float = (a->kind == MI_RT_VAL_FLOAT) || (b->kind == MI_RT_VAL_FLOAT);
   double da = (a->kind == MI_RT_VAL_FLOAT) ? a->as.f : (double) a->as.i;
   double db = (b->kind == MI_RT_VAL_FLOAT) ? b->as.f : (double) b->as.i;
@@ -3547,7 +4079,13 @@ static MiRtValue s_vm_binary_numeric(MiVmOp op, const MiRtValue* a, const MiRtVa
     case MI_VM_OP_SUB:  return is_float ? mi_rt_make_float(da - db) : mi_rt_make_int((long long) (da - db));
     case MI_VM_OP_MUL:  return is_float ? mi_rt_make_float(da * db) : mi_rt_make_int((long long) (da * db));
     case MI_VM_OP_DIV:  return mi_rt_make_float(da / db);
-    case MI_VM_OP_MOD:  return mi_rt_make_int((long long) da % (long long) db);
+    case MI_VM_OP_MOD:
+      if ((long long) db == 0)
+      {
+        mi_error("mi_vm: modulo by zero\n");
+        return mi_rt_make_void();
+      }
+      return mi_rt_make_int((long long) da % (long long) db);
     default:            return mi_rt_make_void();
   }
 }
@@ -3566,6 +4104,22 @@ static MiRtValue s_vm_binary_compare(MiVmOp op, const MiRtValue* a, const MiRtVa
   }
 
 
+  if (a->kind == MI_RT_VAL_INT && b->kind == MI_RT_VAL_INT)
+  {
+    long long ia = a->as.i;
+    long long ib = b->as.i;
+    switch (op)
+    {
+      case MI_VM_OP_EQ:   return mi_rt_make_bool(ia == ib);
+      case MI_VM_OP_NEQ:  return mi_rt_make_bool(ia != ib);
+      case MI_VM_OP_LT:   return mi_rt_make_bool(ia < ib);
+      case MI_VM_OP_LTEQ: return mi_rt_make_bool(ia <= ib);
+      case MI_VM_OP_GT:   return mi_rt_make_bool(ia > ib);
+      case MI_VM_OP_GTEQ: return mi_rt_make_bool(ia >= ib);
+      default:            return mi_rt_make_void();
+    }
+  }
+
   if ((a->kind == MI_RT_VAL_INT || a->kind == MI_RT_VAL_FLOAT) &&
       (b->kind == MI_RT_VAL_INT || b->kind == MI_RT_VAL_FLOAT))
   {
@@ -3595,7 +4149,7 @@ static MiRtValue s_vm_binary_compare(MiVmOp op, const MiRtValue* a, const MiRtVa
 
   if (a->kind == MI_RT_VAL_STRING && b->kind == MI_RT_VAL_STRING)
   {
-    bool eq = s_slice_eq(a->as.s, b->as.s);
+    bool eq = s_slice_eq(mi_rt_value_slice(*a), mi_rt_value_slice(*b));
     switch (op)
     {
       case MI_VM_OP_EQ:  return mi_rt_make_bool(eq);
@@ -3618,424 +4172,1155 @@ static MiRtValue s_vm_binary_compare(MiVmOp op, const MiRtValue* a, const MiRtVa
   return mi_rt_make_void();
 }
 
-MiRtValue mi_vm_execute(MiVm* vm, const MiVmChunk* chunk)
+static void s_vm_arg_push_var_sym(MiVm* vm, const MiVmChunk* chunk, int32_t sym_index)
 {
-  if (!vm || !chunk)
+  if (vm->arg_top >= MI_VM_ARG_STACK_COUNT)
   {
-    return mi_rt_make_void();
+    mi_error("mi_vm: arg stack overflow\n");
+    return;
   }
+  MI_ASSERT(sym_index >= 0 && (size_t)sym_index < chunk->symbol_count);
 
-  s_vm_arg_clear(vm);
-  MiRtValue last = mi_rt_make_void();
+  uint32_t sym_id = s_vm_chunk_sym_id(vm, (MiVmChunk*)chunk, sym_index);
+  MiRtValue v;
+  if (!mi_rt_var_get_id(vm->rt, sym_id, &v))
+  {
+    XSlice name = chunk->symbols[sym_index];
+    mi_error_fmt("undefined variable: %.*s\n", (int)name.length, name.ptr);
+    v = mi_rt_make_void();
+  }
+  mi_rt_value_assign(vm->rt, &vm->arg_stack[vm->arg_top], v);
+  vm->arg_top += 1;
+}
 
-  size_t pc = 0;
-  while (pc < chunk->code_count)
+// Resolve an unqualified CALL_CMD name: a variable holding a command shadows
+// the linked target. The per-site cache skips the scope walk until a binding
+// of the name is created or replaced. It is only filled while the name has no
+// bindings outside the root scope, since those are visible from some scope
+// chains and not others.
+static MiRtCmd* s_vm_cmd_resolve_scoped(MiVm* vm, MiVmChunk* chunk, int32_t index, MiRtCmd* target)
+{
+  MiRuntime* rt = vm->rt;
+  if (!chunk->exec_cmd_cache)
   {
-    MiVmIns ins = chunk->code[pc++];
+    chunk->exec_cmd_cache = (MiVmCmdCache*)s_realloc(NULL, chunk->cmd_count * sizeof(MiVmCmdCache));
+    memset(chunk->exec_cmd_cache, 0, chunk->cmd_count * sizeof(MiVmCmdCache));
+  }
 
-    // Debug: remember current instruction location for trace:. 
-    vm->dbg_chunk = chunk;
-    vm->dbg_ip = (pc == 0) ? 0 : (pc - 1);
-    switch ((MiVmOp) ins.op)
-    {
-      case MI_VM_OP_NOOP:
-        break;
+  MiVmCmdCache* cache = &chunk->exec_cmd_cache[index];
+  if (cache->version != 0u && rt->sym_versions[cache->sym_id] == cache->version)
+  {
+    return cache->cmd;
+  }
 
-      case MI_VM_OP_LOAD_CONST:
-        s_vm_reg_set(vm, ins.a, chunk->consts[ins.imm]);
-        break;
+  uint32_t sym_id = mi_rt_sym_intern(rt, chunk->cmd_names[index]);
+  MiRtValue scoped = mi_rt_make_void();
+  MiRtCmd* cmd = target;
+  if (mi_rt_var_get_id(rt, sym_id, &scoped) && scoped.kind == MI_RT_VAL_CMD)
+  {
+    cmd = scoped.as.cmd;
+  }
 
-      case MI_VM_OP_LOAD_BLOCK:
-        {
-          MI_ASSERT(ins.a < MI_VM_REG_COUNT);
-          MI_ASSERT(ins.imm < (i32) chunk->const_count);
+  cache->version = 0u;
+  if (cmd && (size_t)sym_id < rt->sym_count && rt->sym_shadows[sym_id] == 0u)
+  {
+    cache->cmd = cmd;
+    cache->sym_id = sym_id;
+    cache->version = rt->sym_versions[sym_id];
+  }
+  return cmd;
+}
 
-          if (ins.imm < 0 || (size_t)ins.imm >= chunk->subchunk_count)
-          {
-            mi_error("mi_vm: LOAD_BLOCK invalid subchunk index\n");
-            s_vm_reg_set(vm, ins.a, mi_rt_make_void());
-            break;
-          }
+// Binding of member sym_id in env itself, through an inline cache. NULL when
+// env has no binding of its own (the member may still come from a parent).
+static MiRtVar* s_vm_member_ref(MiVmMemberCache* cache, MiScopeFrame* env, uint32_t sym_id)
+{
+  if (cache->env != env || cache->version != env->version)
+  {
+    cache->env = env;
+    cache->version = env->version;
+    cache->var = mi_rt_var_find_in(env, sym_id);
+  }
+  return cache->var;
+}
 
-          MiRtBlock* b = mi_rt_block_create(vm->rt);
-          b->kind = MI_RT_BLOCK_VM_CHUNK;
-          b->ptr = (void*)chunk->subchunks[(size_t)ins.imm];
-          b->env = vm->rt->current;
-          b->id = (uint32_t)ins.imm;
-          s_vm_reg_set(vm, ins.a, mi_rt_make_block(b));
-        } break;
+static MiVmMemberCache* s_vm_chunk_member_cache(MiVmChunk* chunk, int32_t sym_index)
+{
+  if (!chunk->exec_member_cache)
+  {
+    chunk->exec_member_cache = (MiVmMemberCache*)s_realloc(NULL, chunk->symbol_count * sizeof(MiVmMemberCache));
+    memset(chunk->exec_member_cache, 0, chunk->symbol_count * sizeof(MiVmMemberCache));
+  }
+  return &chunk->exec_member_cache[sym_index];
+}
 
-      case MI_VM_OP_MOV:
-        s_vm_reg_set(vm, ins.a, vm->regs[ins.b]);
-        break;
+static MiRtCmd* s_vm_command_by_sym(MiVm* vm, uint32_t sym_id)
+{
+  if ((size_t)sym_id >= vm->command_index_capacity || vm->command_index[sym_id] == 0u)
+  {
+    return NULL;
+  }
+  MiRtValue v = vm->commands[vm->command_index[sym_id] - 1u].value;
+  return (v.kind == MI_RT_VAL_CMD) ? v.as.cmd : NULL;
+}
 
-      case MI_VM_OP_LIST_NEW:
-        {
-          MI_ASSERT(ins.a < MI_VM_REG_COUNT);
-          MI_ASSERT(ins.b < MI_VM_REG_COUNT);
+static void s_vm_dyn_cache_fill(MiRuntime* rt, MiVmDynCache* cache, XSlice name)
+{
+  // Compared by length, so the copy is not NUL-terminated.
+  cache->name = (char*)s_realloc(cache->name, name.length ? name.length : 1u);
+  memcpy(cache->name, name.ptr, name.length);
+  cache->name_len = name.length;
+  cache->head_sym = UINT32_MAX;
+  cache->member_sym = UINT32_MAX;
+  memset(&cache->member, 0, sizeof(cache->member));
 
-          MiRtList* list = mi_rt_list_create(vm->rt);
-          if (!list)
-          {
-            s_vm_reg_set(vm, ins.a, mi_rt_make_void());
-            break;
-          }
-          s_vm_reg_set(vm, ins.a, mi_rt_make_list(list));
-        } break;
+  size_t dc = 0u;
+  if (!s_slice_find_double_colon(name, 0u, &dc))
+  {
+    cache->head_sym = mi_rt_sym_intern(rt, name);
+    return;
+  }
 
-      case MI_VM_OP_LIST_PUSH:
-        {
-          MI_ASSERT(ins.a < MI_VM_REG_COUNT);
-          MI_ASSERT(ins.b < MI_VM_REG_COUNT);
+  // Only "mod::member" is cached; deeper chains take the generic path.
+  XSlice head = { name.ptr, dc };
+  XSlice member = { (const char*)name.ptr + dc + 2u, name.length - dc - 2u };
+  size_t dc2 = 0u;
+  if (member.length == 0u || s_slice_find_double_colon(member, 0u, &dc2))
+  {
+    return;
+  }
+  cache->head_sym = mi_rt_sym_intern(rt, head);
+  cache->member_sym = mi_rt_sym_intern(rt, member);
+}
 
-          MiRtValue base = vm->regs[ins.a];
-          MiRtValue v = vm->regs[ins.b];
-          if (base.kind != MI_RT_VAL_LIST || !base.as.list)
-          {
-            mi_error("mi_vm: LIST_PUSH base is not a list\n");
-            break;
-          }
-          (void) mi_rt_list_push(base.as.list, v);
-        } break;
+// Resolve the string head of the CALL_CMD_DYN at 'ip' through the site's
+// inline cache; the entry index is kept in the exec_code imm. Returns NULL
+// when the name is not cached or does not resolve to a command, leaving the
+// generic path (and its error reporting) to the caller.
+static MiRtCmd* s_vm_dyn_resolve(MiVm* vm, MiVmChunk* chunk, size_t ip, XSlice name)
+{
+  MiRuntime* rt = vm->rt;
+  MiVmIns* ins = &chunk->exec_code[ip];
+  if (ins->imm <= 0)
+  {
+    if (chunk->exec_dyn_count == chunk->exec_dyn_capacity)
+    {
+      size_t new_cap = chunk->exec_dyn_capacity ? chunk->exec_dyn_capacity * 2u : 4u;
+      chunk->exec_dyn_cache = (MiVmDynCache*)s_realloc(chunk->exec_dyn_cache, new_cap * sizeof(MiVmDynCache));
+      chunk->exec_dyn_capacity = new_cap;
+    }
+    memset(&chunk->exec_dyn_cache[chunk->exec_dyn_count], 0, sizeof(MiVmDynCache));
+    chunk->exec_dyn_count++;
+    ins->imm = (int32_t)chunk->exec_dyn_count;
+  }
 
-      case MI_VM_OP_DICT_NEW:
-        {
-          MiRtDict* dict = mi_rt_dict_create(vm->rt);
-          if (!dict)
-          {
-            s_vm_reg_set(vm, ins.a, mi_rt_make_void());
-            break;
-          }
-          s_vm_reg_set(vm, ins.a, mi_rt_make_dict(dict));
-        } break;
+  MiVmDynCache* cache = &chunk->exec_dyn_cache[ins->imm - 1];
+  if (!cache->name || cache->name_len != name.length || memcmp(cache->name, name.ptr, name.length) != 0)
+  {
+    s_vm_dyn_cache_fill(rt, cache, name);
+  }
+  if (cache->head_sym == UINT32_MAX)
+  {
+    return NULL;
+  }
 
-      case MI_VM_OP_ITER_NEXT:
-        {
-          MI_ASSERT(ins.a < MI_VM_REG_COUNT);
-          MI_ASSERT(ins.b < MI_VM_REG_COUNT);
-          MI_ASSERT(ins.c < MI_VM_REG_COUNT);
+  MiRtValue head = mi_rt_make_void();
+  bool found = mi_rt_var_get_id(rt, cache->head_sym, &head);
+  if (cache->member_sym == UINT32_MAX)
+  {
+    // Scoped commands stored as variables shadow the global registry.
+    if (found && head.kind == MI_RT_VAL_CMD)
+    {
+      return head.as.cmd;
+    }
+    return s_vm_command_by_sym(vm, cache->head_sym);
+  }
 
-          uint8_t dst_item = (uint8_t)(ins.imm & 0xFF);
-          MiRtValue container = vm->regs[ins.b];
-          MiRtValue cursor_v = vm->regs[ins.c];
+  if (!found || head.kind != MI_RT_VAL_BLOCK || !head.as.block || !head.as.block->env)
+  {
+    return NULL;
+  }
+  MiRtVar* var = s_vm_member_ref(&cache->member, head.as.block->env, cache->member_sym);
+  if (!var || var->value.kind != MI_RT_VAL_CMD)
+  {
+    return NULL;
+  }
+  return var->value.as.cmd;
+}
 
-          long long cursor = -1;
-          if (cursor_v.kind == MI_RT_VAL_INT)
-          {
-            cursor = cursor_v.as.i;
-          }
+static MiVmIns* s_vm_chunk_exec_code(MiVmChunk* chunk)
+{
+  if (!chunk->exec_code && chunk->code_count > 0)
+  {
+    chunk->exec_code = (MiVmIns*)s_realloc(NULL, chunk->code_count * sizeof(MiVmIns));
+    memcpy(chunk->exec_code, chunk->code, chunk->code_count * sizeof(MiVmIns));
+    chunk->exec_deopts = (uint8_t*)s_realloc(NULL, chunk->code_count);
+    memset(chunk->exec_deopts, 0, chunk->code_count);
+  }
+  return chunk->exec_code;
+}
 
-          if (container.kind == MI_RT_VAL_LIST && container.as.list)
-          {
-            MiRtList* list = container.as.list;
-            long long next = cursor + 1;
-            if (next >= 0 && (uint64_t)next < (uint64_t)list->count)
-            {
-              s_vm_reg_set(vm, ins.c, mi_rt_make_int(next));
-              s_vm_reg_set(vm, dst_item, list->items[(size_t)next]);
-              s_vm_reg_set(vm, ins.a, mi_rt_make_bool(true));
-            }
-            else
-            {
-              s_vm_reg_set(vm, ins.a, mi_rt_make_bool(false));
-            }
-            break;
-          }
+#if MI_VM_QUICKEN
+// Guarded form of a generic instruction for the operand kinds just observed,
+// or NOOP when there is none.
+static MiVmOp s_vm_quick_op(MiVmOp op, MiRtValueKind ka, MiRtValueKind kb)
+{
+  if (ka == MI_RT_VAL_INT && kb == MI_RT_VAL_INT)
+  {
+    switch (op)
+    {
+      case MI_VM_OP_ADD:            return MI_VM_OP_QADD_INT;
+      case MI_VM_OP_SUB:            return MI_VM_OP_QSUB_INT;
+      case MI_VM_OP_LT:             return MI_VM_OP_QLT_INT;
+      case MI_VM_OP_JUMP_IF_NOT_LT: return MI_VM_OP_QJUMP_IF_NOT_LT_INT;
+      default:                      return MI_VM_OP_NOOP;
+    }
+  }
 
-          if (container.kind == MI_RT_VAL_DICT && container.as.dict)
-          {
-            MiRtDict* dict = container.as.dict;
-            size_t i = (cursor < -1) ? 0u : (size_t)(cursor + 1);
-            while (i < dict->capacity)
-            {
-              MiRtDictEntry* e = &dict->entries[i];
-              if (e->state == 1)
-              {
-                s_vm_reg_set(vm, ins.c, mi_rt_make_int((long long)i));
-                s_vm_reg_set(vm, dst_item, mi_rt_make_kvref(dict, i));
-                s_vm_reg_set(vm, ins.a, mi_rt_make_bool(true));
-                break;
-              }
-              i += 1;
-            }
+  if (ka == MI_RT_VAL_FLOAT && kb == MI_RT_VAL_FLOAT)
+  {
+    switch (op)
+    {
+      case MI_VM_OP_ADD:            return MI_VM_OP_QADD_FLOAT;
+      case MI_VM_OP_SUB:            return MI_VM_OP_QSUB_FLOAT;
+      case MI_VM_OP_LT:             return MI_VM_OP_QLT_FLOAT;
+      case MI_VM_OP_JUMP_IF_NOT_LT: return MI_VM_OP_QJUMP_IF_NOT_LT_FLOAT;
+      default:                      return MI_VM_OP_NOOP;
+    }
+  }
 
-            if (i >= dict->capacity)
-            {
-              s_vm_reg_set(vm, ins.a, mi_rt_make_bool(false));
-            }
-            break;
-          }
+  if (ka == MI_RT_VAL_LIST && kb == MI_RT_VAL_INT)
+  {
+    switch (op)
+    {
+      case MI_VM_OP_INDEX:     return MI_VM_OP_QINDEX_LIST;
+      case MI_VM_OP_ITER_NEXT: return MI_VM_OP_QITER_NEXT_LIST;
+      default:                 return MI_VM_OP_NOOP;
+    }
+  }
 
-          mi_error("mi_vm: ITER_NEXT unsupported container type\n");
-          s_vm_reg_set(vm, ins.a, mi_rt_make_bool(false));
-        } break;
+  return MI_VM_OP_NOOP;
+}
 
-      case MI_VM_OP_INDEX:
-        {
-          MI_ASSERT(ins.a < MI_VM_REG_COUNT);
-          MI_ASSERT(ins.b < MI_VM_REG_COUNT);
-          MI_ASSERT(ins.c < MI_VM_REG_COUNT);
+static inline void s_vm_quicken(MiVmChunk* chunk, size_t ip, MiVmOp op, MiRtValueKind ka, MiRtValueKind kb)
+{
+  if (chunk->exec_deopts[ip] >= MI_VM_QUICKEN_MAX_DEOPTS)
+  {
+    return;
+  }
+  MiVmOp q = s_vm_quick_op(op, ka, kb);
+  if (q != MI_VM_OP_NOOP)
+  {
+    chunk->exec_code[ip].op = (uint8_t)q;
+  }
+}
 
-          MiRtValue base = vm->regs[ins.b];
-          MiRtValue key = vm->regs[ins.c];
-          if (base.kind == MI_RT_VAL_LIST && base.as.list && key.kind == MI_RT_VAL_INT)
-          {
-            MiRtList* list = base.as.list;
-            int64_t idx = key.as.i;
-            if (idx < 0 || (uint64_t)idx >= list->count)
-            {
-              s_vm_reg_set(vm, ins.a, mi_rt_make_void());
-              break;
-            }
-            s_vm_reg_set(vm, ins.a, list->items[(size_t)idx]);
-            break;
-          }
+// Guard failed: put the generic instruction back. The caller re-executes it.
+static void s_vm_deopt(MiVmChunk* chunk, size_t ip, MiVmOp generic)
+{
+  chunk->exec_code[ip].op = (uint8_t)generic;
+  if (chunk->exec_deopts[ip] < 0xFF)
+  {
+    chunk->exec_deopts[ip] += 1;
+  }
+}
 
-          if (base.kind == MI_RT_VAL_PAIR && base.as.pair && key.kind == MI_RT_VAL_INT)
-          {
-            long long idx = key.as.i;
-            if (idx != 0 && idx != 1)
-            {
-              s_vm_reg_set(vm, ins.a, mi_rt_make_void());
-              break;
-            }
-            s_vm_reg_set(vm, ins.a, base.as.pair->items[(int)idx]);
-            break;
-          }
+#define MI_VM_QUICKEN_SITE(ka, kb) \
+  s_vm_quicken((MiVmChunk*)chunk, pc - 1, (MiVmOp)ins.op, (ka), (kb))
+#else
+#define MI_VM_QUICKEN_SITE(ka, kb) ((void)0)
+#endif
+
+// Start a call made by the interpreter loop with the top 'argc' entries of the
+// arg stack as its arguments. Natives borrow them in place and write regs[dst];
+// a user command gets a frame that takes them over, and its chunk is returned
+// so the loop can switch to it. The args are popped either way.
+static const MiVmChunk* s_vm_call_begin(MiVm* vm, XSlice name, MiRtCmd* c, int argc,
+    uint8_t dst, const MiVmChunk* chunk, size_t ip, bool trusted)
+{
+  int base = vm->arg_top - argc;
+  const MiRtValue* argv = &vm->arg_stack[base];
+  if (!c)
+  {
+    s_vm_reg_set(vm, vm->regs, dst, mi_rt_make_void());
+  }
+  else if (c->is_native && trusted)
+  {
+    s_vm_reg_set(vm, vm->regs, dst, s_vm_exec_native(vm, name, c, argc, argv));
+  }
+  else if (c->is_native)
+  {
+    s_vm_reg_set(vm, vm->regs, dst, s_vm_exec_cmd_value(vm, name, mi_rt_make_cmd(c), argc, argv));
+  }
+  else if (s_vm_frame_push_cmd(vm, name, c, argc, argv, trusted, true, dst, chunk, ip))
+  {
+    return (const MiVmChunk*)c->body.as.block->ptr;
+  }
+  else
+  {
+    s_vm_reg_set(vm, vm->regs, dst, mi_rt_make_void());
+  }
+
+  s_vm_arg_drop(vm, base);
+  return NULL;
+}
+
+// Handlers shared by the interpreter loop and mi_vm_jit_step().
+
+static inline void s_vm_op_iter_next(MiVm* vm, MiRtValue* regs, MiVmIns ins)
+{
+  MI_ASSERT(ins.a < MI_VM_REG_COUNT);
+  MI_ASSERT(ins.b < MI_VM_REG_COUNT);
+  MI_ASSERT(ins.c < MI_VM_REG_COUNT);
+
+  uint8_t dst_item = (uint8_t)(ins.imm & 0xFF);
+  MiRtValue container = regs[ins.b];
+  MiRtValue cursor_v = regs[ins.c];
+
+  long long cursor = -1;
+  if (cursor_v.kind == MI_RT_VAL_INT)
+  {
+    cursor = cursor_v.as.i;
+  }
+
+  if (container.kind == MI_RT_VAL_LIST && container.as.list)
+  {
+    MiRtList* list = container.as.list;
+    long long next = cursor + 1;
+    if (next >= 0 && (uint64_t)next < (uint64_t)list->count)
+    {
+      s_vm_reg_set(vm, regs, ins.c, mi_rt_make_int(next));
+      s_vm_reg_set(vm, regs, dst_item, list->items[(size_t)next]);
+      s_vm_reg_set(vm, regs, ins.a, mi_rt_make_bool(true));
+    }
+    else
+    {
+      s_vm_reg_set(vm, regs, ins.a, mi_rt_make_bool(false));
+    }
+    return;
+  }
+
+  if (container.kind == MI_RT_VAL_DICT && container.as.dict)
+  {
+    MiRtDict* dict = container.as.dict;
+    size_t i = (cursor < -1) ? 0u : (size_t)(cursor + 1);
+    while (i < dict->capacity)
+    {
+      MiRtDictEntry* e = &dict->entries[i];
+      if (e->state == 1)
+      {
+        s_vm_reg_set(vm, regs, ins.c, mi_rt_make_int((long long)i));
+        s_vm_reg_set(vm, regs, dst_item, mi_rt_make_kvref(dict, i));
+        s_vm_reg_set(vm, regs, ins.a, mi_rt_make_bool(true));
+        break;
+      }
+      i += 1;
+    }
+
+    if (i >= dict->capacity)
+    {
+      s_vm_reg_set(vm, regs, ins.a, mi_rt_make_bool(false));
+    }
+    return;
+  }
+
+  mi_error("mi_vm: ITER_NEXT unsupported container type\n");
+  s_vm_reg_set(vm, regs, ins.a, mi_rt_make_bool(false));
+}
+
+static inline void s_vm_op_index(MiVm* vm, MiRtValue* regs, MiVmIns ins)
+{
+  MI_ASSERT(ins.a < MI_VM_REG_COUNT);
+  MI_ASSERT(ins.b < MI_VM_REG_COUNT);
+  MI_ASSERT(ins.c < MI_VM_REG_COUNT);
+
+  MiRtValue base = regs[ins.b];
+  MiRtValue key = regs[ins.c];
+  if (base.kind == MI_RT_VAL_LIST && base.as.list && key.kind == MI_RT_VAL_INT)
+  {
+    MiRtList* list = base.as.list;
+    int64_t idx = key.as.i;
+    if (idx < 0 || (uint64_t)idx >= list->count)
+    {
+      s_vm_reg_set(vm, regs, ins.a, mi_rt_make_void());
+      return;
+    }
+    s_vm_reg_set(vm, regs, ins.a, list->items[(size_t)idx]);
+    return;
+  }
+
+  if (base.kind == MI_RT_VAL_PAIR && base.as.pair && key.kind == MI_RT_VAL_INT)
+  {
+    long long idx = key.as.i;
+    if (idx != 0 && idx != 1)
+    {
+      s_vm_reg_set(vm, regs, ins.a, mi_rt_make_void());
+      return;
+    }
+    s_vm_reg_set(vm, regs, ins.a, base.as.pair->items[(int)idx]);
+    return;
+  }
+
+  if (base.kind == MI_RT_VAL_KVREF && key.kind == MI_RT_VAL_INT)
+  {
+    long long idx = key.as.i;
+    MiRtKvRef ref = mi_rt_value_kvref(base);
+    MiRtDict* dict = ref.dict;
+    size_t entry_index = ref.entry_index;
+    if (!dict || entry_index >= dict->capacity)
+    {
+      s_vm_reg_set(vm, regs, ins.a, mi_rt_make_void());
+      return;
+    }
+    MiRtDictEntry* e = &dict->entries[entry_index];
+    if (e->state != 1 || (idx != 0 && idx != 1))
+    {
+      s_vm_reg_set(vm, regs, ins.a, mi_rt_make_void());
+      return;
+    }
+    s_vm_reg_set(vm, regs, ins.a, (idx == 0) ? e->key : e->value);
+    return;
+  }
+
+  if (base.kind == MI_RT_VAL_DICT && base.as.dict)
+  {
+    MiRtValue out;
+    if (mi_rt_dict_get(base.as.dict, key, &out))
+    {
+      s_vm_reg_set(vm, regs, ins.a, out);
+    }
+    else
+    {
+      s_vm_reg_set(vm, regs, ins.a, mi_rt_make_void());
+    }
+    return;
+  }
+
+  mi_error("mi_vm: INDEX unsupported types\n");
+  s_vm_reg_set(vm, regs, ins.a, mi_rt_make_void());
+}
+
+static inline void s_vm_op_store_index(MiVm* vm, MiRtValue* regs, MiVmIns ins)
+{
+  MI_ASSERT(ins.a < MI_VM_REG_COUNT);
+  MI_ASSERT(ins.b < MI_VM_REG_COUNT);
+  MI_ASSERT(ins.c < MI_VM_REG_COUNT);
+
+  MiRtValue base = regs[ins.a];
+  MiRtValue key = regs[ins.b];
+  MiRtValue value = regs[ins.c];
+
+  if (base.kind == MI_RT_VAL_LIST && base.as.list && key.kind == MI_RT_VAL_INT)
+  {
+    MiRtList* list = base.as.list;
+    long long idx = key.as.i;
+    if (idx < 0 || (size_t)idx >= list->count)
+    {
+      mi_error("mi_vm: STORE_INDEX list index out of range\n");
+      return;
+    }
+    mi_rt_value_assign(vm->rt, &list->items[(size_t)idx], value);
+    return;
+  }
+
+  if (base.kind == MI_RT_VAL_PAIR && base.as.pair && key.kind == MI_RT_VAL_INT)
+  {
+    long long idx = key.as.i;
+    if (idx != 0 && idx != 1)
+    {
+      mi_error("mi_vm: STORE_INDEX pair index out of range\n");
+      return;
+    }
+    mi_rt_pair_set(vm->rt, base.as.pair, (int)idx, value);
+    return;
+  }
+
+  if (base.kind == MI_RT_VAL_DICT && base.as.dict)
+  {
+    (void) mi_rt_dict_set(vm->rt, base.as.dict, key, value);
+    return;
+  }
+
+  mi_error("mi_vm: STORE_INDEX unsupported types\n");
+}
+
+static inline void s_vm_op_len(MiVm* vm, MiRtValue* regs, MiVmIns ins)
+{
+  MiRtValue v = regs[ins.b];
+  if (v.kind == MI_RT_VAL_LIST && v.as.list)
+  {
+    s_vm_reg_set(vm, regs, ins.a, mi_rt_make_int((int64_t)v.as.list->count));
+    return;
+  }
+
+  if (v.kind == MI_RT_VAL_PAIR && v.as.pair)
+  {
+    s_vm_reg_set(vm, regs, ins.a, mi_rt_make_int(2));
+    return;
+  }
+
+  if (v.kind == MI_RT_VAL_DICT && v.as.dict)
+  {
+    s_vm_reg_set(vm, regs, ins.a, mi_rt_make_int((int64_t)mi_rt_dict_count(v.as.dict)));
+    return;
+  }
+
+  if (v.kind == MI_RT_VAL_KVREF)
+  {
+    s_vm_reg_set(vm, regs, ins.a, mi_rt_make_int(2));
+    return;
+  }
+
+  if (v.kind == MI_RT_VAL_STRING && mi_rt_value_slice(v).ptr)
+  {
+    s_vm_reg_set(vm, regs, ins.a, mi_rt_make_int((int64_t)mi_rt_value_slice(v).length));
+    return;
+  }
+
+  mi_error("mi_vm: LEN unsupported type\n");
+  s_vm_reg_set(vm, regs, ins.a, mi_rt_make_void());
+}
+
+static inline void s_vm_op_load_var(MiVm* vm, const MiVmChunk* chunk, MiRtValue* regs, MiVmIns ins)
+{
+  uint32_t sym_id = s_vm_chunk_sym_id(vm, (MiVmChunk*)chunk, ins.imm);
+  MiRtValue v;
+  if (!mi_rt_var_get_id(vm->rt, sym_id, &v))
+  {
+    XSlice name = chunk->symbols[ins.imm];
+    mi_error_fmt("undefined variable: %.*s", (int)name.length, name.ptr);
+    v = mi_rt_make_void();
+  }
+  s_vm_reg_set(vm, regs, ins.a, v);
+}
 
-          if (base.kind == MI_RT_VAL_KVREF && key.kind == MI_RT_VAL_INT)
+// LOAD_UPVAL / STORE_UPVAL. An upvalue the block could not capture is left
+// NULL; the block then kept its creating frame as env, so the name (upvalue i
+// is named by symbol i) is reached by lookup instead.
+static inline void s_vm_op_load_upval(MiVm* vm, const MiVmChunk* chunk, MiRtValue* regs, MiVmIns ins)
+{
+  MiRtUpval* up = vm->upvals ? vm->upvals[ins.imm] : NULL;
+  if (up)
+  {
+    s_vm_reg_set(vm, regs, ins.a, up->var->value);
+  }
+  else
+  {
+    s_vm_op_load_var(vm, chunk, regs, ins);
+  }
+}
+
+static inline void s_vm_op_store_upval(MiVm* vm, const MiVmChunk* chunk, MiRtValue* regs, MiVmIns ins)
+{
+  MiRtUpval* up = vm->upvals ? vm->upvals[ins.imm] : NULL;
+  if (up)
+  {
+    mi_rt_var_assign(vm->rt, up->var, regs[ins.a]);
+  }
+  else
+  {
+    mi_rt_var_set_id(vm->rt, s_vm_chunk_sym_id(vm, (MiVmChunk*)chunk, ins.imm), regs[ins.a]);
+  }
+}
+
+// Make 'env' the env of block b. A heap frame is retained, so it outlives
+// its pop for as long as the block does.
+static void s_vm_block_hold_env(MiRtBlock* b, MiScopeFrame* env)
+{
+  b->env = env;
+  if (env && !env->on_stack)
+  {
+    mi_rt_scope_retain(env);
+    b->env_held = true;
+  }
+}
+
+// Block for subchunk 'index' of chunk with env 'env', reused from the last
+// LOAD_BLOCK of that subchunk when it ran in the same frame. Blocks are never
+// changed once made, so the one in the cache is as good as a new one. The
+// entry is only good for the frame version it was made at: a frame popped
+// and pushed again at the same address has another one, and has dropped the
+// block it kept.
+static MiRtBlock* s_vm_load_shared_block(MiVm* vm, MiVmChunk* chunk, size_t index, MiScopeFrame* env)
+{
+  if (!chunk->exec_block_cache)
+  {
+    chunk->exec_block_cache = (MiVmBlockCache*)s_realloc(NULL, chunk->subchunk_count * sizeof(MiVmBlockCache));
+    memset(chunk->exec_block_cache, 0, chunk->subchunk_count * sizeof(MiVmBlockCache));
+  }
+
+  MiVmBlockCache* cache = &chunk->exec_block_cache[index];
+  if (cache->block && cache->env == env && cache->version == env->version)
+  {
+    return cache->block;
+  }
+
+  // The entry may have moved on to another frame (a recursive call) and back.
+  MiRtBlock* b = env->kept_blocks;
+  while (b && b->ptr != (void*)chunk->subchunks[index])
+  {
+    b = b->kept_next;
+  }
+
+  if (!b)
+  {
+    b = mi_rt_block_create(vm->rt);
+    b->kind = MI_RT_BLOCK_VM_CHUNK;
+    b->ptr = (void*)chunk->subchunks[index];
+    b->id = (uint32_t)index;
+    s_vm_block_hold_env(b, env);
+
+    // env keeps the reference the block was created with.
+    mi_rt_scope_keep_block(vm->rt, env, b);
+  }
+  cache->env = env;
+  cache->version = env->version;
+  cache->block = b;
+  return b;
+}
+
+// LOAD_BLOCK. A body without upvalues gets the shared block above; one with
+// upvalues gets a new block, capturing them from the running call: the
+// bindings of its frames, or upvalues the running body shares. When they all
+// are there the block skips those frames and keeps only the call's parent as
+// env; otherwise it holds on to the current frame, for the names left to
+// lookup.
+static void s_vm_op_load_block(MiVm* vm, const MiVmChunk* chunk, MiRtValue* regs, MiVmIns ins)
+{
+  const MiVmChunk* sub = chunk->subchunks[(size_t)ins.imm];
+  MiScopeFrame* current = vm->rt->current;
+  if (sub->upval_count == 0)
+  {
+    MiRtBlock* shared = s_vm_load_shared_block(vm, (MiVmChunk*)chunk, (size_t)ins.imm, current);
+    s_vm_reg_set(vm, regs, ins.a, mi_rt_make_block(shared));
+    return;
+  }
+
+  MiRtBlock* b = mi_rt_block_create(vm->rt);
+  b->kind = MI_RT_BLOCK_VM_CHUNK;
+  b->ptr = (void*)sub;
+  b->id = (uint32_t)ins.imm;
+  MiScopeFrame* env = current;
+
+  if (vm->call_depth > 0)
+  {
+    const MiVmCallFrame* f = &vm->call_stack[vm->call_depth - 1];
+    MiRtUpval** ups = (MiRtUpval**)mi_heap_alloc_buffer(&vm->rt->heap, sub->upval_count * sizeof(*ups));
+    if (!ups)
+    {
+      mi_error("mi_vm: out of memory\n");
+      exit(1);
+    }
+    bool all = true;
+    for (uint32_t i = 0; i < sub->upval_count; ++i)
+    {
+      MiRtUpval* up = NULL;
+      int32_t outer = sub->upval_outer[i];
+      if (outer >= 0)
+      {
+        up = vm->upvals ? vm->upvals[outer] : NULL;
+        mi_rt_upval_retain(up);
+      }
+      else
+      {
+        uint32_t sym_id = s_vm_chunk_sym_id(vm, (MiVmChunk*)sub, (int32_t)i);
+        for (MiScopeFrame* s = current; s; s = s->parent)
+        {
+          MiRtVar* var = mi_rt_var_find_in(s, sym_id);
+          if (var)
           {
-            long long idx = key.as.i;
-            MiRtDict* dict = base.as.kvref.dict;
-            size_t entry_index = base.as.kvref.entry_index;
-            if (!dict || entry_index >= dict->capacity)
-            {
-              s_vm_reg_set(vm, ins.a, mi_rt_make_void());
-              break;
-            }
-            MiRtDictEntry* e = &dict->entries[entry_index];
-            if (e->state != 1 || (idx != 0 && idx != 1))
-            {
-              s_vm_reg_set(vm, ins.a, mi_rt_make_void());
-              break;
-            }
-            s_vm_reg_set(vm, ins.a, (idx == 0) ? e->key : e->value);
+            up = mi_rt_upval_capture(vm->rt, s, var);
             break;
           }
-
-          if (base.kind == MI_RT_VAL_DICT && base.as.dict)
+          if (s == f->scope)
           {
-            MiRtValue out;
-            if (mi_rt_dict_get(base.as.dict, key, &out))
-            {
-              s_vm_reg_set(vm, ins.a, out);
-            }
-            else
-            {
-              s_vm_reg_set(vm, ins.a, mi_rt_make_void());
-            }
             break;
           }
+        }
+      }
+      ups[i] = up;
+      all = all && up;
+    }
+    b->upvals = ups;
+    b->upval_count = sub->upval_count;
+    if (all)
+    {
+      env = f->scope->parent;
+    }
+  }
+  if (env == current)
+  {
+    s_vm_block_hold_env(b, env);
+  }
+  else
+  {
+    b->env = env;
+  }
 
-          mi_error("mi_vm: INDEX unsupported types\n");
-          s_vm_reg_set(vm, ins.a, mi_rt_make_void());
-        } break;
+  // The register takes the only reference.
+  MiRtValue v = mi_rt_make_block(b);
+  s_vm_reg_set(vm, regs, ins.a, v);
+  mi_rt_value_release(vm->rt, v);
+}
 
-      case MI_VM_OP_STORE_INDEX:
-        {
-          MI_ASSERT(ins.a < MI_VM_REG_COUNT);
-          MI_ASSERT(ins.b < MI_VM_REG_COUNT);
-          MI_ASSERT(ins.c < MI_VM_REG_COUNT);
+// ADD_VAR_CONST / SUB_VAR_CONST
+static inline void s_vm_op_var_const(MiVm* vm, const MiVmChunk* chunk, MiRtValue* regs, MiVmIns ins)
+{
+  uint32_t sym_id = s_vm_chunk_sym_id(vm, (MiVmChunk*)chunk, ins.imm);
+  MiRtValue v;
+  if (!mi_rt_var_get_id(vm->rt, sym_id, &v))
+  {
+    XSlice name = chunk->symbols[ins.imm];
+    mi_error_fmt("undefined variable: %.*s", (int)name.length, name.ptr);
+    v = mi_rt_make_void();
+  }
+  MiVmOp arith = ((MiVmOp)ins.op == MI_VM_OP_ADD_VAR_CONST) ? MI_VM_OP_ADD : MI_VM_OP_SUB;
+  s_vm_reg_set(vm, regs, ins.a, s_vm_binary_numeric(arith, &v, &chunk->consts[ins.b]));
+  mi_rt_var_set_id(vm->rt, sym_id, regs[ins.a]);
+}
 
-          MiRtValue base = vm->regs[ins.a];
-          MiRtValue key = vm->regs[ins.b];
-          MiRtValue value = vm->regs[ins.c];
+// Condition of JUMP_IF_TRUE / JUMP_IF_FALSE. Unlike s_vm_is_truthy(), only
+// scalars and non-empty strings can be true.
+static inline bool s_vm_jump_truthy(const MiRtValue* c)
+{
+  switch (c->kind)
+  {
+    case MI_RT_VAL_BOOL:   return c->as.b;
+    case MI_RT_VAL_INT:    return c->as.i != 0;
+    case MI_RT_VAL_FLOAT:  return c->as.f != 0.0f;
+    case MI_RT_VAL_STRING: return mi_rt_value_slice(*c).length != 0;
+    default:               return false;
+  }
+}
 
-          if (base.kind == MI_RT_VAL_LIST && base.as.list && key.kind == MI_RT_VAL_INT)
-          {
-            MiRtList* list = base.as.list;
-            long long idx = key.as.i;
-            if (idx < 0 || (size_t)idx >= list->count)
-            {
-              mi_error("mi_vm: STORE_INDEX list index out of range\n");
-              break;
-            }
-            mi_rt_value_assign(vm->rt, &list->items[(size_t)idx], value);
-            break;
-          }
+// Range loops run from 'from' towards 'limit' (exclusive) by a non-zero step.
+static inline bool s_vm_for_enters(long long from, long long limit, long long step)
+{
+  return step > 0 ? from < limit : from > limit;
+}
+
+// Whether i + step is still inside the range. Compares the distance left
+// with the step, so i + step is never computed when it would overflow.
+static inline bool s_vm_for_continues(long long i, long long limit, long long step)
+{
+  if (step > 0)
+  {
+    return (uint64_t)limit - (uint64_t)i > (uint64_t)step;
+  }
+  return (uint64_t)i - (uint64_t)limit > (uint64_t)0 - (uint64_t)step;
+}
+
+#if MI_VM_JIT
+// Counts an entry or loop back-edge of 'chunk' and compiles it once it turns
+// hot. Returns true when the chunk has native code.
+static bool s_vm_jit_ready(MiVm* vm, MiVmChunk* chunk)
+{
+  if (chunk->jit)
+  {
+    return true;
+  }
+  if (chunk->jit_hits == UINT32_MAX || ++chunk->jit_hits < vm->jit_threshold)
+  {
+    return false;
+  }
+
+  chunk->jit = mi_jit_compile(chunk, vm->jit_mode == MI_VM_JIT_DUMP);
+  if (!chunk->jit)
+  {
+    // Out of memory or unsupported: interpret this chunk from now on.
+    chunk->jit_hits = UINT32_MAX;
+    return false;
+  }
+  if (vm->jit_mode == MI_VM_JIT_DUMP)
+  {
+    mi_jit_dump(chunk->jit, chunk);
+  }
+  return true;
+}
+#endif
+
+// Dispatch helpers for the interpreter loop. With MI_VM_COMPUTED_GOTO every handler
+// jumps straight to the next one through a label table (one indirect branch per
+// handler instead of a single shared one); otherwise they expand to a plain
+// switch. Early exits that use 'break' go through the shared loop head.
+#if MI_VM_COMPUTED_GOTO
+#define MI_VM_CASE(name) case MI_VM_OP_##name: op_##name
+#define MI_VM_DEFAULT    default: op_default
+#define MI_VM_DISPATCH() goto *s_dispatch[ins.op]
+#define MI_VM_NEXT() \
+  if (pc < chunk->code_count) { ins = code[pc++]; goto *s_dispatch[ins.op]; } \
+  break
+#else
+#define MI_VM_CASE(name) case MI_VM_OP_##name
+#define MI_VM_DEFAULT    default
+#define MI_VM_DISPATCH() ((void)0)
+#define MI_VM_NEXT()     break
+#endif
+
+// Handlers that share a tail fall into the next case label. GCC does not see
+// a /* fallthrough */ comment when that label comes from MI_VM_CASE.
+#if defined(__GNUC__) || defined(__clang__)
+#define MI_FALLTHROUGH __attribute__((fallthrough))
+#else
+#define MI_FALLTHROUGH ((void)0)
+#endif
+
+// Publish the current instruction location for trace/error reporting.
+#define MI_VM_SYNC_DBG() do { vm->dbg_chunk = chunk; vm->dbg_ip = pc - 1; } while (0)
+
+#if MI_VM_COMPUTED_GOTO && defined(__GNUC__)
+// Labels as values are a GNU extension.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
+// Interpreter loop. Runs 'chunk' in the current frame until that frame
+// returns. User commands and blocks called from here get frames of their own
+// and run in this same loop; only native code re-enters it.
+static MiRtValue s_vm_run(MiVm* vm, const MiVmChunk* chunk)
+{
+  const int entry_depth = vm->call_depth;
+  const MiVmChunk* callee = NULL;
+  MiRtValue last = mi_rt_make_void();
+  MiRtValue ret;
+
+  // Debug location is only published when something can observe it (calls and
+  // runtime errors, see MI_VM_SYNC_DBG); the loop itself keeps pc local.
+  vm->dbg_chunk = chunk;
+  vm->dbg_ip = 0;
+
+#if MI_VM_COMPUTED_GOTO
+  static void* s_dispatch[256];
+  if (!s_dispatch[0])
+  {
+    for (int i = 0; i < 256; ++i)
+    {
+      s_dispatch[i] = &&op_default;
+    }
+    s_dispatch[MI_VM_OP_NOOP]              = &&op_NOOP;
+    s_dispatch[MI_VM_OP_LOAD_CONST]        = &&op_LOAD_CONST;
+    s_dispatch[MI_VM_OP_LOAD_BLOCK]        = &&op_LOAD_BLOCK;
+    s_dispatch[MI_VM_OP_MOV]               = &&op_MOV;
+    s_dispatch[MI_VM_OP_LIST_NEW]          = &&op_LIST_NEW;
+    s_dispatch[MI_VM_OP_LIST_PUSH]         = &&op_LIST_PUSH;
+    s_dispatch[MI_VM_OP_DICT_NEW]          = &&op_DICT_NEW;
+    s_dispatch[MI_VM_OP_ITER_NEXT]         = &&op_ITER_NEXT;
+    s_dispatch[MI_VM_OP_INDEX]             = &&op_INDEX;
+    s_dispatch[MI_VM_OP_STORE_INDEX]       = &&op_STORE_INDEX;
+    s_dispatch[MI_VM_OP_LEN]               = &&op_LEN;
+    s_dispatch[MI_VM_OP_NEG]               = &&op_NEG;
+    s_dispatch[MI_VM_OP_NOT]               = &&op_NOT;
+    s_dispatch[MI_VM_OP_ADD]               = &&op_ADD;
+    s_dispatch[MI_VM_OP_SUB]               = &&op_SUB;
+    s_dispatch[MI_VM_OP_MUL]               = &&op_MUL;
+    s_dispatch[MI_VM_OP_DIV]               = &&op_DIV;
+    s_dispatch[MI_VM_OP_MOD]               = &&op_MOD;
+    s_dispatch[MI_VM_OP_EQ]                = &&op_EQ;
+    s_dispatch[MI_VM_OP_NEQ]               = &&op_NEQ;
+    s_dispatch[MI_VM_OP_LT]                = &&op_LT;
+    s_dispatch[MI_VM_OP_LTEQ]              = &&op_LTEQ;
+    s_dispatch[MI_VM_OP_GT]                = &&op_GT;
+    s_dispatch[MI_VM_OP_GTEQ]              = &&op_GTEQ;
+    s_dispatch[MI_VM_OP_AND]               = &&op_AND;
+    s_dispatch[MI_VM_OP_OR]                = &&op_OR;
+    s_dispatch[MI_VM_OP_LOAD_VAR]          = &&op_LOAD_VAR;
+    s_dispatch[MI_VM_OP_LOAD_MEMBER]       = &&op_LOAD_MEMBER;
+    s_dispatch[MI_VM_OP_STORE_MEMBER]      = &&op_STORE_MEMBER;
+    s_dispatch[MI_VM_OP_STORE_VAR]         = &&op_STORE_VAR;
+    s_dispatch[MI_VM_OP_DEFINE_VAR]        = &&op_DEFINE_VAR;
+    s_dispatch[MI_VM_OP_LOAD_INDIRECT_VAR] = &&op_LOAD_INDIRECT_VAR;
+    s_dispatch[MI_VM_OP_ARG_CLEAR]         = &&op_ARG_CLEAR;
+    s_dispatch[MI_VM_OP_ARG_PUSH]          = &&op_ARG_PUSH;
+    s_dispatch[MI_VM_OP_ARG_PUSH_CONST]    = &&op_ARG_PUSH_CONST;
+    s_dispatch[MI_VM_OP_ARG_PUSH_VAR_SYM]  = &&op_ARG_PUSH_VAR_SYM;
+    s_dispatch[MI_VM_OP_ARG_PUSH_SYM]      = &&op_ARG_PUSH_SYM;
+    s_dispatch[MI_VM_OP_ARG_SAVE]          = &&op_ARG_SAVE;
+    s_dispatch[MI_VM_OP_ARG_RESTORE]       = &&op_ARG_RESTORE;
+    s_dispatch[MI_VM_OP_CALL_CMD]          = &&op_CALL_CMD;
+    s_dispatch[MI_VM_OP_CALL_CMD_DYN]      = &&op_CALL_CMD_DYN;
+    s_dispatch[MI_VM_OP_CALL_BLOCK]        = &&op_CALL_BLOCK;
+    s_dispatch[MI_VM_OP_SCOPE_PUSH]        = &&op_SCOPE_PUSH;
+    s_dispatch[MI_VM_OP_SCOPE_POP]         = &&op_SCOPE_POP;
+    s_dispatch[MI_VM_OP_SCOPE_RESET]       = &&op_SCOPE_RESET;
+    s_dispatch[MI_VM_OP_JUMP]              = &&op_JUMP;
+    s_dispatch[MI_VM_OP_JUMP_IF_TRUE]      = &&op_JUMP_IF_TRUE;
+    s_dispatch[MI_VM_OP_JUMP_IF_FALSE]     = &&op_JUMP_IF_FALSE;
+    s_dispatch[MI_VM_OP_RETURN]            = &&op_RETURN;
+    s_dispatch[MI_VM_OP_HALT]              = &&op_HALT;
+    s_dispatch[MI_VM_OP_CALL_CMD_FAST]     = &&op_CALL_CMD_FAST;
+    s_dispatch[MI_VM_OP_ADD_VAR_CONST]     = &&op_ADD_VAR_CONST;
+    s_dispatch[MI_VM_OP_SUB_VAR_CONST]     = &&op_SUB_VAR_CONST;
+    s_dispatch[MI_VM_OP_JUMP_IF_NOT_EQ]    = &&op_JUMP_IF_NOT_EQ;
+    s_dispatch[MI_VM_OP_JUMP_IF_NOT_NEQ]   = &&op_JUMP_IF_NOT_NEQ;
+    s_dispatch[MI_VM_OP_JUMP_IF_NOT_LT]    = &&op_JUMP_IF_NOT_LT;
+    s_dispatch[MI_VM_OP_JUMP_IF_NOT_LTEQ]  = &&op_JUMP_IF_NOT_LTEQ;
+    s_dispatch[MI_VM_OP_JUMP_IF_NOT_GT]    = &&op_JUMP_IF_NOT_GT;
+    s_dispatch[MI_VM_OP_JUMP_IF_NOT_GTEQ]  = &&op_JUMP_IF_NOT_GTEQ;
+    s_dispatch[MI_VM_OP_CALL_CMD_FAST_VAR] = &&op_CALL_CMD_FAST_VAR;
+    s_dispatch[MI_VM_OP_ADD_INT]           = &&op_ADD_INT;
+    s_dispatch[MI_VM_OP_SUB_INT]           = &&op_SUB_INT;
+    s_dispatch[MI_VM_OP_MUL_INT]           = &&op_MUL_INT;
+    s_dispatch[MI_VM_OP_ADD_FLOAT]         = &&op_ADD_FLOAT;
+    s_dispatch[MI_VM_OP_SUB_FLOAT]         = &&op_SUB_FLOAT;
+    s_dispatch[MI_VM_OP_MUL_FLOAT]         = &&op_MUL_FLOAT;
+    s_dispatch[MI_VM_OP_DIV_FLOAT]         = &&op_DIV_FLOAT;
+    s_dispatch[MI_VM_OP_EQ_INT]            = &&op_EQ_INT;
+    s_dispatch[MI_VM_OP_NEQ_INT]           = &&op_NEQ_INT;
+    s_dispatch[MI_VM_OP_LT_INT]            = &&op_LT_INT;
+    s_dispatch[MI_VM_OP_LTEQ_INT]          = &&op_LTEQ_INT;
+    s_dispatch[MI_VM_OP_GT_INT]            = &&op_GT_INT;
+    s_dispatch[MI_VM_OP_GTEQ_INT]          = &&op_GTEQ_INT;
+    s_dispatch[MI_VM_OP_LT_FLOAT]          = &&op_LT_FLOAT;
+    s_dispatch[MI_VM_OP_LTEQ_FLOAT]        = &&op_LTEQ_FLOAT;
+    s_dispatch[MI_VM_OP_GT_FLOAT]          = &&op_GT_FLOAT;
+    s_dispatch[MI_VM_OP_GTEQ_FLOAT]        = &&op_GTEQ_FLOAT;
+    s_dispatch[MI_VM_OP_JUMP_IF_NOT_EQ_INT] = &&op_JUMP_IF_NOT_EQ_INT;
+    s_dispatch[MI_VM_OP_JUMP_IF_NOT_NEQ_INT] = &&op_JUMP_IF_NOT_NEQ_INT;
+    s_dispatch[MI_VM_OP_JUMP_IF_NOT_LT_INT] = &&op_JUMP_IF_NOT_LT_INT;
+    s_dispatch[MI_VM_OP_JUMP_IF_NOT_LTEQ_INT] = &&op_JUMP_IF_NOT_LTEQ_INT;
+    s_dispatch[MI_VM_OP_JUMP_IF_NOT_GT_INT] = &&op_JUMP_IF_NOT_GT_INT;
+    s_dispatch[MI_VM_OP_JUMP_IF_NOT_GTEQ_INT] = &&op_JUMP_IF_NOT_GTEQ_INT;
+#if MI_VM_QUICKEN
+    s_dispatch[MI_VM_OP_QADD_INT]          = &&op_QADD_INT;
+    s_dispatch[MI_VM_OP_QADD_FLOAT]        = &&op_QADD_FLOAT;
+    s_dispatch[MI_VM_OP_QSUB_INT]          = &&op_QSUB_INT;
+    s_dispatch[MI_VM_OP_QSUB_FLOAT]        = &&op_QSUB_FLOAT;
+    s_dispatch[MI_VM_OP_QLT_INT]           = &&op_QLT_INT;
+    s_dispatch[MI_VM_OP_QLT_FLOAT]         = &&op_QLT_FLOAT;
+    s_dispatch[MI_VM_OP_QJUMP_IF_NOT_LT_INT] = &&op_QJUMP_IF_NOT_LT_INT;
+    s_dispatch[MI_VM_OP_QJUMP_IF_NOT_LT_FLOAT] = &&op_QJUMP_IF_NOT_LT_FLOAT;
+    s_dispatch[MI_VM_OP_QINDEX_LIST]       = &&op_QINDEX_LIST;
+    s_dispatch[MI_VM_OP_QITER_NEXT_LIST]   = &&op_QITER_NEXT_LIST;
+#endif
+    s_dispatch[MI_VM_OP_LOAD_LOCAL]        = &&op_LOAD_LOCAL;
+    s_dispatch[MI_VM_OP_STORE_LOCAL]       = &&op_STORE_LOCAL;
+    s_dispatch[MI_VM_OP_ARG_PUSH_LOCAL]    = &&op_ARG_PUSH_LOCAL;
+    s_dispatch[MI_VM_OP_ADD_LOCAL_CONST]   = &&op_ADD_LOCAL_CONST;
+    s_dispatch[MI_VM_OP_SUB_LOCAL_CONST]   = &&op_SUB_LOCAL_CONST;
+    s_dispatch[MI_VM_OP_TAIL_CALL]         = &&op_TAIL_CALL;
+    s_dispatch[MI_VM_OP_CLEAR_REGS]        = &&op_CLEAR_REGS;
+    s_dispatch[MI_VM_OP_CALL_CMD_TRUSTED]  = &&op_CALL_CMD_TRUSTED;
+    s_dispatch[MI_VM_OP_FOR_PREP]          = &&op_FOR_PREP;
+    s_dispatch[MI_VM_OP_FOR_LOOP]          = &&op_FOR_LOOP;
+    s_dispatch[MI_VM_OP_LOAD_UPVAL]        = &&op_LOAD_UPVAL;
+    s_dispatch[MI_VM_OP_STORE_UPVAL]       = &&op_STORE_UPVAL;
+  }
+#endif
+
+  // Executes (and quickens) the chunk's private copy of its code.
+  MiVmIns* code = s_vm_chunk_exec_code((MiVmChunk*)chunk);
+  // Slot frame of the user command being run (set up by s_vm_frame_push_cmd).
+  size_t local_base = vm->local_base;
+  // Register window of the running frame. Windows never move, and nested
+  // runs restore vm->regs, so this only changes on frame entry and exit.
+  MiRtValue* regs = vm->regs;
+  size_t pc = 0;
+  MiVmIns ins;
+
+#if MI_VM_JIT
+  if (vm->jit_mode != MI_VM_JIT_OFF)
+  {
+    goto vm_jit;
+  }
+#endif
+
+vm_loop:
+  while (pc < chunk->code_count)
+  {
+    ins = code[pc++];
+    MI_VM_DISPATCH();
+    switch ((MiVmOp) ins.op)
+    {
+      MI_VM_CASE(NOOP):
+        MI_VM_NEXT();
+
+      MI_VM_CASE(LOAD_CONST):
+        s_vm_reg_set(vm, regs, ins.a, chunk->consts[ins.imm]);
+        MI_VM_NEXT();
 
-          if (base.kind == MI_RT_VAL_PAIR && base.as.pair && key.kind == MI_RT_VAL_INT)
-          {
-            long long idx = key.as.i;
-            if (idx != 0 && idx != 1)
-            {
-              mi_error("mi_vm: STORE_INDEX pair index out of range\n");
-              break;
-            }
-            mi_rt_pair_set(vm->rt, base.as.pair, (int)idx, value);
-            break;
-          }
+      MI_VM_CASE(LOAD_BLOCK):
+        {
+          MI_ASSERT(ins.a < MI_VM_REG_COUNT);
+          MI_ASSERT(ins.imm >= 0 && (size_t)ins.imm < chunk->subchunk_count);
 
-          if (base.kind == MI_RT_VAL_DICT && base.as.dict)
-          {
-            (void) mi_rt_dict_set(vm->rt, base.as.dict, key, value);
-            break;
-          }
+          s_vm_op_load_block(vm, chunk, regs, ins);
+        } MI_VM_NEXT();
 
-          mi_error("mi_vm: STORE_INDEX unsupported types\n");
-        } break;
+      MI_VM_CASE(MOV):
+        s_vm_reg_set(vm, regs, ins.a, regs[ins.b]);
+        MI_VM_NEXT();
 
-      case MI_VM_OP_LEN:
+      MI_VM_CASE(LIST_NEW):
         {
-          MiRtValue v = vm->regs[ins.b];
-          if (v.kind == MI_RT_VAL_LIST && v.as.list)
-          {
-            s_vm_reg_set(vm, ins.a, mi_rt_make_int((int64_t)v.as.list->count));
-            break;
-          }
+          MI_ASSERT(ins.a < MI_VM_REG_COUNT);
+          MI_ASSERT(ins.b < MI_VM_REG_COUNT);
 
-          if (v.kind == MI_RT_VAL_PAIR && v.as.pair)
+          MiRtList* list = mi_rt_list_create(vm->rt);
+          if (!list)
           {
-            s_vm_reg_set(vm, ins.a, mi_rt_make_int(2));
+            s_vm_reg_set(vm, regs, ins.a, mi_rt_make_void());
             break;
           }
+          s_vm_reg_set(vm, regs, ins.a, mi_rt_make_list(list));
+        } MI_VM_NEXT();
 
-          if (v.kind == MI_RT_VAL_DICT && v.as.dict)
-          {
-            s_vm_reg_set(vm, ins.a, mi_rt_make_int((int64_t)mi_rt_dict_count(v.as.dict)));
-            break;
-          }
+      MI_VM_CASE(LIST_PUSH):
+        {
+          MI_ASSERT(ins.a < MI_VM_REG_COUNT);
+          MI_ASSERT(ins.b < MI_VM_REG_COUNT);
 
-          if (v.kind == MI_RT_VAL_KVREF)
+          MiRtValue base = regs[ins.a];
+          MiRtValue v = regs[ins.b];
+          if (base.kind != MI_RT_VAL_LIST || !base.as.list)
           {
-            s_vm_reg_set(vm, ins.a, mi_rt_make_int(2));
+            mi_error("mi_vm: LIST_PUSH base is not a list\n");
             break;
           }
+          (void) mi_rt_list_push(base.as.list, v);
+        } MI_VM_NEXT();
 
-          if (v.kind == MI_RT_VAL_STRING && v.as.s.ptr)
+      MI_VM_CASE(DICT_NEW):
+        {
+          MiRtDict* dict = mi_rt_dict_create(vm->rt);
+          if (!dict)
           {
-            s_vm_reg_set(vm, ins.a, mi_rt_make_int((int64_t)v.as.s.length));
+            s_vm_reg_set(vm, regs, ins.a, mi_rt_make_void());
             break;
           }
+          s_vm_reg_set(vm, regs, ins.a, mi_rt_make_dict(dict));
+        } MI_VM_NEXT();
 
-          mi_error("mi_vm: LEN unsupported type\n");
-          s_vm_reg_set(vm, ins.a, mi_rt_make_void());
-        } break;
+      MI_VM_CASE(ITER_NEXT):
+        MI_VM_QUICKEN_SITE(regs[ins.b].kind, regs[ins.c].kind);
+        s_vm_op_iter_next(vm, regs, ins);
+        MI_VM_NEXT();
 
-      case MI_VM_OP_NEG:
+      MI_VM_CASE(INDEX):
+        MI_VM_QUICKEN_SITE(regs[ins.b].kind, regs[ins.c].kind);
+        s_vm_op_index(vm, regs, ins);
+        MI_VM_NEXT();
+
+      MI_VM_CASE(STORE_INDEX):
+        s_vm_op_store_index(vm, regs, ins);
+        MI_VM_NEXT();
+
+      MI_VM_CASE(LEN):
+        s_vm_op_len(vm, regs, ins);
+        MI_VM_NEXT();
+
+      MI_VM_CASE(NEG):
         {
-          MiRtValue x = vm->regs[ins.b];
+          MiRtValue x = regs[ins.b];
           if (x.kind == MI_RT_VAL_INT)
           {
-            s_vm_reg_set(vm, ins.a, mi_rt_make_int(-x.as.i));
+            s_vm_reg_set(vm, regs, ins.a, mi_rt_make_int(-x.as.i));
           }
           else if (x.kind == MI_RT_VAL_FLOAT)
           {
-            s_vm_reg_set(vm, ins.a, mi_rt_make_float(-x.as.f));
+            s_vm_reg_set(vm, regs, ins.a, mi_rt_make_float(-x.as.f));
           }
           else
           {
-            s_vm_reg_set(vm, ins.a, mi_rt_make_void());
+            s_vm_reg_set(vm, regs, ins.a, mi_rt_make_void());
           }
-        } break;
+        } MI_VM_NEXT();
 
-      case MI_VM_OP_NOT:
+      MI_VM_CASE(NOT):
         {
-          MiRtValue x = vm->regs[ins.b];
+          MiRtValue x = regs[ins.b];
           if (x.kind == MI_RT_VAL_BOOL)
           {
-            s_vm_reg_set(vm, ins.a, mi_rt_make_bool(!x.as.b));
+            s_vm_reg_set(vm, regs, ins.a, mi_rt_make_bool(!x.as.b));
           }
           else
           {
-            s_vm_reg_set(vm, ins.a, mi_rt_make_void());
+            s_vm_reg_set(vm, regs, ins.a, mi_rt_make_void());
           }
-        } break;
+        } MI_VM_NEXT();
 
-      case MI_VM_OP_ADD:
-      case MI_VM_OP_SUB:
-      case MI_VM_OP_MUL:
-      case MI_VM_OP_DIV:
-      case MI_VM_OP_MOD:
+      MI_VM_CASE(ADD):
+      MI_VM_CASE(SUB):
+      MI_VM_CASE(MUL):
+      MI_VM_CASE(DIV):
+      MI_VM_CASE(MOD):
         {
-          s_vm_reg_set(vm, ins.a, s_vm_binary_numeric((MiVmOp) ins.op, &vm->regs[ins.b], &vm->regs[ins.c]));
-        } break;
-
-      case MI_VM_OP_EQ:
-      case MI_VM_OP_NEQ:
-      case MI_VM_OP_LT:
-      case MI_VM_OP_LTEQ:
-      case MI_VM_OP_GT:
-      case MI_VM_OP_GTEQ:
+          MI_VM_QUICKEN_SITE(regs[ins.b].kind, regs[ins.c].kind);
+          s_vm_reg_set(vm, regs, ins.a, s_vm_binary_numeric((MiVmOp) ins.op, &regs[ins.b], &regs[ins.c]));
+        } MI_VM_NEXT();
+
+      MI_VM_CASE(EQ):
+      MI_VM_CASE(NEQ):
+      MI_VM_CASE(LT):
+      MI_VM_CASE(LTEQ):
+      MI_VM_CASE(GT):
+      MI_VM_CASE(GTEQ):
         {
-          s_vm_reg_set(vm, ins.a, s_vm_binary_compare((MiVmOp) ins.op, &vm->regs[ins.b], &vm->regs[ins.c]));
-        } break;
+          MI_VM_QUICKEN_SITE(regs[ins.b].kind, regs[ins.c].kind);
+          s_vm_reg_set(vm, regs, ins.a, s_vm_binary_compare((MiVmOp) ins.op, &regs[ins.b], &regs[ins.c]));
+        } MI_VM_NEXT();
 
-      case MI_VM_OP_AND:
+      MI_VM_CASE(AND):
         {
-          MiRtValue x = vm->regs[ins.b];
-          MiRtValue y = vm->regs[ins.c];
+          MiRtValue x = regs[ins.b];
+          MiRtValue y = regs[ins.c];
           if (x.kind == MI_RT_VAL_BOOL && y.kind == MI_RT_VAL_BOOL)
           {
-            s_vm_reg_set(vm, ins.a, mi_rt_make_bool(x.as.b && y.as.b));
+            s_vm_reg_set(vm, regs, ins.a, mi_rt_make_bool(x.as.b && y.as.b));
           }
           else
           {
-            s_vm_reg_set(vm, ins.a, mi_rt_make_void());
+            s_vm_reg_set(vm, regs, ins.a, mi_rt_make_void());
           }
-        } break;
+        } MI_VM_NEXT();
 
-      case MI_VM_OP_OR:
+      MI_VM_CASE(OR):
         {
-          MiRtValue x = vm->regs[ins.b];
-          MiRtValue y = vm->regs[ins.c];
+          MiRtValue x = regs[ins.b];
+          MiRtValue y = regs[ins.c];
           if (x.kind == MI_RT_VAL_BOOL && y.kind == MI_RT_VAL_BOOL)
           {
-            s_vm_reg_set(vm, ins.a, mi_rt_make_bool(x.as.b || y.as.b));
+            s_vm_reg_set(vm, regs, ins.a, mi_rt_make_bool(x.as.b || y.as.b));
           }
           else
           {
-            s_vm_reg_set(vm, ins.a, mi_rt_make_void());
+            s_vm_reg_set(vm, regs, ins.a, mi_rt_make_void());
           }
-        } break;
+        } MI_VM_NEXT();
 
-      case MI_VM_OP_LOAD_VAR:
-        {
-          uint32_t sym_id = s_vm_chunk_sym_id(vm, (MiVmChunk*)chunk, ins.imm);
-          MiRtValue v;
-          if (!mi_rt_var_get_id(vm->rt, sym_id, &v))
-          {
-            XSlice name = chunk->symbols[ins.imm];
-            mi_error_fmt("undefined variable: %.*s", (int)name.length, name.ptr);
-            v = mi_rt_make_void();
-          }
-          s_vm_reg_set(vm, ins.a, v);
-        } break;
+      MI_VM_CASE(LOAD_VAR):
+        s_vm_op_load_var(vm, chunk, regs, ins);
+        MI_VM_NEXT();
 
-      case MI_VM_OP_LOAD_MEMBER:
+      MI_VM_CASE(LOAD_MEMBER):
         {
-          MiRtValue base = vm->regs[ins.b];
+          MiRtValue base = regs[ins.b];
           if (base.kind != MI_RT_VAL_BLOCK || !base.as.block || !base.as.block->env)
           {
             mi_error("member access: base is not a chunk/module\n");
-            s_vm_reg_set(vm, ins.a, mi_rt_make_void());
+            s_vm_reg_set(vm, regs, ins.a, mi_rt_make_void());
             break;
           }
 
           uint32_t sym_id = s_vm_chunk_sym_id(vm, (MiVmChunk*)chunk, ins.imm);
+          MiScopeFrame* env = base.as.block->env;
+          MiRtVar* var = s_vm_member_ref(s_vm_chunk_member_cache((MiVmChunk*)chunk, ins.imm), env, sym_id);
           MiRtValue v;
-          if (!mi_rt_var_get_from_id(base.as.block->env, sym_id, &v))
+          if (var)
+          {
+            v = var->value;
+          }
+          else if (!mi_rt_var_get_from_id(env, sym_id, &v))
           {
             XSlice mem_name = chunk->symbols[ins.imm];
             mi_error_fmt("unknown member: %.*s\n", (int)mem_name.length, (const char*)mem_name.ptr);
             v = mi_rt_make_void();
           }
-          s_vm_reg_set(vm, ins.a, v);
-        } break;
+          s_vm_reg_set(vm, regs, ins.a, v);
+        } MI_VM_NEXT();
 
-      case MI_VM_OP_STORE_MEMBER:
+      MI_VM_CASE(STORE_MEMBER):
         {
-          MiRtValue base = vm->regs[ins.b];
+          MiRtValue base = regs[ins.b];
           if (base.kind != MI_RT_VAL_BLOCK || !base.as.block || !base.as.block->env)
           {
             mi_error("member store: base is not a chunk/module\n");
@@ -4043,125 +5328,101 @@ MiRtValue mi_vm_execute(MiVm* vm, const MiVmChunk* chunk)
           }
 
           uint32_t sym_id = s_vm_chunk_sym_id(vm, (MiVmChunk*)chunk, ins.imm);
-          mi_rt_var_set_from_id(base.as.block->env, sym_id, vm->regs[ins.a]);
-        } break;
+          MiScopeFrame* env = base.as.block->env;
+          MiRtVar* var = s_vm_member_ref(s_vm_chunk_member_cache((MiVmChunk*)chunk, ins.imm), env, sym_id);
+          if (var)
+          {
+            mi_rt_var_assign(vm->rt, var, regs[ins.a]);
+          }
+          else
+          {
+            mi_rt_var_set_from_id(env, sym_id, regs[ins.a]);
+          }
+        } MI_VM_NEXT();
 
-      case MI_VM_OP_STORE_VAR:
+      MI_VM_CASE(STORE_VAR):
         {
           uint32_t sym_id = s_vm_chunk_sym_id(vm, (MiVmChunk*)chunk, ins.imm);
-          mi_rt_var_set_id(vm->rt, sym_id, vm->regs[ins.a]);
-        } break;
+          mi_rt_var_set_id(vm->rt, sym_id, regs[ins.a]);
+        } MI_VM_NEXT();
 
-      case MI_VM_OP_DEFINE_VAR:
+      MI_VM_CASE(DEFINE_VAR):
         {
           uint32_t sym_id = s_vm_chunk_sym_id(vm, (MiVmChunk*)chunk, ins.imm);
-          mi_rt_var_define_id(vm->rt, sym_id, vm->regs[ins.a]);
-        } break;
+          mi_rt_var_define_id(vm->rt, sym_id, regs[ins.a]);
+        } MI_VM_NEXT();
 
-      case MI_VM_OP_LOAD_INDIRECT_VAR:
+      MI_VM_CASE(LOAD_INDIRECT_VAR):
         {
-          MiRtValue n = vm->regs[ins.b];
+          MiRtValue n = regs[ins.b];
           if (n.kind != MI_RT_VAL_STRING)
           {
             mi_error("indirect variable name must be string\n");
-            s_vm_reg_set(vm, ins.a, mi_rt_make_void());
+            s_vm_reg_set(vm, regs, ins.a, mi_rt_make_void());
             break;
           }
           MiRtValue v;
-          if (!mi_rt_var_get(vm->rt, n.as.s, &v))
+          XSlice name = mi_rt_value_slice(n);
+          if (!mi_rt_var_get(vm->rt, name, &v))
           {
-            mi_error_fmt("undefined variable: %.*s\n", (int) n.as.s.length, n.as.s.ptr);
+            mi_error_fmt("undefined variable: %.*s\n", (int) name.length, name.ptr);
             v = mi_rt_make_void();
           }
-          s_vm_reg_set(vm, ins.a, v);
-        } break;
+          s_vm_reg_set(vm, regs, ins.a, v);
+        } MI_VM_NEXT();
 
-      case MI_VM_OP_ARG_CLEAR:
+      MI_VM_CASE(ARG_CLEAR):
         s_vm_arg_clear(vm);
-        break;
+        MI_VM_NEXT();
 
-      case MI_VM_OP_ARG_PUSH:
+      MI_VM_CASE(ARG_PUSH):
         {
           MI_ASSERT(ins.a < MI_VM_REG_COUNT);
 
           if (vm->arg_top >= MI_VM_ARG_STACK_COUNT)
           {
+            MI_VM_SYNC_DBG();
             s_vm_report_error(vm, "arg stack overflow");
             MI_ASSERT(vm->arg_top < MI_VM_ARG_STACK_COUNT);
             break;
           }
 
-          mi_rt_value_assign(vm->rt, &vm->arg_stack[vm->arg_top], vm->regs[ins.a]);
+          mi_rt_value_assign(vm->rt, &vm->arg_stack[vm->arg_top], regs[ins.a]);
           vm->arg_top += 1;
-        } break;
+        } MI_VM_NEXT();
 
-      case MI_VM_OP_ARG_PUSH_CONST:
+      MI_VM_CASE(ARG_PUSH_CONST):
         {
           if (vm->arg_top >= MI_VM_ARG_STACK_COUNT)
           {
             mi_error("mi_vm: arg stack overflow\n");
             break;
           }
-          if (ins.imm < 0 || (size_t)ins.imm >= chunk->const_count)
-          {
-            mi_error("mi_vm: ARG_PUSH_CONST invalid const index\n");
-            mi_rt_value_assign(vm->rt, &vm->arg_stack[vm->arg_top], mi_rt_make_void());
-            vm->arg_top += 1;
-            break;
-          }
+          MI_ASSERT(ins.imm >= 0 && (size_t)ins.imm < chunk->const_count);
           mi_rt_value_assign(vm->rt, &vm->arg_stack[vm->arg_top], chunk->consts[ins.imm]);
           vm->arg_top += 1;
-        } break;
-
-      case MI_VM_OP_ARG_PUSH_VAR_SYM:
-        {
-          if (vm->arg_top >= MI_VM_ARG_STACK_COUNT)
-          {
-            mi_error("mi_vm: arg stack overflow\n");
-            break;
-          }
-          if (ins.imm < 0 || (size_t)ins.imm >= chunk->symbol_count)
-          {
-            mi_error("mi_vm: ARG_PUSH_VAR_SYM invalid symbol index\n");
-            mi_rt_value_assign(vm->rt, &vm->arg_stack[vm->arg_top], mi_rt_make_void());
-            vm->arg_top += 1;
-            break;
-          }
+        } MI_VM_NEXT();
 
-          uint32_t sym_id = s_vm_chunk_sym_id(vm, (MiVmChunk*)chunk, ins.imm);
-          MiRtValue v;
-          if (!mi_rt_var_get_id(vm->rt, sym_id, &v))
-          {
-            XSlice name = chunk->symbols[ins.imm];
-            mi_error_fmt("undefined variable: %.*s\n", (int)name.length, name.ptr);
-            v = mi_rt_make_void();
-          }
-          mi_rt_value_assign(vm->rt, &vm->arg_stack[vm->arg_top], v);
-          vm->arg_top += 1;
-        } break;
+      MI_VM_CASE(ARG_PUSH_VAR_SYM):
+        s_vm_arg_push_var_sym(vm, chunk, ins.imm);
+        MI_VM_NEXT();
 
-      case MI_VM_OP_ARG_PUSH_SYM:
+      MI_VM_CASE(ARG_PUSH_SYM):
         {
           if (vm->arg_top >= MI_VM_ARG_STACK_COUNT)
           {
             mi_error("mi_vm: arg stack overflow\n");
             break;
           }
-          if (ins.imm < 0 || (size_t)ins.imm >= chunk->symbol_count)
-          {
-            mi_error("mi_vm: ARG_PUSH_SYM invalid symbol index\n");
-            mi_rt_value_assign(vm->rt, &vm->arg_stack[vm->arg_top], mi_rt_make_void());
-            vm->arg_top += 1;
-            break;
-          }
+          MI_ASSERT(ins.imm >= 0 && (size_t)ins.imm < chunk->symbol_count);
 
           XSlice name = chunk->symbols[(size_t)ins.imm];
           MiRtValue v = mi_rt_make_string_slice(name);
           mi_rt_value_assign(vm->rt, &vm->arg_stack[vm->arg_top], v);
           vm->arg_top += 1;
-        } break;
+        } MI_VM_NEXT();
 
-      case MI_VM_OP_ARG_SAVE:
+      MI_VM_CASE(ARG_SAVE):
         {
           if (vm->arg_frame_depth >= MI_VM_ARG_FRAME_MAX)
           {
@@ -4169,17 +5430,18 @@ MiRtValue mi_vm_execute(MiVm* vm, const MiVmChunk* chunk)
             break;
           }
           int d = vm->arg_frame_depth;
-          vm->arg_frame_tops[d] = vm->arg_top;
-          for (int i = 0; i < vm->arg_top; ++i)
+          int n = vm->arg_top - vm->arg_base;
+          vm->arg_frame_tops[d] = n;
+          for (int i = 0; i < n; ++i)
           {
-            mi_rt_value_assign(vm->rt, &vm->arg_frames[d][i], vm->arg_stack[i]);
-            mi_rt_value_assign(vm->rt, &vm->arg_stack[i], mi_rt_make_void());
+            vm->arg_frames[d][i] = vm->arg_stack[vm->arg_base + i];
+            vm->arg_stack[vm->arg_base + i] = mi_rt_make_void();
           }
-          vm->arg_top = 0;
+          vm->arg_top = vm->arg_base;
           vm->arg_frame_depth += 1;
-        } break;
+        } MI_VM_NEXT();
 
-      case MI_VM_OP_ARG_RESTORE:
+      MI_VM_CASE(ARG_RESTORE):
         {
           if (vm->arg_frame_depth <= 0)
           {
@@ -4188,64 +5450,42 @@ MiRtValue mi_vm_execute(MiVm* vm, const MiVmChunk* chunk)
           }
           vm->arg_frame_depth -= 1;
           int d = vm->arg_frame_depth;
-          int top = vm->arg_frame_tops[d];
-          if (top < 0) top = 0;
-          if (top > MI_VM_ARG_STACK_COUNT) top = MI_VM_ARG_STACK_COUNT;
-          for (int i = 0; i < top; ++i)
+          int n = vm->arg_frame_tops[d];
+          if (n < 0) n = 0;
+          if (n > MI_VM_ARG_STACK_COUNT - vm->arg_base) n = MI_VM_ARG_STACK_COUNT - vm->arg_base;
+          s_vm_arg_clear(vm);
+          for (int i = 0; i < n; ++i)
           {
-            mi_rt_value_assign(vm->rt, &vm->arg_stack[i], vm->arg_frames[d][i]);
-            mi_rt_value_assign(vm->rt, &vm->arg_frames[d][i], mi_rt_make_void());
+            vm->arg_stack[vm->arg_base + i] = vm->arg_frames[d][i];
+            vm->arg_frames[d][i] = mi_rt_make_void();
           }
-          vm->arg_top = top;
-        } break;
+          vm->arg_top = vm->arg_base + n;
+        } MI_VM_NEXT();
 
-      case MI_VM_OP_CALL_CMD:
+      MI_VM_CASE(CALL_CMD):
         {
+          MI_VM_SYNC_DBG();
           int argc = (int) ins.b;
-          if (argc > vm->arg_top)
+          if (argc > vm->arg_top - vm->arg_base)
           {
             mi_error("mi_vm: arg stack underflow\n");
-            s_vm_reg_set(vm, ins.a, mi_rt_make_void());
+            s_vm_reg_set(vm, regs, ins.a, mi_rt_make_void());
             break;
           }
 
-          MiRtValue argv[MI_VM_ARG_STACK_COUNT];
-          int base = (int)vm->arg_top - argc;
-          for (int i = 0; i < argc; i += 1)
-          {
-            argv[i] = vm->arg_stack[base + i];
-            mi_rt_value_retain(vm->rt, argv[i]);
-          }
-          for (int i = 0; i < argc; i += 1)
-          {
-            mi_rt_value_assign(vm->rt, &vm->arg_stack[base + i], mi_rt_make_void());
-          }
-          vm->arg_top = base;
+          // The callee borrows its args from the arg stack (see s_vm_call_begin).
+          int base = vm->arg_top - argc;
 
           XSlice cmd_name = chunk->cmd_names[ins.imm];
 
           bool is_qualified = s_slice_has_double_colon(cmd_name);
 
+          MiRtCmd* target = chunk->cmd_targets[ins.imm];
+
           // Scoped commands: a local var may shadow a builtin (unqualified only). 
           if (!is_qualified)
           {
-            MiRtValue scoped = mi_rt_make_void();
-            if (mi_rt_var_get(vm->rt, cmd_name, &scoped) && scoped.kind == MI_RT_VAL_CMD)
-            {
-              s_vm_reg_set(vm, ins.a, s_vm_exec_cmd_value(vm, cmd_name, scoped, argc, argv));
-              for (int i = 0; i < argc; i += 1)
-              {
-                mi_rt_value_release(vm->rt, argv[i]);
-              }
-              mi_rt_value_assign(vm->rt, &last, vm->regs[ins.a]);
-              break;
-            }
-          }
-
-          MiRtCmd* target = NULL;
-          if (chunk->cmd_targets && ins.imm >= 0 && (size_t)ins.imm < chunk->cmd_count)
-          {
-            target = chunk->cmd_targets[ins.imm];
+            target = s_vm_cmd_resolve_scoped(vm, (MiVmChunk*)chunk, ins.imm, target);
           }
           if (!target && is_qualified)
           {
@@ -4262,277 +5502,840 @@ MiRtValue mi_vm_execute(MiVm* vm, const MiVmChunk* chunk)
           if (!target)
           {
             mi_error("mi_vm: CALL_CMD unresolved command\n");
-            s_vm_reg_set(vm, ins.a, mi_rt_make_void());
-            for (int i = 0; i < argc; i += 1)
+            s_vm_reg_set(vm, regs, ins.a, mi_rt_make_void());
+            s_vm_arg_drop(vm, base);
+            break;
+          }
+          callee = s_vm_call_begin(vm, cmd_name, target, argc, ins.a, chunk, pc - 1, false);
+          if (callee)
+          {
+            goto vm_enter;
+          }
+          mi_rt_value_assign(vm->rt, &last, regs[ins.a]);
+        } MI_VM_NEXT();
+
+      MI_VM_CASE(CALL_CMD_FAST_VAR):
+        s_vm_arg_push_var_sym(vm, chunk, (int32_t)ins.c);
+        MI_FALLTHROUGH;
+      MI_VM_CASE(CALL_CMD_FAST):
+        {
+          MI_VM_SYNC_DBG();
+          int argc = (int) ins.b;
+          if (argc > vm->arg_top - vm->arg_base)
+          {
+            mi_error("mi_vm: arg stack underflow\n");
+            s_vm_reg_set(vm, regs, ins.a, mi_rt_make_void());
+            break;
+          }
+
+          // The callee borrows its args from the arg stack (see s_vm_call_begin).
+          int base = vm->arg_top - argc;
+
+          XSlice cmd_name = chunk->cmd_names[ins.imm];
+          MiRtCmd* target = chunk->cmd_targets[ins.imm];
+          if (!target)
+          {
+            mi_error("mi_vm: CALL_CMD_FAST unresolved command\n");
+            s_vm_reg_set(vm, regs, ins.a, mi_rt_make_void());
+            s_vm_arg_drop(vm, base);
+            break;
+          }
+
+          callee = s_vm_call_begin(vm, cmd_name, target, argc, ins.a, chunk, pc - 1, false);
+          if (callee)
+          {
+            goto vm_enter;
+          }
+          mi_rt_value_assign(vm->rt, &last, regs[ins.a]);
+        } MI_VM_NEXT();
+
+      MI_VM_CASE(CALL_CMD_TRUSTED):
+        {
+          // The compiler proved the arguments against the target's signature,
+          // and mi_verify_chunk() that the linked target still has it.
+          MI_VM_SYNC_DBG();
+          int argc = (int) ins.b;
+          if (argc > vm->arg_top - vm->arg_base)
+          {
+            mi_error("mi_vm: arg stack underflow\n");
+            s_vm_reg_set(vm, regs, ins.a, mi_rt_make_void());
+            break;
+          }
+
+          callee = s_vm_call_begin(vm, chunk->cmd_names[ins.imm], chunk->cmd_targets[ins.imm], argc, ins.a, chunk, pc - 1, true);
+          if (callee)
+          {
+            goto vm_enter;
+          }
+          mi_rt_value_assign(vm->rt, &last, regs[ins.a]);
+        } MI_VM_NEXT();
+
+      MI_VM_CASE(TAIL_CALL):
+        {
+          // The compiler follows this with the return's SCOPE_POPs and a
+          // RETURN of ins.a. Only frames pushed by this loop can be
+          // replaced; anything else runs as an ordinary CALL_CMD_DYN and
+          // then those instructions.
+          MiRtValue head = regs[ins.b];
+          int argc = (int) ins.c;
+          size_t ret_pc = pc;
+          while (ret_pc < chunk->code_count && code[ret_pc].op == MI_VM_OP_SCOPE_POP)
+          {
+            ret_pc++;
+          }
+          if (vm->call_depth > entry_depth && s_vm_tail_call_ok(head) && argc <= vm->arg_top - vm->arg_base &&
+              ret_pc < chunk->code_count && code[ret_pc].op == MI_VM_OP_RETURN && code[ret_pc].a == ins.a)
+          {
+            MI_VM_SYNC_DBG();
+            callee = s_vm_frame_replace_cmd(vm, (XSlice){NULL, 0u}, head, argc, (int)(ret_pc - pc));
+            if (callee)
             {
-              mi_rt_value_release(vm->rt, argv[i]);
+              goto vm_tail;
             }
+            s_vm_reg_set(vm, regs, ins.a, mi_rt_make_void());
+            s_vm_arg_drop(vm, vm->arg_top - argc);
+            mi_rt_value_assign(vm->rt, &last, regs[ins.a]);
             break;
           }
-          s_vm_reg_set(vm, ins.a, s_vm_exec_cmd_value(vm, cmd_name, mi_rt_make_cmd(target), argc, argv));
-          for (int i = 0; i < argc; i += 1)
+        }
+        MI_FALLTHROUGH;
+      MI_VM_CASE(CALL_CMD_DYN):
+        {
+          MI_VM_SYNC_DBG();
+          int argc = (int) ins.c;
+          if (argc > vm->arg_top - vm->arg_base)
           {
-            mi_rt_value_release(vm->rt, argv[i]);
+            mi_error("mi_vm: arg stack underflow\n");
+            s_vm_reg_set(vm, regs, ins.a, mi_rt_make_void());
+            break;
           }
-          mi_rt_value_assign(vm->rt, &last, vm->regs[ins.a]);
-        } break;
 
-      case MI_VM_OP_CALL_CMD_FAST:
+          MiRtValue head = regs[ins.b];
+
+          // The callee borrows its args from the arg stack (see s_vm_call_begin).
+          int base = vm->arg_top - argc;
+
+          if (head.kind == MI_RT_VAL_CMD)
+          {
+            callee = s_vm_call_begin(vm, (XSlice){NULL, 0u}, head.as.cmd, argc, ins.a, chunk, pc - 1, false);
+            if (callee)
+            {
+              goto vm_enter;
+            }
+            mi_rt_value_assign(vm->rt, &last, regs[ins.a]);
+            break;
+          }
+
+          if (head.kind == MI_RT_VAL_BLOCK)
+          {
+            if (argc != 0)
+            {
+              mi_error("mi_vm: cannot call block with args (DCALL)\n");
+              s_vm_reg_set(vm, regs, ins.a, mi_rt_make_void());
+            }
+            else if (s_vm_frame_push_block(vm, head, ins.a, chunk, pc - 1))
+            {
+              callee = (const MiVmChunk*)head.as.block->ptr;
+              goto vm_enter;
+            }
+            else
+            {
+              s_vm_reg_set(vm, regs, ins.a, mi_rt_make_void());
+            }
+
+            s_vm_arg_drop(vm, base);
+            mi_rt_value_assign(vm->rt, &last, regs[ins.a]);
+            break;
+          }
+
+          if (head.kind != MI_RT_VAL_STRING)
+          {
+            mi_error("mi_vm: dynamic command head must be string/cmd/block\n");
+            s_vm_reg_set(vm, regs, ins.a, mi_rt_make_void());
+            s_vm_arg_drop(vm, base);
+            mi_rt_value_assign(vm->rt, &last, regs[ins.a]);
+            break;
+          }
+
+          XSlice head_name = mi_rt_value_slice(head);
+          MiRtCmd* cached = s_vm_dyn_resolve(vm, (MiVmChunk*)chunk, pc - 1, head_name);
+          if (cached)
+          {
+            callee = s_vm_call_begin(vm, head_name, cached, argc, ins.a, chunk, pc - 1, false);
+            if (callee)
+            {
+              goto vm_enter;
+            }
+            mi_rt_value_assign(vm->rt, &last, regs[ins.a]);
+            break;
+          }
+
+          // Qualified call for dynamic heads (string).
+          bool q_ok = false;
+          MiRtValue q_ret = s_vm_exec_qualified_cmd(vm, head_name, argc, &vm->arg_stack[base], &q_ok);
+          if (q_ok)
+          {
+            s_vm_reg_set(vm, regs, ins.a, q_ret);
+            s_vm_arg_drop(vm, base);
+            mi_rt_value_assign(vm->rt, &last, regs[ins.a]);
+            break;
+          }
+
+          // First: scoped commands stored as variables.
+          MiRtValue scoped = mi_rt_make_void();
+          MiRtValue global_cmd = mi_rt_make_void();
+          MiRtCmd* dyn_target = NULL;
+          if (mi_rt_var_get(vm->rt, head_name, &scoped) && scoped.kind == MI_RT_VAL_CMD)
+          {
+            dyn_target = scoped.as.cmd;
+          }
+          else
+          {
+            if (!mi_vm_find_command(vm, head_name, &global_cmd) || global_cmd.kind != MI_RT_VAL_CMD)
+            {
+              mi_error_fmt("mi_vm: unknown command: %.*s\n", (int)head_name.length, head_name.ptr);
+              s_vm_reg_set(vm, regs, ins.a, mi_rt_make_void());
+              s_vm_arg_drop(vm, base);
+              break;
+            }
+            dyn_target = global_cmd.as.cmd;
+          }
+
+          // The command table keeps global commands alive while they run.
+          callee = s_vm_call_begin(vm, head_name, dyn_target, argc, ins.a, chunk, pc - 1, false);
+          mi_rt_value_release(vm->rt, global_cmd);
+          if (callee)
+          {
+            goto vm_enter;
+          }
+          mi_rt_value_assign(vm->rt, &last, regs[ins.a]);
+        } MI_VM_NEXT();
+
+      MI_VM_CASE(CALL_BLOCK):
+        {
+          MI_VM_SYNC_DBG();
+          MiRtValue block = regs[ins.b];
+          if (s_vm_frame_push_block(vm, block, ins.a, chunk, pc - 1))
+          {
+            callee = (const MiVmChunk*)block.as.block->ptr;
+            goto vm_enter;
+          }
+          s_vm_reg_set(vm, regs, ins.a, mi_rt_make_void());
+          mi_rt_value_assign(vm->rt, &last, regs[ins.a]);
+        } MI_VM_NEXT();
+
+      MI_VM_CASE(SCOPE_PUSH):
+        {
+          s_vm_scope_push(vm, chunk, vm->rt->current);
+        } MI_VM_NEXT();
+
+      MI_VM_CASE(SCOPE_POP):
+        {
+          mi_rt_scope_pop(vm->rt);
+        } MI_VM_NEXT();
+
+      MI_VM_CASE(SCOPE_RESET):
+        {
+          // Most iterations bind nothing in the loop scope.
+          if (vm->rt->current->vars)
+          {
+            mi_rt_scope_reset(vm->rt);
+          }
+        } MI_VM_NEXT();
+
+      MI_VM_CASE(JUMP):
+        pc = (size_t)((int64_t)pc + ins.imm);
+#if MI_VM_JIT
+        // Loop back-edge: the loop runs natively once the chunk is hot.
+        if (ins.imm < 0 && vm->jit_mode != MI_VM_JIT_OFF)
+        {
+          goto vm_jit;
+        }
+#endif
+        MI_VM_NEXT();
+
+      MI_VM_CASE(JUMP_IF_TRUE):
+      MI_VM_CASE(JUMP_IF_FALSE):
+        {
+          MI_ASSERT(ins.a < MI_VM_REG_COUNT);
+          bool is_true = s_vm_jump_truthy(&regs[ins.a]);
+          bool take = ((MiVmOp)ins.op == MI_VM_OP_JUMP_IF_TRUE) ? is_true : !is_true;
+          if (take)
+          {
+            pc = (size_t)((int64_t)pc + ins.imm);
+          }
+        } MI_VM_NEXT();
+
+      MI_VM_CASE(ADD_VAR_CONST):
+      MI_VM_CASE(SUB_VAR_CONST):
+        s_vm_op_var_const(vm, chunk, regs, ins);
+        MI_VM_NEXT();
+
+      MI_VM_CASE(JUMP_IF_NOT_EQ):
+      MI_VM_CASE(JUMP_IF_NOT_NEQ):
+      MI_VM_CASE(JUMP_IF_NOT_LT):
+      MI_VM_CASE(JUMP_IF_NOT_LTEQ):
+      MI_VM_CASE(JUMP_IF_NOT_GT):
+      MI_VM_CASE(JUMP_IF_NOT_GTEQ):
         {
-          int argc = (int) ins.b;
-          if (argc > vm->arg_top)
+          MI_VM_QUICKEN_SITE(regs[ins.b].kind, regs[ins.c].kind);
+          MiVmOp cmp = (MiVmOp)(MI_VM_OP_EQ + (ins.op - MI_VM_OP_JUMP_IF_NOT_EQ));
+          MiRtValue r = s_vm_binary_compare(cmp, &regs[ins.b], &regs[ins.c]);
+          if (r.kind != MI_RT_VAL_BOOL || !r.as.b)
           {
-            mi_error("mi_vm: arg stack underflow\n");
-            s_vm_reg_set(vm, ins.a, mi_rt_make_void());
-            break;
+            pc = (size_t)((int64_t)pc + ins.imm);
           }
-
-          MiRtValue argv[MI_VM_ARG_STACK_COUNT];
-          int base = (int)vm->arg_top - argc;
-          for (int i = 0; i < argc; i += 1)
+        } MI_VM_NEXT();
+
+      MI_VM_CASE(ADD_INT):
+        s_vm_reg_set_int(vm, regs, ins.a, (long long) ((unsigned long long) regs[ins.b].as.i + (unsigned long long) regs[ins.c].as.i));
+        MI_VM_NEXT();
+
+      MI_VM_CASE(SUB_INT):
+        s_vm_reg_set_int(vm, regs, ins.a, (long long) ((unsigned long long) regs[ins.b].as.i - (unsigned long long) regs[ins.c].as.i));
+        MI_VM_NEXT();
+
+      MI_VM_CASE(MUL_INT):
+        s_vm_reg_set_int(vm, regs, ins.a, (long long) ((unsigned long long) regs[ins.b].as.i * (unsigned long long) regs[ins.c].as.i));
+        MI_VM_NEXT();
+
+      MI_VM_CASE(ADD_FLOAT):
+        s_vm_reg_set_float(vm, regs, ins.a, regs[ins.b].as.f + regs[ins.c].as.f);
+        MI_VM_NEXT();
+
+      MI_VM_CASE(SUB_FLOAT):
+        s_vm_reg_set_float(vm, regs, ins.a, regs[ins.b].as.f - regs[ins.c].as.f);
+        MI_VM_NEXT();
+
+      MI_VM_CASE(MUL_FLOAT):
+        s_vm_reg_set_float(vm, regs, ins.a, regs[ins.b].as.f * regs[ins.c].as.f);
+        MI_VM_NEXT();
+
+      MI_VM_CASE(DIV_FLOAT):
+        s_vm_reg_set_float(vm, regs, ins.a, regs[ins.b].as.f / regs[ins.c].as.f);
+        MI_VM_NEXT();
+
+      MI_VM_CASE(EQ_INT):
+        s_vm_reg_set_bool(vm, regs, ins.a, regs[ins.b].as.i == regs[ins.c].as.i);
+        MI_VM_NEXT();
+
+      MI_VM_CASE(NEQ_INT):
+        s_vm_reg_set_bool(vm, regs, ins.a, regs[ins.b].as.i != regs[ins.c].as.i);
+        MI_VM_NEXT();
+
+      MI_VM_CASE(LT_INT):
+        s_vm_reg_set_bool(vm, regs, ins.a, regs[ins.b].as.i < regs[ins.c].as.i);
+        MI_VM_NEXT();
+
+      MI_VM_CASE(LTEQ_INT):
+        s_vm_reg_set_bool(vm, regs, ins.a, regs[ins.b].as.i <= regs[ins.c].as.i);
+        MI_VM_NEXT();
+
+      MI_VM_CASE(GT_INT):
+        s_vm_reg_set_bool(vm, regs, ins.a, regs[ins.b].as.i > regs[ins.c].as.i);
+        MI_VM_NEXT();
+
+      MI_VM_CASE(GTEQ_INT):
+        s_vm_reg_set_bool(vm, regs, ins.a, regs[ins.b].as.i >= regs[ins.c].as.i);
+        MI_VM_NEXT();
+
+      MI_VM_CASE(LT_FLOAT):
+        s_vm_reg_set_bool(vm, regs, ins.a, regs[ins.b].as.f < regs[ins.c].as.f);
+        MI_VM_NEXT();
+
+      MI_VM_CASE(LTEQ_FLOAT):
+        s_vm_reg_set_bool(vm, regs, ins.a, regs[ins.b].as.f <= regs[ins.c].as.f);
+        MI_VM_NEXT();
+
+      MI_VM_CASE(GT_FLOAT):
+        s_vm_reg_set_bool(vm, regs, ins.a, regs[ins.b].as.f > regs[ins.c].as.f);
+        MI_VM_NEXT();
+
+      MI_VM_CASE(GTEQ_FLOAT):
+        s_vm_reg_set_bool(vm, regs, ins.a, regs[ins.b].as.f >= regs[ins.c].as.f);
+        MI_VM_NEXT();
+
+      MI_VM_CASE(JUMP_IF_NOT_EQ_INT):
+      MI_VM_CASE(JUMP_IF_NOT_NEQ_INT):
+      MI_VM_CASE(JUMP_IF_NOT_LT_INT):
+      MI_VM_CASE(JUMP_IF_NOT_LTEQ_INT):
+      MI_VM_CASE(JUMP_IF_NOT_GT_INT):
+      MI_VM_CASE(JUMP_IF_NOT_GTEQ_INT):
+        {
+          long long x = regs[ins.b].as.i;
+          long long y = regs[ins.c].as.i;
+          bool holds = false;
+          switch ((MiVmOp)ins.op)
           {
-            argv[i] = vm->arg_stack[base + i];
-            mi_rt_value_retain(vm->rt, argv[i]);
+            case MI_VM_OP_JUMP_IF_NOT_EQ_INT:   holds = (x == y); break;
+            case MI_VM_OP_JUMP_IF_NOT_NEQ_INT:  holds = (x != y); break;
+            case MI_VM_OP_JUMP_IF_NOT_LT_INT:   holds = (x < y); break;
+            case MI_VM_OP_JUMP_IF_NOT_LTEQ_INT: holds = (x <= y); break;
+            case MI_VM_OP_JUMP_IF_NOT_GT_INT:   holds = (x > y); break;
+            default:                            holds = (x >= y); break;
           }
-          for (int i = 0; i < argc; i += 1)
+          if (!holds)
           {
-            mi_rt_value_assign(vm->rt, &vm->arg_stack[base + i], mi_rt_make_void());
+            pc = (size_t)((int64_t)pc + ins.imm);
           }
-          vm->arg_top = base;
+        } MI_VM_NEXT();
 
-          if (!chunk->cmd_names || ins.imm < 0 || (size_t)ins.imm >= chunk->cmd_count)
+#if MI_VM_QUICKEN
+      MI_VM_CASE(QADD_INT):
+      MI_VM_CASE(QSUB_INT):
+        {
+          const MiRtValue* x = &regs[ins.b];
+          const MiRtValue* y = &regs[ins.c];
+          bool is_add = (MiVmOp)ins.op == MI_VM_OP_QADD_INT;
+          if (x->kind != MI_RT_VAL_INT || y->kind != MI_RT_VAL_INT)
           {
-            mi_error("mi_vm: CALL_CMD_FAST bad cmd id\n");
-            s_vm_reg_set(vm, ins.a, mi_rt_make_void());
-            for (int i = 0; i < argc; i += 1)
-            {
-              mi_rt_value_release(vm->rt, argv[i]);
-            }
+            s_vm_deopt((MiVmChunk*)chunk, --pc, is_add ? MI_VM_OP_ADD : MI_VM_OP_SUB);
             break;
           }
+          unsigned long long ux = (unsigned long long)x->as.i;
+          unsigned long long uy = (unsigned long long)y->as.i;
+          s_vm_reg_set_int(vm, regs, ins.a, (long long)(is_add ? ux + uy : ux - uy));
+        } MI_VM_NEXT();
 
-          XSlice cmd_name = chunk->cmd_names[ins.imm];
-          MiRtCmd* target = chunk->cmd_targets ? chunk->cmd_targets[ins.imm] : NULL;
-          if (!target)
+      MI_VM_CASE(QADD_FLOAT):
+      MI_VM_CASE(QSUB_FLOAT):
+        {
+          const MiRtValue* x = &regs[ins.b];
+          const MiRtValue* y = &regs[ins.c];
+          bool is_add = (MiVmOp)ins.op == MI_VM_OP_QADD_FLOAT;
+          if (x->kind != MI_RT_VAL_FLOAT || y->kind != MI_RT_VAL_FLOAT)
           {
-            mi_error("mi_vm: CALL_CMD_FAST unresolved command\n");
-            s_vm_reg_set(vm, ins.a, mi_rt_make_void());
-            for (int i = 0; i < argc; i += 1)
-            {
-              mi_rt_value_release(vm->rt, argv[i]);
-            }
+            s_vm_deopt((MiVmChunk*)chunk, --pc, is_add ? MI_VM_OP_ADD : MI_VM_OP_SUB);
             break;
           }
+          s_vm_reg_set_float(vm, regs, ins.a, is_add ? x->as.f + y->as.f : x->as.f - y->as.f);
+        } MI_VM_NEXT();
 
-          s_vm_reg_set(vm, ins.a, s_vm_exec_cmd_value(vm, cmd_name, mi_rt_make_cmd(target), argc, argv));
-          for (int i = 0; i < argc; i += 1)
+      MI_VM_CASE(QLT_INT):
+        {
+          const MiRtValue* x = &regs[ins.b];
+          const MiRtValue* y = &regs[ins.c];
+          if (x->kind != MI_RT_VAL_INT || y->kind != MI_RT_VAL_INT)
           {
-            mi_rt_value_release(vm->rt, argv[i]);
+            s_vm_deopt((MiVmChunk*)chunk, --pc, MI_VM_OP_LT);
+            break;
           }
-          mi_rt_value_assign(vm->rt, &last, vm->regs[ins.a]);
-        } break;
+          s_vm_reg_set_bool(vm, regs, ins.a, x->as.i < y->as.i);
+        } MI_VM_NEXT();
 
-      case MI_VM_OP_CALL_CMD_DYN:
+      MI_VM_CASE(QLT_FLOAT):
         {
-          int argc = (int) ins.c;
-          if (argc > vm->arg_top)
+          const MiRtValue* x = &regs[ins.b];
+          const MiRtValue* y = &regs[ins.c];
+          if (x->kind != MI_RT_VAL_FLOAT || y->kind != MI_RT_VAL_FLOAT)
           {
-            mi_error("mi_vm: arg stack underflow\n");
-            s_vm_reg_set(vm, ins.a, mi_rt_make_void());
+            s_vm_deopt((MiVmChunk*)chunk, --pc, MI_VM_OP_LT);
             break;
           }
+          s_vm_reg_set_bool(vm, regs, ins.a, x->as.f < y->as.f);
+        } MI_VM_NEXT();
 
-          MiRtValue head = vm->regs[ins.b];
-
-          MiRtValue argv[MI_VM_ARG_STACK_COUNT];
-          int base = (int)vm->arg_top - argc;
-          for (int i = 0; i < argc; i += 1)
+      MI_VM_CASE(QJUMP_IF_NOT_LT_INT):
+      MI_VM_CASE(QJUMP_IF_NOT_LT_FLOAT):
+        {
+          const MiRtValue* x = &regs[ins.b];
+          const MiRtValue* y = &regs[ins.c];
+          bool holds = false;
+          if ((MiVmOp)ins.op == MI_VM_OP_QJUMP_IF_NOT_LT_INT && x->kind == MI_RT_VAL_INT && y->kind == MI_RT_VAL_INT)
           {
-            argv[i] = vm->arg_stack[base + i];
-            mi_rt_value_retain(vm->rt, argv[i]);
+            holds = x->as.i < y->as.i;
           }
-          for (int i = 0; i < argc; i += 1)
+          else if ((MiVmOp)ins.op == MI_VM_OP_QJUMP_IF_NOT_LT_FLOAT && x->kind == MI_RT_VAL_FLOAT && y->kind == MI_RT_VAL_FLOAT)
           {
-            mi_rt_value_assign(vm->rt, &vm->arg_stack[base + i], mi_rt_make_void());
+            holds = x->as.f < y->as.f;
           }
-          vm->arg_top = base;
-
-          if (head.kind == MI_RT_VAL_CMD)
+          else
           {
-            s_vm_reg_set(vm, ins.a, s_vm_exec_cmd_value(vm, (XSlice){NULL, 0u}, head, argc, argv));
-            for (int i = 0; i < argc; i += 1)
-            {
-              mi_rt_value_release(vm->rt, argv[i]);
-            }
-            mi_rt_value_assign(vm->rt, &last, vm->regs[ins.a]);
+            s_vm_deopt((MiVmChunk*)chunk, --pc, MI_VM_OP_JUMP_IF_NOT_LT);
             break;
           }
-
-          if (head.kind == MI_RT_VAL_BLOCK)
+          if (!holds)
           {
-            if (argc != 0)
-            {
-              mi_error("mi_vm: cannot call block with args (DCALL)\n");
-              s_vm_reg_set(vm, ins.a, mi_rt_make_void());
-            }
-            else
-            {
-              MiRtValue ret = s_vm_exec_block_value(vm, head, chunk, vm->dbg_ip);
-              s_vm_reg_set(vm, ins.a, ret);
-            }
-
-            for (int i = 0; i < argc; i += 1)
-            {
-              mi_rt_value_release(vm->rt, argv[i]);
-            }
-            mi_rt_value_assign(vm->rt, &last, vm->regs[ins.a]);
-            break;
+            pc = (size_t)((int64_t)pc + ins.imm);
           }
+        } MI_VM_NEXT();
 
-          if (head.kind != MI_RT_VAL_STRING)
+      MI_VM_CASE(QINDEX_LIST):
+        {
+          const MiRtValue* base = &regs[ins.b];
+          const MiRtValue* key = &regs[ins.c];
+          if (base->kind != MI_RT_VAL_LIST || !base->as.list || key->kind != MI_RT_VAL_INT)
           {
-            mi_error("mi_vm: dynamic command head must be string/cmd/block\n");
-            s_vm_reg_set(vm, ins.a, mi_rt_make_void());
-            for (int i = 0; i < argc; i += 1)
-            {
-              mi_rt_value_release(vm->rt, argv[i]);
-            }
-            mi_rt_value_assign(vm->rt, &last, vm->regs[ins.a]);
+            s_vm_deopt((MiVmChunk*)chunk, --pc, MI_VM_OP_INDEX);
             break;
           }
+          MiRtList* list = base->as.list;
+          long long idx = key->as.i;
+          if (idx < 0 || (uint64_t)idx >= list->count)
+          {
+            s_vm_reg_set(vm, regs, ins.a, mi_rt_make_void());
+          }
+          else
+          {
+            s_vm_reg_set(vm, regs, ins.a, list->items[(size_t)idx]);
+          }
+        } MI_VM_NEXT();
 
-          // Qualified call for dynamic heads (string).
-          bool q_ok = false;
-          MiRtValue q_ret = s_vm_exec_qualified_cmd(vm, head.as.s, argc, argv, &q_ok);
-          if (q_ok)
+      MI_VM_CASE(QITER_NEXT_LIST):
+        {
+          const MiRtValue* container = &regs[ins.b];
+          const MiRtValue* cursor = &regs[ins.c];
+          if (container->kind != MI_RT_VAL_LIST || !container->as.list || cursor->kind != MI_RT_VAL_INT)
           {
-            s_vm_reg_set(vm, ins.a, q_ret);
-            for (int i = 0; i < argc; i += 1)
-            {
-              mi_rt_value_release(vm->rt, argv[i]);
-            }
-            mi_rt_value_assign(vm->rt, &last, vm->regs[ins.a]);
+            s_vm_deopt((MiVmChunk*)chunk, --pc, MI_VM_OP_ITER_NEXT);
             break;
           }
-
-          // First: scoped commands stored as variables.
-          MiRtValue scoped = mi_rt_make_void();
-          if (mi_rt_var_get(vm->rt, head.as.s, &scoped) && scoped.kind == MI_RT_VAL_CMD)
+          MiRtList* list = container->as.list;
+          long long next = cursor->as.i + 1;
+          if (next >= 0 && (uint64_t)next < (uint64_t)list->count)
           {
-            s_vm_reg_set(vm, ins.a, s_vm_exec_cmd_value(vm, head.as.s, scoped, argc, argv));
+            s_vm_reg_set_int(vm, regs, ins.c, next);
+            s_vm_reg_set(vm, regs, (uint8_t)(ins.imm & 0xFF), list->items[(size_t)next]);
+            s_vm_reg_set_bool(vm, regs, ins.a, true);
           }
           else
           {
-            MiRtValue global_cmd = mi_rt_make_void();
-            if (!mi_vm_find_command(vm, head.as.s, &global_cmd) || global_cmd.kind != MI_RT_VAL_CMD)
-            {
-              mi_error_fmt("mi_vm: unknown command: %.*s\n", (int)head.as.s.length, head.as.s.ptr);
-              s_vm_reg_set(vm, ins.a, mi_rt_make_void());
-              for (int i = 0; i < argc; i += 1)
-              {
-                mi_rt_value_release(vm->rt, argv[i]);
-              }
-              break;
-            }
-
-            MiRtValue ret = s_vm_exec_cmd_value(vm, head.as.s, global_cmd, argc, argv);
-            mi_rt_value_release(vm->rt, global_cmd);
-            s_vm_reg_set(vm, ins.a, ret);
+            s_vm_reg_set_bool(vm, regs, ins.a, false);
           }
+        } MI_VM_NEXT();
+#endif
 
-          for (int i = 0; i < argc; i += 1)
-          {
-            mi_rt_value_release(vm->rt, argv[i]);
-          }
-          mi_rt_value_assign(vm->rt, &last, vm->regs[ins.a]);
-        } break;
+      MI_VM_CASE(LOAD_LOCAL):
+        s_vm_reg_set(vm, regs, ins.a, vm->locals[local_base + (size_t)ins.imm]);
+        MI_VM_NEXT();
 
-      case MI_VM_OP_CALL_BLOCK:
-        {
-          MiRtValue ret = s_vm_exec_block_value(vm, vm->regs[ins.b], chunk, vm->dbg_ip);
-          s_vm_reg_set(vm, ins.a, ret);
-          mi_rt_value_assign(vm->rt, &last, ret);
-        } break;
+      MI_VM_CASE(LOAD_UPVAL):
+        s_vm_op_load_upval(vm, chunk, regs, ins);
+        MI_VM_NEXT();
 
-      case MI_VM_OP_SCOPE_PUSH:
-        {
-          mi_rt_scope_push(vm->rt);
-        } break;
+      MI_VM_CASE(STORE_UPVAL):
+        s_vm_op_store_upval(vm, chunk, regs, ins);
+        MI_VM_NEXT();
 
-      case MI_VM_OP_SCOPE_POP:
-        {
-          mi_rt_scope_pop(vm->rt);
-        } break;
+      MI_VM_CASE(STORE_LOCAL):
+        mi_rt_value_assign(vm->rt, &vm->locals[local_base + (size_t)ins.imm], regs[ins.a]);
+        MI_VM_NEXT();
 
-      case MI_VM_OP_JUMP:
+      MI_VM_CASE(ARG_PUSH_LOCAL):
         {
-          int64_t npc = (int64_t)pc + (int64_t)ins.imm;
-          if (npc < 0 || npc > (int64_t)chunk->code_count)
+          if (vm->arg_top >= MI_VM_ARG_STACK_COUNT)
           {
-            mi_error("mi_vm: JUMP out of range\n");
-            return last;
+            mi_error("mi_vm: arg stack overflow\n");
+            break;
           }
-          pc = (size_t)npc;
-        } break;
+          mi_rt_value_assign(vm->rt, &vm->arg_stack[vm->arg_top], vm->locals[local_base + (size_t)ins.imm]);
+          vm->arg_top += 1;
+        } MI_VM_NEXT();
 
-      case MI_VM_OP_JUMP_IF_TRUE:
-      case MI_VM_OP_JUMP_IF_FALSE:
+      MI_VM_CASE(ADD_LOCAL_CONST):
+      MI_VM_CASE(SUB_LOCAL_CONST):
         {
-          MI_ASSERT(ins.a < MI_VM_REG_COUNT);
-          MiRtValue c = vm->regs[ins.a];
-          bool is_true = false;
-          if (c.kind == MI_RT_VAL_BOOL)
-          {
-            is_true = c.as.b;
-          }
-          else if (c.kind == MI_RT_VAL_INT)
-          {
-            is_true = (c.as.i != 0);
-          }
-          else if (c.kind == MI_RT_VAL_FLOAT)
+          MiRtValue* slot = &vm->locals[local_base + (size_t)ins.imm];
+          MiVmOp arith = ((MiVmOp)ins.op == MI_VM_OP_ADD_LOCAL_CONST) ? MI_VM_OP_ADD : MI_VM_OP_SUB;
+          s_vm_reg_set(vm, regs, ins.a, s_vm_binary_numeric(arith, slot, &chunk->consts[ins.b]));
+          mi_rt_value_assign(vm->rt, slot, regs[ins.a]);
+        } MI_VM_NEXT();
+
+      MI_VM_CASE(CLEAR_REGS):
+        for (uint32_t i = 0; i < ins.b; ++i)
+        {
+          s_vm_reg_set(vm, regs, (uint8_t)(ins.a + i), mi_rt_make_void());
+        }
+        MI_VM_NEXT();
+
+      MI_VM_CASE(FOR_PREP):
+        {
+          const MiRtValue* r = &regs[ins.a];
+          if (r[0].kind != MI_RT_VAL_INT || r[1].kind != MI_RT_VAL_INT || r[2].kind != MI_RT_VAL_INT || r[2].as.i == 0)
           {
-            is_true = (c.as.f != 0.0f);
+            MI_VM_SYNC_DBG();
+            s_vm_report_error(vm, r[2].kind == MI_RT_VAL_INT && r[2].as.i == 0 ?
+                "foreach: range step is zero" : "foreach: range bounds and step must be ints");
+            pc = (size_t)((int64_t)pc + ins.imm);
+            MI_VM_NEXT();
           }
-          else if (c.kind == MI_RT_VAL_STRING)
+          if (!s_vm_for_enters(r[0].as.i, r[1].as.i, r[2].as.i))
           {
-            is_true = (c.as.s.length != 0);
+            pc = (size_t)((int64_t)pc + ins.imm);
           }
+        } MI_VM_NEXT();
 
-          bool take = ((MiVmOp)ins.op == MI_VM_OP_JUMP_IF_TRUE) ? is_true : !is_true;
-          if (take)
+      MI_VM_CASE(FOR_LOOP):
+        {
+          // The range registers are compiler temporaries: FOR_PREP checked
+          // their kinds and nothing else writes them.
+          long long i = regs[ins.a].as.i;
+          long long step = regs[ins.a + 2].as.i;
+          if (s_vm_for_continues(i, regs[ins.a + 1].as.i, step))
           {
-            int64_t npc = (int64_t)pc + (int64_t)ins.imm;
-            if (npc < 0 || npc > (int64_t)chunk->code_count)
+            s_vm_reg_set_int(vm, regs, ins.a, (long long)((uint64_t)i + (uint64_t)step));
+            pc = (size_t)((int64_t)pc + ins.imm);
+#if MI_VM_JIT
+            if (vm->jit_mode != MI_VM_JIT_OFF)
             {
-              s_vm_report_error(vm, "JUMP_IF out of range");
-              MI_ASSERT(npc >= 0 && npc <= (int64_t)chunk->code_count);
-              return last;
+              goto vm_jit;
             }
-            pc = (size_t)npc;
+#endif
           }
-        } break;
+        } MI_VM_NEXT();
 
-      case MI_VM_OP_RETURN:
+      MI_VM_CASE(RETURN):
         {
           MI_ASSERT(ins.a < MI_VM_REG_COUNT);
 
-          MiRtValue ret = vm->regs[ins.a];
+          ret = regs[ins.a];
           mi_rt_value_retain(vm->rt, ret);
-          return ret;
+          mi_rt_value_release(vm->rt, last);
+          last = mi_rt_make_void();
+          goto vm_leave;
         }
 
-      case MI_VM_OP_HALT:
-        return last;
+      MI_VM_CASE(HALT):
+        goto vm_halt;
 
-      default:
+      MI_VM_DEFAULT:
+        MI_VM_SYNC_DBG();
         s_vm_report_error(vm, "unhandled opcode");
         mi_error_fmt("  opcode: %u\n", (unsigned) ins.op);
-        return last;
+        goto vm_halt;
     }
   }
 
-  return last;
+vm_halt:
+  // A chunk that halts (or runs off its end) yields its last command result.
+  ret = last;
+  last = mi_rt_make_void();
+
+vm_leave:
+  if (vm->call_depth <= entry_depth)
+  {
+    return ret;
+  }
+
+  {
+    // Resume the caller and hand it the result.
+    const MiVmCallFrame* f = &vm->call_stack[vm->call_depth - 1];
+    uint8_t dst = f->ret_reg;
+    chunk = f->caller_chunk;
+    pc = f->caller_ip + 1;
+    last = f->caller_last;
+    s_vm_frame_pop(vm);
+
+    code = s_vm_chunk_exec_code((MiVmChunk*)chunk);
+    local_base = vm->local_base;
+    regs = vm->regs;
+    vm->dbg_chunk = chunk;
+    s_vm_reg_set(vm, regs, dst, ret);
+    mi_rt_value_release(vm->rt, ret);
+    mi_rt_value_assign(vm->rt, &last, regs[dst]);
+  }
+#if MI_VM_JIT
+  if (chunk->jit && vm->jit_mode != MI_VM_JIT_OFF)
+  {
+    goto vm_jit_resume;
+  }
+#endif
+  goto vm_loop;
+
+vm_tail:
+  // A tail call replaced the running frame with one for 'callee'.
+  mi_rt_value_release(vm->rt, last);
+  last = mi_rt_make_void();
+  goto vm_switch;
+
+vm_enter:
+  // A call pushed a frame for 'callee': park the caller's state and run it.
+  vm->call_stack[vm->call_depth - 1].caller_last = last;
+  last = mi_rt_make_void();
+
+vm_switch:
+  chunk = callee;
+  code = s_vm_chunk_exec_code((MiVmChunk*)chunk);
+  local_base = vm->local_base;
+  regs = vm->regs;
+  pc = 0;
+  vm->dbg_chunk = chunk;
+  vm->dbg_ip = 0;
+#if MI_VM_JIT
+  if (vm->jit_mode != MI_VM_JIT_OFF)
+  {
+    goto vm_jit;
+  }
+#endif
+  goto vm_loop;
+
+#if MI_VM_JIT
+vm_jit:
+  // Frame entry or loop back-edge with the JIT on.
+  if (!s_vm_jit_ready(vm, (MiVmChunk*)chunk))
+  {
+    goto vm_loop;
+  }
+
+vm_jit_resume:
+  // Run natively from pc up to the first instruction the JIT leaves to the
+  // interpreter (a call, a return, ...), then carry on interpreting there.
+  if (mi_jit_is_native(chunk->jit, pc))
+  {
+    MiJitFrame frame = { vm, chunk, regs, vm->locals ? vm->locals + local_base : NULL };
+    pc = mi_jit_enter(chunk->jit, &frame, pc);
+  }
+  goto vm_loop;
+#endif
+}
+
+MiRtValue mi_vm_execute(MiVm* vm, const MiVmChunk* chunk)
+{
+  if (!vm || !chunk)
+  {
+    return mi_rt_make_void();
+  }
+
+  // Everything the dispatch loop runs is reached from here: block and
+  // command bodies are subchunks, verified along with their parent (or on
+  // their first call when they were left to compile lazily).
+  if (chunk->lazy && !s_vm_chunk_force(chunk))
+  {
+    return mi_rt_make_void();
+  }
+  if (!chunk->verified && !mi_verify_chunk((MiVmChunk*)chunk))
+  {
+    mi_error("mi_vm: chunk failed verification; not running it\n");
+    return mi_rt_make_void();
+  }
+
+  // Run in a register window and arg frame of its own, above whatever is
+  // active (a native calling back borrows its args from the arg stack).
+  // Top-level chunks have no named locals but may spill registers to slots.
+  MiRtValue* saved_regs = vm->regs;
+  int saved_arg_base = vm->arg_base;
+  size_t saved_local_base = vm->local_base;
+  MiRtUpval** saved_upvals = vm->upvals;
+  vm->regs = s_vm_regs_push(vm, MI_VM_REG_COUNT);
+  vm->arg_base = vm->arg_top;
+  vm->local_base = s_vm_locals_push(vm, chunk->local_count);
+  vm->upvals = NULL;
+
+  MiRtValue ret = s_vm_run(vm, chunk);
+
+  vm->upvals = saved_upvals;
+  s_vm_locals_pop(vm, vm->local_base);
+  vm->local_base = saved_local_base;
+  s_vm_arg_clear(vm);
+  vm->arg_base = saved_arg_base;
+  s_vm_regs_pop(vm, vm->regs, MI_VM_REG_COUNT);
+  vm->regs = saved_regs;
+  return ret;
+}
+
+#if MI_VM_COMPUTED_GOTO && defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+
+
+//----------------------------------------------------------
+// JIT slow paths (see mi_jit.h)
+//----------------------------------------------------------
+
+#if MI_VM_JIT
+void mi_vm_jit_release(MiVm* vm, MiRtValue* v)
+{
+  mi_rt_value_release(vm->rt, *v);
+  *v = mi_rt_make_void();
+}
+
+void mi_vm_jit_assign(MiVm* vm, MiRtValue* dst, const MiRtValue* src)
+{
+  mi_rt_value_assign(vm->rt, dst, *src);
+}
+
+void mi_vm_jit_step(MiJitFrame* frame, uint32_t pc)
+{
+  MiVm* vm = frame->vm;
+  const MiVmChunk* chunk = frame->chunk;
+  MiRtValue* regs = frame->regs;
+  MiVmIns ins = chunk->code[pc];
+  vm->dbg_ip = pc;
+
+  switch ((MiVmOp)ins.op)
+  {
+    case MI_VM_OP_LOAD_CONST:
+      s_vm_reg_set(vm, regs, ins.a, chunk->consts[ins.imm]);
+      break;
+
+    case MI_VM_OP_ADD:
+    case MI_VM_OP_SUB:
+    case MI_VM_OP_MUL:
+    case MI_VM_OP_DIV:
+    case MI_VM_OP_MOD:
+      s_vm_reg_set(vm, regs, ins.a, s_vm_binary_numeric((MiVmOp)ins.op, &regs[ins.b], &regs[ins.c]));
+      break;
+
+    case MI_VM_OP_EQ:
+    case MI_VM_OP_NEQ:
+    case MI_VM_OP_LT:
+    case MI_VM_OP_LTEQ:
+    case MI_VM_OP_GT:
+    case MI_VM_OP_GTEQ:
+      s_vm_reg_set(vm, regs, ins.a, s_vm_binary_compare((MiVmOp)ins.op, &regs[ins.b], &regs[ins.c]));
+      break;
+
+    case MI_VM_OP_ITER_NEXT:   s_vm_op_iter_next(vm, regs, ins); break;
+    case MI_VM_OP_INDEX:       s_vm_op_index(vm, regs, ins); break;
+    case MI_VM_OP_STORE_INDEX: s_vm_op_store_index(vm, regs, ins); break;
+    case MI_VM_OP_LEN:         s_vm_op_len(vm, regs, ins); break;
+    case MI_VM_OP_LOAD_VAR:    s_vm_op_load_var(vm, chunk, regs, ins); break;
+    case MI_VM_OP_LOAD_UPVAL:  s_vm_op_load_upval(vm, chunk, regs, ins); break;
+    case MI_VM_OP_STORE_UPVAL: s_vm_op_store_upval(vm, chunk, regs, ins); break;
+
+    case MI_VM_OP_STORE_VAR:
+      mi_rt_var_set_id(vm->rt, s_vm_chunk_sym_id(vm, (MiVmChunk*)chunk, ins.imm), regs[ins.a]);
+      break;
+
+    case MI_VM_OP_ADD_VAR_CONST:
+    case MI_VM_OP_SUB_VAR_CONST:
+      s_vm_op_var_const(vm, chunk, regs, ins);
+      break;
+
+    case MI_VM_OP_ADD_LOCAL_CONST:
+    case MI_VM_OP_SUB_LOCAL_CONST:
+      {
+        MiRtValue* slot = &frame->locals[ins.imm];
+        MiVmOp arith = ((MiVmOp)ins.op == MI_VM_OP_ADD_LOCAL_CONST) ? MI_VM_OP_ADD : MI_VM_OP_SUB;
+        s_vm_reg_set(vm, regs, ins.a, s_vm_binary_numeric(arith, slot, &chunk->consts[ins.b]));
+        mi_rt_value_assign(vm->rt, slot, regs[ins.a]);
+      }
+      break;
+
+    case MI_VM_OP_SCOPE_PUSH: s_vm_scope_push(vm, chunk, vm->rt->current); break;
+    case MI_VM_OP_SCOPE_POP:  mi_rt_scope_pop(vm->rt); break;
+    case MI_VM_OP_SCOPE_RESET: mi_rt_scope_reset(vm->rt); break;
+    case MI_VM_OP_ARG_CLEAR:  s_vm_arg_clear(vm); break;
+
+    default:
+      mi_error_fmt("mi_vm: JIT cannot step opcode %s\n", s_op_name((MiVmOp)ins.op));
+      break;
+  }
+}
+
+bool mi_vm_jit_truthy(const MiRtValue* v)
+{
+  return s_vm_jump_truthy(v);
+}
+
+bool mi_vm_jit_holds(MiJitFrame* frame, uint32_t pc)
+{
+  MiVmIns ins = frame->chunk->code[pc];
+  MiVmOp cmp = (MiVmOp)(MI_VM_OP_EQ + (ins.op - MI_VM_OP_JUMP_IF_NOT_EQ));
+  MiRtValue r = s_vm_binary_compare(cmp, &frame->regs[ins.b], &frame->regs[ins.c]);
+  return r.kind == MI_RT_VAL_BOOL && r.as.b;
 }
+#endif
 
 
 //----------------------------------------------------------
@@ -4585,14 +6388,69 @@ static const char* s_op_name(MiVmOp op)
     case MI_VM_OP_CALL_CMD:           return "CALL";
     case MI_VM_OP_CALL_CMD_FAST:      return "CALLF";
     case MI_VM_OP_CALL_CMD_DYN:       return "DCALL";
+    case MI_VM_OP_TAIL_CALL:          return "TCALL";
+    case MI_VM_OP_CLEAR_REGS:         return "RCLR";
+    case MI_VM_OP_CALL_CMD_TRUSTED:   return "CALLT";
+    case MI_VM_OP_FOR_PREP:           return "FORPREP";
+    case MI_VM_OP_FOR_LOOP:           return "FORLOOP";
+    case MI_VM_OP_LOAD_UPVAL:         return "LDU";
+    case MI_VM_OP_STORE_UPVAL:        return "STU";
     case MI_VM_OP_CALL_BLOCK:         return "BCALL";
     case MI_VM_OP_SCOPE_PUSH:         return "SPUSH";
     case MI_VM_OP_SCOPE_POP:          return "SPOP";
+    case MI_VM_OP_SCOPE_RESET:        return "SRESET";
     case MI_VM_OP_JUMP:               return "JMP";
     case MI_VM_OP_JUMP_IF_TRUE:       return "JT";
     case MI_VM_OP_JUMP_IF_FALSE:      return "JF";
     case MI_VM_OP_RETURN:             return "RET";
     case MI_VM_OP_HALT:               return "HALT";
+    case MI_VM_OP_ADD_VAR_CONST:      return "ADDVK";
+    case MI_VM_OP_SUB_VAR_CONST:      return "SUBVK";
+    case MI_VM_OP_JUMP_IF_NOT_EQ:     return "JNEQ";
+    case MI_VM_OP_JUMP_IF_NOT_NEQ:    return "JNNEQ";
+    case MI_VM_OP_JUMP_IF_NOT_LT:     return "JNLT";
+    case MI_VM_OP_JUMP_IF_NOT_LTEQ:   return "JNLTEQ";
+    case MI_VM_OP_JUMP_IF_NOT_GT:     return "JNGT";
+    case MI_VM_OP_JUMP_IF_NOT_GTEQ:   return "JNGTEQ";
+    case MI_VM_OP_CALL_CMD_FAST_VAR:  return "CALLFV";
+    case MI_VM_OP_ADD_INT:            return "ADDI";
+    case MI_VM_OP_SUB_INT:            return "SUBI";
+    case MI_VM_OP_MUL_INT:            return "MULI";
+    case MI_VM_OP_ADD_FLOAT:          return "ADDF";
+    case MI_VM_OP_SUB_FLOAT:          return "SUBF";
+    case MI_VM_OP_MUL_FLOAT:          return "MULF";
+    case MI_VM_OP_DIV_FLOAT:          return "DIVF";
+    case MI_VM_OP_EQ_INT:             return "EQI";
+    case MI_VM_OP_NEQ_INT:            return "NEQI";
+    case MI_VM_OP_LT_INT:             return "LTI";
+    case MI_VM_OP_LTEQ_INT:           return "LTEQI";
+    case MI_VM_OP_GT_INT:             return "GTI";
+    case MI_VM_OP_GTEQ_INT:           return "GTEQI";
+    case MI_VM_OP_LT_FLOAT:           return "LTF";
+    case MI_VM_OP_LTEQ_FLOAT:         return "LTEQF";
+    case MI_VM_OP_GT_FLOAT:           return "GTF";
+    case MI_VM_OP_GTEQ_FLOAT:         return "GTEQF";
+    case MI_VM_OP_JUMP_IF_NOT_EQ_INT: return "JNEQI";
+    case MI_VM_OP_JUMP_IF_NOT_NEQ_INT:return "JNNEQI";
+    case MI_VM_OP_JUMP_IF_NOT_LT_INT: return "JNLTI";
+    case MI_VM_OP_JUMP_IF_NOT_LTEQ_INT:return "JNLTEQI";
+    case MI_VM_OP_JUMP_IF_NOT_GT_INT: return "JNGTI";
+    case MI_VM_OP_JUMP_IF_NOT_GTEQ_INT:return "JNGTEQI";
+    case MI_VM_OP_QADD_INT:           return "QADDI";
+    case MI_VM_OP_QADD_FLOAT:         return "QADDF";
+    case MI_VM_OP_QSUB_INT:           return "QSUBI";
+    case MI_VM_OP_QSUB_FLOAT:         return "QSUBF";
+    case MI_VM_OP_QLT_INT:            return "QLTI";
+    case MI_VM_OP_QLT_FLOAT:          return "QLTF";
+    case MI_VM_OP_QJUMP_IF_NOT_LT_INT:return "QJNLTI";
+    case MI_VM_OP_QJUMP_IF_NOT_LT_FLOAT:return "QJNLTF";
+    case MI_VM_OP_QINDEX_LIST:        return "QIDXL";
+    case MI_VM_OP_QITER_NEXT_LIST:    return "QITERL";
+    case MI_VM_OP_LOAD_LOCAL:         return "LDL";
+    case MI_VM_OP_STORE_LOCAL:        return "STL";
+    case MI_VM_OP_ARG_PUSH_LOCAL:     return "APL";
+    case MI_VM_OP_ADD_LOCAL_CONST:    return "ADDLK";
+    case MI_VM_OP_SUB_LOCAL_CONST:    return "SUBLK";
     default: mi_error_fmt("Unknown opcode %X\n", op); return "?";
   }
 }
@@ -4634,6 +6492,7 @@ static void s_vm_disasm_ex(const MiVmChunk* chunk, const MiVmChunk** stack, size
   printf("syms:   %zu\n", chunk->symbol_count);
   printf("cmds:   %zu\n", chunk->cmd_count);
   printf("subs:   %zu\n", chunk->subchunk_count);
+  printf("locals: %u\n", (unsigned)chunk->local_count);
 
   if (chunk->const_count)
   {
@@ -4787,10 +6646,28 @@ static void s_vm_disasm_ex(const MiVmChunk* chunk, const MiVmChunk** stack, size
       case MI_VM_OP_GTEQ:
       case MI_VM_OP_AND:
       case MI_VM_OP_OR:
+      case MI_VM_OP_ADD_INT:
+      case MI_VM_OP_SUB_INT:
+      case MI_VM_OP_MUL_INT:
+      case MI_VM_OP_ADD_FLOAT:
+      case MI_VM_OP_SUB_FLOAT:
+      case MI_VM_OP_MUL_FLOAT:
+      case MI_VM_OP_DIV_FLOAT:
+      case MI_VM_OP_EQ_INT:
+      case MI_VM_OP_NEQ_INT:
+      case MI_VM_OP_LT_INT:
+      case MI_VM_OP_LTEQ_INT:
+      case MI_VM_OP_GT_INT:
+      case MI_VM_OP_GTEQ_INT:
+      case MI_VM_OP_LT_FLOAT:
+      case MI_VM_OP_LTEQ_FLOAT:
+      case MI_VM_OP_GT_FLOAT:
+      case MI_VM_OP_GTEQ_FLOAT:
         (void)snprintf(instr, sizeof(instr), "%s r%u, r%u, r%u", s_op_name(op), (unsigned)ins.a, (unsigned)ins.b, (unsigned)ins.c);
         break;
 
       case MI_VM_OP_LOAD_VAR:
+      case MI_VM_OP_LOAD_UPVAL:
         (void)snprintf(instr, sizeof(instr), "%s r%u, %d", s_op_name(op), (unsigned)ins.a, (int)ins.imm);
         if (ins.imm >= 0 && (size_t)ins.imm < chunk->symbol_count)
         {
@@ -4830,6 +6707,7 @@ static void s_vm_disasm_ex(const MiVmChunk* chunk, const MiVmChunk** stack, size
         break;
 
       case MI_VM_OP_STORE_VAR:
+      case MI_VM_OP_STORE_UPVAL:
         (void)snprintf(instr, sizeof(instr), "%s %d, r%u", s_op_name(op), (int)ins.imm, (unsigned)ins.a);
         if (ins.imm >= 0 && (size_t)ins.imm < chunk->symbol_count)
         {
@@ -4934,6 +6812,7 @@ static void s_vm_disasm_ex(const MiVmChunk* chunk, const MiVmChunk** stack, size
         } break;
 
       case MI_VM_OP_CALL_CMD_FAST:
+      case MI_VM_OP_CALL_CMD_TRUSTED:
         {
           const char* name = "cmd";
           int name_len = 3;
@@ -4948,6 +6827,7 @@ static void s_vm_disasm_ex(const MiVmChunk* chunk, const MiVmChunk** stack, size
         } break;
 
       case MI_VM_OP_CALL_CMD_DYN:
+      case MI_VM_OP_TAIL_CALL:
         (void)snprintf(instr, sizeof(instr), "%s r%u, r%u, %u", s_op_name(op), (unsigned)ins.a, (unsigned)ins.b, (unsigned)ins.c);
         break;
 
@@ -4957,6 +6837,7 @@ static void s_vm_disasm_ex(const MiVmChunk* chunk, const MiVmChunk** stack, size
 
       case MI_VM_OP_SCOPE_PUSH:
       case MI_VM_OP_SCOPE_POP:
+      case MI_VM_OP_SCOPE_RESET:
         (void)snprintf(instr, sizeof(instr), "%s", s_op_name(op));
         break;
 
@@ -4964,8 +6845,8 @@ static void s_vm_disasm_ex(const MiVmChunk* chunk, const MiVmChunk** stack, size
         {
           (void)snprintf(instr, sizeof(instr), "%s %d", s_op_name(op), (int)ins.imm);
 
-          int64_t ins_target = (int64_t)i + (int64_t)ins.imm;
-          uint64_t pc_target = (uint64_t)pc + ((uint64_t)(int64_t)ins.imm * (uint64_t)sizeof(MiVmIns));
+          int64_t ins_target = (int64_t)i + 1 + (int64_t)ins.imm;
+          uint64_t pc_target = (uint64_t)ins_target * (uint64_t)sizeof(MiVmIns);
           if (ins_target < 0 || (size_t)ins_target >= chunk->code_count)
           {
             (void)snprintf(comment, sizeof(comment), "-> 0x%08zx (OOB)", (size_t)pc_target);
@@ -4980,8 +6861,8 @@ static void s_vm_disasm_ex(const MiVmChunk* chunk, const MiVmChunk** stack, size
         {
           (void)snprintf(instr, sizeof(instr), "%s r%u, %d", s_op_name(op), (unsigned)ins.a, (int)ins.imm);
 
-          int64_t ins_target = (int64_t)i + (int64_t)ins.imm;
-          uint64_t pc_target = (uint64_t)pc + ((uint64_t)(int64_t)ins.imm * (uint64_t)sizeof(MiVmIns));
+          int64_t ins_target = (int64_t)i + 1 + (int64_t)ins.imm;
+          uint64_t pc_target = (uint64_t)ins_target * (uint64_t)sizeof(MiVmIns);
           if (ins_target < 0 || (size_t)ins_target >= chunk->code_count)
           {
             (void)snprintf(comment, sizeof(comment), "-> 0x%08zx (OOB)", (size_t)pc_target);
@@ -4992,12 +6873,29 @@ static void s_vm_disasm_ex(const MiVmChunk* chunk, const MiVmChunk** stack, size
           }
         } break;
 
+      case MI_VM_OP_FOR_PREP:
+      case MI_VM_OP_FOR_LOOP:
+        {
+          (void)snprintf(instr, sizeof(instr), "%s r%u, %d", s_op_name(op), (unsigned)ins.a, (int)ins.imm);
+
+          int64_t ins_target = (int64_t)i + 1 + (int64_t)ins.imm;
+          uint64_t pc_target = (uint64_t)ins_target * (uint64_t)sizeof(MiVmIns);
+          if (ins_target < 0 || (size_t)ins_target > chunk->code_count)
+          {
+            (void)snprintf(comment, sizeof(comment), "r%u..r%u -> 0x%08zx (OOB)", (unsigned)ins.a, (unsigned)ins.a + 2u, (size_t)pc_target);
+          }
+          else
+          {
+            (void)snprintf(comment, sizeof(comment), "r%u..r%u -> 0x%08zx", (unsigned)ins.a, (unsigned)ins.a + 2u, (size_t)pc_target);
+          }
+        } break;
+
       case MI_VM_OP_JUMP_IF_FALSE:
         {
           (void)snprintf(instr, sizeof(instr), "%s r%u, %d", s_op_name(op), (unsigned)ins.a, (int)ins.imm);
 
-          int64_t ins_target = (int64_t)i + (int64_t)ins.imm;
-          uint64_t pc_target = (uint64_t)pc + ((uint64_t)(int64_t)ins.imm * (uint64_t)sizeof(MiVmIns));
+          int64_t ins_target = (int64_t)i + 1 + (int64_t)ins.imm;
+          uint64_t pc_target = (uint64_t)ins_target * (uint64_t)sizeof(MiVmIns);
           if (ins_target < 0 || (size_t)ins_target >= chunk->code_count)
           {
             (void)snprintf(comment, sizeof(comment), "-> 0x%08zx (OOB)", (size_t)pc_target);
@@ -5008,6 +6906,107 @@ static void s_vm_disasm_ex(const MiVmChunk* chunk, const MiVmChunk** stack, size
           }
         } break;
 
+      case MI_VM_OP_LOAD_LOCAL:
+        (void)snprintf(instr, sizeof(instr), "%s r%u, %d", s_op_name(op), (unsigned)ins.a, (int)ins.imm);
+        (void)snprintf(comment, sizeof(comment), "local_%d", (int)ins.imm);
+        break;
+
+      case MI_VM_OP_STORE_LOCAL:
+        (void)snprintf(instr, sizeof(instr), "%s %d, r%u", s_op_name(op), (int)ins.imm, (unsigned)ins.a);
+        (void)snprintf(comment, sizeof(comment), "local_%d", (int)ins.imm);
+        break;
+
+      case MI_VM_OP_ARG_PUSH_LOCAL:
+        (void)snprintf(instr, sizeof(instr), "%s %d", s_op_name(op), (int)ins.imm);
+        (void)snprintf(comment, sizeof(comment), "local_%d", (int)ins.imm);
+        break;
+
+      case MI_VM_OP_ADD_LOCAL_CONST:
+      case MI_VM_OP_SUB_LOCAL_CONST:
+        (void)snprintf(instr, sizeof(instr), "%s r%u, %d, const_%u", s_op_name(op), (unsigned)ins.a, (int)ins.imm, (unsigned)ins.b);
+        if (ins.b < chunk->const_count)
+        {
+          char vbuf[64];
+          vbuf[0] = '\0';
+          s_vm_value_to_string(vbuf, sizeof(vbuf), &chunk->consts[ins.b]);
+          (void)snprintf(comment, sizeof(comment), "local_%d, %s", (int)ins.imm, vbuf);
+        }
+        else
+        {
+          (void)snprintf(comment, sizeof(comment), "<oob>");
+        }
+        break;
+
+      case MI_VM_OP_CLEAR_REGS:
+        (void)snprintf(instr, sizeof(instr), "%s r%u, %u", s_op_name(op), (unsigned)ins.a, (unsigned)ins.b);
+        break;
+
+      case MI_VM_OP_ADD_VAR_CONST:
+      case MI_VM_OP_SUB_VAR_CONST:
+        (void)snprintf(instr, sizeof(instr), "%s r%u, %d, const_%u", s_op_name(op), (unsigned)ins.a, (int)ins.imm, (unsigned)ins.b);
+        if (ins.imm >= 0 && (size_t)ins.imm < chunk->symbol_count && ins.b < chunk->const_count)
+        {
+          char vbuf[64];
+          vbuf[0] = '\0';
+          s_vm_value_to_string(vbuf, sizeof(vbuf), &chunk->consts[ins.b]);
+          XSlice s = chunk->symbols[(size_t)ins.imm];
+          (void)snprintf(comment, sizeof(comment), "sym_%d %.*s, %s", (int)ins.imm, (int)s.length, s.ptr, vbuf);
+        }
+        else
+        {
+          (void)snprintf(comment, sizeof(comment), "<oob>");
+        }
+        break;
+
+      case MI_VM_OP_JUMP_IF_NOT_EQ:
+      case MI_VM_OP_JUMP_IF_NOT_NEQ:
+      case MI_VM_OP_JUMP_IF_NOT_LT:
+      case MI_VM_OP_JUMP_IF_NOT_LTEQ:
+      case MI_VM_OP_JUMP_IF_NOT_GT:
+      case MI_VM_OP_JUMP_IF_NOT_GTEQ:
+      case MI_VM_OP_JUMP_IF_NOT_EQ_INT:
+      case MI_VM_OP_JUMP_IF_NOT_NEQ_INT:
+      case MI_VM_OP_JUMP_IF_NOT_LT_INT:
+      case MI_VM_OP_JUMP_IF_NOT_LTEQ_INT:
+      case MI_VM_OP_JUMP_IF_NOT_GT_INT:
+      case MI_VM_OP_JUMP_IF_NOT_GTEQ_INT:
+        {
+          (void)snprintf(instr, sizeof(instr), "%s r%u, r%u, %d", s_op_name(op), (unsigned)ins.b, (unsigned)ins.c, (int)ins.imm);
+
+          int64_t ins_target = (int64_t)i + 1 + (int64_t)ins.imm;
+          uint64_t pc_target = (uint64_t)ins_target * (uint64_t)sizeof(MiVmIns);
+          if (ins_target < 0 || (size_t)ins_target > chunk->code_count)
+          {
+            (void)snprintf(comment, sizeof(comment), "-> 0x%08zx (OOB)", (size_t)pc_target);
+          }
+          else
+          {
+            (void)snprintf(comment, sizeof(comment), "-> 0x%08zx", (size_t)pc_target);
+          }
+        } break;
+
+      case MI_VM_OP_CALL_CMD_FAST_VAR:
+        {
+          const char* name = "cmd";
+          int name_len = 3;
+          if (chunk->cmd_names && ins.imm >= 0 && (size_t)ins.imm < chunk->cmd_count)
+          {
+            XSlice s = chunk->cmd_names[(size_t)ins.imm];
+            name = s.ptr;
+            name_len = (int)s.length;
+          }
+          (void)snprintf(instr, sizeof(instr), "%s r%u, %u, %u, %.*s", s_op_name(op), (unsigned)ins.a, (unsigned)ins.b, (unsigned)ins.c, name_len, name);
+          if (ins.c < chunk->symbol_count)
+          {
+            XSlice s = chunk->symbols[ins.c];
+            (void)snprintf(comment, sizeof(comment), "cmd_%d, sym_%u %.*s", (int)ins.imm, (unsigned)ins.c, (int)s.length, s.ptr);
+          }
+          else
+          {
+            (void)snprintf(comment, sizeof(comment), "cmd_%d, <oob>", (int)ins.imm);
+          }
+        } break;
+
       case MI_VM_OP_RETURN:
         (void)snprintf(instr, sizeof(instr), "%s r%u", s_op_name(op), (unsigned)ins.a);
         break;
@@ -5066,3 +7065,8 @@ void mi_vm_disasm(const MiVmChunk* chunk)
   s_vm_disasm_ex(chunk, NULL, 0);
 }
 
+const char* mi_vm_op_name(MiVmOp op)
+{
+  return s_op_name(op);
+}
+
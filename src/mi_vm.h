@@ -15,28 +15,111 @@
 
 typedef struct MiVm MiVm;
 typedef struct MiVmChunk MiVmChunk;
+typedef struct MiVmLazy MiVmLazy;
 
 #define MI_VM_REG_COUNT 32
 #define MI_VM_ARG_STACK_COUNT 256
 #define MI_VM_ARG_FRAME_MAX 16
 
-// Debug call stack (blocks + user commands).
+// Call frames (blocks + user commands) live on a growable VM-managed stack;
+// this only bounds runaway recursion.
 #ifndef MI_VM_CALL_STACK_MAX
-#define MI_VM_CALL_STACK_MAX 64
+#define MI_VM_CALL_STACK_MAX (1 << 18)
 #endif
 
+// Dispatch strategy for mi_vm_execute: direct-threaded (computed goto) when the
+// compiler supports it. Define MI_VM_COMPUTED_GOTO=0 to force the switch loop.
+// Runtime quickening: generic INDEX/ADD/SUB/LT/ITER_NEXT rewrite themselves in
+// the chunk's exec_code to guarded forms for the operand kinds they observe.
+// A site that fails its guard MI_VM_QUICKEN_MAX_DEOPTS times stays generic.
+#ifndef MI_VM_QUICKEN
+#define MI_VM_QUICKEN 1
+#endif
+
+#ifndef MI_VM_QUICKEN_MAX_DEOPTS
+#define MI_VM_QUICKEN_MAX_DEOPTS 4
+#endif
+
+#ifndef MI_VM_COMPUTED_GOTO
+#if defined(__GNUC__) || defined(__clang__)
+#define MI_VM_COMPUTED_GOTO 1
+#else
+#define MI_VM_COMPUTED_GOTO 0
+#endif
+#endif
+
+// Baseline JIT (mi_jit.c): hot chunks are translated to x86-64 code when a VM
+// runs with mi_vm_set_jit(). A chunk is hot once its entries plus loop
+// back-edges reach MI_VM_JIT_THRESHOLD, or MINIMA_JIT_THRESHOLD from the
+// environment when set. Define MI_VM_JIT=0 to leave it out.
+#ifndef MI_VM_JIT
+#if defined(__x86_64__) && !defined(_WIN32) && (defined(__GNUC__) || defined(__clang__))
+#define MI_VM_JIT 1
+#else
+#define MI_VM_JIT 0
+#endif
+#endif
+
+#ifndef MI_VM_JIT_THRESHOLD
+#define MI_VM_JIT_THRESHOLD 1000
+#endif
+
+typedef enum MiVmJitMode
+{
+  MI_VM_JIT_OFF = 0,
+  MI_VM_JIT_ON,
+  MI_VM_JIT_DUMP,   // MI_VM_JIT_ON, and print each chunk's native code as it is compiled
+} MiVmJitMode;
+
 typedef enum MiVmCallFrameKind
 {
   MI_VM_CALL_FRAME_BLOCK = 1,
   MI_VM_CALL_FRAME_USER_CMD = 2,
 } MiVmCallFrameKind;
 
+// Register windows are carved out of a chain of blocks that never move, so a
+// window pointer stays valid for as long as its frame lives.
+typedef struct MiVmRegBlock
+{
+  struct MiVmRegBlock* prev;
+  struct MiVmRegBlock* next;
+  size_t               count;
+  size_t               top;
+  MiRtValue*           slots;
+} MiVmRegBlock;
+
 typedef struct MiVmCallFrame
 {
   MiVmCallFrameKind kind;
   XSlice            name;       // For MI_VM_CALL_FRAME_USER_CMD; otherwise empty.
   const MiVmChunk*  caller_chunk;
   size_t            caller_ip;  // Instruction index in caller chunk (0-based).
+
+  // Callee storage, released when the frame is popped. The arguments of a
+  // user command follow its registers in the window.
+  MiRtValue*        regs;
+  int               argc;
+  size_t            local_base;
+
+  // Caller state restored when the frame is popped.
+  MiRtValue*        caller_regs;
+  size_t            caller_local_base;
+  MiScopeFrame*     caller_scope;
+  int               caller_argc;
+  const MiRtValue*  caller_argv;
+  int               caller_arg_base;
+  MiRtValue         caller_last;
+  uint8_t           ret_reg;    // Caller register that receives the result
+
+  // Command run by a tail call into this frame, kept alive here because
+  // the register that held it went away with the replaced body.
+  MiRtValue         self;
+
+  // Scope frame pushed for the body, and the block whose upvalues the body
+  // runs with (void when it has none), kept alive for the call.
+  MiScopeFrame*     scope;
+  MiRtValue         closure;
+  MiRtUpval**       caller_upvals;
 } MiVmCallFrame;
 
 
@@ -235,6 +318,49 @@ typedef struct MiVmCommandEntry
   MiRtValue      value; // MI_RT_VAL_CMD (retained by VM)
 } MiVmCommandEntry;
 
+// Per-site result of the shadow check done by unqualified CALL_CMD: while
+// the runtime symbol version still equals 'version', 'cmd' is what the name
+// resolves to and the scope walk can be skipped. version 0 means unresolved.
+typedef struct MiVmCmdCache
+{
+  MiRtCmd*       cmd;
+  uint32_t       sym_id;
+  uint32_t       version;
+} MiVmCmdCache;
+
+// Inline cache for LOAD_MEMBER/STORE_MEMBER: 'var' is the member's binding
+// in 'env' itself (NULL if it has none) as of env->version. Stores through
+// 'var' are seen by every reader; new bindings change the version.
+typedef struct MiVmMemberCache
+{
+  const MiScopeFrame* env;
+  uint64_t            version;
+  MiRtVar*            var;
+} MiVmMemberCache;
+
+// Last block LOAD_BLOCK made for a subchunk without upvalues. Such a block is
+// only its body and env, so while the running frame is still 'env' at
+// 'version' the same object is handed out again instead of allocating one per
+// execution. The reference to 'block' is kept by env (mi_rt_scope_keep_block)
+// and dropped when env is popped or reset, which also changes its version.
+typedef struct MiVmBlockCache
+{
+  const MiScopeFrame* env;
+  uint64_t            version;
+  MiRtBlock*          block;
+} MiVmBlockCache;
+
+// Inline cache for a CALL_CMD_DYN site whose head is a string: the name is
+// split and interned once instead of on every call.
+typedef struct MiVmDynCache
+{
+  char*           name;       // copy of the head string the entry was filled for
+  size_t          name_len;
+  uint32_t        head_sym;   // whole name, or "mod" in "mod::member"; UINT32_MAX = not cacheable
+  uint32_t        member_sym; // "member" in "mod::member"; UINT32_MAX when unqualified
+  MiVmMemberCache member;
+} MiVmDynCache;
+
 typedef struct MiVmModuleCacheEntry
 {
   char*     key;        // resolved mx path (heap string)
@@ -246,6 +372,10 @@ typedef uint32_t (*MiModuleCountFn)(void);
 typedef const char* (*MiModuleNameFn)(uint32_t index);
 typedef bool (*MiModuleRegisterFn)(MiVm* vm, const char* module_name, MiRtValue ns_block);
 
+/* Export of AOT objects built by minima --aot (see mi_aot.h). */
+struct MiAotImage;
+typedef const struct MiAotImage* (*MiAotImageFn)(void);
+
 typedef struct MiVmNativeDll
 {
   char*              path; /* resolved full path */
@@ -253,6 +383,7 @@ typedef struct MiVmNativeDll
   MiModuleCountFn    module_count;
   MiModuleNameFn     module_name;
   MiModuleRegisterFn module_register;
+  MiAotImageFn       aot_image; /* AOT objects instead of the module exports */
 } MiVmNativeDll;
 
 typedef struct MiVmUserCommand
@@ -334,6 +465,74 @@ typedef enum MiVmOp
   MI_VM_OP_HALT,
 
   MI_VM_OP_CALL_CMD_FAST,
+
+                              // Superinstructions (produced by mi_peephole_chunk)
+  MI_VM_OP_ADD_VAR_CONST,     // a = $sym[imm] = $sym[imm] + const[b]
+  MI_VM_OP_SUB_VAR_CONST,     // a = $sym[imm] = $sym[imm] - const[b]
+  MI_VM_OP_JUMP_IF_NOT_EQ,    // if !(regs[b] == regs[c]) pc += imm
+  MI_VM_OP_JUMP_IF_NOT_NEQ,   // if !(regs[b] != regs[c]) pc += imm
+  MI_VM_OP_JUMP_IF_NOT_LT,    // if !(regs[b] <  regs[c]) pc += imm
+  MI_VM_OP_JUMP_IF_NOT_LTEQ,  // if !(regs[b] <= regs[c]) pc += imm
+  MI_VM_OP_JUMP_IF_NOT_GT,    // if !(regs[b] >  regs[c]) pc += imm
+  MI_VM_OP_JUMP_IF_NOT_GTEQ,  // if !(regs[b] >= regs[c]) pc += imm
+  MI_VM_OP_CALL_CMD_FAST_VAR, // push $sym[c], then a = call cmd_fn[imm] with argc=b
+
+                              // Typed arithmetic (emitted when operand types are statically known)
+  MI_VM_OP_ADD_INT,           // a = b + c (int, wraps)
+  MI_VM_OP_SUB_INT,           // a = b - c (int, wraps)
+  MI_VM_OP_MUL_INT,           // a = b * c (int, wraps)
+  MI_VM_OP_ADD_FLOAT,         // a = b + c (float)
+  MI_VM_OP_SUB_FLOAT,         // a = b - c (float)
+  MI_VM_OP_MUL_FLOAT,         // a = b * c (float)
+  MI_VM_OP_DIV_FLOAT,         // a = b / c (float)
+  MI_VM_OP_EQ_INT,            // a = (b == c) (int)
+  MI_VM_OP_NEQ_INT,           // a = (b != c) (int)
+  MI_VM_OP_LT_INT,            // a = (b <  c) (int)
+  MI_VM_OP_LTEQ_INT,          // a = (b <= c) (int)
+  MI_VM_OP_GT_INT,            // a = (b >  c) (int)
+  MI_VM_OP_GTEQ_INT,          // a = (b >= c) (int)
+  MI_VM_OP_LT_FLOAT,          // a = (b <  c) (float)
+  MI_VM_OP_LTEQ_FLOAT,        // a = (b <= c) (float)
+  MI_VM_OP_GT_FLOAT,          // a = (b >  c) (float)
+  MI_VM_OP_GTEQ_FLOAT,        // a = (b >= c) (float)
+  MI_VM_OP_JUMP_IF_NOT_EQ_INT,   // if !(regs[b] == regs[c]) pc += imm (int)
+  MI_VM_OP_JUMP_IF_NOT_NEQ_INT,  // if !(regs[b] != regs[c]) pc += imm (int)
+  MI_VM_OP_JUMP_IF_NOT_LT_INT,   // if !(regs[b] <  regs[c]) pc += imm (int)
+  MI_VM_OP_JUMP_IF_NOT_LTEQ_INT, // if !(regs[b] <= regs[c]) pc += imm (int)
+  MI_VM_OP_JUMP_IF_NOT_GT_INT,   // if !(regs[b] >  regs[c]) pc += imm (int)
+  MI_VM_OP_JUMP_IF_NOT_GTEQ_INT, // if !(regs[b] >= regs[c]) pc += imm (int)
+
+                              // Quickened forms (only ever written to exec_code; revert when the guard fails)
+  MI_VM_OP_QADD_INT,          // ADD, int operands
+  MI_VM_OP_QADD_FLOAT,        // ADD, float operands
+  MI_VM_OP_QSUB_INT,          // SUB, int operands
+  MI_VM_OP_QSUB_FLOAT,        // SUB, float operands
+  MI_VM_OP_QLT_INT,           // LT, int operands
+  MI_VM_OP_QLT_FLOAT,         // LT, float operands
+  MI_VM_OP_QJUMP_IF_NOT_LT_INT,   // JUMP_IF_NOT_LT, int operands
+  MI_VM_OP_QJUMP_IF_NOT_LT_FLOAT, // JUMP_IF_NOT_LT, float operands
+  MI_VM_OP_QINDEX_LIST,       // INDEX, list base and int key
+  MI_VM_OP_QITER_NEXT_LIST,   // ITER_NEXT over a list
+
+                              // Function locals resolved to frame slots (see MiVmChunk.local_count)
+  MI_VM_OP_LOAD_LOCAL,        // a = local[imm]
+  MI_VM_OP_STORE_LOCAL,       // local[imm] = a
+  MI_VM_OP_ARG_PUSH_LOCAL,    // push local[imm]
+  MI_VM_OP_ADD_LOCAL_CONST,   // a = local[imm] = local[imm] + const[b]
+  MI_VM_OP_SUB_LOCAL_CONST,   // a = local[imm] = local[imm] - const[b]
+
+  MI_VM_OP_TAIL_CALL,         // CALL_CMD_DYN in tail position: a user command replaces the running frame
+  MI_VM_OP_CLEAR_REGS,        // regs[a .. a+b) = void; releases loop temporaries at loop exit
+  MI_VM_OP_CALL_CMD_TRUSTED,  // CALL_CMD_FAST whose arguments were proven to match the target's signature
+
+                              // Integer range loops (foreach (i, from, to[, step])); regs[a] counter, regs[a+1] limit, regs[a+2] step
+  MI_VM_OP_FOR_PREP,          // check the range is int with a non-zero step; if it is empty pc += imm
+  MI_VM_OP_FOR_LOOP,          // if regs[a] + regs[a+2] is still short of the limit: regs[a] += step, pc += imm
+  MI_VM_OP_SCOPE_RESET,       // drop the variables of the current scope frame (loop scope hoisted out of the body)
+
+                              // Bindings captured by the running block (see MiVmChunk.upval_count)
+  MI_VM_OP_LOAD_UPVAL,        // a = upval[imm]
+  MI_VM_OP_STORE_UPVAL,       // upval[imm] = a
 } MiVmOp;
 
 typedef struct MiVmIns
@@ -369,6 +568,48 @@ struct MiVmChunk
   size_t         subchunk_count;
   size_t         subchunk_capacity;
 
+  // Writable copy of code that the VM executes and quickens in place. Created
+  // on first execution so that `code` stays pristine for disassembly and MX.
+  MiVmIns*       exec_code;
+  uint8_t*       exec_deopts;    // per-instruction guard failure count
+  MiVmCmdCache*  exec_cmd_cache; // per-command shadow check, parallel to cmd_targets
+  MiVmMemberCache* exec_member_cache; // per-symbol member binding, parallel to symbols
+  MiVmBlockCache* exec_block_cache; // per-subchunk reusable block, parallel to subchunks
+  MiVmDynCache*  exec_dyn_cache;  // string-head CALL_CMD_DYN sites; exec_code imm = index + 1
+  size_t         exec_dyn_count;
+  size_t         exec_dyn_capacity;
+
+  // User command bodies: locals the compiler resolved to frame slots. Each
+  // call reserves local_count slots; parameter i is stored in param_slots[i],
+  // or bound by name in the scope frame when that entry is -1.
+  uint32_t       local_count;
+  int32_t*       param_slots;
+  uint32_t       param_slot_count;
+
+  // Block and command bodies: bindings of enclosing frames the compiler
+  // resolved to upvalues, captured when the block is created. Upvalue i is
+  // named by symbols[i]; upval_outer[i] is the index of the creating chunk's
+  // upvalue it shares, or -1 when it is a binding of the creating frame.
+  int32_t*       upval_outer;
+  uint32_t       upval_count;
+
+  // Set by mi_verify_chunk(). The VM only runs verified chunks, which lets the
+  // dispatch loop skip operand range checks.
+  bool           verified;
+
+  // Set with verified when the code has a LOAD_BLOCK. Blocks keep the scope
+  // frame they are created in as their env, so the VM gives this chunk heap
+  // frames instead of scope stack ones.
+  bool           captures_env;
+
+  // Body left uncompiled by mi_compile_vm_script_lazy(): everything above is
+  // empty until mi_compile_force() compiles it on the first call.
+  MiVmLazy*      lazy;
+
+  // Native code of the chunk once the JIT compiled it (freed with the
+  // execution state), and its entry + back-edge count until then.
+  struct MiJitCode* jit;
+  uint32_t       jit_hits;
 
   // Debug source mapping (optional; may be NULL for chunks loaded without debug info)
   XSlice     dbg_name;        // e.g. function name, "<script>", "<block>"
@@ -402,6 +643,10 @@ struct MiVm
   size_t            command_count;
   size_t            command_capacity;
 
+  // Registry index by runtime symbol id: holds command index + 1, 0 when absent.
+  uint32_t*         command_index;
+  size_t            command_index_capacity;
+
   // Loaded modules (include:)
   struct MiMixProgram* modules;
   size_t               module_count;
@@ -420,10 +665,13 @@ struct MiVm
   size_t               module_env_count;
   size_t               module_env_capacity;
 
-  // Working state (execution).
-  MiRtValue regs[MI_VM_REG_COUNT];
+  // Working state (execution). Every frame owns a window of MI_VM_REG_COUNT
+  // registers; regs points at the running frame's window.
+  MiRtValue*    regs;
+  MiVmRegBlock* reg_block; // Block holding the innermost window.
   MiRtValue arg_stack[MI_VM_ARG_STACK_COUNT];
   int       arg_top;
+  int       arg_base; // Bottom of the running frame's args; below are borrowed by callers.
 
   // Arg stack save/restore for nested command expressions.
   MiRtValue arg_frames[MI_VM_ARG_FRAME_MAX][MI_VM_ARG_STACK_COUNT];
@@ -436,11 +684,26 @@ struct MiVm
   const MiRtCmd*      cur_cmd;
   XSlice              cur_cmd_name;
 
+  // Slot storage for the locals of active user command calls. Each call owns
+  // [local_base, local_base + chunk->local_count); the array may move when it
+  // grows, so the VM addresses slots by index.
+  MiRtValue* locals;
+  size_t     local_top;
+  size_t     local_capacity;
+  size_t     local_base;
+
+  // Upvalues of the running block or command body (see MiRtBlock.upvals).
+  MiRtUpval** upvals;
+
+  MiVmJitMode jit_mode;
+  uint32_t    jit_threshold;
+
   // Debug: track current instruction and call stack for trace:.
   const MiVmChunk*  dbg_chunk;
   size_t            dbg_ip; // last fetched instruction index (0-based).
-  MiVmCallFrame     call_stack[MI_VM_CALL_STACK_MAX];
+  MiVmCallFrame*    call_stack;
   int               call_depth;
+  int               call_capacity;
 };
 
 //----------------------------------------------------------
@@ -484,6 +747,17 @@ void mi_vm_set_cache_dir(MiVm* vm, const char* path);
 /* Set MI_ROOT/modules directory for native module loading. */
 void mi_vm_set_modules_dir(MiVm* vm, const char* path);
 
+/**
+ * Enable or disable the baseline JIT for chunks this VM runs.
+ *
+ * Has no effect in builds without MI_VM_JIT; the VM then always interprets.
+ * Reads the hot threshold from MINIMA_JIT_THRESHOLD when it is set.
+ *
+ * @param vm   Pointer to the VM instance.
+ * @param mode MI_VM_JIT_OFF (default), MI_VM_JIT_ON or MI_VM_JIT_DUMP.
+ */
+void mi_vm_set_jit(MiVm* vm, MiVmJitMode mode);
+
 /**
  * Register a native command implemented in C.
  *
@@ -572,6 +846,15 @@ MiVmCommandFn mi_vm_find_command_fn(MiVm* vm, XSlice name);
  */
 void mi_vm_chunk_destroy(MiVmChunk* chunk);
 
+/**
+ * Free the execution state the VM attaches to a chunk when it first runs it
+ * (exec_code and the inline caches). Used by owners that free chunks
+ * themselves, such as MX programs.
+ *
+ * @param chunk Chunk whose execution state to free.
+ */
+void mi_vm_chunk_release_exec(MiVmChunk* chunk);
+
 /**
  * Execute a compiled bytecode chunk.
  *
@@ -613,4 +896,17 @@ bool mi_vm_link_chunk_commands(MiVm* vm, MiVmChunk* chunk);
  */
 void mi_vm_disasm(const MiVmChunk* chunk);
 
+/**
+ * Load an AOT object built by minima --aot (kept loaded until mi_vm_shutdown).
+ * Failures are reported with mi_error_fmt.
+ *
+ * @param vm   Pointer to the VM instance.
+ * @param path Path of the shared object.
+ * @return Its image (see mi_aot.h), or NULL.
+ */
+const struct MiAotImage* mi_vm_load_aot_image(MiVm* vm, const char* path);
+
+/* Short mnemonic of an opcode, as printed by mi_vm_disasm(). */
+const char* mi_vm_op_name(MiVmOp op);
+
 #endif  // MI_VM_H
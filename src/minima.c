@@ -4,6 +4,7 @@
 #include <string.h>
 #include "minima.h"
 #include "mi_vm.h"
+#include "mi_opt.h"
 #include "stdx_filesystem.h"
 
 //----------------------------------------------------------
@@ -131,6 +132,11 @@ static const char* s_get_modules_dir()
 }
 
 int mi_compile_only(const char* in_file, const char* out_file, const char* cache_dir)
+{
+  return mi_compile_only_ex(in_file, out_file, cache_dir, false);
+}
+
+int mi_compile_only_ex(const char* in_file, const char* out_file, const char* cache_dir, bool optimize)
 {
   size_t src_len = 0;
   char* src = x_io_read_text(in_file, &src_len);
@@ -182,6 +188,18 @@ int mi_compile_only(const char* in_file, const char* out_file, const char* cache
     return 1;
   }
 
+  if (optimize)
+  {
+    MiOptStats st;
+    memset(&st, 0, sizeof(st));
+    mi_opt_chunk(ch, &st);
+    mi_info_fmt("-O constprop: %zu loads propagated, %zu operations folded, %zu branches resolved\n",
+        st.const_loads, st.const_folds, st.const_branches);
+    mi_info_fmt("-O licm: %zu instructions hoisted out of %zu loops\n", st.licm_hoisted, st.licm_loops);
+    mi_info_fmt("-O dce: %zu unreachable and %zu dead instructions removed\n", st.dce_unreachable, st.dce_dead);
+    mi_info_fmt("-O %zu -> %zu instructions\n", st.code_before, st.code_after);
+  }
+
   if (!mi_mx_save_file(ch, out_file))
   {
     mi_error_fmt("Failed to write MIX file: %s\n", out_file);
@@ -226,21 +244,21 @@ int mi_disasm(const char* mx_file, const char* cache_dir)
   return 0;
 }
 
-int mi_disasm_mi(const char* mi_file, const char* cache_dir)
+// Compile mi_file into its cached .mx unless that is already up to date.
+static int s_refresh_cached_mx(const char* mi_file, const char* cache_dir, XFSPath* out_mx)
 {
-  XFSPath cached_mx;
-  if (!s_cached_mx_for_mi(cache_dir, mi_file, &cached_mx))
+  if (!s_cached_mx_for_mi(cache_dir, mi_file, out_mx))
   {
     mi_error_fmt("Failed to resolve cache path for: %s\n", mi_file);
     return 1;
   }
 
-  bool mx_exists = x_fs_is_file(cached_mx.buf);
+  bool mx_exists = x_fs_is_file(out_mx->buf);
 
   time_t mi_time = 0;
   time_t mx_time = 0;
   bool have_mi = x_fs_file_modification_time(mi_file, &mi_time);
-  bool have_mx = mx_exists && x_fs_file_modification_time(cached_mx.buf, &mx_time);
+  bool have_mx = mx_exists && x_fs_file_modification_time(out_mx->buf, &mx_time);
 
   if (!have_mi)
   {
@@ -250,17 +268,89 @@ int mi_disasm_mi(const char* mi_file, const char* cache_dir)
 
   if (!have_mx || mi_time > mx_time)
   {
-    int rc = mi_compile_only(mi_file, cached_mx.buf, cache_dir);
+    return mi_compile_only(mi_file, out_mx->buf, cache_dir);
+  }
+  return 0;
+}
+
+int mi_disasm_mi(const char* mi_file, const char* cache_dir)
+{
+  XFSPath cached_mx;
+  int rc = s_refresh_cached_mx(mi_file, cache_dir, &cached_mx);
+  if (rc != 0)
+  {
+    return rc;
+  }
+
+  return mi_disasm(cached_mx.buf, cache_dir);
+}
+
+int mi_aot_compile(const char* in_file, const char* out_file, const char* cache_dir)
+{
+  XFSPath cached_mx;
+  const char* mx_file = in_file;
+  if (x_cstr_ends_with(in_file, ".mi"))
+  {
+    int rc = s_refresh_cached_mx(in_file, cache_dir, &cached_mx);
     if (rc != 0)
     {
       return rc;
     }
+    mx_file = cached_mx.buf;
   }
 
-  return mi_disasm(cached_mx.buf, cache_dir);
+  MiRuntime rt;
+  mi_rt_init(&rt);
+
+  MiVm vm;
+  mi_vm_init(&vm, &rt);
+  mi_vm_set_cache_dir(&vm, cache_dir);
+  mi_vm_set_modules_dir(&vm, s_get_modules_dir());
+
+  bool ok = mi_aot_build(&vm, mx_file, out_file);
+
+  mi_vm_shutdown(&vm);
+  mi_rt_shutdown(&rt);
+  return ok ? 0 : 1;
+}
+
+int mi_run_aot(const char* so_file, const char* cache_dir)
+{
+  MiRuntime rt;
+  mi_rt_init(&rt);
+
+  MiVm vm;
+  mi_vm_init(&vm, &rt);
+  mi_vm_set_cache_dir(&vm, cache_dir);
+  // Native code is only entered with the JIT on; chunks the object does not
+  // cover (e.g. from modules) are then compiled as they get hot.
+  mi_vm_set_jit(&vm, MI_VM_JIT_ON);
+  mi_vm_set_modules_dir(&vm, s_get_modules_dir());
+
+  MiMixProgram p;
+  const MiAotImage* image = mi_vm_load_aot_image(&vm, so_file);
+  if (!image || !mi_aot_attach(&vm, image, &p))
+  {
+    mi_error_fmt("Failed to load AOT object: %s\n", so_file);
+    mi_vm_shutdown(&vm);
+    mi_rt_shutdown(&rt);
+    return 1;
+  }
+
+  (void)mi_vm_execute(&vm, p.entry);
+
+  mi_mx_program_destroy(&p);
+  mi_vm_shutdown(&vm);
+  mi_rt_shutdown(&rt);
+  return 0;
 }
 
 int mi_run_source(const char* mi_file, const char* cache_dir)
+{
+  return mi_run_source_ex(mi_file, cache_dir, MI_VM_JIT_OFF);
+}
+
+int mi_run_source_ex(const char* mi_file, const char* cache_dir, MiVmJitMode jit)
 {
   MiRuntime rt;
   mi_rt_init(&rt);
@@ -268,6 +358,7 @@ int mi_run_source(const char* mi_file, const char* cache_dir)
   MiVm vm;
   mi_vm_init(&vm, &rt);
   mi_vm_set_cache_dir(&vm, cache_dir);
+  mi_vm_set_jit(&vm, jit);
   mi_vm_set_modules_dir(&vm, s_get_modules_dir());
 
   // Try cached .mx first
@@ -338,14 +429,15 @@ int mi_run_source(const char* mi_file, const char* cache_dir)
     return 1;
   }
 
-  MiVmChunk* ch = mi_compile_vm_script_ex(&vm,
+  // Block and command bodies compile on their first call; the AST and the
+  // source it points into go with the chunk until then.
+  MiVmChunk* ch = mi_compile_vm_script_lazy(&vm,
       res.script,
+      arena,
+      src,
       x_slice_from_cstr("<script>"),
       x_slice_from_cstr(mi_file));
 
-  x_arena_destroy(arena);
-  free(src);
-
   if (!ch)
   {
     mi_error_fmt("Compilation failed: %s\n", mi_file);
@@ -354,12 +446,6 @@ int mi_run_source(const char* mi_file, const char* cache_dir)
     return 1;
   }
 
-  // Save to cache (best-effort)
-  if (have_cached_path)
-  {
-    (void)mi_mx_save_file(ch, cached_mx.buf);
-  }
-
   if (!mi_vm_link_chunk_commands(&vm, ch))
   {
     mi_error("Link failed: unresolved command(s)\n");
@@ -370,6 +456,13 @@ int mi_run_source(const char* mi_file, const char* cache_dir)
   }
 
   (void)mi_vm_execute(&vm, ch);
+
+  // Save to cache (best-effort) after the run, so only the bodies it never
+  // called are compiled for it.
+  if (have_cached_path)
+  {
+    (void)mi_mx_save_file(ch, cached_mx.buf);
+  }
   mi_vm_chunk_destroy(ch);
 
   mi_vm_shutdown(&vm);
@@ -378,6 +471,11 @@ int mi_run_source(const char* mi_file, const char* cache_dir)
 }
 
 int mi_run_mx(const char* mx_file, const char* cache_dir)
+{
+  return mi_run_mx_ex(mx_file, cache_dir, MI_VM_JIT_OFF);
+}
+
+int mi_run_mx_ex(const char* mx_file, const char* cache_dir, MiVmJitMode jit)
 {
   MiRuntime rt;
   mi_rt_init(&rt);
@@ -385,6 +483,7 @@ int mi_run_mx(const char* mx_file, const char* cache_dir)
   MiVm vm;
   mi_vm_init(&vm, &rt);
   mi_vm_set_cache_dir(&vm, cache_dir);
+  mi_vm_set_jit(&vm, jit);
 
   mi_vm_set_modules_dir(&vm, s_get_modules_dir());
 
@@ -13,12 +13,18 @@ extern "C" {
 #include "mi_mx.h"
 #include "mi_log.h"
 #include "mi_compile.h"
+#include "mi_aot.h"
 
   int mi_compile_only(const char* in_file, const char* out_file, const char* cache_dir);
+  int mi_compile_only_ex(const char* in_file, const char* out_file, const char* cache_dir, bool optimize);
   int mi_disasm(const char* mx_file, const char* cache_dir);
   int mi_disasm_mi(const char* mi_file, const char* cache_dir);
   int mi_run_source(const char* mi_file, const char* cache_dir);
+  int mi_run_source_ex(const char* mi_file, const char* cache_dir, MiVmJitMode jit);
   int mi_run_mx(const char* mx_file, const char* cache_dir);
+  int mi_run_mx_ex(const char* mx_file, const char* cache_dir, MiVmJitMode jit);
+  int mi_aot_compile(const char* in_file, const char* out_file, const char* cache_dir);
+  int mi_run_aot(const char* so_file, const char* cache_dir);
 
 #ifdef __cplusplus
 }
@@ -101,7 +101,7 @@ static bool s_to_float(MiRtValue v, double* out)
       *out = v.as.b ? 1.0 : 0.0;
       return true;
     case MI_RT_VAL_STRING:
-      return s_parse_double(v.as.s, out);
+      return s_parse_double(mi_rt_value_slice(v), out);
     case MI_RT_VAL_VOID:
       *out = 0.0;
       return true;
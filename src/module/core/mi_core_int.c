@@ -111,7 +111,7 @@ static bool s_to_int(MiRtValue v, long long* out)
       *out = v.as.b ? 1 : 0;
       return true;
     case MI_RT_VAL_STRING:
-      return s_parse_int64(v.as.s, out);
+      return s_parse_int64(mi_rt_value_slice(v), out);
     case MI_RT_VAL_VOID:
       *out = 0;
       return true;
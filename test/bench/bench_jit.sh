@@ -0,0 +1,55 @@
+#!/usr/bin/env bash
+# ============================================================
+# JIT against the interpreters: times each bench_*.mi program
+# with --no-jit and --jit (best of 3), and with a second
+# minima built with the switch dispatcher when one is given:
+#   cmake -S . -B build-switch -DMINIMA_VM_COMPUTED_GOTO=OFF
+#   cmake --build build-switch
+# The first run fills the compile cache, so the timed runs
+# measure the VM alone. Outputs must not differ between modes.
+# Run with: bash test/bench/bench_jit.sh [path/to/minima] [path/to/minima-switch]
+# ============================================================
+set -e
+
+MINIMA="$(command -v "${1:-minima}" || echo "$1")"
+SWITCH="${2:+$(command -v "$2" || echo "$2")}"
+HERE="$(cd "$(dirname "$0")" && pwd)"
+WORK="$(mktemp -d)"
+trap 'rm -rf "$WORK"' EXIT
+
+# best <output> <command...>: prints the fastest of 3 wall-clock runs.
+best()
+{
+  local out="$1"
+  shift
+  local fastest=""
+  for run in 1 2 3; do
+    local start end
+    start=$(date +%s.%N)
+    "$@" > "$out"
+    end=$(date +%s.%N)
+    fastest=$(echo "$start $end $fastest" | awk '{ t = $2 - $1; if ($3 != "" && $3 < t) t = $3; printf "%.2f", t }')
+  done
+  echo "$fastest"
+}
+
+printf "%-10s %8s %8s %8s\n" "" switch goto --jit
+for name in arith calls dynamic loop; do
+  script="$HERE/bench_$name.mi"
+  "$MINIMA" --cache-dir "$WORK/cache" "$script" > /dev/null
+
+  switch_time="-"
+  if [ -n "$SWITCH" ]; then
+    "$SWITCH" --cache-dir "$WORK/cache-switch" "$script" > /dev/null
+    switch_time="$(best "$WORK/$name.switch" "$SWITCH" --cache-dir "$WORK/cache-switch" "$script")s"
+  fi
+  goto_time="$(best "$WORK/$name.goto" "$MINIMA" --cache-dir "$WORK/cache" --no-jit "$script")s"
+  jit_time="$(best "$WORK/$name.jit" "$MINIMA" --cache-dir "$WORK/cache" --jit "$script")s"
+  printf "%-10s %8s %8s %8s\n" "$name" "$switch_time" "$goto_time" "$jit_time"
+
+  if ! diff -q "$WORK/$name.goto" "$WORK/$name.jit" > /dev/null ||
+     { [ -n "$SWITCH" ] && ! diff -q "$WORK/$name.goto" "$WORK/$name.switch" > /dev/null; }; then
+    echo "FAIL $name: output differs between modes"
+    exit 1
+  fi
+done
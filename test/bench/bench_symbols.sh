@@ -0,0 +1,31 @@
+#!/usr/bin/env bash
+# ============================================================
+# Symbol interning: generates scripts with N distinct global
+# identifiers (in blocks of 100, like generated config) and
+# times them. The first run fills the compile cache, so the
+# timed run measures the VM alone; its cost should grow
+# linearly with N.
+# Run with: bash test/bench/bench_symbols.sh [path/to/minima]
+# ============================================================
+set -e
+
+MINIMA="${1:-minima}"
+WORK="$(mktemp -d)"
+trap 'rm -rf "$WORK"' EXIT
+
+for n in 1000 10000 50000 100000; do
+  script="$WORK/symbols_$n.mi"
+  awk -v n="$n" 'BEGIN {
+    print "on = true;";
+    for (b = 0; b < n; b += 100) {
+      line = "if (on) {";
+      for (i = b; i < b + 100; i++) line = line " s" i " = " i ";";
+      print line " }";
+    }
+    print "print(\"symbols:\", " n ");";
+  }' > "$script"
+
+  "$MINIMA" --cache-dir "$WORK/cache" "$script" > /dev/null
+  echo "== $n symbols"
+  time "$MINIMA" --cache-dir "$WORK/cache" "$script"
+done
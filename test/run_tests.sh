@@ -0,0 +1,123 @@
+#!/usr/bin/env bash
+# ============================================================
+# Runs tests.mi through every execution path and fails if any
+# assertion prints FAIL, a run hangs, or a backend's output
+# differs from the interpreter's. Scripts in errors/ must be
+# reported the way expect() says.
+# Run with: bash test/run_tests.sh [path/to/minima]
+# ============================================================
+set -e
+
+MINIMA="$(command -v "${1:-minima}" || echo "$1")"
+HERE="$(cd "$(dirname "$0")" && pwd)"
+WORK="$(mktemp -d)"
+trap 'rm -rf "$WORK"' EXIT
+cd "$HERE"
+
+status=0
+
+check()
+{
+  local name="$1"
+  shift
+  echo "== $name"
+  local rc=0
+  timeout 60 "$@" > "$WORK/$name.out" 2>&1 || rc=$?
+  if [ $rc -ne 0 ]; then
+    echo "FAIL $name: exited with $rc"
+    status=1
+  fi
+  if grep -q '^FAIL' "$WORK/$name.out"; then
+    grep '^FAIL' "$WORK/$name.out"
+    status=1
+  fi
+  if [ "$name" != interp ] && ! diff -q "$WORK/interp.out" "$WORK/$name.out" > /dev/null; then
+    echo "FAIL $name: output differs from the interpreter"
+    diff "$WORK/interp.out" "$WORK/$name.out" | head -20
+    status=1
+  fi
+}
+
+# expect <name> <status> <pattern>... -- <command...>: the command exits
+# with 'status' and prints a line matching each pattern.
+expect()
+{
+  local name="$1" want="$2"
+  shift 2
+  local patterns=()
+  while [ "$1" != "--" ]; do
+    patterns+=("$1")
+    shift
+  done
+  shift
+  echo "== $name"
+  local rc=0
+  timeout 60 "$@" > "$WORK/$name.out" 2>&1 || rc=$?
+  if [ $rc -ne "$want" ]; then
+    echo "FAIL $name: exited with $rc, expected $want"
+    status=1
+  fi
+  for pattern in "${patterns[@]}"; do
+    if ! grep -q -- "$pattern" "$WORK/$name.out"; then
+      echo "FAIL $name: no \"$pattern\" in the output"
+      status=1
+    fi
+  done
+  if grep -q '^FAIL' "$WORK/$name.out"; then
+    grep '^FAIL' "$WORK/$name.out"
+    status=1
+  fi
+}
+
+check interp "$MINIMA" --cache-dir "$WORK/cache" tests.mi
+
+"$MINIMA" --cache-dir "$WORK/cache" -c tests.mi "$WORK/tests.mx" > /dev/null
+check mx "$MINIMA" --cache-dir "$WORK/cache" "$WORK/tests.mx"
+
+"$MINIMA" --cache-dir "$WORK/cache" -c -O tests.mi "$WORK/tests-O.mx" > /dev/null
+check mx-O "$MINIMA" --cache-dir "$WORK/cache" "$WORK/tests-O.mx"
+
+# Builds without native code support refuse --jit. The second run compiles
+# every chunk on its first entry, so the native code of each one runs.
+if "$MINIMA" --jit --cache-dir "$WORK/cache" errors/mx_corrupt.mi > "$WORK/jit-probe.out" 2>&1; then
+  check jit "$MINIMA" --jit --cache-dir "$WORK/cache" tests.mi
+  check jit-hot env MINIMA_JIT_THRESHOLD=1 "$MINIMA" --jit --cache-dir "$WORK/cache" tests.mi
+elif grep -q "no native code support" "$WORK/jit-probe.out"; then
+  echo "== jit (skipped: no native code support)"
+else
+  cat "$WORK/jit-probe.out"
+  echo "FAIL jit: --jit failed"
+  status=1
+fi
+
+# Builds without native code support refuse --aot.
+if "$MINIMA" --cache-dir "$WORK/cache" --aot tests.mi "$WORK/tests.so" > "$WORK/aot-build.out" 2>&1; then
+  check aot "$MINIMA" --cache-dir "$WORK/cache" "$WORK/tests.so"
+elif grep -q "no native code support" "$WORK/aot-build.out"; then
+  echo "== aot (skipped: no native code support)"
+else
+  cat "$WORK/aot-build.out"
+  echo "FAIL aot: --aot failed"
+  status=1
+fi
+
+expect lazy-type-error 1 "Type error at 7:3" -- \
+  "$MINIMA" --cache-dir "$WORK/cache" errors/lazy_type_error.mi
+expect lazy-compile-error 0 "break: not inside a loop" "called: 1" -- \
+  "$MINIMA" --cache-dir "$WORK/cache" errors/lazy_compile_error.mi
+
+# A damaged .mx file is rejected rather than run. The first instruction's
+# register operand sits after the 16-byte header, the u32 instruction count
+# and the opcode byte.
+"$MINIMA" --cache-dir "$WORK/cache" -c errors/mx_corrupt.mi "$WORK/corrupt.mx" > /dev/null
+expect mx-intact 0 "^42" -- "$MINIMA" --cache-dir "$WORK/cache" "$WORK/corrupt.mx"
+
+head -c 40 "$WORK/corrupt.mx" > "$WORK/truncated.mx"
+expect mx-truncated 1 "Failed to load MIX file" -- "$MINIMA" --cache-dir "$WORK/cache" "$WORK/truncated.mx"
+
+cp "$WORK/corrupt.mx" "$WORK/bad-register.mx"
+printf '\310' | dd of="$WORK/bad-register.mx" bs=1 seek=21 conv=notrunc 2> /dev/null
+expect mx-bad-register 1 "register out of range" "Failed to load MIX file" -- \
+  "$MINIMA" --cache-dir "$WORK/cache" "$WORK/bad-register.mx"
+
+exit $status